@@ -16,26 +16,332 @@
 
 #include "ast.h"
 #include "util.h"
+#include "lexer.h"
 #include <stdlib.h>
 #include <string.h>
 
+// Nodes are carved out of large slabs instead of being malloc'd one by one,
+// so a tree built in parse order sits mostly contiguous in memory. Freed
+// nodes go on a free list and are handed out again by ast_node_new.
+#define AST_SLAB_NODES 4096
+
+typedef struct ASTSlab {
+    struct ASTSlab* next;
+    int used;
+    ASTNode nodes[AST_SLAB_NODES];
+} ASTSlab;
+
+static ASTSlab* slab_head = NULL;
+static ASTNode* free_nodes = NULL;
+
+static ASTNode* ast_node_alloc(void) {
+    if (free_nodes) {
+        ASTNode* node = free_nodes;
+        free_nodes = (ASTNode*)node->children;
+        return node;
+    }
+
+    if (!slab_head || slab_head->used == AST_SLAB_NODES) {
+        ASTSlab* slab = xmalloc(sizeof(ASTSlab));
+        slab->next = slab_head;
+        slab->used = 0;
+        slab_head = slab;
+    }
+
+    return &slab_head->nodes[slab_head->used++];
+}
+
 ASTNode* ast_node_new(ASTNodeKind kind) {
-    ASTNode* node = xcalloc(1, sizeof(ASTNode));
-    node->kind = kind;
-    node->line = 0;
-    node->column = 0;
-    node->type = NULL;
-    node->stack_offset = 0;
-    node->child_count = 0;  // Initialize child count
-    node->child_capacity = 4;
-    node->children = xcalloc(node->child_capacity, sizeof(ASTNode*));
+    ASTNode* node = ast_node_alloc();
+    memset(node, 0, sizeof(ASTNode));
+    node->kind = (uint8_t)kind;
+    node->children = node->inline_children;
     return node;
 }
 
-// The AST Dump function is somewhat fixed here... (will visit soon)
+uint32_t ast_loc_pack(int line, int column) {
+    const int max_line = (1 << (32 - AST_LOC_COLUMN_BITS)) - 1;
+    const int max_column = (1 << AST_LOC_COLUMN_BITS) - 1;
+
+    if (line < 0) line = 0;
+    if (line > max_line) line = max_line;
+    if (column < 0) column = 0;
+    if (column > max_column) column = max_column;
+
+    return ((uint32_t)line << AST_LOC_COLUMN_BITS) | (uint32_t)column;
+}
+
+// Side arrays start at 8 entries and double, so the capacity of a spilled
+// list never has to be stored: it is the next power of two >= child_count.
+static int side_array_capacity(int count) {
+    int cap = 8;
+    while (cap < count) cap *= 2;
+    return cap;
+}
+
+// AST dumping. Both formats walk the tree in pre-order with an explicit
+// stack, so arbitrarily deep trees cannot overflow the C stack, and write
+// through a large buffer that is flushed with a single fwrite when full.
+
+#define DUMP_BUFFER_SIZE (1 << 20)
+#define DUMP_MAX_INDENT 64
+
+typedef struct {
+    FILE* out;
+    char* buf;
+    size_t len;
+} DumpBuffer;
+
+typedef struct {
+    ASTNode* node;
+    int depth;
+} DumpFrame;
+
+static void dump_flush(DumpBuffer* db) {
+    if (db->len > 0) {
+        fwrite(db->buf, 1, db->len, db->out);
+        db->len = 0;
+    }
+}
+
+static void dump_bytes(DumpBuffer* db, const void* data, size_t n) {
+    if (db->len + n > DUMP_BUFFER_SIZE) {
+        dump_flush(db);
+        if (n > DUMP_BUFFER_SIZE) {
+            fwrite(data, 1, n, db->out);
+            return;
+        }
+    }
+    memcpy(db->buf + db->len, data, n);
+    db->len += n;
+}
+
+static void dump_char(DumpBuffer* db, char c) {
+    if (db->len == DUMP_BUFFER_SIZE) dump_flush(db);
+    db->buf[db->len++] = c;
+}
+
+static void dump_str(DumpBuffer* db, const char* s) {
+    dump_bytes(db, s, strlen(s));
+}
+
+static void dump_int(DumpBuffer* db, long long v) {
+    char tmp[24];
+    int i = sizeof(tmp);
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+
+    do {
+        tmp[--i] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0) tmp[--i] = '-';
+
+    dump_bytes(db, tmp + i, sizeof(tmp) - i);
+}
+
+static void dump_varint(DumpBuffer* db, uint64_t v) {
+    while (v >= 0x80) {
+        dump_char(db, (char)(v | 0x80));
+        v >>= 7;
+    }
+    dump_char(db, (char)v);
+}
+
+static const char* ast_kind_name(int kind) {
+    switch (kind) {
+        case AST_PROGRAM:       return "Program";
+        case AST_FUNCTION:      return "Function";
+        case AST_FUNCTION_DECL: return "FunctionDecl";
+        case AST_VAR_DECL:      return "VarDecl";
+        case AST_RETURN:        return "Return";
+        case AST_IF:            return "If";
+        case AST_WHILE:         return "While";
+        case AST_FOR:           return "For";
+        case AST_BREAK:         return "Break";
+        case AST_CONTINUE:      return "Continue";
+        case AST_BLOCK:         return "Block";
+        case AST_UNSAFE_BLOCK:  return "UnsafeBlock";
+        case AST_BINARY_OP:     return "BinaryOp";
+        case AST_UNARY_OP:      return "UnaryOp";
+        case AST_ASSIGN:        return "Assign";
+        case AST_CALL:          return "Call";
+        case AST_MEMBER:        return "Member";
+        case AST_INDEX:         return "Index";
+        case AST_CAST:          return "Cast";
+        case AST_PRINT_STR:     return "PrintStr";
+        case AST_NUMBER:        return "Number";
+        case AST_FLOAT:         return "Float";
+        case AST_STRING:        return "String";
+        case AST_IDENTIFIER:    return "Identifier";
+        case AST_BOOLEAN:       return "Boolean";
+        case AST_NULL:          return "Null";
+        case AST_SIZEOF:        return "Sizeof";
+        case AST_TYPE:          return "Type";
+        case AST_STRUCT:        return "Struct";
+        case AST_STRUCT_MEMBER: return "StructMember";
+        case AST_ENUM:          return "Enum";
+        case AST_ENUM_MEMBER:   return "EnumMember";
+        case AST_POINTER_TYPE:  return "PointerType";
+        case AST_ARRAY_TYPE:    return "ArrayType";
+        default:                return "Unknown";
+    }
+}
+
+static const char* ast_op_spelling(int op) {
+    switch (op) {
+        case TOKEN_PLUS:     return "+";
+        case TOKEN_MINUS:    return "-";
+        case TOKEN_STAR:     return "*";
+        case TOKEN_SLASH:    return "/";
+        case TOKEN_PERCENT:  return "%";
+        case TOKEN_AMP:      return "&";
+        case TOKEN_PIPE:     return "|";
+        case TOKEN_CARET:    return "^";
+        case TOKEN_TILDE:    return "~";
+        case TOKEN_LSHIFT:   return "<<";
+        case TOKEN_RSHIFT:   return ">>";
+        case TOKEN_EQ:       return "==";
+        case TOKEN_NE:       return "!=";
+        case TOKEN_LT:       return "<";
+        case TOKEN_GT:       return ">";
+        case TOKEN_LE:       return "<=";
+        case TOKEN_GE:       return ">=";
+        case TOKEN_AND:      return "&&";
+        case TOKEN_OR:       return "||";
+        case TOKEN_NOT:      return "!";
+        case TOKEN_ASSIGN:   return "=";
+        case TOKEN_PLUS_EQ:  return "+=";
+        case TOKEN_MINUS_EQ: return "-=";
+        case TOKEN_STAR_EQ:  return "*=";
+        case TOKEN_SLASH_EQ: return "/=";
+        default:             return "?";
+    }
+}
+
+static bool ast_kind_has_name(int kind) {
+    return kind == AST_FUNCTION || kind == AST_VAR_DECL ||
+           kind == AST_IDENTIFIER || kind == AST_TYPE || kind == AST_STRING;
+}
+
+static bool ast_kind_has_op(int kind) {
+    return kind == AST_BINARY_OP || kind == AST_UNARY_OP || kind == AST_ASSIGN;
+}
+
+static void dump_node_text(DumpBuffer* db, ASTNode* node, int depth) {
+    int indent = depth < DUMP_MAX_INDENT ? depth : DUMP_MAX_INDENT;
+    for (int i = 0; i < indent; i++) {
+        dump_bytes(db, "  ", 2);
+    }
+    if (depth > DUMP_MAX_INDENT) {
+        dump_char(db, '[');
+        dump_int(db, depth);
+        dump_bytes(db, "] ", 2);
+    }
+
+    dump_str(db, ast_kind_name(node->kind));
+
+    if (node->kind == AST_NUMBER) {
+        dump_char(db, ' ');
+        dump_int(db, node->data.int_value);
+    } else if (node->kind == AST_FLOAT) {
+        char tmp[32];
+        snprintf(tmp, sizeof(tmp), " %.17g", node->data.float_value);
+        dump_str(db, tmp);
+    } else if (node->kind == AST_BOOLEAN) {
+        dump_str(db, node->data.bool_value ? " true" : " false");
+    } else if (node->kind == AST_STRING) {
+        dump_bytes(db, " \"", 2);
+        if (node->data.string_value) dump_str(db, node->data.string_value);
+        dump_char(db, '"');
+    } else if (ast_kind_has_name(node->kind) && node->data.name) {
+        dump_char(db, ' ');
+        dump_str(db, node->data.name);
+    } else if (ast_kind_has_op(node->kind)) {
+        dump_char(db, ' ');
+        dump_str(db, ast_op_spelling(node->data.op));
+    }
+
+    dump_bytes(db, " @", 2);
+    dump_int(db, AST_LOC_LINE(node->loc));
+    dump_char(db, ':');
+    dump_int(db, AST_LOC_COLUMN(node->loc));
+    dump_char(db, '\n');
+}
+
+// Binary layout: the 8-byte magic "UWUAST" + version, then every node in
+// pre-order as kind (u8), child count and loc (varints), and a payload:
+// zigzag varint for numbers, 8 raw bytes for floats, a length-prefixed
+// string for named nodes, a byte for operators. Child counts alone are
+// enough to rebuild the tree shape.
+#define AST_DUMP_MAGIC "UWUAST"
+#define AST_DUMP_VERSION 1
+
+static void dump_node_binary(DumpBuffer* db, ASTNode* node) {
+    dump_char(db, (char)node->kind);
+    dump_varint(db, (uint64_t)node->child_count);
+    dump_varint(db, node->loc);
+
+    if (node->kind == AST_NUMBER) {
+        long long v = node->data.int_value;
+        dump_varint(db, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+    } else if (node->kind == AST_FLOAT) {
+        dump_bytes(db, &node->data.float_value, sizeof(double));
+    } else if (node->kind == AST_BOOLEAN) {
+        dump_char(db, (char)node->data.bool_value);
+    } else if (ast_kind_has_name(node->kind)) {
+        const char* s = node->data.name ? node->data.name : "";
+        size_t len = strlen(s);
+        dump_varint(db, len);
+        dump_bytes(db, s, len);
+    } else if (ast_kind_has_op(node->kind)) {
+        dump_char(db, (char)node->data.op);
+    }
+}
+
+static void ast_dump_format(ASTNode* root, FILE* out, bool binary) {
+    DumpBuffer db = { out, xmalloc(DUMP_BUFFER_SIZE), 0 };
+
+    if (binary) {
+        dump_bytes(&db, AST_DUMP_MAGIC, strlen(AST_DUMP_MAGIC));
+        dump_char(&db, 0);
+        dump_char(&db, AST_DUMP_VERSION);
+    }
+
+    size_t cap = 256;
+    size_t top = 0;
+    DumpFrame* stack = xmalloc(cap * sizeof(DumpFrame));
+    if (root) stack[top++] = (DumpFrame){ root, 0 };
+
+    while (top > 0) {
+        DumpFrame f = stack[--top];
+
+        if (binary) {
+            dump_node_binary(&db, f.node);
+        } else {
+            dump_node_text(&db, f.node, f.depth);
+        }
+
+        if (top + (size_t)f.node->child_count > cap) {
+            while (top + (size_t)f.node->child_count > cap) cap *= 2;
+            stack = xrealloc(stack, cap * sizeof(DumpFrame));
+        }
+        for (int i = f.node->child_count - 1; i >= 0; i--) {
+            stack[top++] = (DumpFrame){ f.node->children[i], f.depth + 1 };
+        }
+    }
+
+    dump_flush(&db);
+    fflush(out);
+    free(stack);
+    free(db.buf);
+}
+
 void ast_dump(ASTNode* node, FILE* out) {
-    (void)node;
-    (void)out;
+    ast_dump_format(node, out, false);
+}
+
+void ast_dump_binary(ASTNode* node, FILE* out) {
+    ast_dump_format(node, out, true);
 }
 
 
@@ -46,7 +352,7 @@ void ast_node_free(ASTNode* node) {
         ast_node_free(node->children[i]);
     }
     
-    if (node->children) {
+    if (node->children != node->inline_children) {
         free(node->children);
     }
     
@@ -58,22 +364,61 @@ void ast_node_free(ASTNode* node) {
         }
     }
     
-    if (node->type) {
-        type_free(node->type);
-    }
-    
-    free(node);
+    // node->type is an annotation from semantic analysis and is shared with
+    // symbol table entries and other nodes, so the tree does not own it.
+
+    node->children = (ASTNode**)free_nodes;
+    free_nodes = node;
 }
 
 void ast_node_add_child(ASTNode* parent, ASTNode* child) {
-    if (parent->child_count >= parent->child_capacity) {
-        parent->child_capacity *= 2;
-        parent->children = xrealloc(parent->children, 
-                                   parent->child_capacity * sizeof(ASTNode*));
+    int n = parent->child_count;
+
+    if (n == AST_INLINE_CHILDREN) {
+        ASTNode** side = xmalloc(side_array_capacity(n + 1) * sizeof(ASTNode*));
+        memcpy(side, parent->inline_children, n * sizeof(ASTNode*));
+        parent->children = side;
+    } else if (n > AST_INLINE_CHILDREN && n == side_array_capacity(n)) {
+        parent->children = xrealloc(parent->children,
+                                    n * 2 * sizeof(ASTNode*));
     }
+
     parent->children[parent->child_count++] = child;
 }
 
+void ast_stats(ASTNode* root, ASTStats* stats) {
+    memset(stats, 0, sizeof(ASTStats));
+    if (!root) return;
+
+    size_t cap = 64;
+    size_t top = 0;
+    ASTNode** stack = xmalloc(cap * sizeof(ASTNode*));
+    stack[top++] = root;
+
+    while (top > 0) {
+        ASTNode* node = stack[--top];
+        if (!node) continue;
+
+        stats->node_count++;
+        if (node->children != node->inline_children) {
+            stats->side_array_count++;
+            stats->side_array_bytes +=
+                (size_t)side_array_capacity(node->child_count) * sizeof(ASTNode*);
+        }
+
+        if (top + (size_t)node->child_count > cap) {
+            while (top + (size_t)node->child_count > cap) cap *= 2;
+            stack = xrealloc(stack, cap * sizeof(ASTNode*));
+        }
+        for (int i = 0; i < node->child_count; i++) {
+            stack[top++] = node->children[i];
+        }
+    }
+
+    stats->node_bytes = stats->node_count * sizeof(ASTNode);
+    free(stack);
+}
+
 // Type system implementation
 Type* type_new(TypeKind kind) {
     Type* t = xcalloc(1, sizeof(Type));
@@ -107,9 +452,32 @@ Type* type_array(Type* base, int size) {
     t->base = base;
     t->size = base->size * size;
     t->align = base->align;
+    t->array_size = size;
     return t;
 }
 
+bool type_is_float(const Type* t) {
+    return t && (t->kind == TYPE_FLOOF || t->kind == TYPE_BIGFLOOF);
+}
+
+// Mixed arithmetic is done in the widest floating operand type.
+Type* type_float_common(Type* a, Type* b) {
+    if (!type_is_float(a)) return type_is_float(b) ? b : NULL;
+    if (!type_is_float(b)) return a;
+    return a->size >= b->size ? a : b;
+}
+
+// Integer arithmetic is done in the wider operand type. A pointer operand
+// wins over an integer one, and an array decays to a pointer to its element.
+Type* type_int_common(Type* a, Type* b) {
+    if (!a || !b) return a ? a : b;
+    if (a->kind == TYPE_ARRAY) return type_pointer(a->base);
+    if (a->kind == TYPE_POINTER) return a;
+    if (b->kind == TYPE_ARRAY) return type_pointer(b->base);
+    if (b->kind == TYPE_POINTER) return b;
+    return b->size > a->size ? b : a;
+}
+
 void type_free(Type* type) {
     if (!type) return;
     if (type->base) {
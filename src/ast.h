@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 
@@ -76,18 +77,27 @@ typedef struct Type {
 } Type;
 
 
-typedef struct ASTNode {
-    ASTNodeKind kind;
+// Source locations are packed into 32 bits: 20 bits of line, 12 of column.
+// Values that do not fit are clamped to the largest representable one.
+#define AST_LOC_COLUMN_BITS 12
+#define AST_LOC_LINE(loc)   ((int)((loc) >> AST_LOC_COLUMN_BITS))
+#define AST_LOC_COLUMN(loc) ((int)((loc) & ((1u << AST_LOC_COLUMN_BITS) - 1)))
 
-    int line;
-    int column;
+// Children of nodes with small fixed arity (operators, if, while, calls
+// with few arguments...) live inside the node itself. Longer lists such as
+// blocks and programs spill into a separately allocated side array.
+#define AST_INLINE_CHILDREN 3
 
-    Type* type;
+typedef struct ASTNode {
+    uint8_t kind;               // ASTNodeKind
+    int child_count;
+    uint32_t loc;
     int stack_offset;
 
+    Type* type;
+
+    // Points at inline_children or at the side array.
     struct ASTNode** children;
-    int child_count;
-    int child_capacity;
 
     union {
         long long int_value;
@@ -103,18 +113,33 @@ typedef struct ASTNode {
             char* value;
         } print_str;
     } data;
+
+    struct ASTNode* inline_children[AST_INLINE_CHILDREN];
 } ASTNode;
 
+typedef struct {
+    size_t node_count;
+    size_t node_bytes;          // slab storage backing the nodes
+    size_t side_array_count;
+    size_t side_array_bytes;
+} ASTStats;
+
 
 ASTNode* ast_node_new(ASTNodeKind kind);
 void ast_node_free(ASTNode* node);
 void ast_node_add_child(ASTNode* parent, ASTNode* child);
 void ast_dump(ASTNode* node, FILE* out);
+void ast_dump_binary(ASTNode* node, FILE* out);
+uint32_t ast_loc_pack(int line, int column);
+void ast_stats(ASTNode* root, ASTStats* stats);
 
 
 Type* type_new(TypeKind kind);
 Type* type_pointer(Type* base);
 Type* type_array(Type* base, int size);
+bool type_is_float(const Type* t);
+Type* type_float_common(Type* a, Type* b);
+Type* type_int_common(Type* a, Type* b);
 void type_free(Type* type);
 
 #endif
\ No newline at end of file
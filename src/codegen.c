@@ -22,6 +22,8 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <stdint.h>
 
 typedef struct {
     bool enable_bounds_checks;
@@ -74,18 +76,255 @@ static int parse_offset(const char* s) {
     return 0;
 }
 
+// Bytes of packed locals in the current function. Variables are named by
+// the end offset of their slot, temps follow in 8-byte slots.
+static int frame_locals = 0;
+
+// Layout of the current function's frame, set by the prologue: the
+// callee-saved registers pushed between the frame base and the slots, and
+// the offset of the first stack argument from the frame base.
+static int frame_save = 0;
+static int frame_args = 16;
+
+// With stack checks on, a frame of a page or more touches each page as the
+// stack pointer moves down, so that it cannot step over the guard page
+// below the stack; smaller frames are never probed. Up to
+// STACK_PROBE_UNROLL pages are probed in line, larger frames in a loop.
+#define STACK_PAGE_SIZE    4096
+#define STACK_PROBE_UNROLL 8
+
+static int stack_probe_pages(int size) {
+    return config.enable_stack_checks ? size / STACK_PAGE_SIZE : 0;
+}
+
 static int get_stack_offset(const char* name, int frame_size) {
     int offset = parse_offset(name);
-    if (offset > 0) {
-        return -(offset * 8 + 8);
+    if (is_var(name)) {
+        return -(frame_save + offset);
     }
-    return 0;
+    return -(frame_save + frame_locals + (offset + 1) * 8);
+}
+
+// Incoming arguments claimed so far by the current function's param
+// instructions: integer registers, FP registers and stack slots.
+static int params_gp = 0;
+static int params_fp = 0;
+static int params_stack = 0;
+
+static bool is_float_arg(IRInstruction* call, int i) {
+    return (call->float_args >> i) & 1;
+}
+
+// Vector instructions start with 'v' and name their registers q0-q7.
+static bool is_vector_op(IRInstruction* inst) {
+    return inst->opcode[0] == 'v';
 }
 
+static int vec_reg_index(const char* q) {
+    return atoi(q + 1);
+}
+
+// "func name frame locals" carries the function's own frame size and the
+// size of its locals; fall back to the program-wide value for IR that
+// predates them.
+static int begin_function(IRInstruction* func, int fallback) {
+    frame_locals = func->operands[2] ? atoi(func->operands[2]) : 0;
+    params_gp = params_fp = params_stack = 0;
+    if (func->operands[1]) {
+        return atoi(func->operands[1]);
+    }
+    return fallback;
+}
+
+// A failed chkbounds, chkrange or chknull jumps to a shared stub that
+// reports the error; the stubs are emitted once, after the last function,
+// and only when something jumps to them.
+#define BOUNDS_FAIL_LABEL ".Luwu_bounds_fail"
+#define NULL_FAIL_LABEL   ".Luwu_null_fail"
+
+static bool bounds_fail_used = false;
+static bool null_fail_used = false;
+
 static int align_to(int value, int alignment) {
     return (value + alignment - 1) & ~(alignment - 1);
 }
 
+// A leaf function makes no calls, so it needs no return address saved and
+// no aligned stack of its own.
+static bool is_leaf_function(IRInstruction* func) {
+    for (IRInstruction* inst = func->next; inst && strcmp(inst->opcode, "func") != 0;
+         inst = inst->next) {
+        if (strcmp(inst->opcode, "call") == 0 || strcmp(inst->opcode, "tailcall") == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Functions the profile saw run go into .text.hot and those it never saw
+// run into .text.unlikely, as do the cold blocks of a function (the ones
+// after "cold") and the error stubs; the linker groups each section, away
+// from the rest of .text. Mach-O keeps everything in __text.
+static const char* text_section = ".text";
+
+static void emit_text_section(FILE* f, const char* section) {
+    text_section = section;
+#ifdef __APPLE__
+    fprintf(f, ".text\n");
+#else
+    fprintf(f, ".section %s\n", section);
+#endif
+}
+
+static void begin_function_section(FILE* f, IRInstruction* func) {
+    const char* section = func->count > 0 ? ".text.hot" :
+                          func->count == 0 ? ".text.unlikely" : ".text";
+    if (strcmp(section, text_section) != 0) {
+        emit_text_section(f, section);
+    }
+}
+
+static void begin_cold_section(FILE* f, IRInstruction* cold) {
+    emit_text_section(f, ".text.unlikely");
+#ifndef __APPLE__
+    fprintf(f, "%s.cold:\n", cold->operands[0]);
+#else
+    (void)cold;
+#endif
+}
+
+static int jump_tables = 0;
+
+// Emits the jump table of a switch into .rodata as 32-bit offsets from the
+// table, one per case following it, and returns to the text section.
+// Returns the number of entries.
+static int emit_jump_table(FILE* f, IRInstruction* sw, char* label, size_t size) {
+    snprintf(label, size, ".Lswitch%d", jump_tables++);
+#ifdef __APPLE__
+    fprintf(f, ".section __TEXT,__const\n");
+#else
+    fprintf(f, ".section .rodata\n");
+#endif
+    fprintf(f, "    .p2align 2\n");
+    fprintf(f, "%s:\n", label);
+    int count = 0;
+    for (IRInstruction* c = sw->next; c && strcmp(c->opcode, "case") == 0; c = c->next) {
+        fprintf(f, "    .long %s - %s\n", c->operands[0], label);
+        count++;
+    }
+    emit_text_section(f, text_section);
+    return count;
+}
+
+// Profiling (--profile-generate). The block counters of an instrumented
+// program live in .data, one 64-bit slot per "count N"; a constructor hands
+// them to uwu_profile_register together with the profile's path and a
+// "<function> <blocks>" line per function, which says whose counts they are.
+#define PROFILE_COUNTERS ".Luwu_prof_counters"
+#define PROFILE_INIT     ".Luwu_prof_init"
+
+static IRInstruction* find_profile(IRProgram* program) {
+    for (IRInstruction* inst = program->head; inst; inst = inst->next) {
+        if (strcmp(inst->opcode, "profile") == 0) return inst;
+        if (strcmp(inst->opcode, "func") == 0) break;
+    }
+    return NULL;
+}
+
+// Emits the counters, path and layout, and leaves the constructor's address
+// in the init array; the caller emits the constructor at PROFILE_INIT.
+static void emit_profile_data(FILE* f, IRInstruction* profile) {
+    int total = atoi(profile->operands[1]);
+#ifdef __APPLE__
+    fprintf(f, ".section __DATA,__data\n");
+#else
+    fprintf(f, ".section .data\n");
+#endif
+    fprintf(f, "    .p2align 3\n");
+    fprintf(f, "%s:\n", PROFILE_COUNTERS);
+    fprintf(f, "    .zero %d\n", 8 * (total > 0 ? total : 1));
+
+#ifdef __APPLE__
+    fprintf(f, ".section __TEXT,__cstring,cstring_literals\n");
+#else
+    fprintf(f, ".section .rodata\n");
+#endif
+    fprintf(f, ".Luwu_prof_path:\n");
+    fprintf(f, "    .asciz \"");
+    for (const char* c = profile->operands[0]; *c; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', f);
+        fputc(*c, f);
+    }
+    fprintf(f, "\"\n");
+    fprintf(f, ".Luwu_prof_layout:\n");
+    for (IRInstruction* inst = profile->next; inst && strcmp(inst->opcode, "profunc") == 0;
+         inst = inst->next) {
+        fprintf(f, "    .ascii \"%s %s\\n\"\n", inst->operands[0], inst->operands[1]);
+    }
+    fprintf(f, "    .byte 0\n");
+
+#ifdef __APPLE__
+    fprintf(f, ".section __DATA,__mod_init_func,mod_init_funcs\n");
+#else
+    fprintf(f, ".section .init_array,\"aw\"\n");
+#endif
+    fprintf(f, "    .p2align 3\n");
+    fprintf(f, "    .quad %s\n", PROFILE_INIT);
+    emit_text_section(f, text_section);
+}
+
+// Signed division by a constant.
+//
+// A div or mod whose divisor is an immediate d with |d| >= 2 needs no
+// divide instruction. By 2^k, the dividend is biased by 2^k - 1 when
+// negative and shifted; otherwise the quotient is the high half of n * magic
+// (plus n when magic is negative), shifted right and rounded towards zero
+// (Hacker's Delight, 10-4). A remainder is n - q * |d|, and a negative d
+// negates the quotient. Unsigned division keeps the divide.
+static bool constant_divisor(IRInstruction* inst, uint64_t* divisor) {
+    if (inst->is_unsigned || !is_immediate(inst->operands[2])) return false;
+    long long d = atoll(inst->operands[2]);
+    if (d == LLONG_MIN) return false;
+    *divisor = d < 0 ? -(uint64_t)d : (uint64_t)d;
+    return *divisor >= 2;
+}
+
+// log2 of a power of two, or -1.
+static int exact_log2(uint64_t value) {
+    if (value == 0 || (value & (value - 1)) != 0) return -1;
+    int k = 0;
+    while (value >>= 1) k++;
+    return k;
+}
+
+// The magic multiplier for 2 <= d < 2^63; returns the shift.
+static int division_magic(uint64_t d, int64_t* magic) {
+    const uint64_t two63 = 1ULL << 63;
+    uint64_t anc = two63 - 1 - two63 % d;
+    uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / d, r2 = two63 - q2 * d;
+    uint64_t delta;
+    int p = 63;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= d) {
+            q2++;
+            r2 -= d;
+        }
+        delta = d - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *magic = (int64_t)(q2 + 1);
+    return p - 64;
+}
+
 static int parse_arg_count(const char* s) {
     if (!s) return 0;
     return atoi(s);
@@ -96,6 +335,40 @@ static int parse_arg_count(const char* s) {
 static const char* x86_64_arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 static const int x86_64_num_arg_regs = 6;
 
+// Leaf functions whose slots fit in the red zone below %rsp keep no frame
+// pointer and address their slots from %rsp, which they never move. %rbx
+// is saved only when the function uses it.
+#define X86_64_RED_ZONE 128
+
+static bool x86_64_frameless = false;
+static bool x86_64_save_rbx = false;
+
+static const char* x86_64_frame_reg(void) {
+    return x86_64_frameless ? "rsp" : "rbp";
+}
+
+static void emit_x86_64_stack_alloc(FILE* f, int size) {
+    int pages = stack_probe_pages(size);
+    if (pages > STACK_PROBE_UNROLL) {
+        fprintf(f, "    leaq -%d(%%rsp), %%rax\n", pages * STACK_PAGE_SIZE);
+        fprintf(f, "1:\n");
+        fprintf(f, "    subq $%d, %%rsp\n", STACK_PAGE_SIZE);
+        fprintf(f, "    orq $0, (%%rsp)\n");
+        fprintf(f, "    cmpq %%rax, %%rsp\n");
+        fprintf(f, "    jne 1b\n");
+    } else {
+        for (int i = 0; i < pages; i++) {
+            fprintf(f, "    subq $%d, %%rsp\n", STACK_PAGE_SIZE);
+            fprintf(f, "    orq $0, (%%rsp)\n");
+        }
+    }
+
+    int rest = size - pages * STACK_PAGE_SIZE;
+    if (rest > 0) {
+        fprintf(f, "    subq $%d, %%rsp\n", rest);
+    }
+}
+
 static void emit_x86_64_prologue(FILE* f, const char* func_name, int frame_size) {
 #ifdef __APPLE__
     fprintf(f, ".globl _%s\n", func_name);
@@ -106,36 +379,139 @@ static void emit_x86_64_prologue(FILE* f, const char* func_name, int frame_size)
     fprintf(f, "%s:\n", func_name);
 #endif
 
+    frame_save = 0;
+    if (x86_64_frameless) {
+        if (x86_64_save_rbx) {
+            fprintf(f, "    pushq %%rbx\n");
+        }
+        frame_args = x86_64_save_rbx ? 16 : 8;
+        return;
+    }
+
     fprintf(f, "    pushq %%rbp\n");
     fprintf(f, "    movq %%rsp, %%rbp\n");
-    fprintf(f, "    pushq %%rbx\n");
-    fprintf(f, "    pushq %%r12\n");
+    if (x86_64_save_rbx) {
+        fprintf(f, "    pushq %%rbx\n");
+        frame_save = 8;
+    }
+    frame_args = 16;
 
-    int aligned_frame = align_to(frame_size, 16);
+    // The slots start below the saved registers; calls need %rsp 16-byte
+    // aligned again.
+    emit_x86_64_stack_alloc(f, align_to(frame_size + frame_save, 16) - frame_save);
+}
 
-    if (aligned_frame > 0) {
-        fprintf(f, "    subq $%d, %%rsp\n", aligned_frame);
+// Restores the registers and stack pointer the prologue saved, leaving the
+// return address on top.
+static void emit_x86_64_leave(FILE* f) {
+    if (x86_64_frameless) {
+        if (x86_64_save_rbx) {
+            fprintf(f, "    popq %%rbx\n");
+        }
+        return;
     }
-
-    if (config.enable_stack_checks && aligned_frame > 0) {
-        fprintf(f, "    leaq -%d(%%rsp), %%rax\n", aligned_frame);
-        fprintf(f, "    cmpq $0, (%%rax)\n");
+    if (x86_64_save_rbx) {
+        fprintf(f, "    movq -8(%%rbp), %%rbx\n");
     }
+    fprintf(f, "    leave\n");
 }
 
 static void emit_x86_64_epilogue(FILE* f) {
-    fprintf(f, "    popq %%r12\n");
-    fprintf(f, "    popq %%rbx\n");
-    fprintf(f, "    leave\n");
+    emit_x86_64_leave(f);
     fprintf(f, "    retq\n");
 }
 
+enum { X86_RAX, X86_RBX, X86_RCX, X86_RDX };
+
+static const char* x86_64_regs[4][4] = {
+    {"al", "ax", "eax", "rax"},
+    {"bl", "bx", "ebx", "rbx"},
+    {"cl", "cx", "ecx", "rcx"},
+    {"dl", "dx", "edx", "rdx"},
+};
+
+static const char* x86_64_arg_regs_sized[6][4] = {
+    {"dil", "di", "edi", "rdi"},
+    {"sil", "si", "esi", "rsi"},
+    {"dl", "dx", "edx", "rdx"},
+    {"cl", "cx", "ecx", "rcx"},
+    {"r8b", "r8w", "r8d", "r8"},
+    {"r9b", "r9w", "r9d", "r9"},
+};
+
+static int width_index(int width) {
+    switch (width) {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        default: return 3;
+    }
+}
+
+static const char* x86_64_reg(int reg, int width) {
+    return x86_64_regs[reg][width_index(width)];
+}
+
+static char x86_64_suffix(int width) {
+    return "bwlq"[width_index(width)];
+}
+
+// Loads a value of the given width from mem into %rax, sign- or
+// zero-extending it to 64 bits.
+static void emit_x86_64_load_mem(FILE* f, const char* mem, int width, bool is_unsigned) {
+    switch (width) {
+        case 1:
+            fprintf(f, "    %s %s, %%rax\n", is_unsigned ? "movzbq" : "movsbq", mem);
+            break;
+        case 2:
+            fprintf(f, "    %s %s, %%rax\n", is_unsigned ? "movzwq" : "movswq", mem);
+            break;
+        case 4:
+            if (is_unsigned) {
+                fprintf(f, "    movl %s, %%eax\n", mem);
+            } else {
+                fprintf(f, "    movslq %s, %%rax\n", mem);
+            }
+            break;
+        default:
+            fprintf(f, "    movq %s, %%rax\n", mem);
+            break;
+    }
+}
+
+static void emit_x86_64_store_mem(FILE* f, const char* mem, int width) {
+    fprintf(f, "    mov%c %%%s, %s\n", x86_64_suffix(width),
+            x86_64_reg(X86_RAX, width), mem);
+}
+
+// Re-establishes the 64-bit extended form of a value computed in the low
+// width bytes of %rax.
+static void emit_x86_64_extend(FILE* f, int width, bool is_unsigned) {
+    switch (width) {
+        case 1:
+            fprintf(f, "    %s %%al, %%rax\n", is_unsigned ? "movzbq" : "movsbq");
+            break;
+        case 2:
+            fprintf(f, "    %s %%ax, %%rax\n", is_unsigned ? "movzwq" : "movswq");
+            break;
+        case 4:
+            if (is_unsigned) {
+                fprintf(f, "    movl %%eax, %%eax\n");
+            } else {
+                fprintf(f, "    cltq\n");
+            }
+            break;
+        default:
+            break;
+    }
+}
+
 static void emit_x86_64_load(FILE* f, const char* src, int frame_size) {
     if (is_immediate(src)) {
         fprintf(f, "    movq $%s, %%rax\n", src);
     } else if (is_var(src) || is_temp(src)) {
         int offset = get_stack_offset(src, frame_size);
-        fprintf(f, "    movq %d(%%rbp), %%rax\n", offset);
+        fprintf(f, "    movq %d(%%%s), %%rax\n", offset, x86_64_frame_reg());
     } else if (is_string_literal(src)) {
         fprintf(f, "    leaq %s(%%rip), %%rax\n", src);
     } else {
@@ -146,11 +522,40 @@ static void emit_x86_64_load(FILE* f, const char* src, int frame_size) {
 static void emit_x86_64_store(FILE* f, const char* dest, int frame_size) {
     if (is_var(dest) || is_temp(dest)) {
         int offset = get_stack_offset(dest, frame_size);
-        fprintf(f, "    movq %%rax, %d(%%rbp)\n", offset);
+        fprintf(f, "    movq %%rax, %d(%%%s)\n", offset, x86_64_frame_reg());
+    }
+}
+
+// Variables live in slots of their own width; temps are always 8 bytes.
+static void emit_x86_64_load_sized(FILE* f, const char* src, IRInstruction* inst, int frame_size) {
+    if (is_var(src) && inst->width && inst->width != 8) {
+        char mem[32];
+        snprintf(mem, sizeof(mem), "%d(%%%s)", get_stack_offset(src, frame_size),
+                 x86_64_frame_reg());
+        emit_x86_64_load_mem(f, mem, inst->width, inst->is_unsigned);
+    } else {
+        emit_x86_64_load(f, src, frame_size);
     }
 }
 
-static void emit_x86_64_call(FILE* f, const char* func, IRInstruction* inst, int frame_size) {
+static void emit_x86_64_store_sized(FILE* f, const char* dest, IRInstruction* inst, int frame_size) {
+    if (is_var(dest) && inst->width && inst->width != 8) {
+        char mem[32];
+        snprintf(mem, sizeof(mem), "%d(%%%s)", get_stack_offset(dest, frame_size),
+                 x86_64_frame_reg());
+        emit_x86_64_store_mem(f, mem, inst->width);
+    } else {
+        emit_x86_64_store(f, dest, frame_size);
+    }
+}
+
+// Integer arguments go to the next free general register and floating
+// ones to the next free XMM register; whatever does not fit is passed on
+// the stack in argument order.
+// A tail call leaves the frame before jumping to the callee, which returns
+// straight to our caller; its arguments are all in registers.
+static void emit_x86_64_call(FILE* f, const char* func, IRInstruction* inst, int frame_size,
+                             bool tail) {
     int num_args = 0;
 
     for (int i = 1; i < 16 && inst->operands[i]; i++) {
@@ -160,19 +565,53 @@ static void emit_x86_64_call(FILE* f, const char* func, IRInstruction* inst, int
     bool is_print_str = strcmp(func, "print_str") == 0;
     const char* actual_func = is_print_str ? "puts" : func;
 
-    bool need_align = ((num_args > 6 ? (num_args - 6) : 0) * 8) % 16 != 0;
+    int reg[16];
+    int stack_slots[16];
+    int gp = 0, fp = 0, stack_args = 0;
+    for (int i = 1; i <= num_args; i++) {
+        if (is_float_arg(inst, i) && fp < 8) {
+            reg[i] = fp++;
+        } else if (!is_float_arg(inst, i) && gp < x86_64_num_arg_regs) {
+            reg[i] = gp++;
+        } else {
+            reg[i] = -1;
+            stack_slots[stack_args++] = i;
+        }
+    }
+
+    bool need_align = (stack_args * 8) % 16 != 0;
     if (need_align) {
         fprintf(f, "    subq $8, %%rsp\n");
     }
 
-    for (int i = num_args; i > 6; i--) {
-        emit_x86_64_load(f, inst->operands[i], frame_size);
+    for (int s = stack_args - 1; s >= 0; s--) {
+        emit_x86_64_load(f, inst->operands[stack_slots[s]], frame_size);
         fprintf(f, "    pushq %%rax\n");
     }
 
-    for (int i = 1; i <= num_args && i <= 6; i++) {
+    for (int i = 1; i <= num_args; i++) {
+        if (reg[i] < 0) continue;
         emit_x86_64_load(f, inst->operands[i], frame_size);
-        fprintf(f, "    movq %%rax, %%%s\n", x86_64_arg_regs[i-1]);
+        if (is_float_arg(inst, i)) {
+            fprintf(f, "    movq %%rax, %%xmm%d\n", reg[i]);
+        } else {
+            fprintf(f, "    movq %%rax, %%%s\n", x86_64_arg_regs[reg[i]]);
+        }
+    }
+
+    // Variadic callees read the number of vector registers used from %al.
+    if (fp > 0) {
+        fprintf(f, "    movl $%d, %%eax\n", fp);
+    }
+
+    if (tail) {
+        emit_x86_64_leave(f);
+#ifdef __APPLE__
+        fprintf(f, "    jmp _%s\n", actual_func);
+#else
+        fprintf(f, "    jmp %s@PLT\n", actual_func);
+#endif
+        return;
     }
 
 #ifdef __APPLE__
@@ -181,161 +620,484 @@ static void emit_x86_64_call(FILE* f, const char* func, IRInstruction* inst, int
     fprintf(f, "    call %s@PLT\n", actual_func);
 #endif
 
-    int stack_args = num_args > 6 ? num_args - 6 : 0;
     if (stack_args > 0 || need_align) {
         int cleanup = stack_args * 8 + (need_align ? 8 : 0);
         fprintf(f, "    addq $%d, %%rsp\n", cleanup);
     }
 }
 
-static void emit_x86_64_instruction(FILE* f, IRInstruction* inst, int frame_size) {
-    if (strcmp(inst->opcode, "mov") == 0) {
-        emit_x86_64_load(f, inst->operands[1], frame_size);
-        emit_x86_64_store(f, inst->operands[0], frame_size);
+// Arithmetic is done at the instruction's width (32 or 64 bits): the left
+// operand ends up in %rbx and the right one in %rax.
+static void emit_x86_64_operands(FILE* f, IRInstruction* inst, int frame_size) {
+    emit_x86_64_load(f, inst->operands[1], frame_size);
+    fprintf(f, "    movq %%rax, %%rbx\n");
+    emit_x86_64_load(f, inst->operands[2], frame_size);
+}
+
+static void emit_x86_64_result(FILE* f, IRInstruction* inst, int frame_size) {
+    if (inst->width == 4) {
+        emit_x86_64_extend(f, 4, inst->is_unsigned);
     }
-    else if (strcmp(inst->opcode, "add") == 0) {
-        emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    addq %%rbx, %%rax\n");
-        emit_x86_64_store(f, inst->operands[0], frame_size);
+    emit_x86_64_store(f, inst->operands[0], frame_size);
+}
+
+static const char* x86_64_binary_op(const char* opcode) {
+    if (strcmp(opcode, "add") == 0) return "add";
+    if (strcmp(opcode, "mul") == 0) return "imul";
+    if (strcmp(opcode, "and") == 0) return "and";
+    if (strcmp(opcode, "or") == 0) return "or";
+    if (strcmp(opcode, "xor") == 0) return "xor";
+    return NULL;
+}
+
+static const char* x86_64_compare_cc(const char* opcode) {
+    if (strcmp(opcode, "lt") == 0) return "l";
+    if (strcmp(opcode, "le") == 0) return "le";
+    if (strcmp(opcode, "gt") == 0) return "g";
+    if (strcmp(opcode, "ge") == 0) return "ge";
+    if (strcmp(opcode, "eq") == 0) return "e";
+    if (strcmp(opcode, "ne") == 0) return "ne";
+    return NULL;
+}
+
+// Floating values travel through %rax as raw bits; arithmetic uses %xmm0
+// and %xmm1.
+static void emit_x86_64_fload(FILE* f, const char* src, int xmm, int frame_size) {
+    if (is_var(src) || is_temp(src)) {
+        fprintf(f, "    movq %d(%%%s), %%xmm%d\n", get_stack_offset(src, frame_size),
+                x86_64_frame_reg(), xmm);
+    } else {
+        emit_x86_64_load(f, src, frame_size);
+        fprintf(f, "    movq %%rax, %%xmm%d\n", xmm);
     }
-    else if (strcmp(inst->opcode, "sub") == 0) {
-        emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    subq %%rax, %%rbx\n");
-        fprintf(f, "    movq %%rbx, %%rax\n");
-        emit_x86_64_store(f, inst->operands[0], frame_size);
+}
+
+static void emit_x86_64_fstore(FILE* f, const char* dest, int width, int frame_size) {
+    if (width == 4) {
+        fprintf(f, "    movd %%xmm0, %%eax\n");
+    } else {
+        fprintf(f, "    movq %%xmm0, %%rax\n");
     }
-    else if (strcmp(inst->opcode, "mul") == 0) {
-        emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    imulq %%rbx, %%rax\n");
+    emit_x86_64_store(f, dest, frame_size);
+}
+
+static const char* x86_64_float_op(const char* opcode) {
+    if (strcmp(opcode, "add") == 0) return "add";
+    if (strcmp(opcode, "sub") == 0) return "sub";
+    if (strcmp(opcode, "mul") == 0) return "mul";
+    if (strcmp(opcode, "div") == 0) return "div";
+    return NULL;
+}
+
+// Handles the instructions whose floating form differs from the integer
+// one. ucomis sets CF/ZF like an unsigned compare and all of CF, ZF and PF
+// for unordered operands, so lt/le are done as gt/ge with the operands
+// swapped to make NaN compare false.
+static bool emit_x86_64_float(FILE* f, IRInstruction* inst, int frame_size) {
+    char p = inst->width == 4 ? 's' : 'd';
+    const char* op;
+
+    if ((op = x86_64_float_op(inst->opcode)) != NULL) {
+        emit_x86_64_fload(f, inst->operands[1], 0, frame_size);
+        emit_x86_64_fload(f, inst->operands[2], 1, frame_size);
+        fprintf(f, "    %ss%c %%xmm1, %%xmm0\n", op, p);
+        emit_x86_64_fstore(f, inst->operands[0], inst->width, frame_size);
+    }
+    else if ((op = x86_64_compare_cc(inst->opcode)) != NULL) {
+        emit_x86_64_fload(f, inst->operands[1], 0, frame_size);
+        emit_x86_64_fload(f, inst->operands[2], 1, frame_size);
+        bool swap = strcmp(inst->opcode, "lt") == 0 || strcmp(inst->opcode, "le") == 0;
+        fprintf(f, "    ucomis%c %%xmm%d, %%xmm%d\n", p, swap ? 0 : 1, swap ? 1 : 0);
+        if (strcmp(inst->opcode, "eq") == 0) {
+            fprintf(f, "    sete %%al\n");
+            fprintf(f, "    setnp %%cl\n");
+            fprintf(f, "    andb %%cl, %%al\n");
+        } else if (strcmp(inst->opcode, "ne") == 0) {
+            fprintf(f, "    setne %%al\n");
+            fprintf(f, "    setp %%cl\n");
+            fprintf(f, "    orb %%cl, %%al\n");
+        } else {
+            bool strict = strcmp(inst->opcode, "lt") == 0 || strcmp(inst->opcode, "gt") == 0;
+            fprintf(f, "    %s %%al\n", strict ? "seta" : "setae");
+        }
+        fprintf(f, "    movzbq %%al, %%rax\n");
         emit_x86_64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "div") == 0) {
+    else if (strcmp(inst->opcode, "neg") == 0) {
         emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    movq %%rbx, %%rax\n");
-        fprintf(f, "    cqo\n");
-        fprintf(f, "    idivq %d(%%rbp)\n", get_stack_offset(inst->operands[2], frame_size));
+        if (inst->width == 4) {
+            fprintf(f, "    btcl $31, %%eax\n");
+        } else {
+            fprintf(f, "    btcq $63, %%rax\n");
+        }
         emit_x86_64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "mod") == 0) {
-        emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    movq %%rbx, %%rax\n");
-        fprintf(f, "    cqo\n");
-        fprintf(f, "    idivq %d(%%rbp)\n", get_stack_offset(inst->operands[2], frame_size));
-        fprintf(f, "    movq %%rdx, %%rax\n");
+    else if (strcmp(inst->opcode, "fconst") == 0) {
+        fprintf(f, "    movq %s(%%rip), %%rax\n", inst->operands[1]);
         emit_x86_64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "lt") == 0) {
+    else if (strcmp(inst->opcode, "itof") == 0) {
         emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmpq %%rax, %%rbx\n");
-        fprintf(f, "    setl %%al\n");
-        fprintf(f, "    movzbq %%al, %%rax\n");
-        emit_x86_64_store(f, inst->operands[0], frame_size);
+        fprintf(f, "    cvtsi2s%cq %%rax, %%xmm0\n", p);
+        emit_x86_64_fstore(f, inst->operands[0], inst->width, frame_size);
     }
-    else if (strcmp(inst->opcode, "le") == 0) {
-        emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmpq %%rax, %%rbx\n");
-        fprintf(f, "    setle %%al\n");
-        fprintf(f, "    movzbq %%al, %%rax\n");
+    else if (strcmp(inst->opcode, "ftoi") == 0) {
+        emit_x86_64_fload(f, inst->operands[1], 0, frame_size);
+        fprintf(f, "    cvtts%c2siq %%xmm0, %%rax\n", p);
         emit_x86_64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "gt") == 0) {
-        emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmpq %%rax, %%rbx\n");
-        fprintf(f, "    setg %%al\n");
-        fprintf(f, "    movzbq %%al, %%rax\n");
-        emit_x86_64_store(f, inst->operands[0], frame_size);
+    else if (strcmp(inst->opcode, "fext") == 0 || strcmp(inst->opcode, "ftrunc") == 0) {
+        emit_x86_64_fload(f, inst->operands[1], 0, frame_size);
+        fprintf(f, "    %s %%xmm0, %%xmm0\n", inst->width == 4 ? "cvtsd2ss" : "cvtss2sd");
+        emit_x86_64_fstore(f, inst->operands[0], inst->width, frame_size);
+    }
+    else if (strcmp(inst->opcode, "getret") == 0) {
+        emit_x86_64_fstore(f, inst->operands[0], inst->width, frame_size);
+    }
+    else if (strcmp(inst->opcode, "ret") == 0) {
+        emit_x86_64_fload(f, inst->operands[0], 0, frame_size);
+        emit_x86_64_epilogue(f);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Vector operations work on q0-q7, which are %xmm0-%xmm7; %xmm14 and
+// %xmm15 are scratch. Only SSE2 is used, so the output runs on any x86-64.
+static char x86_64_lane(int width) {
+    switch (width) {
+        case 1:  return 'b';
+        case 2:  return 'w';
+        case 4:  return 'd';
+        default: return 'q';
+    }
+}
+
+// The integer forms of add, sub, and, or and xor.
+static void emit_x86_64_vector_int_op(FILE* f, const char* op, int width, int src, int dest) {
+    if (strcmp(op, "add") == 0 || strcmp(op, "sub") == 0) {
+        fprintf(f, "    p%s%c %%xmm%d, %%xmm%d\n", op, x86_64_lane(width), src, dest);
+    } else {
+        fprintf(f, "    p%s %%xmm%d, %%xmm%d\n", op, src, dest);
     }
-    else if (strcmp(inst->opcode, "ge") == 0) {
+}
+
+// SSE2 has no pmulld: multiply the even and odd lanes with pmuludq and
+// interleave the low halves of the products.
+static void emit_x86_64_pmulld(FILE* f, int src, int dest) {
+    fprintf(f, "    movdqa %%xmm%d, %%xmm14\n", dest);
+    fprintf(f, "    pmuludq %%xmm%d, %%xmm%d\n", src, dest);
+    fprintf(f, "    psrlq $32, %%xmm14\n");
+    fprintf(f, "    movdqa %%xmm%d, %%xmm15\n", src);
+    fprintf(f, "    psrlq $32, %%xmm15\n");
+    fprintf(f, "    pmuludq %%xmm15, %%xmm14\n");
+    fprintf(f, "    pshufd $0x08, %%xmm%d, %%xmm%d\n", dest, dest);
+    fprintf(f, "    pshufd $0x08, %%xmm14, %%xmm14\n");
+    fprintf(f, "    punpckldq %%xmm14, %%xmm%d\n", dest);
+}
+
+static bool emit_x86_64_vector(FILE* f, IRInstruction* inst, int frame_size) {
+    int w = inst->width ? inst->width : 8;
+    const char* packed = w == 4 ? "ps" : "pd";
+    const char* op = inst->opcode + 1;
+    int d = inst->operands[0] && inst->operands[0][0] == 'q' ? vec_reg_index(inst->operands[0]) : 0;
+
+    if (strcmp(inst->opcode, "vload") == 0) {
         emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmpq %%rax, %%rbx\n");
-        fprintf(f, "    setge %%al\n");
-        fprintf(f, "    movzbq %%al, %%rax\n");
-        emit_x86_64_store(f, inst->operands[0], frame_size);
+        fprintf(f, "    movdqu (%%rax), %%xmm%d\n", d);
+    }
+    else if (strcmp(inst->opcode, "vstore") == 0) {
+        emit_x86_64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    movdqu %%xmm%d, (%%rax)\n", vec_reg_index(inst->operands[1]));
     }
-    else if (strcmp(inst->opcode, "eq") == 0) {
+    else if (strcmp(inst->opcode, "vsplat") == 0) {
         emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmpq %%rax, %%rbx\n");
-        fprintf(f, "    sete %%al\n");
-        fprintf(f, "    movzbq %%al, %%rax\n");
+        fprintf(f, "    movq %%rax, %%xmm%d\n", d);
+        switch (w) {
+            case 1:
+                fprintf(f, "    punpcklbw %%xmm%d, %%xmm%d\n", d, d);
+                /* fall through */
+            case 2:
+                fprintf(f, "    punpcklwd %%xmm%d, %%xmm%d\n", d, d);
+                /* fall through */
+            case 4:
+                fprintf(f, "    pshufd $0, %%xmm%d, %%xmm%d\n", d, d);
+                break;
+            default:
+                fprintf(f, "    punpcklqdq %%xmm%d, %%xmm%d\n", d, d);
+                break;
+        }
+    }
+    else if (strcmp(inst->opcode, "vzero") == 0) {
+        fprintf(f, "    pxor %%xmm%d, %%xmm%d\n", d, d);
+    }
+    else if (strcmp(inst->opcode, "vneg") == 0 || strcmp(inst->opcode, "vnot") == 0) {
+        int a = vec_reg_index(inst->operands[1]);
+        if (a != d) {
+            fprintf(f, "    movdqa %%xmm%d, %%xmm%d\n", a, d);
+        }
+        if (strcmp(inst->opcode, "vnot") == 0) {
+            fprintf(f, "    pcmpeqd %%xmm15, %%xmm15\n");
+            fprintf(f, "    pxor %%xmm15, %%xmm%d\n", d);
+        } else if (inst->is_float) {
+            fprintf(f, "    pcmpeqd %%xmm15, %%xmm15\n");
+            fprintf(f, "    %s %%xmm15\n", w == 4 ? "pslld $31," : "psllq $63,");
+            fprintf(f, "    pxor %%xmm15, %%xmm%d\n", d);
+        } else {
+            fprintf(f, "    pxor %%xmm15, %%xmm15\n");
+            fprintf(f, "    psub%c %%xmm%d, %%xmm15\n", x86_64_lane(w), d);
+            fprintf(f, "    movdqa %%xmm15, %%xmm%d\n", d);
+        }
+    }
+    else if (strcmp(inst->opcode, "vreduce") == 0) {
+        int a = vec_reg_index(inst->operands[1]);
+        fprintf(f, "    pshufd $0x4e, %%xmm%d, %%xmm15\n", a);
+        emit_x86_64_vector_int_op(f, inst->operands[2], w, 15, a);
+        if (w == 4) {
+            fprintf(f, "    pshufd $0xb1, %%xmm%d, %%xmm15\n", a);
+            emit_x86_64_vector_int_op(f, inst->operands[2], w, 15, a);
+            fprintf(f, "    movd %%xmm%d, %%eax\n", a);
+            emit_x86_64_extend(f, 4, inst->is_unsigned);
+        } else {
+            fprintf(f, "    movq %%xmm%d, %%rax\n", a);
+        }
         emit_x86_64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "ne") == 0) {
+    else if (inst->operands[2]) {
+        int a = vec_reg_index(inst->operands[1]);
+        int b = vec_reg_index(inst->operands[2]);
+        if (a != d) {
+            fprintf(f, "    movdqa %%xmm%d, %%xmm%d\n", a, d);
+        }
+        if (inst->is_float) {
+            fprintf(f, "    %s%s %%xmm%d, %%xmm%d\n", op, packed, b, d);
+        } else if (strcmp(op, "mul") == 0 && w == 4) {
+            emit_x86_64_pmulld(f, b, d);
+        } else if (strcmp(op, "mul") == 0) {
+            fprintf(f, "    pmullw %%xmm%d, %%xmm%d\n", b, d);
+        } else {
+            emit_x86_64_vector_int_op(f, op, w, b, d);
+        }
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Integer arithmetic and compares go through emit_x86_64_operands, which
+// leaves the left operand in %rbx.
+static bool x86_64_uses_rbx(IRInstruction* inst) {
+    if (is_vector_op(inst) || inst->is_float) return false;
+    return x86_64_binary_op(inst->opcode) || x86_64_compare_cc(inst->opcode) ||
+           strcmp(inst->opcode, "sub") == 0 || strcmp(inst->opcode, "div") == 0 ||
+           strcmp(inst->opcode, "mod") == 0 || strcmp(inst->opcode, "shl") == 0 ||
+           strcmp(inst->opcode, "shr") == 0;
+}
+
+static void x86_64_plan_frame(IRInstruction* func, int frame_size) {
+    x86_64_save_rbx = false;
+    for (IRInstruction* inst = func->next; inst && strcmp(inst->opcode, "func") != 0;
+         inst = inst->next) {
+        if (x86_64_uses_rbx(inst)) {
+            x86_64_save_rbx = true;
+            break;
+        }
+    }
+    x86_64_frameless = is_leaf_function(func) &&
+                       align_to(frame_size, 16) <= X86_64_RED_ZONE;
+}
+
+// Divides the dividend in %rbx by the immediate divisor of inst, leaving the
+// quotient or remainder in %rax. A 32-bit dividend is sign-extended first, as
+// idivl would see it. Clobbers %rbx, %rcx and %rdx.
+static void emit_x86_64_divide_constant(FILE* f, IRInstruction* inst, uint64_t divisor) {
+    bool mod = strcmp(inst->opcode, "mod") == 0;
+    bool negative = atoll(inst->operands[2]) < 0;
+    int k = exact_log2(divisor);
+    if (inst->width == 4) {
+        fprintf(f, "    movslq %%ebx, %%rbx\n");
+    }
+    if (k > 0) {
+        fprintf(f, "    movq %%rbx, %%rax\n");
+        fprintf(f, "    sarq $63, %%rax\n");
+        fprintf(f, "    shrq $%d, %%rax\n", 64 - k);
+        fprintf(f, "    addq %%rbx, %%rax\n");
+        fprintf(f, "    sarq $%d, %%rax\n", k);
+        if (mod) {
+            fprintf(f, "    shlq $%d, %%rax\n", k);
+            fprintf(f, "    subq %%rax, %%rbx\n");
+            fprintf(f, "    movq %%rbx, %%rax\n");
+        } else if (negative) {
+            fprintf(f, "    negq %%rax\n");
+        }
+        return;
+    }
+
+    int64_t magic;
+    int shift = division_magic(divisor, &magic);
+    fprintf(f, "    movabsq $%lld, %%rax\n", (long long)magic);
+    fprintf(f, "    imulq %%rbx\n");
+    if (magic < 0) {
+        fprintf(f, "    addq %%rbx, %%rdx\n");
+    }
+    if (shift > 0) {
+        fprintf(f, "    sarq $%d, %%rdx\n", shift);
+    }
+    fprintf(f, "    movq %%rbx, %%rax\n");
+    fprintf(f, "    shrq $63, %%rax\n");
+    fprintf(f, "    addq %%rdx, %%rax\n");
+    if (mod) {
+        fprintf(f, "    movabsq $%llu, %%rcx\n", (unsigned long long)divisor);
+        fprintf(f, "    imulq %%rcx, %%rax\n");
+        fprintf(f, "    subq %%rax, %%rbx\n");
+        fprintf(f, "    movq %%rbx, %%rax\n");
+    } else if (negative) {
+        fprintf(f, "    negq %%rax\n");
+    }
+}
+
+static void emit_x86_64_instruction(FILE* f, IRInstruction* inst, int frame_size) {
+    int w = inst->width == 4 ? 4 : 8;
+    char sfx = x86_64_suffix(w);
+    const char* op;
+    uint64_t divisor;
+
+    if (is_vector_op(inst) && emit_x86_64_vector(f, inst, frame_size)) {
+        return;
+    }
+    if (inst->is_float && emit_x86_64_float(f, inst, frame_size)) {
+        return;
+    }
+
+    if (strcmp(inst->opcode, "mov") == 0) {
+        emit_x86_64_load_sized(f, inst->operands[1], inst, frame_size);
+        emit_x86_64_store_sized(f, inst->operands[0], inst, frame_size);
+    }
+    else if ((op = x86_64_binary_op(inst->opcode)) != NULL) {
+        emit_x86_64_operands(f, inst, frame_size);
+        fprintf(f, "    %s%c %%%s, %%%s\n", op, sfx,
+                x86_64_reg(X86_RBX, w), x86_64_reg(X86_RAX, w));
+        emit_x86_64_result(f, inst, frame_size);
+    }
+    else if (strcmp(inst->opcode, "sub") == 0) {
+        emit_x86_64_operands(f, inst, frame_size);
+        fprintf(f, "    sub%c %%%s, %%%s\n", sfx,
+                x86_64_reg(X86_RAX, w), x86_64_reg(X86_RBX, w));
+        fprintf(f, "    movq %%rbx, %%rax\n");
+        emit_x86_64_result(f, inst, frame_size);
+    }
+    else if ((strcmp(inst->opcode, "div") == 0 || strcmp(inst->opcode, "mod") == 0) &&
+             constant_divisor(inst, &divisor)) {
         emit_x86_64_load(f, inst->operands[1], frame_size);
         fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmpq %%rax, %%rbx\n");
-        fprintf(f, "    setne %%al\n");
+        emit_x86_64_divide_constant(f, inst, divisor);
+        emit_x86_64_result(f, inst, frame_size);
+    }
+    else if (strcmp(inst->opcode, "div") == 0 || strcmp(inst->opcode, "mod") == 0) {
+        emit_x86_64_operands(f, inst, frame_size);
+        fprintf(f, "    movq %%rax, %%rcx\n");
+        fprintf(f, "    movq %%rbx, %%rax\n");
+        fprintf(f, "    %s\n", w == 4 ? "cltd" : "cqo");
+        fprintf(f, "    idiv%c %%%s\n", sfx, x86_64_reg(X86_RCX, w));
+        if (strcmp(inst->opcode, "mod") == 0) {
+            fprintf(f, "    movq %%rdx, %%rax\n");
+        }
+        emit_x86_64_result(f, inst, frame_size);
+    }
+    else if ((op = x86_64_compare_cc(inst->opcode)) != NULL) {
+        emit_x86_64_operands(f, inst, frame_size);
+        fprintf(f, "    cmp%c %%%s, %%%s\n", sfx,
+                x86_64_reg(X86_RAX, w), x86_64_reg(X86_RBX, w));
+        fprintf(f, "    set%s %%al\n", op);
         fprintf(f, "    movzbq %%al, %%rax\n");
         emit_x86_64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "and") == 0) {
-        emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    andq %%rbx, %%rax\n");
-        emit_x86_64_store(f, inst->operands[0], frame_size);
+    else if (strcmp(inst->opcode, "shl") == 0 || strcmp(inst->opcode, "shr") == 0) {
+        op = strcmp(inst->opcode, "shl") == 0 ? "shl" : inst->is_unsigned ? "shr" : "sar";
+        const char* count = inst->operands[2];
+        if (is_immediate(count) && atoll(count) >= 0 && atoll(count) < w * 8) {
+            emit_x86_64_load(f, inst->operands[1], frame_size);
+            fprintf(f, "    %s%c $%s, %%%s\n", op, sfx, count, x86_64_reg(X86_RAX, w));
+        } else {
+            emit_x86_64_operands(f, inst, frame_size);
+            fprintf(f, "    movq %%rax, %%rcx\n");
+            fprintf(f, "    movq %%rbx, %%rax\n");
+            fprintf(f, "    %s%c %%cl, %%%s\n", op, sfx, x86_64_reg(X86_RAX, w));
+        }
+        emit_x86_64_result(f, inst, frame_size);
     }
-    else if (strcmp(inst->opcode, "or") == 0) {
+    else if (strcmp(inst->opcode, "ext") == 0) {
         emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    orq %%rbx, %%rax\n");
+        emit_x86_64_extend(f, inst->width, inst->is_unsigned);
         emit_x86_64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "xor") == 0) {
+    else if (strcmp(inst->opcode, "neg") == 0 || strcmp(inst->opcode, "not") == 0) {
         emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    xorq %%rbx, %%rax\n");
-        emit_x86_64_store(f, inst->operands[0], frame_size);
+        fprintf(f, "    %s%c %%%s\n", inst->opcode, sfx, x86_64_reg(X86_RAX, w));
+        emit_x86_64_result(f, inst, frame_size);
     }
-    else if (strcmp(inst->opcode, "shl") == 0) {
-        emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    movq %%rax, %%rcx\n");
-        fprintf(f, "    movq %%rbx, %%rax\n");
-        fprintf(f, "    shlq %%cl, %%rax\n");
+    else if (strcmp(inst->opcode, "addr") == 0) {
+        fprintf(f, "    leaq %d(%%%s), %%rax\n", get_stack_offset(inst->operands[1], frame_size),
+                x86_64_frame_reg());
         emit_x86_64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "shr") == 0) {
+    else if (strcmp(inst->opcode, "load") == 0) {
         emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    movq %%rax, %%rbx\n");
-        emit_x86_64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    movq %%rax, %%rcx\n");
-        fprintf(f, "    movq %%rbx, %%rax\n");
-        fprintf(f, "    shrq %%cl, %%rax\n");
+        emit_x86_64_load_mem(f, "(%rax)", inst->width, inst->is_unsigned);
         emit_x86_64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "neg") == 0) {
+    else if (strcmp(inst->opcode, "store") == 0) {
+        emit_x86_64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    movq %%rax, %%rcx\n");
         emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    negq %%rax\n");
-        emit_x86_64_store(f, inst->operands[0], frame_size);
+        emit_x86_64_store_mem(f, "(%rcx)", inst->width);
     }
-    else if (strcmp(inst->opcode, "not") == 0) {
+    else if (strcmp(inst->opcode, "chkbounds") == 0) {
+        // Unsigned, so that a negative index fails as well.
+        emit_x86_64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    cmpq $%s, %%rax\n", inst->operands[1]);
+        fprintf(f, "    jae %s\n", BOUNDS_FAIL_LABEL);
+        bounds_fail_used = true;
+    }
+    else if (strcmp(inst->opcode, "chkrange") == 0) {
+        // An empty range lo >= hi accesses nothing.
+        emit_x86_64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    movq %%rax, %%rcx\n");
         emit_x86_64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    notq %%rax\n");
-        emit_x86_64_store(f, inst->operands[0], frame_size);
+        fprintf(f, "    cmpq %%rax, %%rcx\n");
+        fprintf(f, "    jge 1f\n");
+        fprintf(f, "    testq %%rcx, %%rcx\n");
+        fprintf(f, "    js %s\n", BOUNDS_FAIL_LABEL);
+        fprintf(f, "    cmpq $%s, %%rax\n", inst->operands[2]);
+        fprintf(f, "    jg %s\n", BOUNDS_FAIL_LABEL);
+        fprintf(f, "1:\n");
+        bounds_fail_used = true;
+    }
+    else if (strcmp(inst->opcode, "chknull") == 0) {
+        emit_x86_64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    testq %%rax, %%rax\n");
+        fprintf(f, "    jz %s\n", NULL_FAIL_LABEL);
+        null_fail_used = true;
+    }
+    else if (strcmp(inst->opcode, "param") == 0) {
+        int offset = get_stack_offset(inst->operands[0], frame_size);
+        if (inst->is_float && params_fp < 8) {
+            fprintf(f, "    movs%c %%xmm%d, %d(%%%s)\n", inst->width == 4 ? 's' : 'd',
+                    params_fp++, offset, x86_64_frame_reg());
+        } else if (!inst->is_float && params_gp < x86_64_num_arg_regs) {
+            fprintf(f, "    mov%c %%%s, %d(%%%s)\n", x86_64_suffix(inst->width),
+                    x86_64_arg_regs_sized[params_gp++][width_index(inst->width)], offset,
+                    x86_64_frame_reg());
+        } else {
+            // Stack arguments sit above the return address and whatever the
+            // prologue pushed.
+            fprintf(f, "    movq %d(%%%s), %%rax\n", frame_args + params_stack++ * 8,
+                    x86_64_frame_reg());
+            emit_x86_64_store_sized(f, inst->operands[0], inst, frame_size);
+        }
     }
     else if (strcmp(inst->opcode, "label") == 0) {
         fprintf(f, "%s:\n", inst->operands[0]);
@@ -353,10 +1115,48 @@ static void emit_x86_64_instruction(FILE* f, IRInstruction* inst, int frame_size
         fprintf(f, "    testq %%rax, %%rax\n");
         fprintf(f, "    jnz %s\n", inst->operands[1]);
     }
-    else if (strcmp(inst->opcode, "call") == 0) {
-        emit_x86_64_call(f, inst->operands[0], inst, frame_size);
+    else if (inst->opcode[0] == 'b' && (op = x86_64_compare_cc(inst->opcode + 1)) != NULL) {
+        // Compare-and-branch: the left operand in %rax, the right one in
+        // %rcx or as an immediate.
+        const char* right = inst->operands[1];
+        bool imm = is_immediate(right) && llabs(atoll(right)) < 0x80000000LL;
+        if (!imm) {
+            emit_x86_64_load(f, right, frame_size);
+            fprintf(f, "    movq %%rax, %%rcx\n");
+        }
+        emit_x86_64_load(f, inst->operands[0], frame_size);
+        if (imm) {
+            fprintf(f, "    cmp%c $%s, %%%s\n", sfx, right, x86_64_reg(X86_RAX, w));
+        } else {
+            fprintf(f, "    cmp%c %%%s, %%%s\n", sfx,
+                    x86_64_reg(X86_RCX, w), x86_64_reg(X86_RAX, w));
+        }
+        fprintf(f, "    j%s %s\n", op, inst->operands[2]);
+    }
+    else if (strcmp(inst->opcode, "switch") == 0) {
+        char table[32];
+        int count = emit_jump_table(f, inst, table, sizeof(table));
+        emit_x86_64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    subq $%s, %%rax\n", inst->operands[1]);
+        fprintf(f, "    cmpq $%d, %%rax\n", count);
+        fprintf(f, "    jae %s\n", inst->operands[2]);
+        fprintf(f, "    leaq %s(%%rip), %%rcx\n", table);
+        fprintf(f, "    movslq (%%rcx,%%rax,4), %%rax\n");
+        fprintf(f, "    addq %%rcx, %%rax\n");
+        fprintf(f, "    jmp *%%rax\n");
+    }
+    else if (strcmp(inst->opcode, "case") == 0) {
+        // Part of the switch's table.
+    }
+    else if (strcmp(inst->opcode, "count") == 0) {
+        fprintf(f, "    incq %s+%d(%%rip)\n", PROFILE_COUNTERS, 8 * atoi(inst->operands[0]));
+    }
+    else if (strcmp(inst->opcode, "call") == 0 || strcmp(inst->opcode, "tailcall") == 0) {
+        emit_x86_64_call(f, inst->operands[0], inst, frame_size,
+                         strcmp(inst->opcode, "tailcall") == 0);
     }
     else if (strcmp(inst->opcode, "getret") == 0) {
+        emit_x86_64_extend(f, inst->width, inst->is_unsigned);
         emit_x86_64_store(f, inst->operands[0], frame_size);
     }
     else if (strcmp(inst->opcode, "ret") == 0) {
@@ -370,10 +1170,36 @@ static void emit_x86_64_instruction(FILE* f, IRInstruction* inst, int frame_size
         emit_x86_64_epilogue(f);
     }
     else if (strcmp(inst->opcode, "func") == 0) {
+        x86_64_plan_frame(inst, frame_size);
         emit_x86_64_prologue(f, inst->operands[0], frame_size);
     }
 }
 
+static void emit_x86_64_fail_stub(FILE* f, const char* label, const char* message,
+                                  const char* handler) {
+    fprintf(f, "%s:\n", label);
+    // Leaf functions jump here without an aligned stack.
+    fprintf(f, "    andq $-16, %%rsp\n");
+    fprintf(f, "    leaq %s(%%rip), %%rdi\n", message);
+#ifdef __APPLE__
+    fprintf(f, "    call _%s\n", handler);
+#else
+    fprintf(f, "    call %s@PLT\n", handler);
+#endif
+}
+
+static void emit_x86_64_profile_init(FILE* f) {
+    fprintf(f, "%s:\n", PROFILE_INIT);
+    fprintf(f, "    leaq .Luwu_prof_path(%%rip), %%rdi\n");
+    fprintf(f, "    leaq .Luwu_prof_layout(%%rip), %%rsi\n");
+    fprintf(f, "    leaq %s(%%rip), %%rdx\n", PROFILE_COUNTERS);
+#ifdef __APPLE__
+    fprintf(f, "    jmp _uwu_profile_register\n");
+#else
+    fprintf(f, "    jmp uwu_profile_register@PLT\n");
+#endif
+}
+
 #endif
 
 #ifdef UWUCC_ARCH_ARM64
@@ -381,7 +1207,46 @@ static void emit_x86_64_instruction(FILE* f, IRInstruction* inst, int frame_size
 static const char* arm64_arg_regs[] = {"x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7"};
 static const int arm64_num_arg_regs = 8;
 
-static void emit_arm64_prologue(FILE* f, const char* func_name, int frame_size) {
+// Leaf functions do not save x29 and x30. Their slots are addressed from
+// x16, the stack pointer on entry, which nothing else in a leaf touches.
+static bool arm64_frameless = false;
+
+static const char* arm64_frame_reg(void) {
+    return arm64_frameless ? "x16" : "x29";
+}
+
+// Immediates of sub are 12 bits, optionally shifted left by 12, so the
+// whole pages and the rest of a frame are subtracted separately.
+static void emit_arm64_stack_alloc(FILE* f, int size) {
+    int pages = stack_probe_pages(size);
+    if (pages > STACK_PROBE_UNROLL) {
+        fprintf(f, "    mov x9, sp\n");
+        fprintf(f, "    mov x10, #%d\n", pages);
+        fprintf(f, "    sub x9, x9, x10, lsl #12\n");
+        fprintf(f, "1:\n");
+        fprintf(f, "    sub sp, sp, #%d\n", STACK_PAGE_SIZE);
+        fprintf(f, "    str xzr, [sp]\n");
+        fprintf(f, "    cmp sp, x9\n");
+        fprintf(f, "    b.ne 1b\n");
+    } else {
+        for (int i = 0; i < pages; i++) {
+            fprintf(f, "    sub sp, sp, #%d\n", STACK_PAGE_SIZE);
+            fprintf(f, "    str xzr, [sp]\n");
+        }
+    }
+
+    int rest = size - pages * STACK_PAGE_SIZE;
+    if (rest >= STACK_PAGE_SIZE) {
+        fprintf(f, "    sub sp, sp, #%d\n", rest & ~(STACK_PAGE_SIZE - 1));
+        rest &= STACK_PAGE_SIZE - 1;
+    }
+    if (rest > 0) {
+        fprintf(f, "    sub sp, sp, #%d\n", rest);
+    }
+}
+
+static void emit_arm64_prologue(FILE* f, IRInstruction* func, int frame_size) {
+    const char* func_name = func->operands[0];
 #ifdef __APPLE__
     fprintf(f, ".globl _%s\n", func_name);
     fprintf(f, "_%s:\n", func_name);
@@ -391,29 +1256,107 @@ static void emit_arm64_prologue(FILE* f, const char* func_name, int frame_size)
     fprintf(f, "%s:\n", func_name);
 #endif
 
-    fprintf(f, "    stp x29, x30, [sp, #-16]!\n");
-    fprintf(f, "    mov x29, sp\n");
-
+    arm64_frameless = is_leaf_function(func);
     int aligned_frame = align_to(frame_size, 16);
-    if (aligned_frame > 0) {
-        fprintf(f, "    sub sp, sp, #%d\n", aligned_frame);
+    if (arm64_frameless) {
+        frame_args = 0;
+        if (aligned_frame > 0) {
+            fprintf(f, "    mov x16, sp\n");
+        }
+    } else {
+        frame_args = 16;
+        fprintf(f, "    stp x29, x30, [sp, #-16]!\n");
+        fprintf(f, "    mov x29, sp\n");
     }
 
-    if (config.enable_stack_checks && aligned_frame > 0) {
-        fprintf(f, "    sub x9, sp, #%d\n", aligned_frame);
-        fprintf(f, "    ldr xzr, [x9]\n");
-    }
+    emit_arm64_stack_alloc(f, aligned_frame);
 }
 
-static void emit_arm64_epilogue(FILE* f, int frame_size) {
+// Pops the frame and restores x29 and the return address in x30.
+static void emit_arm64_leave(FILE* f, int frame_size) {
     int aligned_frame = align_to(frame_size, 16);
-    if (aligned_frame > 0) {
+    if (aligned_frame > 4095) {
+        fprintf(f, "    mov sp, %s\n", arm64_frame_reg());
+    } else if (aligned_frame > 0) {
         fprintf(f, "    add sp, sp, #%d\n", aligned_frame);
     }
-    fprintf(f, "    ldp x29, x30, [sp], #16\n");
+    if (!arm64_frameless) {
+        fprintf(f, "    ldp x29, x30, [sp], #16\n");
+    }
+}
+
+static void emit_arm64_epilogue(FILE* f, int frame_size) {
+    emit_arm64_leave(f, frame_size);
     fprintf(f, "    ret\n");
 }
 
+// Returns the [x29, #-off] operand for a slot (x16 in a leaf),
+// materialising the address in x9 when the offset is outside the unscaled
+// immediate range.
+static const char* arm64_slot(FILE* f, const char* name, int frame_size, char* buf, size_t size) {
+    int offset = -get_stack_offset(name, frame_size);
+    const char* base = arm64_frame_reg();
+    if (offset <= 256) {
+        snprintf(buf, size, "[%s, #-%d]", base, offset);
+    } else {
+        if (offset <= 4095) {
+            fprintf(f, "    sub x9, %s, #%d\n", base, offset);
+        } else {
+            fprintf(f, "    mov x9, #%d\n", offset);
+            fprintf(f, "    sub x9, %s, x9\n", base);
+        }
+        snprintf(buf, size, "[x9]");
+    }
+    return buf;
+}
+
+static void emit_arm64_load_mem(FILE* f, const char* mem, int width, bool is_unsigned) {
+    switch (width) {
+        case 1:
+            fprintf(f, "    %s %s, %s\n", is_unsigned ? "ldrb" : "ldrsb",
+                    is_unsigned ? "w0" : "x0", mem);
+            break;
+        case 2:
+            fprintf(f, "    %s %s, %s\n", is_unsigned ? "ldrh" : "ldrsh",
+                    is_unsigned ? "w0" : "x0", mem);
+            break;
+        case 4:
+            if (is_unsigned) {
+                fprintf(f, "    ldr w0, %s\n", mem);
+            } else {
+                fprintf(f, "    ldrsw x0, %s\n", mem);
+            }
+            break;
+        default:
+            fprintf(f, "    ldr x0, %s\n", mem);
+            break;
+    }
+}
+
+static void emit_arm64_store_mem(FILE* f, const char* mem, int width) {
+    switch (width) {
+        case 1:  fprintf(f, "    strb w0, %s\n", mem); break;
+        case 2:  fprintf(f, "    strh w0, %s\n", mem); break;
+        case 4:  fprintf(f, "    str w0, %s\n", mem); break;
+        default: fprintf(f, "    str x0, %s\n", mem); break;
+    }
+}
+
+static void emit_arm64_extend(FILE* f, int width, bool is_unsigned) {
+    switch (width) {
+        case 1:  fprintf(f, "    %s x0, w0\n", is_unsigned ? "uxtb" : "sxtb"); break;
+        case 2:  fprintf(f, "    %s x0, w0\n", is_unsigned ? "uxth" : "sxth"); break;
+        case 4:
+            if (is_unsigned) {
+                fprintf(f, "    mov w0, w0\n");
+            } else {
+                fprintf(f, "    sxtw x0, w0\n");
+            }
+            break;
+        default: break;
+    }
+}
+
 static void emit_arm64_load(FILE* f, const char* src, int frame_size) {
     if (is_immediate(src)) {
         long val = atol(src);
@@ -432,8 +1375,8 @@ static void emit_arm64_load(FILE* f, const char* src, int frame_size) {
             }
         }
     } else if (is_var(src) || is_temp(src)) {
-        int offset = get_stack_offset(src, frame_size);
-        fprintf(f, "    ldr x0, [sp, #%d]\n", -offset);
+        char mem[32];
+        fprintf(f, "    ldr x0, %s\n", arm64_slot(f, src, frame_size, mem, sizeof(mem)));
     } else if (is_string_literal(src)) {
 #ifdef __APPLE__
         fprintf(f, "    adrp x0, %s@PAGE\n", src);
@@ -455,12 +1398,37 @@ static void emit_arm64_load(FILE* f, const char* src, int frame_size) {
 
 static void emit_arm64_store(FILE* f, const char* dest, int frame_size) {
     if (is_var(dest) || is_temp(dest)) {
-        int offset = get_stack_offset(dest, frame_size);
-        fprintf(f, "    str x0, [sp, #%d]\n", -offset);
+        char mem[32];
+        fprintf(f, "    str x0, %s\n", arm64_slot(f, dest, frame_size, mem, sizeof(mem)));
+    }
+}
+
+static void emit_arm64_load_sized(FILE* f, const char* src, IRInstruction* inst, int frame_size) {
+    if (is_var(src) && inst->width && inst->width != 8) {
+        char mem[32];
+        arm64_slot(f, src, frame_size, mem, sizeof(mem));
+        emit_arm64_load_mem(f, mem, inst->width, inst->is_unsigned);
+    } else {
+        emit_arm64_load(f, src, frame_size);
+    }
+}
+
+static void emit_arm64_store_sized(FILE* f, const char* dest, IRInstruction* inst, int frame_size) {
+    if (is_var(dest) && inst->width && inst->width != 8) {
+        char mem[32];
+        arm64_slot(f, dest, frame_size, mem, sizeof(mem));
+        emit_arm64_store_mem(f, mem, inst->width);
+    } else {
+        emit_arm64_store(f, dest, frame_size);
     }
 }
 
-static void emit_arm64_call(FILE* f, const char* func, IRInstruction* inst, int frame_size) {
+// Arguments are classified like on x86-64: integers to x0-x7, floating
+// values to d0-d7 and the rest to the stack. Every load goes through x0, so
+// the integer registers are filled last, from x7 down to x0.
+// See emit_x86_64_call for tail calls.
+static void emit_arm64_call(FILE* f, const char* func, IRInstruction* inst, int frame_size,
+                            bool tail) {
     int num_args = 0;
 
     for (int i = 1; i < 16 && inst->operands[i]; i++) {
@@ -470,25 +1438,55 @@ static void emit_arm64_call(FILE* f, const char* func, IRInstruction* inst, int
     bool is_print_str = strcmp(func, "print_str") == 0;
     const char* actual_func = is_print_str ? "puts" : func;
 
-    int stack_args = num_args > 8 ? num_args - 8 : 0;
+    int reg[16];
+    int stack_slots[16];
+    int gp = 0, fp = 0, stack_args = 0;
+    for (int i = 1; i <= num_args; i++) {
+        if (is_float_arg(inst, i) && fp < 8) {
+            reg[i] = fp++;
+        } else if (!is_float_arg(inst, i) && gp < arm64_num_arg_regs) {
+            reg[i] = gp++;
+        } else {
+            reg[i] = -1;
+            stack_slots[stack_args++] = i;
+        }
+    }
+
     bool need_align = (stack_args * 8) % 16 != 0;
 
     if (need_align) {
         fprintf(f, "    sub sp, sp, #8\n");
     }
 
-    for (int i = num_args; i > 8; i--) {
-        emit_arm64_load(f, inst->operands[i], frame_size);
+    for (int s = stack_args - 1; s >= 0; s--) {
+        emit_arm64_load(f, inst->operands[stack_slots[s]], frame_size);
         fprintf(f, "    str x0, [sp, #-8]!\n");
     }
 
-    for (int i = 1; i <= num_args && i <= 8; i++) {
+    for (int i = 1; i <= num_args; i++) {
+        if (reg[i] < 0 || !is_float_arg(inst, i)) continue;
+        emit_arm64_load(f, inst->operands[i], frame_size);
+        fprintf(f, "    fmov d%d, x0\n", reg[i]);
+    }
+
+    for (int i = num_args; i >= 1; i--) {
+        if (reg[i] < 0 || is_float_arg(inst, i)) continue;
         emit_arm64_load(f, inst->operands[i], frame_size);
-        if (i < 8) {
-            fprintf(f, "    mov x%d, x0\n", i-1);
+        if (reg[i] > 0) {
+            fprintf(f, "    mov %s, x0\n", arm64_arg_regs[reg[i]]);
         }
     }
 
+    if (tail) {
+        emit_arm64_leave(f, frame_size);
+#ifdef __APPLE__
+        fprintf(f, "    b _%s\n", actual_func);
+#else
+        fprintf(f, "    b %s\n", actual_func);
+#endif
+        return;
+    }
+
 #ifdef __APPLE__
     fprintf(f, "    bl _%s\n", actual_func);
 #else
@@ -501,139 +1499,402 @@ static void emit_arm64_call(FILE* f, const char* func, IRInstruction* inst, int
     }
 }
 
-static void emit_arm64_instruction(FILE* f, IRInstruction* inst, int frame_size) {
-    if (strcmp(inst->opcode, "mov") == 0) {
-        emit_arm64_load(f, inst->operands[1], frame_size);
-        emit_arm64_store(f, inst->operands[0], frame_size);
+// Binary operations take the left operand in x1 and the right one in x0. At
+// width 4 they are done on the w registers and the result sign-extended.
+static void emit_arm64_operands(FILE* f, IRInstruction* inst, int frame_size) {
+    emit_arm64_load(f, inst->operands[1], frame_size);
+    fprintf(f, "    mov x1, x0\n");
+    emit_arm64_load(f, inst->operands[2], frame_size);
+}
+
+static void emit_arm64_result(FILE* f, IRInstruction* inst, int frame_size) {
+    if (inst->width == 4) {
+        emit_arm64_extend(f, 4, inst->is_unsigned);
     }
-    else if (strcmp(inst->opcode, "add") == 0) {
-        emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    add x0, x1, x0\n");
-        emit_arm64_store(f, inst->operands[0], frame_size);
+    emit_arm64_store(f, inst->operands[0], frame_size);
+}
+
+static const char* arm64_binary_op(const char* opcode) {
+    if (strcmp(opcode, "add") == 0) return "add";
+    if (strcmp(opcode, "sub") == 0) return "sub";
+    if (strcmp(opcode, "mul") == 0) return "mul";
+    if (strcmp(opcode, "div") == 0) return "sdiv";
+    if (strcmp(opcode, "and") == 0) return "and";
+    if (strcmp(opcode, "or") == 0) return "orr";
+    if (strcmp(opcode, "xor") == 0) return "eor";
+    if (strcmp(opcode, "shl") == 0) return "lsl";
+    return NULL;
+}
+
+static const char* arm64_compare_cc(const char* opcode) {
+    if (strcmp(opcode, "lt") == 0) return "lt";
+    if (strcmp(opcode, "le") == 0) return "le";
+    if (strcmp(opcode, "gt") == 0) return "gt";
+    if (strcmp(opcode, "ge") == 0) return "ge";
+    if (strcmp(opcode, "eq") == 0) return "eq";
+    if (strcmp(opcode, "ne") == 0) return "ne";
+    return NULL;
+}
+
+// Floating values travel through x0 as raw bits; arithmetic uses d0/d1
+// (s0/s1 for floof).
+static void emit_arm64_fload(FILE* f, const char* src, int reg, int frame_size) {
+    if (is_var(src) || is_temp(src)) {
+        char mem[32];
+        fprintf(f, "    ldr d%d, %s\n", reg, arm64_slot(f, src, frame_size, mem, sizeof(mem)));
+    } else {
+        emit_arm64_load(f, src, frame_size);
+        fprintf(f, "    fmov d%d, x0\n", reg);
     }
-    else if (strcmp(inst->opcode, "sub") == 0) {
-        emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    sub x0, x1, x0\n");
-        emit_arm64_store(f, inst->operands[0], frame_size);
+}
+
+static void emit_arm64_fstore(FILE* f, const char* dest, int width, int frame_size) {
+    if (width == 4) {
+        fprintf(f, "    fmov w0, s0\n");
+    } else {
+        fprintf(f, "    fmov x0, d0\n");
     }
-    else if (strcmp(inst->opcode, "mul") == 0) {
-        emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    mul x0, x1, x0\n");
+    emit_arm64_store(f, dest, frame_size);
+}
+
+static const char* arm64_float_op(const char* opcode) {
+    if (strcmp(opcode, "add") == 0) return "fadd";
+    if (strcmp(opcode, "sub") == 0) return "fsub";
+    if (strcmp(opcode, "mul") == 0) return "fmul";
+    if (strcmp(opcode, "div") == 0) return "fdiv";
+    return NULL;
+}
+
+// fcmp sets C and V for unordered operands; mi and ls rather than lt and
+// le keep NaN comparisons false.
+static const char* arm64_float_cc(const char* opcode) {
+    if (strcmp(opcode, "lt") == 0) return "mi";
+    if (strcmp(opcode, "le") == 0) return "ls";
+    if (strcmp(opcode, "gt") == 0) return "gt";
+    if (strcmp(opcode, "ge") == 0) return "ge";
+    if (strcmp(opcode, "eq") == 0) return "eq";
+    if (strcmp(opcode, "ne") == 0) return "ne";
+    return NULL;
+}
+
+static bool emit_arm64_float(FILE* f, IRInstruction* inst, int frame_size) {
+    char r = inst->width == 4 ? 's' : 'd';
+    const char* op;
+
+    if ((op = arm64_float_op(inst->opcode)) != NULL) {
+        emit_arm64_fload(f, inst->operands[1], 0, frame_size);
+        emit_arm64_fload(f, inst->operands[2], 1, frame_size);
+        fprintf(f, "    %s %c0, %c0, %c1\n", op, r, r, r);
+        emit_arm64_fstore(f, inst->operands[0], inst->width, frame_size);
+    }
+    else if ((op = arm64_float_cc(inst->opcode)) != NULL) {
+        emit_arm64_fload(f, inst->operands[1], 0, frame_size);
+        emit_arm64_fload(f, inst->operands[2], 1, frame_size);
+        fprintf(f, "    fcmp %c0, %c1\n", r, r);
+        fprintf(f, "    cset x0, %s\n", op);
         emit_arm64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "div") == 0) {
+    else if (strcmp(inst->opcode, "neg") == 0) {
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    sdiv x0, x1, x0\n");
+        if (inst->width == 4) {
+            fprintf(f, "    eor w0, w0, #0x80000000\n");
+        } else {
+            fprintf(f, "    eor x0, x0, #0x8000000000000000\n");
+        }
         emit_arm64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "mod") == 0) {
-        emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    sdiv x2, x1, x0\n");
-        fprintf(f, "    msub x0, x2, x0, x1\n");
+    else if (strcmp(inst->opcode, "fconst") == 0) {
+#ifdef __APPLE__
+        fprintf(f, "    adrp x9, %s@PAGE\n", inst->operands[1]);
+        fprintf(f, "    ldr x0, [x9, %s@PAGEOFF]\n", inst->operands[1]);
+#else
+        fprintf(f, "    adrp x9, %s\n", inst->operands[1]);
+        fprintf(f, "    ldr x0, [x9, :lo12:%s]\n", inst->operands[1]);
+#endif
         emit_arm64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "lt") == 0) {
+    else if (strcmp(inst->opcode, "itof") == 0) {
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmp x1, x0\n");
-        fprintf(f, "    cset x0, lt\n");
-        emit_arm64_store(f, inst->operands[0], frame_size);
+        fprintf(f, "    scvtf %c0, x0\n", r);
+        emit_arm64_fstore(f, inst->operands[0], inst->width, frame_size);
     }
-    else if (strcmp(inst->opcode, "le") == 0) {
-        emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmp x1, x0\n");
-        fprintf(f, "    cset x0, le\n");
+    else if (strcmp(inst->opcode, "ftoi") == 0) {
+        emit_arm64_fload(f, inst->operands[1], 0, frame_size);
+        fprintf(f, "    fcvtzs x0, %c0\n", r);
         emit_arm64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "gt") == 0) {
-        emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmp x1, x0\n");
-        fprintf(f, "    cset x0, gt\n");
-        emit_arm64_store(f, inst->operands[0], frame_size);
+    else if (strcmp(inst->opcode, "fext") == 0 || strcmp(inst->opcode, "ftrunc") == 0) {
+        emit_arm64_fload(f, inst->operands[1], 0, frame_size);
+        fprintf(f, "    %s\n", inst->width == 4 ? "fcvt s0, d0" : "fcvt d0, s0");
+        emit_arm64_fstore(f, inst->operands[0], inst->width, frame_size);
+    }
+    else if (strcmp(inst->opcode, "getret") == 0) {
+        emit_arm64_fstore(f, inst->operands[0], inst->width, frame_size);
     }
-    else if (strcmp(inst->opcode, "ge") == 0) {
+    else if (strcmp(inst->opcode, "ret") == 0) {
+        emit_arm64_fload(f, inst->operands[0], 0, frame_size);
+        emit_arm64_epilogue(f, frame_size);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Vector operations work on q0-q7 (v0-v7); v31 is scratch.
+static const char* arm64_arrangement(int width) {
+    switch (width) {
+        case 1:  return "16b";
+        case 2:  return "8h";
+        case 4:  return "4s";
+        default: return "2d";
+    }
+}
+
+static void emit_arm64_vector_op(FILE* f, const char* op, IRInstruction* inst,
+                                 int d, int a, int b) {
+    int w = inst->width ? inst->width : 8;
+    const char* arr = arm64_arrangement(w);
+    if (strcmp(op, "and") == 0 || strcmp(op, "or") == 0 || strcmp(op, "xor") == 0) {
+        const char* name = op[0] == 'a' ? "and" : op[0] == 'o' ? "orr" : "eor";
+        fprintf(f, "    %s v%d.16b, v%d.16b, v%d.16b\n", name, d, a, b);
+    } else {
+        fprintf(f, "    %s%s v%d.%s, v%d.%s, v%d.%s\n", inst->is_float ? "f" : "", op,
+                d, arr, a, arr, b, arr);
+    }
+}
+
+static bool emit_arm64_vector(FILE* f, IRInstruction* inst, int frame_size) {
+    int w = inst->width ? inst->width : 8;
+    const char* arr = arm64_arrangement(w);
+    int d = inst->operands[0] && inst->operands[0][0] == 'q' ? vec_reg_index(inst->operands[0]) : 0;
+
+    if (strcmp(inst->opcode, "vload") == 0) {
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmp x1, x0\n");
-        fprintf(f, "    cset x0, ge\n");
-        emit_arm64_store(f, inst->operands[0], frame_size);
+        fprintf(f, "    ldr q%d, [x0]\n", d);
+    }
+    else if (strcmp(inst->opcode, "vstore") == 0) {
+        emit_arm64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    str q%d, [x0]\n", vec_reg_index(inst->operands[1]));
     }
-    else if (strcmp(inst->opcode, "eq") == 0) {
+    else if (strcmp(inst->opcode, "vsplat") == 0) {
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmp x1, x0\n");
-        fprintf(f, "    cset x0, eq\n");
+        fprintf(f, "    dup v%d.%s, %c0\n", d, arr, w == 8 ? 'x' : 'w');
+    }
+    else if (strcmp(inst->opcode, "vzero") == 0) {
+        fprintf(f, "    movi v%d.2d, #0\n", d);
+    }
+    else if (strcmp(inst->opcode, "vneg") == 0) {
+        fprintf(f, "    %sneg v%d.%s, v%d.%s\n", inst->is_float ? "f" : "",
+                d, arr, vec_reg_index(inst->operands[1]), arr);
+    }
+    else if (strcmp(inst->opcode, "vnot") == 0) {
+        fprintf(f, "    mvn v%d.16b, v%d.16b\n", d, vec_reg_index(inst->operands[1]));
+    }
+    else if (strcmp(inst->opcode, "vreduce") == 0) {
+        int a = vec_reg_index(inst->operands[1]);
+        fprintf(f, "    ext v31.16b, v%d.16b, v%d.16b, #8\n", a, a);
+        emit_arm64_vector_op(f, inst->operands[2], inst, a, a, 31);
+        if (w == 4) {
+            fprintf(f, "    ext v31.16b, v%d.16b, v%d.16b, #4\n", a, a);
+            emit_arm64_vector_op(f, inst->operands[2], inst, a, a, 31);
+            fprintf(f, "    fmov w0, s%d\n", a);
+            emit_arm64_extend(f, 4, inst->is_unsigned);
+        } else {
+            fprintf(f, "    fmov x0, d%d\n", a);
+        }
         emit_arm64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "ne") == 0) {
+    else if (inst->operands[2]) {
+        emit_arm64_vector_op(f, inst->opcode + 1, inst, d, vec_reg_index(inst->operands[1]),
+                             vec_reg_index(inst->operands[2]));
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Divides the dividend in x1 by the immediate divisor of inst, leaving the
+// quotient or remainder in x0. A 32-bit dividend is sign-extended first, as
+// sdiv on w registers would see it. Clobbers x2.
+static void emit_arm64_divide_constant(FILE* f, IRInstruction* inst, uint64_t divisor,
+                                       int frame_size) {
+    bool mod = strcmp(inst->opcode, "mod") == 0;
+    bool negative = atoll(inst->operands[2]) < 0;
+    int k = exact_log2(divisor);
+    if (inst->width == 4) {
+        fprintf(f, "    sxtw x1, w1\n");
+    }
+    if (k > 0) {
+        fprintf(f, "    asr x0, x1, #63\n");
+        fprintf(f, "    add x0, x1, x0, lsr #%d\n", 64 - k);
+        fprintf(f, "    asr x0, x0, #%d\n", k);
+        if (mod) {
+            fprintf(f, "    sub x0, x1, x0, lsl #%d\n", k);
+        } else if (negative) {
+            fprintf(f, "    neg x0, x0\n");
+        }
+        return;
+    }
+
+    int64_t magic;
+    char value[32];
+    int shift = division_magic(divisor, &magic);
+    snprintf(value, sizeof(value), "%lld", (long long)magic);
+    emit_arm64_load(f, value, frame_size);
+    fprintf(f, "    smulh x2, x1, x0\n");
+    if (magic < 0) {
+        fprintf(f, "    add x2, x2, x1\n");
+    }
+    if (shift > 0) {
+        fprintf(f, "    asr x2, x2, #%d\n", shift);
+    }
+    fprintf(f, "    add x2, x2, x1, lsr #63\n");
+    if (mod) {
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)divisor);
+        emit_arm64_load(f, value, frame_size);
+        fprintf(f, "    msub x0, x2, x0, x1\n");
+    } else {
+        fprintf(f, "    %s x0, x2\n", negative ? "neg" : "mov");
+    }
+}
+
+static void emit_arm64_instruction(FILE* f, IRInstruction* inst, int frame_size) {
+    char r = inst->width == 4 ? 'w' : 'x';
+    const char* op;
+    uint64_t divisor;
+
+    if (is_vector_op(inst) && emit_arm64_vector(f, inst, frame_size)) {
+        return;
+    }
+    if (inst->is_float && emit_arm64_float(f, inst, frame_size)) {
+        return;
+    }
+
+    if (strcmp(inst->opcode, "mov") == 0) {
+        emit_arm64_load_sized(f, inst->operands[1], inst, frame_size);
+        emit_arm64_store_sized(f, inst->operands[0], inst, frame_size);
+    }
+    else if ((strcmp(inst->opcode, "div") == 0 || strcmp(inst->opcode, "mod") == 0) &&
+             constant_divisor(inst, &divisor)) {
         emit_arm64_load(f, inst->operands[1], frame_size);
         fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    cmp x1, x0\n");
-        fprintf(f, "    cset x0, ne\n");
+        emit_arm64_divide_constant(f, inst, divisor, frame_size);
+        emit_arm64_result(f, inst, frame_size);
+    }
+    else if ((op = arm64_binary_op(inst->opcode)) != NULL) {
+        emit_arm64_operands(f, inst, frame_size);
+        fprintf(f, "    %s %c0, %c1, %c0\n", op, r, r, r);
+        emit_arm64_result(f, inst, frame_size);
+    }
+    else if (strcmp(inst->opcode, "shr") == 0) {
+        emit_arm64_operands(f, inst, frame_size);
+        fprintf(f, "    %s %c0, %c1, %c0\n", inst->is_unsigned ? "lsr" : "asr", r, r, r);
+        emit_arm64_result(f, inst, frame_size);
+    }
+    else if (strcmp(inst->opcode, "mod") == 0) {
+        emit_arm64_operands(f, inst, frame_size);
+        fprintf(f, "    sdiv %c2, %c1, %c0\n", r, r, r);
+        fprintf(f, "    msub %c0, %c2, %c0, %c1\n", r, r, r, r);
+        emit_arm64_result(f, inst, frame_size);
+    }
+    else if ((op = arm64_compare_cc(inst->opcode)) != NULL) {
+        emit_arm64_operands(f, inst, frame_size);
+        fprintf(f, "    cmp %c1, %c0\n", r, r);
+        fprintf(f, "    cset x0, %s\n", op);
         emit_arm64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "and") == 0) {
+    else if (strcmp(inst->opcode, "neg") == 0) {
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    and x0, x1, x0\n");
-        emit_arm64_store(f, inst->operands[0], frame_size);
+        fprintf(f, "    neg %c0, %c0\n", r, r);
+        emit_arm64_result(f, inst, frame_size);
     }
-    else if (strcmp(inst->opcode, "or") == 0) {
+    else if (strcmp(inst->opcode, "ext") == 0) {
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    orr x0, x1, x0\n");
+        emit_arm64_extend(f, inst->width, inst->is_unsigned);
         emit_arm64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "xor") == 0) {
+    else if (strcmp(inst->opcode, "not") == 0) {
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    eor x0, x1, x0\n");
+        fprintf(f, "    mvn %c0, %c0\n", r, r);
+        emit_arm64_result(f, inst, frame_size);
+    }
+    else if (strcmp(inst->opcode, "addr") == 0) {
+        int offset = -get_stack_offset(inst->operands[1], frame_size);
+        if (offset <= 4095) {
+            fprintf(f, "    sub x0, %s, #%d\n", arm64_frame_reg(), offset);
+        } else {
+            fprintf(f, "    mov x0, #%d\n", offset);
+            fprintf(f, "    sub x0, %s, x0\n", arm64_frame_reg());
+        }
         emit_arm64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "shl") == 0) {
+    else if (strcmp(inst->opcode, "load") == 0) {
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    lsl x0, x1, x0\n");
+        emit_arm64_load_mem(f, "[x0]", inst->width, inst->is_unsigned);
         emit_arm64_store(f, inst->operands[0], frame_size);
     }
-    else if (strcmp(inst->opcode, "shr") == 0) {
+    else if (strcmp(inst->opcode, "store") == 0) {
+        emit_arm64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    mov x10, x0\n");
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mov x1, x0\n");
-        emit_arm64_load(f, inst->operands[2], frame_size);
-        fprintf(f, "    lsr x0, x1, x0\n");
-        emit_arm64_store(f, inst->operands[0], frame_size);
+        emit_arm64_store_mem(f, "[x10]", inst->width);
     }
-    else if (strcmp(inst->opcode, "neg") == 0) {
+    else if (strcmp(inst->opcode, "chkbounds") == 0) {
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    neg x0, x0\n");
-        emit_arm64_store(f, inst->operands[0], frame_size);
+        fprintf(f, "    mov x1, x0\n");
+        emit_arm64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    cmp x0, x1\n");
+        fprintf(f, "    b.hs %s\n", BOUNDS_FAIL_LABEL);
+        bounds_fail_used = true;
     }
-    else if (strcmp(inst->opcode, "not") == 0) {
+    else if (strcmp(inst->opcode, "chkrange") == 0) {
+        emit_arm64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    mov x2, x0\n");
+        emit_arm64_load(f, inst->operands[2], frame_size);
+        fprintf(f, "    mov x1, x0\n");
         emit_arm64_load(f, inst->operands[1], frame_size);
-        fprintf(f, "    mvn x0, x0\n");
-        emit_arm64_store(f, inst->operands[0], frame_size);
+        fprintf(f, "    cmp x2, x0\n");
+        fprintf(f, "    b.ge 1f\n");
+        fprintf(f, "    tbnz x2, #63, %s\n", BOUNDS_FAIL_LABEL);
+        fprintf(f, "    cmp x0, x1\n");
+        fprintf(f, "    b.gt %s\n", BOUNDS_FAIL_LABEL);
+        fprintf(f, "1:\n");
+        bounds_fail_used = true;
+    }
+    else if (strcmp(inst->opcode, "chknull") == 0) {
+        emit_arm64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    cbz x0, %s\n", NULL_FAIL_LABEL);
+        null_fail_used = true;
+    }
+    else if (strcmp(inst->opcode, "param") == 0) {
+        // Floating parameters are stored straight from their register so
+        // that x0 still holds the first integer parameter.
+        if (inst->is_float) {
+            char mem[32];
+            char r = inst->width == 4 ? 's' : 'd';
+            int reg = 0;
+            if (params_fp < 8) {
+                reg = params_fp++;
+            } else {
+                fprintf(f, "    ldr d0, [%s, #%d]\n", arm64_frame_reg(),
+                        frame_args + params_stack++ * 8);
+            }
+            fprintf(f, "    str %c%d, %s\n", r, reg,
+                    arm64_slot(f, inst->operands[0], frame_size, mem, sizeof(mem)));
+            return;
+        }
+        if (params_gp < arm64_num_arg_regs) {
+            if (params_gp > 0) {
+                fprintf(f, "    mov x0, %s\n", arm64_arg_regs[params_gp]);
+            }
+            params_gp++;
+        } else {
+            fprintf(f, "    ldr x0, [%s, #%d]\n", arm64_frame_reg(),
+                    frame_args + params_stack++ * 8);
+        }
+        emit_arm64_store_sized(f, inst->operands[0], inst, frame_size);
     }
     else if (strcmp(inst->opcode, "label") == 0) {
         fprintf(f, "%s:\n", inst->operands[0]);
@@ -649,10 +1910,68 @@ static void emit_arm64_instruction(FILE* f, IRInstruction* inst, int frame_size)
         emit_arm64_load(f, inst->operands[0], frame_size);
         fprintf(f, "    cbnz x0, %s\n", inst->operands[1]);
     }
-    else if (strcmp(inst->opcode, "call") == 0) {
-        emit_arm64_call(f, inst->operands[0], inst, frame_size);
+    else if (inst->opcode[0] == 'b' && (op = arm64_compare_cc(inst->opcode + 1)) != NULL) {
+        // Compare-and-branch, with the operands in x1 and x0.
+        const char* right = inst->operands[1];
+        emit_arm64_load(f, inst->operands[0], frame_size);
+        if (is_immediate(right) && atoll(right) >= 0 && atoll(right) <= 4095) {
+            fprintf(f, "    cmp %c0, #%s\n", r, right);
+        } else {
+            fprintf(f, "    mov x1, x0\n");
+            emit_arm64_load(f, right, frame_size);
+            fprintf(f, "    cmp %c1, %c0\n", r, r);
+        }
+        fprintf(f, "    b.%s %s\n", op, inst->operands[2]);
+    }
+    else if (strcmp(inst->opcode, "switch") == 0) {
+        char table[32];
+        int count = emit_jump_table(f, inst, table, sizeof(table));
+        emit_arm64_load(f, inst->operands[1], frame_size);
+        fprintf(f, "    mov x1, x0\n");
+        emit_arm64_load(f, inst->operands[0], frame_size);
+        fprintf(f, "    sub x0, x0, x1\n");
+        fprintf(f, "    cmp x0, #%d\n", count);
+        fprintf(f, "    b.hs %s\n", inst->operands[2]);
+#ifdef __APPLE__
+        fprintf(f, "    adrp x1, %s@PAGE\n", table);
+        fprintf(f, "    add x1, x1, %s@PAGEOFF\n", table);
+#else
+        fprintf(f, "    adrp x1, %s\n", table);
+        fprintf(f, "    add x1, x1, :lo12:%s\n", table);
+#endif
+        fprintf(f, "    ldrsw x0, [x1, x0, lsl #2]\n");
+        fprintf(f, "    add x0, x1, x0\n");
+        fprintf(f, "    br x0\n");
+    }
+    else if (strcmp(inst->opcode, "case") == 0) {
+        // Part of the switch's table.
+    }
+    else if (strcmp(inst->opcode, "count") == 0) {
+        // x9 and x10 hold nothing across instructions.
+#ifdef __APPLE__
+        fprintf(f, "    adrp x9, %s@PAGE\n", PROFILE_COUNTERS);
+        fprintf(f, "    add x9, x9, %s@PAGEOFF\n", PROFILE_COUNTERS);
+#else
+        fprintf(f, "    adrp x9, %s\n", PROFILE_COUNTERS);
+        fprintf(f, "    add x9, x9, :lo12:%s\n", PROFILE_COUNTERS);
+#endif
+        int offset = 8 * atoi(inst->operands[0]);
+        if (offset >= 4096) {
+            fprintf(f, "    add x9, x9, #%d, lsl #12\n", offset >> 12);
+        }
+        if (offset & 4095) {
+            fprintf(f, "    add x9, x9, #%d\n", offset & 4095);
+        }
+        fprintf(f, "    ldr x10, [x9]\n");
+        fprintf(f, "    add x10, x10, #1\n");
+        fprintf(f, "    str x10, [x9]\n");
+    }
+    else if (strcmp(inst->opcode, "call") == 0 || strcmp(inst->opcode, "tailcall") == 0) {
+        emit_arm64_call(f, inst->operands[0], inst, frame_size,
+                        strcmp(inst->opcode, "tailcall") == 0);
     }
     else if (strcmp(inst->opcode, "getret") == 0) {
+        emit_arm64_extend(f, inst->width, inst->is_unsigned);
         emit_arm64_store(f, inst->operands[0], frame_size);
     }
     else if (strcmp(inst->opcode, "ret") == 0) {
@@ -666,8 +1985,42 @@ static void emit_arm64_instruction(FILE* f, IRInstruction* inst, int frame_size)
         emit_arm64_epilogue(f, frame_size);
     }
     else if (strcmp(inst->opcode, "func") == 0) {
-        emit_arm64_prologue(f, inst->operands[0], frame_size);
+        emit_arm64_prologue(f, inst, frame_size);
+    }
+}
+
+static void emit_arm64_fail_stub(FILE* f, const char* label, const char* message,
+                                 const char* handler) {
+    fprintf(f, "%s:\n", label);
+#ifdef __APPLE__
+    fprintf(f, "    adrp x0, %s@PAGE\n", message);
+    fprintf(f, "    add x0, x0, %s@PAGEOFF\n", message);
+    fprintf(f, "    bl _%s\n", handler);
+#else
+    fprintf(f, "    adrp x0, %s\n", message);
+    fprintf(f, "    add x0, x0, :lo12:%s\n", message);
+    fprintf(f, "    bl %s\n", handler);
+#endif
+}
+
+static void emit_arm64_profile_init(FILE* f) {
+    static const char* const symbols[] = {".Luwu_prof_path", ".Luwu_prof_layout",
+                                          PROFILE_COUNTERS};
+    fprintf(f, "%s:\n", PROFILE_INIT);
+    for (int i = 0; i < 3; i++) {
+#ifdef __APPLE__
+        fprintf(f, "    adrp x%d, %s@PAGE\n", i, symbols[i]);
+        fprintf(f, "    add x%d, x%d, %s@PAGEOFF\n", i, i, symbols[i]);
+#else
+        fprintf(f, "    adrp x%d, %s\n", i, symbols[i]);
+        fprintf(f, "    add x%d, x%d, :lo12:%s\n", i, i, symbols[i]);
+#endif
     }
+#ifdef __APPLE__
+    fprintf(f, "    b _uwu_profile_register\n");
+#else
+    fprintf(f, "    b uwu_profile_register\n");
+#endif
 }
 
 #endif
@@ -685,6 +2038,22 @@ static void emit_string_table(FILE* f, IRProgram* program) {
         }
     }
 
+    // Floating-point constants, 8 bytes each; floof values sit in the low
+    // half.
+#ifdef __APPLE__
+    fprintf(f, ".section __TEXT,__literal8,8byte_literals\n");
+#endif
+    fprintf(f, "    .p2align 3\n");
+    for (IRInstruction* inst = program->head; inst; inst = inst->next) {
+        if (strcmp(inst->opcode, "float") == 0) {
+            fprintf(f, "%s:\n", inst->operands[0]);
+            fprintf(f, "    .quad %s\n", inst->operands[1]);
+        }
+    }
+#ifdef __APPLE__
+    fprintf(f, ".section __TEXT,__cstring,cstring_literals\n");
+#endif
+
     if (config.enable_bounds_checks) {
         fprintf(f, ".Lbounds_error:\n");
         fprintf(f, "    .asciz \"runtime error: array index out of bounds\\n\"\n");
@@ -693,11 +2062,7 @@ static void emit_string_table(FILE* f, IRProgram* program) {
         fprintf(f, ".Lnull_error:\n");
         fprintf(f, "    .asciz \"runtime error: null pointer dereference\\n\"\n");
     }
-#ifdef __APPLE__
-    fprintf(f, ".text\n");
-#else
-    fprintf(f, ".section .text\n");
-#endif
+    emit_text_section(f, text_section);
 }
 
 void codegen_emit_asm(IRProgram* program, const char* output_file) {
@@ -712,14 +2077,39 @@ void codegen_emit_asm(IRProgram* program, const char* output_file) {
 #else
     fprintf(f, ".section .text\n");
 #endif
+    text_section = ".text";
     emit_string_table(f, program);
+    bounds_fail_used = null_fail_used = false;
+    jump_tables = 0;
 
+    int frame_size = program->frame_size;
     for (IRInstruction* i = program->head; i; i = i->next) {
+        if (strcmp(i->opcode, "func") == 0) {
+            frame_size = begin_function(i, program->frame_size);
+            begin_function_section(f, i);
+        } else if (strcmp(i->opcode, "cold") == 0) {
+            begin_cold_section(f, i);
+        }
         if (strcmp(i->opcode, "string") != 0) {
-            emit_x86_64_instruction(f, i, program->frame_size);
+            emit_x86_64_instruction(f, i, frame_size);
         }
     }
 
+    IRInstruction* profile = find_profile(program);
+    if (bounds_fail_used || null_fail_used || profile) {
+        emit_text_section(f, ".text.unlikely");
+    }
+    if (bounds_fail_used) {
+        emit_x86_64_fail_stub(f, BOUNDS_FAIL_LABEL, ".Lbounds_error", "uwu_bounds_error");
+    }
+    if (null_fail_used) {
+        emit_x86_64_fail_stub(f, NULL_FAIL_LABEL, ".Lnull_error", "uwu_null_error");
+    }
+    if (profile) {
+        emit_x86_64_profile_init(f);
+        emit_profile_data(f, profile);
+    }
+
 #elif defined(UWUCC_ARCH_ARM64)
 #ifdef __APPLE__
     fprintf(f, ".section __TEXT,__text,regular,pure_instructions\n");
@@ -727,14 +2117,39 @@ void codegen_emit_asm(IRProgram* program, const char* output_file) {
 #else
     fprintf(f, ".section .text\n");
 #endif
+    text_section = ".text";
     emit_string_table(f, program);
+    bounds_fail_used = null_fail_used = false;
+    jump_tables = 0;
 
+    int frame_size = program->frame_size;
     for (IRInstruction* i = program->head; i; i = i->next) {
+        if (strcmp(i->opcode, "func") == 0) {
+            frame_size = begin_function(i, program->frame_size);
+            begin_function_section(f, i);
+        } else if (strcmp(i->opcode, "cold") == 0) {
+            begin_cold_section(f, i);
+        }
         if (strcmp(i->opcode, "string") != 0) {
-            emit_arm64_instruction(f, i, program->frame_size);
+            emit_arm64_instruction(f, i, frame_size);
         }
     }
 
+    IRInstruction* profile = find_profile(program);
+    if (bounds_fail_used || null_fail_used || profile) {
+        emit_text_section(f, ".text.unlikely");
+    }
+    if (bounds_fail_used) {
+        emit_arm64_fail_stub(f, BOUNDS_FAIL_LABEL, ".Lbounds_error", "uwu_bounds_error");
+    }
+    if (null_fail_used) {
+        emit_arm64_fail_stub(f, NULL_FAIL_LABEL, ".Lnull_error", "uwu_null_error");
+    }
+    if (profile) {
+        emit_arm64_profile_init(f);
+        emit_profile_data(f, profile);
+    }
+
 #else
     #error "Unsupported architecture"
 #endif
@@ -4,5 +4,6 @@
 #include "ir.h"
 
 void codegen_emit_asm(IRProgram* program, const char* output_file);
+void codegen_set_config(bool bounds_checks, bool null_checks, bool stack_checks, int opt_level);
 
 #endif // CODEGEN_H
@@ -0,0 +1,228 @@
+/**
+ * @file flat_ast.c
+ * @brief Struct-of-arrays representation of the UwU-C AST
+ * @author Bober
+ * @version 1.0.0
+ *
+ * An alternative to the pointer-based ASTNode tree for very large inputs.
+ * Every node is a row across a handful of parallel arrays and refers to
+ * its children by 32-bit index, so a whole program is a few large
+ * allocations that the semantic and IR passes can sweep through linearly.
+ *
+ * The flat tree is built from the parsed ASTNode tree; names and string
+ * literals are interned into one string pool on the way.
+ */
+
+#include "flat_ast.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FLAT_NO_STRING UINT64_MAX
+
+static void flat_ast_reserve(FlatAST* ast, uint32_t capacity) {
+    ast->capacity = capacity;
+    ast->kind = xrealloc(ast->kind, capacity * sizeof(uint8_t));
+    ast->first_child = xrealloc(ast->first_child, capacity * sizeof(uint32_t));
+    ast->next_sibling = xrealloc(ast->next_sibling, capacity * sizeof(uint32_t));
+    ast->child_count = xrealloc(ast->child_count, capacity * sizeof(uint32_t));
+    ast->loc = xrealloc(ast->loc, capacity * sizeof(uint32_t));
+    ast->payload = xrealloc(ast->payload, capacity * sizeof(uint64_t));
+    ast->type = xrealloc(ast->type, capacity * sizeof(Type*));
+    ast->stack_offset = xrealloc(ast->stack_offset, capacity * sizeof(int));
+}
+
+// Open-addressing table used while flattening so that every distinct name
+// is stored once in the string pool.
+typedef struct {
+    uint64_t* offsets;
+    size_t cap;
+    size_t used;
+} StringInterner;
+
+static uint64_t hash_string(const char* s) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t pool_append(FlatAST* ast, const char* s) {
+    size_t len = strlen(s) + 1;
+    if (ast->strings_len + len > ast->strings_cap) {
+        while (ast->strings_len + len > ast->strings_cap) {
+            ast->strings_cap = ast->strings_cap ? ast->strings_cap * 2 : 4096;
+        }
+        ast->strings = xrealloc(ast->strings, ast->strings_cap);
+    }
+    uint64_t off = ast->strings_len;
+    memcpy(ast->strings + off, s, len);
+    ast->strings_len += len;
+    return off;
+}
+
+static void interner_grow(StringInterner* in, FlatAST* ast);
+
+static uint64_t intern(StringInterner* in, FlatAST* ast, const char* s) {
+    if (!s) return FLAT_NO_STRING;
+
+    if ((in->used + 1) * 2 > in->cap) {
+        interner_grow(in, ast);
+    }
+
+    size_t mask = in->cap - 1;
+    size_t i = hash_string(s) & mask;
+    while (in->offsets[i] != FLAT_NO_STRING) {
+        if (strcmp(ast->strings + in->offsets[i], s) == 0) {
+            return in->offsets[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    in->offsets[i] = pool_append(ast, s);
+    in->used++;
+    return in->offsets[i];
+}
+
+static void interner_grow(StringInterner* in, FlatAST* ast) {
+    size_t old_cap = in->cap;
+    uint64_t* old = in->offsets;
+
+    in->cap = old_cap ? old_cap * 2 : 1024;
+    in->offsets = xmalloc(in->cap * sizeof(uint64_t));
+    for (size_t i = 0; i < in->cap; i++) {
+        in->offsets[i] = FLAT_NO_STRING;
+    }
+
+    size_t mask = in->cap - 1;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i] == FLAT_NO_STRING) continue;
+        size_t j = hash_string(ast->strings + old[i]) & mask;
+        while (in->offsets[j] != FLAT_NO_STRING) {
+            j = (j + 1) & mask;
+        }
+        in->offsets[j] = old[i];
+    }
+
+    free(old);
+}
+
+static uint64_t node_payload(ASTNode* node, StringInterner* in, FlatAST* ast) {
+    switch (node->kind) {
+        case AST_NUMBER:
+            return (uint64_t)node->data.int_value;
+        case AST_FLOAT: {
+            uint64_t bits;
+            memcpy(&bits, &node->data.float_value, sizeof(bits));
+            return bits;
+        }
+        case AST_BOOLEAN:
+            return node->data.bool_value;
+        case AST_BINARY_OP:
+        case AST_UNARY_OP:
+        case AST_ASSIGN:
+            return (uint64_t)node->data.op;
+        case AST_STRING:
+        case AST_IDENTIFIER:
+        case AST_TYPE:
+        case AST_FUNCTION:
+        case AST_VAR_DECL:
+            return intern(in, ast, node->data.name);
+        default:
+            return 0;
+    }
+}
+
+FlatAST* flat_ast_from_tree(ASTNode* root) {
+    FlatAST* ast = xcalloc(1, sizeof(FlatAST));
+    if (!root) return ast;
+
+    ASTStats st;
+    ast_stats(root, &st);
+    flat_ast_reserve(ast, st.node_count ? (uint32_t)st.node_count : 1);
+
+    StringInterner in = {0};
+
+    // Explicit DFS stack of (node, parent index). Children are pushed in
+    // reverse so they are popped, and therefore numbered, in source order.
+    typedef struct { ASTNode* node; uint32_t parent; } Pending;
+    size_t cap = 64;
+    size_t top = 0;
+    Pending* stack = xmalloc(cap * sizeof(Pending));
+    uint32_t* last_child = xmalloc(ast->capacity * sizeof(uint32_t));
+
+    stack[top++] = (Pending){ root, FLAT_NONE };
+
+    while (top > 0) {
+        Pending cur = stack[--top];
+        ASTNode* node = cur.node;
+        uint32_t i = ast->count++;
+
+        ast->kind[i] = node->kind;
+        ast->first_child[i] = FLAT_NONE;
+        ast->next_sibling[i] = FLAT_NONE;
+        ast->child_count[i] = (uint32_t)node->child_count;
+        ast->loc[i] = node->loc;
+        ast->payload[i] = node_payload(node, &in, ast);
+        ast->type[i] = NULL;
+        ast->stack_offset[i] = 0;
+        last_child[i] = FLAT_NONE;
+
+        if (cur.parent != FLAT_NONE) {
+            if (last_child[cur.parent] == FLAT_NONE) {
+                ast->first_child[cur.parent] = i;
+            } else {
+                ast->next_sibling[last_child[cur.parent]] = i;
+            }
+            last_child[cur.parent] = i;
+        }
+
+        if (top + (size_t)node->child_count > cap) {
+            while (top + (size_t)node->child_count > cap) cap *= 2;
+            stack = xrealloc(stack, cap * sizeof(Pending));
+        }
+        for (int c = node->child_count - 1; c >= 0; c--) {
+            stack[top++] = (Pending){ node->children[c], i };
+        }
+    }
+
+    free(stack);
+    free(last_child);
+    free(in.offsets);
+    return ast;
+}
+
+void flat_ast_free(FlatAST* ast) {
+    if (!ast) return;
+    free(ast->kind);
+    free(ast->first_child);
+    free(ast->next_sibling);
+    free(ast->child_count);
+    free(ast->loc);
+    free(ast->payload);
+    free(ast->type);
+    free(ast->stack_offset);
+    free(ast->strings);
+    free(ast);
+}
+
+uint32_t flat_ast_child(FlatAST* ast, uint32_t node, uint32_t index) {
+    uint32_t c = ast->first_child[node];
+    while (index-- > 0 && c != FLAT_NONE) {
+        c = ast->next_sibling[c];
+    }
+    return c;
+}
+
+const char* flat_ast_name(FlatAST* ast, uint32_t node) {
+    uint64_t off = ast->payload[node];
+    return off == FLAT_NO_STRING ? NULL : ast->strings + off;
+}
+
+size_t flat_ast_bytes(FlatAST* ast) {
+    size_t per_node = sizeof(uint8_t) + 4 * sizeof(uint32_t) +
+                      sizeof(uint64_t) + sizeof(Type*) + sizeof(int);
+    return (size_t)ast->capacity * per_node + ast->strings_cap;
+}
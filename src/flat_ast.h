@@ -0,0 +1,43 @@
+#ifndef FLAT_AST_H
+#define FLAT_AST_H
+
+#include "ast.h"
+#include <stdint.h>
+
+// Struct-of-arrays AST. Node i is described by kind[i], first_child[i],
+// next_sibling[i], payload[i] and loc[i]; links are 32-bit indices and
+// FLAT_NONE marks a missing child or sibling. Nodes are stored in pre-order,
+// so every subtree occupies the contiguous range [i, i + subtree size).
+#define FLAT_NONE UINT32_MAX
+
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+
+    uint8_t* kind;
+    uint32_t* first_child;
+    uint32_t* next_sibling;
+    uint32_t* child_count;
+    uint32_t* loc;
+
+    // Integer value, operator token, raw bits of a float, or an offset into
+    // strings[] for nodes that carry a name.
+    uint64_t* payload;
+
+    // Filled in by semantic_analyze_flat.
+    Type** type;
+    int* stack_offset;
+
+    char* strings;
+    size_t strings_len;
+    size_t strings_cap;
+} FlatAST;
+
+FlatAST* flat_ast_from_tree(ASTNode* root);
+void flat_ast_free(FlatAST* ast);
+
+uint32_t flat_ast_child(FlatAST* ast, uint32_t node, uint32_t index);
+const char* flat_ast_name(FlatAST* ast, uint32_t node);
+size_t flat_ast_bytes(FlatAST* ast);
+
+#endif
@@ -0,0 +1,931 @@
+#include "jit_engine.h"
+#include "util.h"
+#include "../stdlib/uwu_stdlib.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The execution engine's interpreter. Each function is translated once, on
+// its first run, into a compact bytecode (see Bytecode below) and executed
+// by a direct-threaded loop, or a switch where computed goto is not
+// available. It needs no executable memory, so it runs where W^X forbids
+// JIT pages. Frames are laid out as compiled code lays them out
+// (jit_frame_size), so the engine can move a running frame into compiled
+// code at a loop header, and every operation mirrors what the baseline JIT
+// emits for it.
+
+#if defined(__GNUC__) && !defined(UWUCC_INTERP_SWITCH)
+#define INTERP_THREADED 1
+#endif
+
+#define INTERP_STACK_SIZE (8 * 1024 * 1024)
+// Left free above each frame's top, for the linkage osr_enter writes there.
+#define INTERP_FRAME_LINK 32
+
+static const char bounds_message[] = "runtime error: array index out of bounds\n";
+static const char null_message[] = "runtime error: null pointer dereference\n";
+
+static InterpState *state;
+static InterpHooks hooks;
+
+static void free_bytecode(InterpState *is);
+
+InterpState *interp_create(void) {
+    InterpState *is = xcalloc(1, sizeof(InterpState));
+    is->mem_size = INTERP_STACK_SIZE;
+    is->mem = xmalloc(is->mem_size);
+    return is;
+}
+
+void interp_destroy(InterpState *is) {
+    if (!is) return;
+    if (state == is) state = NULL;
+    free_bytecode(is);
+    free(is->mem);
+    free(is);
+}
+
+// The bytecode holds the data's address, so it is translated again.
+void interp_set_hooks(InterpState *is, const InterpHooks *h) {
+    free_bytecode(is);
+    state = is;
+    hooks = *h;
+}
+// ---------------------------------------------------------------------------
+// Values
+
+static int64_t extend(int64_t v, int width, bool is_unsigned) {
+    switch (width) {
+        case 1: return is_unsigned ? (int64_t)(uint8_t)v : (int64_t)(int8_t)v;
+        case 2: return is_unsigned ? (int64_t)(uint16_t)v : (int64_t)(int16_t)v;
+        case 4: return is_unsigned ? (int64_t)(uint32_t)v : (int64_t)(int32_t)v;
+        default: return v;
+    }
+}
+
+static void store_sized(void *p, int64_t v, int width) {
+    memcpy(p, &v, width);
+}
+
+static float as_float(int64_t bits) {
+    uint32_t lo = (uint32_t)bits;
+    float f;
+    memcpy(&f, &lo, sizeof(f));
+    return f;
+}
+
+static double as_double(int64_t bits) {
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// A floof keeps its upper 32 bits clear.
+static int64_t float_bits(float f) {
+    uint32_t lo;
+    memcpy(&lo, &f, sizeof(lo));
+    return lo;
+}
+
+static int64_t double_bits(double d) {
+    int64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return bits;
+}
+
+// cvttsd2si: NaN and out of range give the "integer indefinite" value.
+static int64_t truncate_to_int(double d) {
+    if (!(d >= -9223372036854775808.0 && d < 9223372036854775808.0)) return INT64_MIN;
+    return (int64_t)d;
+}
+
+
+// ---------------------------------------------------------------------------
+// Native calls
+
+typedef NativeResult (*NativeFunc)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, ...);
+
+// Calls native code the way compiled code does. The integer arguments take
+// the six fixed parameters; in the variadic part that follows, eight
+// doubles take xmm0-xmm7 (with al set for variadic callees) and everything
+// after them goes on the stack in order, which is where the SysV convention
+// puts the arguments that did not fit in registers.
+static NativeResult call_native(void *code, const int64_t *args, int argc, uint16_t float_args) {
+    int64_t gp[6] = {0}, stack[16] = {0};
+    double fp[8] = {0};
+    int ngp = 0, nfp = 0, nstack = 0;
+    for (int n = 0; n < argc; n++) {
+        bool is_float = (float_args >> (n + 1)) & 1;
+        if (is_float && nfp < 8) {
+            fp[nfp++] = as_double(args[n]);
+        } else if (!is_float && ngp < 6) {
+            gp[ngp++] = args[n];
+        } else {
+            stack[nstack++] = args[n];
+        }
+    }
+
+#define NATIVE_ARGS gp[0], gp[1], gp[2], gp[3], gp[4], gp[5], \
+        fp[0], fp[1], fp[2], fp[3], fp[4], fp[5], fp[6], fp[7], \
+        stack[0], stack[1], stack[2], stack[3], stack[4], stack[5], stack[6], stack[7], \
+        stack[8], stack[9], stack[10], stack[11], stack[12], stack[13], stack[14], stack[15]
+    return ((NativeFunc)code)(NATIVE_ARGS);
+#undef NATIVE_ARGS
+}
+
+// ---------------------------------------------------------------------------
+// Bytecode
+//
+// Fixed-width instructions on a register file: every operand is a byte
+// offset from the frame's top. Variables and vregs sit below the top, where
+// compiled code keeps them, and a function's constants (immediates, string
+// and external addresses) are copied above it, past the link area, on
+// entry, so an instruction reads an immediate as it reads a vreg. Opcodes
+// are specialized by width and kind, and translation fuses common pairs: a
+// slot load is folded into the instruction that uses it, a result stored
+// to a slot is written there directly, and a compare feeding a branch
+// becomes a compare-and-branch.
+
+#define BC_OPS(X) \
+    X(MOV) X(LEA) \
+    X(SLD1S) X(SLD1U) X(SLD2S) X(SLD2U) X(SLD4S) X(SLD4U) \
+    X(SST1) X(SST2) X(SST4) \
+    X(LD1S) X(LD1U) X(LD2S) X(LD2U) X(LD4S) X(LD4U) X(LD8) \
+    X(ST1) X(ST2) X(ST4) X(ST8) \
+    X(ADD) X(SUB) X(MUL) X(DIV) X(MOD) X(AND) X(OR) X(XOR) X(SHL) X(SHR) \
+    X(SHRU) X(NEG) X(NOT) \
+    X(ADD32) X(SUB32) X(MUL32) X(DIV32) X(MOD32) X(AND32) X(OR32) X(XOR32) \
+    X(SHL32) X(SHR32) X(SHRU32) X(NEG32) X(NOT32) \
+    X(EXT1S) X(EXT1U) X(EXT2S) X(EXT2U) X(EXT4S) X(EXT4U) \
+    X(EQ) X(NE) X(LT) X(LE) X(GT) X(GE) \
+    X(EQ32) X(NE32) X(LT32) X(LE32) X(GT32) X(GE32) \
+    X(FADD) X(FSUB) X(FMUL) X(FDIV) X(FNEG) \
+    X(FADDS) X(FSUBS) X(FMULS) X(FDIVS) X(FNEGS) \
+    X(FEQ) X(FNE) X(FLT) X(FLE) X(FGT) X(FGE) \
+    X(FEQS) X(FNES) X(FLTS) X(FLES) X(FGTS) X(FGES) \
+    X(ITOF) X(ITOFS) X(FTOI) X(FTOIS) X(FEXT) X(FTRUNC) \
+    X(PARAM) X(CALL) X(TAILCALL) \
+    X(CHKBOUNDS) X(CHKRANGE) X(CHKNULL) \
+    X(JMP) X(BRZ) X(BRNZ) \
+    X(BEQ) X(BNE) X(BLT) X(BLE) X(BGT) X(BGE) \
+    X(BEQ32) X(BNE32) X(BLT32) X(BLE32) X(BGT32) X(BGE32) \
+    X(SWITCH) X(RET)
+
+// The groups keep the order of their Opcodes (OP_ADD..OP_SHR, OP_EQ..OP_GE).
+#define BC_ENUM(name) BC_##name,
+typedef enum { BC_OPS(BC_ENUM) BC_COUNT } BCOp;
+#undef BC_ENUM
+
+// dst is the result's operand, or the target's pc for a branch; a branch
+// back to a loop header keeps the header's block id in c, -1 otherwise.
+typedef struct {
+    union {
+        const void *label;  // threaded: the handler's address
+        uintptr_t op;
+    } h;
+    int32_t dst, a, b, c;
+} BCInst;
+
+#define BC_NONE INT32_MIN
+// A call's kind of result, in b: its width, and these.
+#define BC_RESULT_UNSIGNED 0x10
+#define BC_RESULT_FLOAT 0x20
+#define BC_MAX_ARGS 16
+
+typedef struct {
+    Function *callee;       // NULL: the address in callee_operand
+    int32_t callee_operand;
+    int argc;
+    uint16_t float_args;
+    int32_t args[BC_MAX_ARGS];
+} BCCall;
+
+typedef struct Bytecode {
+    BCInst *code;
+    int count;
+    int64_t *consts;
+    int const_count;
+    BCCall *calls;
+    // Switches, from b: the number of cases, the default block, then a
+    // block per case.
+    int32_t *tables;
+    int *block_pc;          // each block's first instruction
+    int frame_size;         // below the top
+    int size;               // the whole frame: with the link and constants
+    bool threaded;
+} Bytecode;
+
+static void free_bytecode(InterpState *is) {
+    for (int n = 0; n < is->bytecode_count; n++) {
+        Bytecode *bc = is->bytecode[n];
+        if (!bc) continue;
+        free(bc->code);
+        free(bc->consts);
+        free(bc->calls);
+        free(bc->tables);
+        free(bc->block_pc);
+        free(bc);
+    }
+    free(is->bytecode);
+    is->bytecode = NULL;
+    is->bytecode_count = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Translation
+
+typedef struct {
+    Function *f;
+    Bytecode *bc;
+    int code_cap, const_cap, call_count, call_cap, table_count, table_cap;
+    int *uses;              // reads of each vreg
+    int32_t *fold;          // the slot a vreg's load was folded into, or 0
+} Translation;
+
+static BCInst *emit(Translation *t, BCOp op, int32_t dst, int32_t a, int32_t b, int32_t c) {
+    Bytecode *bc = t->bc;
+    if (bc->count == t->code_cap) {
+        t->code_cap = t->code_cap ? t->code_cap * 2 : 64;
+        bc->code = xrealloc(bc->code, t->code_cap * sizeof(BCInst));
+    }
+    BCInst *in = &bc->code[bc->count++];
+    in->h.op = op;
+    in->dst = dst;
+    in->a = a;
+    in->b = b;
+    in->c = c;
+    return in;
+}
+
+static int32_t constant(Translation *t, int64_t v) {
+    Bytecode *bc = t->bc;
+    int k = 0;
+    while (k < bc->const_count && bc->consts[k] != v) k++;
+    if (k == bc->const_count) {
+        if (bc->const_count == t->const_cap) {
+            t->const_cap = t->const_cap ? t->const_cap * 2 : 16;
+            bc->consts = xrealloc(bc->consts, t->const_cap * sizeof(int64_t));
+        }
+        bc->consts[bc->const_count++] = v;
+    }
+    return INTERP_FRAME_LINK + 8 * k;
+}
+
+static int32_t vreg_operand(Translation *t, int n) {
+    return -jit_vreg_offset(t->f, n);
+}
+
+static int32_t slot_operand(const Value *v) {
+    return -v->as.slot;
+}
+
+static int32_t operand(Translation *t, const Value *v) {
+    void *code;
+    switch (v->kind) {
+        case VAL_VREG:
+            if (t->fold[v->as.vreg_num]) return t->fold[v->as.vreg_num];
+            return vreg_operand(t, v->as.vreg_num);
+        case VAL_IMMEDIATE:
+            return constant(t, v->as.imm);
+        case VAL_DATA:
+            return constant(t, (int64_t)(uintptr_t)(hooks.data + v->as.data));
+        case VAL_SYMBOL:
+            code = v->function->is_external ? hooks.on_entry(v->function) : NULL;
+            if (!code) {
+                error("--run: the interpreter cannot take the address of '%s'", v->as.symbol);
+            }
+            return constant(t, (int64_t)(uintptr_t)code);
+        default:
+            error("interp: operand cannot be read");
+            return 0;
+    }
+}
+
+static bool is_vreg(const Value *v, int n) {
+    return v->kind == VAL_VREG && v->as.vreg_num == n;
+}
+
+static bool reads(const Instruction *i, int n) {
+    for (int k = 0; k < i->operand_count; k++) {
+        if (is_vreg(i->operands[k], n)) return true;
+    }
+    return false;
+}
+
+// Loads and conversions by width: 1, 2 or 4, then 8 where there is one.
+static BCOp sized(BCOp base, const Instruction *i) {
+    int step = i->width == 1 ? 0 : i->width == 2 ? 2 : i->width == 4 ? 4 : 6;
+    return (BCOp)(base + step + (i->is_unsigned && i->width != 8));
+}
+
+static BCOp stored(BCOp base, int width) {
+    return (BCOp)(base + (width == 1 ? 0 : width == 2 ? 1 : width == 4 ? 2 : 3));
+}
+
+static void emit_branch(Translation *t, BCOp op, BasicBlock *target, BasicBlock *bb,
+                        int32_t a, int32_t b) {
+    emit(t, op, target->id, a, b, target->id <= bb->id ? target->id : -1);
+}
+
+static void emit_call(Translation *t, Instruction *i, int32_t dst) {
+    int argc = i->operand_count - 1;
+    if (argc > BC_MAX_ARGS) {
+        error("--run: the interpreter passes at most %d arguments", BC_MAX_ARGS);
+    }
+    if (t->call_count == t->call_cap) {
+        t->call_cap = t->call_cap ? t->call_cap * 2 : 8;
+        t->bc->calls = xrealloc(t->bc->calls, t->call_cap * sizeof(BCCall));
+    }
+    BCCall *call = &t->bc->calls[t->call_count];
+    Value *callee = i->operands[0];
+    call->callee = callee->kind == VAL_SYMBOL ? callee->function : NULL;
+    call->callee_operand = call->callee ? 0 : operand(t, callee);
+    call->argc = argc;
+    call->float_args = i->float_args;
+    for (int k = 0; k < argc; k++) {
+        call->args[k] = operand(t, i->operands[k + 1]);
+    }
+    int kind = i->width | (i->is_unsigned ? BC_RESULT_UNSIGNED : 0) | (i->is_float ? BC_RESULT_FLOAT : 0);
+    emit(t, i->op == OP_TAILCALL ? BC_TAILCALL : BC_CALL,
+         i->result ? dst : BC_NONE, t->call_count++, kind, 0);
+}
+
+static void emit_switch(Translation *t, Instruction *i, BasicBlock *bb) {
+    int count = i->operand_count - 3;
+    if (t->table_count + count + 2 > t->table_cap) {
+        t->table_cap = (t->table_count + count + 2) * 2;
+        t->bc->tables = xrealloc(t->bc->tables, t->table_cap * sizeof(int32_t));
+    }
+    int32_t *table = t->bc->tables + t->table_count;
+    table[0] = count;
+    table[1] = i->operands[2]->as.block->id;
+    for (int k = 0; k < count; k++) {
+        table[2 + k] = i->operands[3 + k]->as.block->id;
+    }
+    emit(t, BC_SWITCH, constant(t, i->operands[1]->as.imm), operand(t, i->operands[0]),
+         t->table_count, bb->id);
+    t->table_count += count + 2;
+}
+
+// i, with its result going to dst.
+static void translate(Translation *t, Instruction *i, int32_t dst, BasicBlock *bb) {
+    Value **o = i->operands;
+    bool w4 = i->width == 4;
+    BCOp op;
+    switch (i->op) {
+        case OP_MOV:
+            emit(t, BC_MOV, dst, operand(t, o[0]), 0, 0);
+            break;
+        case OP_LOAD_SLOT:
+            emit(t, i->width == 8 ? BC_MOV : sized(BC_SLD1S, i), dst, slot_operand(o[0]), 0, 0);
+            break;
+        case OP_STORE_SLOT:
+            emit(t, i->width == 8 ? BC_MOV : stored(BC_SST1, i->width),
+                 slot_operand(o[0]), operand(t, o[1]), 0, 0);
+            break;
+        case OP_ADDR:
+            emit(t, BC_LEA, dst, slot_operand(o[0]), 0, 0);
+            break;
+        case OP_LOAD:
+            emit(t, sized(BC_LD1S, i), dst, operand(t, o[0]), 0, 0);
+            break;
+        case OP_STORE:
+            emit(t, stored(BC_ST1, i->width), 0, operand(t, o[0]), operand(t, o[1]), 0);
+            break;
+
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+        case OP_SHL:
+        case OP_SHR:
+            if (i->is_float && i->op <= OP_DIV) {
+                op = (BCOp)((w4 ? BC_FADDS : BC_FADD) + (i->op - OP_ADD));
+            } else if (i->op == OP_SHR && i->is_unsigned) {
+                op = w4 ? BC_SHRU32 : BC_SHRU;
+            } else {
+                op = (BCOp)((w4 ? BC_ADD32 : BC_ADD) + (i->op - OP_ADD));
+            }
+            emit(t, op, dst, operand(t, o[0]), operand(t, o[1]), 0);
+            if (w4 && i->is_unsigned && !i->is_float) emit(t, BC_EXT4U, dst, dst, 0, 0);
+            break;
+        case OP_NEG:
+        case OP_NOT:
+            if (i->is_float) {
+                op = w4 ? BC_FNEGS : BC_FNEG;
+            } else if (i->op == OP_NEG) {
+                op = w4 ? BC_NEG32 : BC_NEG;
+            } else {
+                op = w4 ? BC_NOT32 : BC_NOT;
+            }
+            emit(t, op, dst, operand(t, o[0]), 0, 0);
+            if (w4 && i->is_unsigned && !i->is_float) emit(t, BC_EXT4U, dst, dst, 0, 0);
+            break;
+        case OP_EXT:
+            emit(t, i->width == 8 ? BC_MOV : sized(BC_EXT1S, i), dst, operand(t, o[0]), 0, 0);
+            break;
+
+        case OP_EQ:
+        case OP_NE:
+        case OP_LT:
+        case OP_LE:
+        case OP_GT:
+        case OP_GE:
+            if (i->is_float) {
+                op = (BCOp)((w4 ? BC_FEQS : BC_FEQ) + (i->op - OP_EQ));
+            } else {
+                op = (BCOp)((w4 ? BC_EQ32 : BC_EQ) + (i->op - OP_EQ));
+            }
+            emit(t, op, dst, operand(t, o[0]), operand(t, o[1]), 0);
+            break;
+
+        case OP_ITOF:
+            emit(t, w4 ? BC_ITOFS : BC_ITOF, dst, operand(t, o[0]), 0, 0);
+            break;
+        case OP_FTOI:
+            emit(t, w4 ? BC_FTOIS : BC_FTOI, dst, operand(t, o[0]), 0, 0);
+            break;
+        case OP_FEXT:
+        case OP_FTRUNC:
+            // By the result's width, as compiled code converts.
+            emit(t, w4 ? BC_FTRUNC : BC_FEXT, dst, operand(t, o[0]), 0, 0);
+            break;
+
+        case OP_PARAM:
+            emit(t, BC_PARAM, slot_operand(o[0]), (int32_t)o[1]->as.imm, i->width, 0);
+            break;
+        case OP_CALL:
+        case OP_TAILCALL:
+            emit_call(t, i, dst);
+            break;
+
+        case OP_CHKBOUNDS:
+            emit(t, BC_CHKBOUNDS, 0, operand(t, o[0]), operand(t, o[1]), 0);
+            break;
+        case OP_CHKRANGE:
+            emit(t, BC_CHKRANGE, 0, operand(t, o[0]), operand(t, o[1]), operand(t, o[2]));
+            break;
+        case OP_CHKNULL:
+            emit(t, BC_CHKNULL, 0, operand(t, o[0]), 0, 0);
+            break;
+
+        case OP_JMP:
+            emit_branch(t, BC_JMP, o[0]->as.block, bb, 0, 0);
+            break;
+        case OP_BRZ:
+        case OP_BRNZ:
+            emit_branch(t, i->op == OP_BRZ ? BC_BRZ : BC_BRNZ, o[1]->as.block, bb,
+                        operand(t, o[0]), 0);
+            break;
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BLE:
+        case OP_BGT:
+        case OP_BGE:
+            emit_branch(t, (BCOp)((w4 ? BC_BEQ32 : BC_BEQ) + (i->op - OP_BEQ)), o[2]->as.block, bb,
+                        operand(t, o[0]), operand(t, o[1]));
+            break;
+        case OP_SWITCH:
+            emit_switch(t, i, bb);
+            break;
+        case OP_RET:
+            emit(t, BC_RET, 0, i->operand_count > 0 ? operand(t, o[0]) : constant(t, 0), 0, 0);
+            break;
+    }
+}
+
+// An integer compare whose only use is the branch right after it.
+static bool feeds_branch(Translation *t, const Instruction *i, const Instruction *next) {
+    if (i->op < OP_EQ || i->op > OP_GE || i->is_float || !next) return false;
+    if (next->op != OP_BRZ && next->op != OP_BRNZ) return false;
+    int n = i->result->as.vreg_num;
+    return is_vreg(next->operands[0], n) && t->uses[n] == 1;
+}
+
+#define MAX_PENDING 8
+
+static void translate_block(Translation *t, BasicBlock *bb) {
+    // eq ne lt le gt ge, negated.
+    static const int negated[] = {1, 0, 5, 4, 3, 2};
+    // Single-use 8-byte slot loads, held back to be folded into the
+    // instruction that reads them. Only loads come between, so the slots
+    // still hold the same values there.
+    Instruction *pending[MAX_PENDING];
+    int pending_count = 0;
+
+    for (Instruction *i = bb->first_inst; i; i = i->next) {
+        if (i->op == OP_LOAD_SLOT && i->width == 8 && t->uses[i->result->as.vreg_num] == 1 &&
+            pending_count < MAX_PENDING) {
+            pending[pending_count++] = i;
+            continue;
+        }
+        for (int p = 0; p < pending_count; p++) {
+            int n = pending[p]->result->as.vreg_num;
+            int32_t slot = slot_operand(pending[p]->operands[0]);
+            if (reads(i, n)) {
+                t->fold[n] = slot;
+            } else {
+                emit(t, BC_MOV, vreg_operand(t, n), slot, 0, 0);
+            }
+        }
+
+        Instruction *next = i->next;
+        if (feeds_branch(t, i, next)) {
+            int cc = i->op - OP_EQ;
+            if (next->op == OP_BRZ) cc = negated[cc];
+            emit_branch(t, (BCOp)((i->width == 4 ? BC_BEQ32 : BC_BEQ) + cc), next->operands[1]->as.block,
+                        bb, operand(t, i->operands[0]), operand(t, i->operands[1]));
+            i = next;
+        } else if (i->result) {
+            int n = i->result->as.vreg_num;
+            int32_t dst = vreg_operand(t, n);
+            bool to_slot = next && next->op == OP_STORE_SLOT && next->width == 8 &&
+                           is_vreg(next->operands[1], n) && t->uses[n] == 1;
+            if (to_slot) dst = slot_operand(next->operands[0]);
+            translate(t, i, dst, bb);
+            if (to_slot) i = next;
+        } else {
+            translate(t, i, BC_NONE, bb);
+        }
+
+        for (int p = 0; p < pending_count; p++) {
+            t->fold[pending[p]->result->as.vreg_num] = 0;
+        }
+        pending_count = 0;
+    }
+
+    // Read in a later block.
+    for (int p = 0; p < pending_count; p++) {
+        emit(t, BC_MOV, vreg_operand(t, pending[p]->result->as.vreg_num),
+             slot_operand(pending[p]->operands[0]), 0, 0);
+    }
+}
+
+static Bytecode *translate_function(Function *f) {
+    Translation t = {0};
+    Bytecode *bc = xcalloc(1, sizeof(Bytecode));
+    t.f = f;
+    t.bc = bc;
+    t.uses = xcalloc(f->vreg_counter + 1, sizeof(int));
+    t.fold = xcalloc(f->vreg_counter + 1, sizeof(int32_t));
+    for (int b = 0; b < f->block_count; b++) {
+        for (Instruction *i = f->blocks[b]->first_inst; i; i = i->next) {
+            for (int k = 0; k < i->operand_count; k++) {
+                if (i->operands[k]->kind == VAL_VREG) t.uses[i->operands[k]->as.vreg_num]++;
+            }
+        }
+    }
+
+    bc->block_pc = xmalloc((f->block_count + 1) * sizeof(int));
+    for (int b = 0; b < f->block_count; b++) {
+        bc->block_pc[b] = bc->count;
+        translate_block(&t, f->blocks[b]);
+    }
+    // Falling off the last block.
+    emit(&t, BC_RET, 0, constant(&t, 0), 0, 0);
+
+    for (int n = 0; n < bc->count; n++) {
+        BCInst *in = &bc->code[n];
+        if (in->h.op >= BC_JMP && in->h.op <= BC_BGE32) in->dst = bc->block_pc[in->dst];
+    }
+
+    bc->frame_size = jit_frame_size(f);
+    bc->size = (bc->frame_size + INTERP_FRAME_LINK + 8 * bc->const_count + 15) & ~15;
+    free(t.uses);
+    free(t.fold);
+    return bc;
+}
+
+static Bytecode *bytecode_of(InterpState *is, Function *f) {
+    if (f->index >= is->bytecode_count) {
+        int count = f->index + 16;
+        is->bytecode = xrealloc(is->bytecode, count * sizeof(Bytecode *));
+        memset(is->bytecode + is->bytecode_count, 0, (count - is->bytecode_count) * sizeof(Bytecode *));
+        is->bytecode_count = count;
+    }
+    if (!is->bytecode[f->index]) is->bytecode[f->index] = translate_function(f);
+    return is->bytecode[f->index];
+}
+
+// ---------------------------------------------------------------------------
+// Execution
+
+static int64_t read64(const uint8_t *p) {
+    int64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void write64(uint8_t *p, int64_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static int64_t call_result(NativeResult r, int kind) {
+    int width = kind & 15;
+    if (kind & BC_RESULT_FLOAT) {
+        int64_t bits = double_bits(r.xmm0);
+        return width == 4 ? (int64_t)(uint32_t)bits : bits;
+    }
+    return extend(r.rax, width, kind & BC_RESULT_UNSIGNED);
+}
+
+NativeResult interp_exec_func(Function *f, int64_t *args, int argc) {
+    InterpState *is = state;
+    int64_t call_args[BC_MAX_ARGS], tail_args[BC_MAX_ARGS];
+    NativeResult result;
+#ifdef INTERP_THREADED
+#define BC_LABEL(name) &&L_##name,
+    static const void *const labels[] = { BC_OPS(BC_LABEL) };
+#undef BC_LABEL
+#endif
+
+enter:;
+    Bytecode *bc = bytecode_of(is, f);
+#ifdef INTERP_THREADED
+    if (!bc->threaded) {
+        for (int n = 0; n < bc->count; n++) {
+            bc->code[n].h.label = labels[bc->code[n].h.op];
+        }
+        bc->threaded = true;
+    }
+#endif
+    int frame = is->sp;
+    if ((size_t)frame + bc->size > is->mem_size) {
+        uwu_stack_overflow();
+    }
+    uint8_t *top = is->mem + frame + bc->frame_size;
+    is->sp = frame + bc->size;
+    memcpy(top + INTERP_FRAME_LINK, bc->consts, bc->const_count * sizeof(int64_t));
+    const BCInst *code = bc->code;
+    const BCInst *pc = code;
+    const BCCall *call;
+
+#ifdef INTERP_THREADED
+#define CASE(name) L_##name:
+#define DISPATCH() goto *pc->h.label
+#else
+#define CASE(name) case BC_##name:
+#define DISPATCH() continue
+#endif
+#define NEXT() { pc++; DISPATCH(); }
+#define A read64(top + pc->a)
+#define B read64(top + pc->b)
+#define C read64(top + pc->c)
+#define SET(x) write64(top + pc->dst, (x))
+#define U(x) ((uint64_t)(x))
+#define S32(x) ((int64_t)(int32_t)(uint32_t)(x))
+#define PTR(x) ((uint8_t *)(uintptr_t)(x))
+#define LOAD(T, p) { T v_; memcpy(&v_, (p), sizeof(T)); SET((int64_t)v_); }
+#define STORE(T, p, x) { T v_ = (T)(x); memcpy((p), &v_, sizeof(T)); }
+// To target's pc; back is the block id of a loop header, or -1.
+#define GO(target, back) { \
+        int back_ = (back), target_ = (target); \
+        if (back_ >= 0 && hooks.on_backedge) { \
+            void *native_ = hooks.on_backedge(f, f->blocks[back_]); \
+            if (native_) { \
+                result = hooks.osr_enter(top, native_); \
+                goto done; \
+            } \
+        } \
+        pc = code + target_; \
+        DISPATCH(); \
+    }
+
+#ifdef INTERP_THREADED
+    DISPATCH();
+#else
+    for (;;) switch ((BCOp)pc->h.op) {
+#endif
+    CASE(MOV)    SET(A); NEXT();
+    CASE(LEA)    SET((int64_t)(uintptr_t)(top + pc->a)); NEXT();
+
+    CASE(SLD1S)  LOAD(int8_t, top + pc->a); NEXT();
+    CASE(SLD1U)  LOAD(uint8_t, top + pc->a); NEXT();
+    CASE(SLD2S)  LOAD(int16_t, top + pc->a); NEXT();
+    CASE(SLD2U)  LOAD(uint16_t, top + pc->a); NEXT();
+    CASE(SLD4S)  LOAD(int32_t, top + pc->a); NEXT();
+    CASE(SLD4U)  LOAD(uint32_t, top + pc->a); NEXT();
+    CASE(SST1)   STORE(uint8_t, top + pc->dst, A); NEXT();
+    CASE(SST2)   STORE(uint16_t, top + pc->dst, A); NEXT();
+    CASE(SST4)   STORE(uint32_t, top + pc->dst, A); NEXT();
+
+    CASE(LD1S)   LOAD(int8_t, PTR(A)); NEXT();
+    CASE(LD1U)   LOAD(uint8_t, PTR(A)); NEXT();
+    CASE(LD2S)   LOAD(int16_t, PTR(A)); NEXT();
+    CASE(LD2U)   LOAD(uint16_t, PTR(A)); NEXT();
+    CASE(LD4S)   LOAD(int32_t, PTR(A)); NEXT();
+    CASE(LD4U)   LOAD(uint32_t, PTR(A)); NEXT();
+    CASE(LD8)    LOAD(int64_t, PTR(A)); NEXT();
+    CASE(ST1)    STORE(uint8_t, PTR(A), B); NEXT();
+    CASE(ST2)    STORE(uint16_t, PTR(A), B); NEXT();
+    CASE(ST4)    STORE(uint32_t, PTR(A), B); NEXT();
+    CASE(ST8)    STORE(int64_t, PTR(A), B); NEXT();
+
+    CASE(ADD)    SET((int64_t)(U(A) + U(B))); NEXT();
+    CASE(SUB)    SET((int64_t)(U(A) - U(B))); NEXT();
+    CASE(MUL)    SET((int64_t)(U(A) * U(B))); NEXT();
+    // idiv traps on a zero divisor and on the one quotient that overflows.
+    CASE(DIV) {
+        int64_t a = A, b = B;
+        if (b == 0 || (a == INT64_MIN && b == -1)) raise(SIGFPE);
+        SET(a / b);
+        NEXT();
+    }
+    CASE(MOD) {
+        int64_t a = A, b = B;
+        if (b == 0 || (a == INT64_MIN && b == -1)) raise(SIGFPE);
+        SET(a % b);
+        NEXT();
+    }
+    CASE(AND)    SET(A & B); NEXT();
+    CASE(OR)     SET(A | B); NEXT();
+    CASE(XOR)    SET(A ^ B); NEXT();
+    CASE(SHL)    SET((int64_t)(U(A) << (B & 63))); NEXT();
+    CASE(SHR)    SET(A >> (B & 63)); NEXT();
+    CASE(SHRU)   SET((int64_t)(U(A) >> (B & 63))); NEXT();
+    CASE(NEG)    SET((int64_t)(0 - U(A))); NEXT();
+    CASE(NOT)    SET(~A); NEXT();
+
+    CASE(ADD32)  SET(S32(U(A) + U(B))); NEXT();
+    CASE(SUB32)  SET(S32(U(A) - U(B))); NEXT();
+    CASE(MUL32)  SET(S32(U(A) * U(B))); NEXT();
+    CASE(DIV32) {
+        int32_t a = (int32_t)A, b = (int32_t)B;
+        if (b == 0 || (a == INT32_MIN && b == -1)) raise(SIGFPE);
+        SET(a / b);
+        NEXT();
+    }
+    CASE(MOD32) {
+        int32_t a = (int32_t)A, b = (int32_t)B;
+        if (b == 0 || (a == INT32_MIN && b == -1)) raise(SIGFPE);
+        SET(a % b);
+        NEXT();
+    }
+    CASE(AND32)  SET(S32(A & B)); NEXT();
+    CASE(OR32)   SET(S32(A | B)); NEXT();
+    CASE(XOR32)  SET(S32(A ^ B)); NEXT();
+    CASE(SHL32)  SET(S32(U(A) << (B & 31))); NEXT();
+    CASE(SHR32)  SET((int32_t)A >> (B & 31)); NEXT();
+    CASE(SHRU32) SET(S32((uint32_t)A >> (B & 31))); NEXT();
+    CASE(NEG32)  SET(S32(0 - U(A))); NEXT();
+    CASE(NOT32)  SET(S32(~A)); NEXT();
+
+    CASE(EXT1S)  SET((int8_t)A); NEXT();
+    CASE(EXT1U)  SET((uint8_t)A); NEXT();
+    CASE(EXT2S)  SET((int16_t)A); NEXT();
+    CASE(EXT2U)  SET((uint16_t)A); NEXT();
+    CASE(EXT4S)  SET((int32_t)A); NEXT();
+    CASE(EXT4U)  SET((uint32_t)A); NEXT();
+
+    CASE(EQ)     SET(A == B); NEXT();
+    CASE(NE)     SET(A != B); NEXT();
+    CASE(LT)     SET(A < B); NEXT();
+    CASE(LE)     SET(A <= B); NEXT();
+    CASE(GT)     SET(A > B); NEXT();
+    CASE(GE)     SET(A >= B); NEXT();
+    CASE(EQ32)   SET((int32_t)A == (int32_t)B); NEXT();
+    CASE(NE32)   SET((int32_t)A != (int32_t)B); NEXT();
+    CASE(LT32)   SET((int32_t)A < (int32_t)B); NEXT();
+    CASE(LE32)   SET((int32_t)A <= (int32_t)B); NEXT();
+    CASE(GT32)   SET((int32_t)A > (int32_t)B); NEXT();
+    CASE(GE32)   SET((int32_t)A >= (int32_t)B); NEXT();
+
+    CASE(FADD)   SET(double_bits(as_double(A) + as_double(B))); NEXT();
+    CASE(FSUB)   SET(double_bits(as_double(A) - as_double(B))); NEXT();
+    CASE(FMUL)   SET(double_bits(as_double(A) * as_double(B))); NEXT();
+    CASE(FDIV)   SET(double_bits(as_double(A) / as_double(B))); NEXT();
+    // Flip the sign bit.
+    CASE(FNEG)   SET((int64_t)(U(A) ^ (1ull << 63))); NEXT();
+    CASE(FADDS)  SET(float_bits(as_float(A) + as_float(B))); NEXT();
+    CASE(FSUBS)  SET(float_bits(as_float(A) - as_float(B))); NEXT();
+    CASE(FMULS)  SET(float_bits(as_float(A) * as_float(B))); NEXT();
+    CASE(FDIVS)  SET(float_bits(as_float(A) / as_float(B))); NEXT();
+    CASE(FNEGS)  SET((int64_t)((uint32_t)A ^ 0x80000000u)); NEXT();
+
+    // Comparisons with NaN are false, except ne, as ucomis has them.
+    CASE(FEQ)    SET(as_double(A) == as_double(B)); NEXT();
+    CASE(FNE)    SET(as_double(A) != as_double(B)); NEXT();
+    CASE(FLT)    SET(as_double(A) < as_double(B)); NEXT();
+    CASE(FLE)    SET(as_double(A) <= as_double(B)); NEXT();
+    CASE(FGT)    SET(as_double(A) > as_double(B)); NEXT();
+    CASE(FGE)    SET(as_double(A) >= as_double(B)); NEXT();
+    CASE(FEQS)   SET(as_float(A) == as_float(B)); NEXT();
+    CASE(FNES)   SET(as_float(A) != as_float(B)); NEXT();
+    CASE(FLTS)   SET(as_float(A) < as_float(B)); NEXT();
+    CASE(FLES)   SET(as_float(A) <= as_float(B)); NEXT();
+    CASE(FGTS)   SET(as_float(A) > as_float(B)); NEXT();
+    CASE(FGES)   SET(as_float(A) >= as_float(B)); NEXT();
+
+    CASE(ITOF)   SET(double_bits((double)A)); NEXT();
+    CASE(ITOFS)  SET(float_bits((float)A)); NEXT();
+    CASE(FTOI)   SET(truncate_to_int(as_double(A))); NEXT();
+    CASE(FTOIS)  SET(truncate_to_int(as_float(A))); NEXT();
+    CASE(FEXT)   SET(double_bits(as_float(A))); NEXT();
+    CASE(FTRUNC) SET(float_bits((float)as_double(A))); NEXT();
+
+    CASE(PARAM)
+        store_sized(top + pc->dst, pc->a < argc ? args[pc->a] : 0, pc->b);
+        NEXT();
+    CASE(CALL) {
+        call = &bc->calls[pc->a];
+        for (int k = 0; k < call->argc; k++) {
+            call_args[k] = read64(top + call->args[k]);
+        }
+        Function *g = call->callee;
+        void *native = g ? hooks.on_entry(g) : (void *)PTR(read64(top + call->callee_operand));
+        NativeResult r = native ? call_native(native, call_args, call->argc, call->float_args)
+                                : interp_exec_func(g, call_args, call->argc);
+        if (pc->dst != BC_NONE) SET(call_result(r, pc->b));
+        NEXT();
+    }
+    CASE(TAILCALL) {
+        call = &bc->calls[pc->a];
+        for (int k = 0; k < call->argc; k++) {
+            call_args[k] = read64(top + call->args[k]);
+        }
+        Function *g = call->callee;
+        void *native = g ? hooks.on_entry(g) : (void *)PTR(read64(top + call->callee_operand));
+        if (native) {
+            result = call_native(native, call_args, call->argc, call->float_args);
+            goto done;
+        }
+        // Reuses the frame, as a compiled tail call does.
+        memcpy(tail_args, call_args, call->argc * sizeof(int64_t));
+        is->sp = frame;
+        f = g;
+        args = tail_args;
+        argc = call->argc;
+        goto enter;
+    }
+
+    // Unsigned, so that a negative index fails as well.
+    CASE(CHKBOUNDS)
+        if (U(A) >= U(B)) uwu_bounds_error(bounds_message);
+        NEXT();
+    CASE(CHKRANGE) {
+        int64_t a = A, b = B;
+        if (a < b && (a < 0 || b > C)) uwu_bounds_error(bounds_message);
+        NEXT();
+    }
+    CASE(CHKNULL)
+        if (A == 0) uwu_null_error(null_message);
+        NEXT();
+
+    CASE(JMP)    GO(pc->dst, pc->c);
+    CASE(BRZ)    if (A == 0) GO(pc->dst, pc->c); NEXT();
+    CASE(BRNZ)   if (A != 0) GO(pc->dst, pc->c); NEXT();
+    CASE(BEQ)    if (A == B) GO(pc->dst, pc->c); NEXT();
+    CASE(BNE)    if (A != B) GO(pc->dst, pc->c); NEXT();
+    CASE(BLT)    if (A < B) GO(pc->dst, pc->c); NEXT();
+    CASE(BLE)    if (A <= B) GO(pc->dst, pc->c); NEXT();
+    CASE(BGT)    if (A > B) GO(pc->dst, pc->c); NEXT();
+    CASE(BGE)    if (A >= B) GO(pc->dst, pc->c); NEXT();
+    CASE(BEQ32)  if ((int32_t)A == (int32_t)B) GO(pc->dst, pc->c); NEXT();
+    CASE(BNE32)  if ((int32_t)A != (int32_t)B) GO(pc->dst, pc->c); NEXT();
+    CASE(BLT32)  if ((int32_t)A < (int32_t)B) GO(pc->dst, pc->c); NEXT();
+    CASE(BLE32)  if ((int32_t)A <= (int32_t)B) GO(pc->dst, pc->c); NEXT();
+    CASE(BGT32)  if ((int32_t)A > (int32_t)B) GO(pc->dst, pc->c); NEXT();
+    CASE(BGE32)  if ((int32_t)A >= (int32_t)B) GO(pc->dst, pc->c); NEXT();
+    CASE(SWITCH) {
+        const int32_t *table = bc->tables + pc->b;
+        uint64_t index = U(A) - U(read64(top + pc->dst));
+        int target = index < (uint64_t)table[0] ? table[2 + index] : table[1];
+        GO(bc->block_pc[target], target <= pc->c ? target : -1);
+    }
+    // Both registers, as the callee's kind of result is not known to every
+    // caller.
+    CASE(RET) {
+        int64_t a = A;
+        result.rax = a;
+        result.xmm0 = as_double(a);
+        goto done;
+    }
+#ifndef INTERP_THREADED
+    default:
+        error("interp: bad opcode %d", (int)pc->h.op);
+    }
+#endif
+
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef A
+#undef B
+#undef C
+#undef SET
+#undef U
+#undef S32
+#undef PTR
+#undef LOAD
+#undef STORE
+#undef GO
+
+done:
+    is->sp = frame;
+    return result;
+}
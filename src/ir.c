@@ -8,6 +8,8 @@
 #include "ir.h"
 #include "util.h"
 #include "lexer.h"
+#include "semantic.h"
+#include "vectorize.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -15,6 +17,7 @@
 static IRInstruction* ir_inst_new(const char* opcode) {
     IRInstruction* inst = xcalloc(1, sizeof(IRInstruction));
     inst->opcode = xstrdup(opcode);
+    inst->count = -1;
     inst->next = NULL;
     for (int i = 0; i < 16; i++) {
         inst->operands[i] = NULL;
@@ -41,6 +44,24 @@ static int temp_counter = 0;
 static int label_counter = 0;
 static int string_counter = 0;
 static IRProgram* current_prog = NULL;
+static IRInstruction* current_func = NULL;
+static Type* current_ret_type = NULL;
+
+static int opt_level = 0;
+static bool vec_report_enabled = false;
+static bool vectorize_enabled = true;
+static bool bounds_checks_enabled = true;
+static bool null_checks_enabled = true;
+
+// Floating-point literals are pooled per program: each distinct bit
+// pattern gets one .LfpN constant in .rodata.
+static uint64_t* float_pool = NULL;
+static int float_pool_count = 0;
+static int float_pool_cap = 0;
+
+// C's default argument promotion for floof values passed without a
+// prototype (uwu_printf and other runtime functions).
+static Type promoted_float_type = {.kind = TYPE_BIGFLOOF, .size = 8, .align = 8};
 
 static char* new_temp(void) {
     char* temp = xmalloc(16);
@@ -57,6 +78,12 @@ static char* new_label(void) {
     return label;
 }
 
+static void ir_reset(void) {
+    label_counter = 0;
+    string_counter = 0;
+    float_pool_count = 0;
+}
+
 static void ir_emit_string(IRProgram* prog, const char* label, const char* value) {
     IRInstruction* inst = ir_inst_new("string");
     ir_inst_add_operand(inst, 0, label);
@@ -64,145 +91,697 @@ static void ir_emit_string(IRProgram* prog, const char* label, const char* value
     ir_program_append(prog, inst);
 }
 
-static char* gen_expr_ir(IRProgram* prog, ASTNode* node);
+// Emission helpers shared by the ASTNode and FlatAST walkers. Each takes
+// ownership of the operand strings it is handed and returns a fresh temp.
 
-static char* gen_expr_ir(IRProgram* prog, ASTNode* node) {
-    if (!node) return NULL;
+static IRInstruction* emit_inst(IRProgram* prog, const char* opcode,
+                                const char* a, const char* b, const char* c) {
+    IRInstruction* inst = ir_inst_new(opcode);
+    ir_inst_add_operand(inst, 0, a);
+    ir_inst_add_operand(inst, 1, b);
+    ir_inst_add_operand(inst, 2, c);
+    ir_program_append(prog, inst);
+    return inst;
+}
 
-    char* result = NULL;
+// Memory width and signedness of a value of type t. 8-byte values keep the
+// default width.
+static void set_width(IRInstruction* inst, Type* t) {
+    if (!t) return;
+    if (t->size == 1 || t->size == 2 || t->size == 4) {
+        inst->width = t->size;
+    }
+    inst->is_unsigned = t->kind == TYPE_BYTE || t->kind == TYPE_BOOP ||
+                        t->kind == TYPE_POINTER || t->kind == TYPE_FLOOF;
+    inst->is_float = type_is_float(t);
+}
 
-    switch (node->kind) {
-        case AST_NUMBER: {
-            result = new_temp();
-            IRInstruction* inst = ir_inst_new("mov");
-            ir_inst_add_operand(inst, 0, result);
-            char val[32];
-            snprintf(val, sizeof(val), "%lld", node->data.int_value);
-            ir_inst_add_operand(inst, 1, val);
-            ir_program_append(prog, inst);
-            break;
+static void set_float_width(IRInstruction* inst, Type* t) {
+    inst->is_float = true;
+    inst->width = t->size;
+}
+
+// Arithmetic on anything narrower than 8 bytes is done in 32 bits, as the
+// operands would be promoted to chonk.
+static void set_op_width(IRInstruction* inst, Type* t) {
+    if (t && t->size > 0 && t->size < 8) {
+        inst->width = 4;
+    }
+}
+
+static int element_size(Type* t) {
+    return t && t->size > 0 ? t->size : 8;
+}
+
+static void emit_label(IRProgram* prog, const char* label) {
+    emit_inst(prog, "label", label, NULL, NULL);
+}
+
+static void emit_jmp(IRProgram* prog, const char* label) {
+    emit_inst(prog, "jmp", label, NULL, NULL);
+}
+
+static void emit_brz(IRProgram* prog, const char* cond, const char* label) {
+    emit_inst(prog, "brz", cond, label, NULL);
+}
+
+static void var_slot(char* buf, size_t size, int stack_offset) {
+    snprintf(buf, size, "v%d", stack_offset);
+}
+
+static char* lower_number(IRProgram* prog, long long value) {
+    char* result = new_temp();
+    char val[32];
+    snprintf(val, sizeof(val), "%lld", value);
+    emit_inst(prog, "mov", result, val, NULL);
+    return result;
+}
+
+static char* lower_float(IRProgram* prog, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    int index = 0;
+    while (index < float_pool_count && float_pool[index] != bits) {
+        index++;
+    }
+
+    char label[32];
+    snprintf(label, sizeof(label), ".Lfp%d", index);
+
+    if (index == float_pool_count) {
+        if (float_pool_count == float_pool_cap) {
+            float_pool_cap = float_pool_cap ? float_pool_cap * 2 : 16;
+            float_pool = xrealloc(float_pool, float_pool_cap * sizeof(uint64_t));
         }
+        float_pool[float_pool_count++] = bits;
 
-        case AST_STRING: {
-            result = new_temp();
-            char label[32];
-            snprintf(label, sizeof(label), ".Lstr%d", string_counter++);
-            ir_emit_string(prog, label, node->data.string_value);
+        char hex[32];
+        snprintf(hex, sizeof(hex), "0x%016llx", (unsigned long long)bits);
+        emit_inst(prog, "float", label, hex, NULL);
+    }
 
-            IRInstruction* inst = ir_inst_new("mov");
-            ir_inst_add_operand(inst, 0, result);
-            ir_inst_add_operand(inst, 1, label);
-            ir_program_append(prog, inst);
-            break;
+    char* result = new_temp();
+    emit_inst(prog, "fconst", result, label, NULL)->is_float = true;
+    return result;
+}
+
+// Converts val from one type to another where the representation differs:
+// itof/ftoi between integers and floats, fext/ftrunc between floof and
+// bigfloof. The width is that of the floating side (the result for fext
+// and ftrunc). Takes ownership of val.
+static char* lower_convert(IRProgram* prog, char* val, Type* from, Type* to) {
+    bool from_float = type_is_float(from);
+    bool to_float = type_is_float(to);
+    if (!val || (!from_float && !to_float)) return val;
+    if (from_float && to_float && from->size == to->size) return val;
+
+    const char* opcode;
+    if (from_float && to_float) {
+        opcode = to->size > from->size ? "fext" : "ftrunc";
+    } else {
+        opcode = to_float ? "itof" : "ftoi";
+    }
+
+    char* result = new_temp();
+    set_float_width(emit_inst(prog, opcode, result, val, NULL), to_float ? to : from);
+    free(val);
+    return result;
+}
+
+static char* lower_string(IRProgram* prog, const char* value) {
+    char* result = new_temp();
+    char label[32];
+    snprintf(label, sizeof(label), ".Lstr%d", string_counter++);
+    ir_emit_string(prog, label, value);
+    emit_inst(prog, "mov", result, label, NULL);
+    return result;
+}
+
+static char* lower_var_addr(IRProgram* prog, int stack_offset) {
+    char* result = new_temp();
+    char var_name[64];
+    var_slot(var_name, sizeof(var_name), stack_offset);
+    emit_inst(prog, "addr", result, var_name, NULL);
+    return result;
+}
+
+// An array variable evaluates to its address rather than its contents.
+static char* lower_load_var(IRProgram* prog, int stack_offset, Type* type) {
+    char* result = new_temp();
+    char var_name[64];
+    var_slot(var_name, sizeof(var_name), stack_offset);
+    if (type && type->kind == TYPE_ARRAY) {
+        emit_inst(prog, "addr", result, var_name, NULL);
+    } else {
+        set_width(emit_inst(prog, "mov", result, var_name, NULL), type);
+    }
+    return result;
+}
+
+// Returns val so that an assignment can be used as an expression.
+static char* lower_store_var(IRProgram* prog, int stack_offset, Type* type, char* val) {
+    char var_name[64];
+    var_slot(var_name, sizeof(var_name), stack_offset);
+    set_width(emit_inst(prog, "mov", var_name, val, NULL), type);
+    return val;
+}
+
+static void lower_param(IRProgram* prog, int stack_offset, int index, Type* type) {
+    char var_name[64];
+    char arg[16];
+    var_slot(var_name, sizeof(var_name), stack_offset);
+    snprintf(arg, sizeof(arg), "%d", index);
+    set_width(emit_inst(prog, "param", var_name, arg, NULL), type);
+}
+
+// val * size or val / size, in 64 bits. Takes ownership of val.
+static char* lower_scale(IRProgram* prog, const char* opcode, char* val, int size) {
+    if (size == 1) return val;
+    char* result = new_temp();
+    char imm[16];
+    snprintf(imm, sizeof(imm), "%d", size);
+    emit_inst(prog, opcode, result, val, imm);
+    free(val);
+    return result;
+}
+
+// base + index * sizeof(element). Takes ownership of base and index.
+static char* lower_index_addr(IRProgram* prog, char* base, char* index, Type* elem) {
+    index = lower_scale(prog, "mul", index, element_size(elem));
+
+    char* addr = new_temp();
+    emit_inst(prog, "add", addr, base, index);
+    free(base);
+    free(index);
+    return addr;
+}
+
+// Safe-mode checks on an element access. Indexing a fixed-size array emits
+// "chkbounds index length", which fails unless 0 <= index < length;
+// indexing or dereferencing a pointer emits "chknull pointer". Both are
+// ordinary instructions so that ir_optimize can drop or hoist them.
+static void lower_index_check(IRProgram* prog, Type* base_type, const char* base,
+                              const char* index) {
+    if (!base_type) return;
+    if (base_type->kind == TYPE_ARRAY && base_type->array_size > 0) {
+        if (bounds_checks_enabled) {
+            char len[16];
+            snprintf(len, sizeof(len), "%d", base_type->array_size);
+            emit_inst(prog, "chkbounds", index, len, NULL);
+        }
+    } else if (base_type->kind == TYPE_POINTER) {
+        if (null_checks_enabled) {
+            emit_inst(prog, "chknull", base, NULL, NULL);
         }
+    }
+}
 
-        case AST_IDENTIFIER: {
-            result = new_temp();
-            char var_name[64];
-            snprintf(var_name, sizeof(var_name), "v%d", node->stack_offset);
+static char* lower_deref_addr(IRProgram* prog, char* ptr, Type* ptr_type) {
+    lower_index_check(prog, ptr_type, ptr, NULL);
+    return ptr;
+}
 
-            IRInstruction* inst = ir_inst_new("mov");
-            ir_inst_add_operand(inst, 0, result);
-            ir_inst_add_operand(inst, 1, var_name);
-            ir_program_append(prog, inst);
-            break;
+static char* lower_load(IRProgram* prog, char* addr, Type* type) {
+    char* result = new_temp();
+    set_width(emit_inst(prog, "load", result, addr, NULL), type);
+    free(addr);
+    return result;
+}
+
+static char* lower_store(IRProgram* prog, char* addr, Type* type, char* val) {
+    set_width(emit_inst(prog, "store", addr, val, NULL), type);
+    free(addr);
+    return val;
+}
+
+static int compound_op(int op) {
+    switch (op) {
+        case TOKEN_PLUS_EQ:  return TOKEN_PLUS;
+        case TOKEN_MINUS_EQ: return TOKEN_MINUS;
+        case TOKEN_STAR_EQ:  return TOKEN_STAR;
+        case TOKEN_SLASH_EQ: return TOKEN_SLASH;
+        default:             return 0;
+    }
+}
+
+static const char* binary_opcode(int op) {
+    switch (op) {
+        case TOKEN_PLUS:    return "add";
+        case TOKEN_MINUS:   return "sub";
+        case TOKEN_STAR:    return "mul";
+        case TOKEN_SLASH:   return "div";
+        case TOKEN_PERCENT: return "mod";
+        case TOKEN_EQ:      return "eq";
+        case TOKEN_NE:      return "ne";
+        case TOKEN_LT:      return "lt";
+        case TOKEN_GT:      return "gt";
+        case TOKEN_LE:      return "le";
+        case TOKEN_GE:      return "ge";
+        case TOKEN_AND:     return "and";
+        case TOKEN_OR:      return "or";
+        case TOKEN_AMP:     return "and";
+        case TOKEN_PIPE:    return "or";
+        case TOKEN_CARET:   return "xor";
+        case TOKEN_LSHIFT:  return "shl";
+        case TOKEN_RSHIFT:  return "shr";
+        default:            return "add";
+    }
+}
+
+static const char* unary_opcode(int op) {
+    switch (op) {
+        case TOKEN_MINUS: return "neg";
+        case TOKEN_NOT:   return "not";
+        case TOKEN_TILDE: return "not";
+        default:          return "mov";
+    }
+}
+
+static bool is_pointer_type(Type* t) {
+    return t && (t->kind == TYPE_POINTER || t->kind == TYPE_ARRAY);
+}
+
+// With a floating operand both sides are converted to the common floating
+// type first; type is the result type (chonk for comparisons). Pointer
+// arithmetic counts in elements: an integer added to or subtracted from a
+// pointer is scaled by the element size, and the difference of two pointers
+// is divided by it.
+static char* lower_binary(IRProgram* prog, int op, Type* type,
+                          Type* left_type, char* left, Type* right_type, char* right) {
+    Type* float_type = type_float_common(left_type, right_type);
+    if (float_type) {
+        left = lower_convert(prog, left, left_type, float_type);
+        right = lower_convert(prog, right, right_type, float_type);
+    }
+
+    bool left_pointer = is_pointer_type(left_type);
+    bool right_pointer = is_pointer_type(right_type);
+    if ((op == TOKEN_PLUS || op == TOKEN_MINUS) && left_pointer != right_pointer) {
+        if (left_pointer) {
+            right = lower_scale(prog, "mul", right, element_size(left_type->base));
+        } else {
+            left = lower_scale(prog, "mul", left, element_size(right_type->base));
+        }
+    }
+
+    // A comparison yields a chonk but is done as wide as its operands.
+    if (op == TOKEN_EQ || op == TOKEN_NE || op == TOKEN_LT ||
+        op == TOKEN_GT || op == TOKEN_LE || op == TOKEN_GE) {
+        type = type_int_common(left_type, right_type);
+    }
+
+    char* result = new_temp();
+    IRInstruction* inst = emit_inst(prog, binary_opcode(op), result, left, right);
+    if (float_type) {
+        set_float_width(inst, float_type);
+    } else {
+        set_op_width(inst, type);
+    }
+    free(left);
+    free(right);
+
+    if (op == TOKEN_MINUS && left_pointer && right_pointer) {
+        result = lower_scale(prog, "div", result, element_size(left_type->base));
+    }
+    return result;
+}
+
+static char* lower_unary(IRProgram* prog, int op, Type* type, char* operand) {
+    char* result = new_temp();
+    IRInstruction* inst = emit_inst(prog, unary_opcode(op), result, operand, NULL);
+    if (type_is_float(type)) {
+        set_float_width(inst, type);
+    } else {
+        set_op_width(inst, type);
+    }
+    free(operand);
+    return result;
+}
+
+// Arguments are converted to the callee's parameter types when it has a
+// signature; floating arguments are marked for the FP registers.
+static void lower_call(IRProgram* prog, char* result, const char* callee,
+                       Type* ret_type, char** args, Type** arg_types, int num_args) {
+    uint16_t float_args = 0;
+    for (int i = 0; i < num_args; i++) {
+        Type* param = semantic_param_type(callee, i);
+        if (!param && arg_types[i] && arg_types[i]->kind == TYPE_FLOOF) {
+            param = &promoted_float_type;
         }
+        if (param) {
+            args[i] = lower_convert(prog, args[i], arg_types[i], param);
+        }
+        if (type_is_float(param ? param : arg_types[i])) {
+            float_args |= (uint16_t)(1u << (i + 1));
+        }
+    }
+
+    IRInstruction* call = ir_inst_new("call");
+    ir_inst_add_operand(call, 0, callee);
+    for (int i = 0; i < num_args; i++) {
+        ir_inst_add_operand(call, i + 1, args[i]);
+    }
+    call->float_args = float_args;
+    ir_program_append(prog, call);
+
+    set_width(emit_inst(prog, "getret", result, NULL, NULL), ret_type);
+
+    for (int i = 0; i < num_args; i++) {
+        free(args[i]);
+    }
+}
+
+static void lower_return(IRProgram* prog, char* val, Type* type) {
+    val = lower_convert(prog, val, type, current_ret_type);
+    IRInstruction* inst = emit_inst(prog, "ret", val, NULL, NULL);
+    if (val && type_is_float(current_ret_type)) {
+        set_float_width(inst, current_ret_type);
+    } else if (val) {
+        set_width(inst, current_ret_type);
+    }
+    free(val);
+}
+
+static void begin_function_ir(IRProgram* prog, const char* name, Type* ret_type) {
+    temp_counter = 0;
+    current_prog = prog;
+    current_ret_type = ret_type;
+    emit_inst(prog, "func", name, NULL, NULL);
+    current_func = prog->tail;
+}
+
+// Locals are packed by semantic analysis, which hands over their total size
+// in bytes; temps follow in 8-byte slots. "func name frame locals" records
+// both so codegen can place every slot without the rest of the program.
+static void end_function_ir(IRProgram* prog, int local_bytes) {
+    int local_size = (local_bytes + 7) & ~7;
+    int temp_size = temp_counter * 8;
+    prog->frame_size = ((local_size + temp_size + 15) & ~15);
+
+    char frame[16];
+    snprintf(frame, sizeof(frame), "%d", prog->frame_size);
+    ir_inst_add_operand(current_func, 1, frame);
+    snprintf(frame, sizeof(frame), "%d", local_size);
+    ir_inst_add_operand(current_func, 2, frame);
+
+    ir_program_append(prog, ir_inst_new("endfunc"));
+    current_prog = NULL;
+    current_func = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Vector loops
+
+static char* vec_reg(int reg) {
+    char* name = xmalloc(16);
+    snprintf(name, 16, "q%d", reg);
+    return name;
+}
+
+static char* lower_vec_addr(IRProgram* prog, VecLoop* loop, int array_offset) {
+    char* base = lower_var_addr(prog, array_offset);
+    char* index = lower_load_var(prog, loop->index_offset, loop->index_type);
+    return lower_index_addr(prog, base, index, loop->elem);
+}
+
+// Evaluates node n into q<reg>, using the registers above it for operands.
+// splats[] holds the scalar value of every constant and invariant node.
+static void lower_vec_expr(IRProgram* prog, VecLoop* loop, int n, int reg, char** splats) {
+    VecExpr* e = &loop->nodes[n];
+    char* dest = vec_reg(reg);
+
+    if (e->kind == VEC_LOAD) {
+        char* addr = lower_vec_addr(prog, loop, e->stack_offset);
+        set_width(emit_inst(prog, "vload", dest, addr, NULL), loop->elem);
+        free(addr);
+    } else if (e->kind == VEC_SCALAR || e->kind == VEC_CONST) {
+        set_width(emit_inst(prog, "vsplat", dest, splats[n], NULL), loop->elem);
+    } else if (e->kind == VEC_BINARY) {
+        char opcode[16];
+        char* right = vec_reg(reg + 1);
+        lower_vec_expr(prog, loop, e->left, reg, splats);
+        lower_vec_expr(prog, loop, e->right, reg + 1, splats);
+        snprintf(opcode, sizeof(opcode), "v%s", binary_opcode(e->op));
+        set_width(emit_inst(prog, opcode, dest, dest, right), loop->elem);
+        free(right);
+    } else {
+        lower_vec_expr(prog, loop, e->left, reg, splats);
+        set_width(emit_inst(prog, e->op == TOKEN_MINUS ? "vneg" : "vnot", dest, dest, NULL),
+                  loop->elem);
+    }
+    free(dest);
+}
+
+// Runs the loop lanes iterations at a time while index + lanes <= bound;
+// the scalar loop emitted after it picks up the remaining iterations.
+// Reductions keep one partial result per lane in q7, q6, ... and fold them
+// into the variable once the vector loop exits.
+static void lower_vector_loop(IRProgram* prog, VecLoop* loop) {
+    char* splats[VEC_MAX_NODES] = {NULL};
+    Type* chonk = type_new(TYPE_CHONK);
+
+    for (int n = 0; n < loop->node_count; n++) {
+        VecExpr* e = &loop->nodes[n];
+        if (e->kind == VEC_SCALAR) {
+            splats[n] = lower_load_var(prog, e->stack_offset, e->type);
+        } else if (e->kind == VEC_CONST && e->is_float_const) {
+            splats[n] = lower_float(prog, e->float_value);
+        } else if (e->kind == VEC_CONST) {
+            splats[n] = lower_convert(prog, lower_number(prog, e->int_value), chonk, loop->elem);
+        }
+    }
+
+    char* bound = loop->bound_is_const
+        ? lower_number(prog, loop->bound_value)
+        : lower_load_var(prog, loop->bound_offset, loop->bound_type);
+
+    // The vector loop and the scalar loop after it together touch every
+    // index from the current one up to bound, so one range check covers
+    // both.
+    if (bounds_checks_enabled && loop->min_length > 0) {
+        char length[16];
+        snprintf(length, sizeof(length), "%d", loop->min_length);
+        char* first = lower_load_var(prog, loop->index_offset, loop->index_type);
+        emit_inst(prog, "chkrange", first, bound, length);
+        free(first);
+    }
+
+    int acc = VEC_REGS;
+    for (int i = 0; i < loop->stmt_count; i++) {
+        if (loop->stmts[i].is_reduction) {
+            char* reg = vec_reg(--acc);
+            set_width(emit_inst(prog, "vzero", reg, NULL, NULL), loop->elem);
+            free(reg);
+        }
+    }
+
+    char* start = new_label();
+    char* end = new_label();
+    char lanes[16];
+    snprintf(lanes, sizeof(lanes), "%d", loop->lanes);
+
+    emit_label(prog, start);
+    char* index = lower_load_var(prog, loop->index_offset, loop->index_type);
+    char* last = new_temp();
+    emit_inst(prog, "add", last, index, lanes);
+    char* cond = new_temp();
+    emit_inst(prog, "le", cond, last, bound);
+    emit_brz(prog, cond, end);
+
+    acc = VEC_REGS;
+    for (int i = 0; i < loop->stmt_count; i++) {
+        VecStmt* stmt = &loop->stmts[i];
+        char* value = vec_reg(0);
+        lower_vec_expr(prog, loop, stmt->expr, 0, splats);
+        if (stmt->is_reduction) {
+            char opcode[16];
+            char* reg = vec_reg(--acc);
+            snprintf(opcode, sizeof(opcode), "v%s", binary_opcode(stmt->op));
+            set_width(emit_inst(prog, opcode, reg, reg, value), loop->elem);
+            free(reg);
+        } else {
+            char* addr = lower_vec_addr(prog, loop, stmt->stack_offset);
+            set_width(emit_inst(prog, "vstore", addr, value, NULL), loop->elem);
+            free(addr);
+        }
+        free(value);
+    }
+
+    char* step = lower_binary(prog, TOKEN_PLUS, loop->index_type, loop->index_type,
+                              lower_load_var(prog, loop->index_offset, loop->index_type),
+                              loop->index_type, xstrdup(lanes));
+    free(lower_store_var(prog, loop->index_offset, loop->index_type, step));
+    emit_jmp(prog, start);
+    emit_label(prog, end);
+
+    acc = VEC_REGS;
+    for (int i = 0; i < loop->stmt_count; i++) {
+        VecStmt* stmt = &loop->stmts[i];
+        if (!stmt->is_reduction) continue;
+
+        char* reg = vec_reg(--acc);
+        char* partial = new_temp();
+        set_width(emit_inst(prog, "vreduce", partial, reg, binary_opcode(stmt->op)), loop->elem);
+        char* old = lower_load_var(prog, stmt->stack_offset, loop->elem);
+        char* sum = lower_binary(prog, stmt->op, loop->elem, loop->elem, old, loop->elem, partial);
+        free(lower_store_var(prog, stmt->stack_offset, loop->elem, sum));
+        free(reg);
+    }
+
+    for (int n = 0; n < loop->node_count; n++) {
+        free(splats[n]);
+    }
+    free(bound);
+    free(index);
+    free(last);
+    free(cond);
+    free(start);
+    free(end);
+}
+
+// Called once the loop's initializer has been emitted, with the result of
+// vec_analyze; the vector loop then runs ahead of the scalar one.
+static void vectorize_loop(IRProgram* prog, VecLoop* loop, uint32_t loc) {
+    if (opt_level < 2 && !loop->reason) {
+        loop->reason = "vectorization needs -O2";
+    }
+    if (!vectorize_enabled && !loop->reason) {
+        loop->reason = "vectorization is off for --run and --emit-module";
+    }
+    if (!loop->reason) {
+        lower_vector_loop(prog, loop);
+    }
+    if (vec_report_enabled) {
+        vec_report(loc, loop);
+    }
+}
+
+static char* gen_expr_ir(IRProgram* prog, ASTNode* node);
+
+static char* gen_index_addr_ir(IRProgram* prog, ASTNode* node) {
+    char* base = gen_expr_ir(prog, node->children[0]);
+    char* index = gen_expr_ir(prog, node->children[1]);
+    lower_index_check(prog, node->children[0]->type, base, index);
+    return lower_index_addr(prog, base, index, node->type);
+}
+
+// Address of a variable, an element or a dereferenced pointer.
+static char* gen_addr_ir(IRProgram* prog, ASTNode* node) {
+    if (node->kind == AST_INDEX) {
+        return gen_index_addr_ir(prog, node);
+    }
+    if (node->kind == AST_UNARY_OP) {
+        ASTNode* ptr = node->children[0];
+        return lower_deref_addr(prog, gen_expr_ir(prog, ptr), ptr->type);
+    }
+    return lower_var_addr(prog, node->stack_offset);
+}
+
+// The result type of a compound assignment before it is converted back to
+// the target's type.
+static Type* compound_type(Type* target, Type* value) {
+    Type* float_type = type_float_common(target, value);
+    return float_type ? float_type : target;
+}
+
+static char* gen_assign_ir(IRProgram* prog, ASTNode* node) {
+    ASTNode* target = node->children[0];
+    Type* type = target->type;
+    Type* val_type = node->children[1]->type;
+    char* val = gen_expr_ir(prog, node->children[1]);
+    int op = compound_op(node->data.op);
+
+    if (target->kind == AST_INDEX ||
+        (target->kind == AST_UNARY_OP && target->data.op == TOKEN_STAR)) {
+        char* addr = gen_addr_ir(prog, target);
+        if (op) {
+            char* old = lower_load(prog, xstrdup(addr), type);
+            val = lower_binary(prog, op, type, type, old, val_type, val);
+            val_type = compound_type(type, val_type);
+        }
+        val = lower_convert(prog, val, val_type, type);
+        return lower_store(prog, addr, type, val);
+    }
+
+    if (target->kind == AST_IDENTIFIER) {
+        if (op) {
+            char* old = lower_load_var(prog, target->stack_offset, type);
+            val = lower_binary(prog, op, type, type, old, val_type, val);
+            val_type = compound_type(type, val_type);
+        }
+        val = lower_convert(prog, val, val_type, type);
+        return lower_store_var(prog, target->stack_offset, type, val);
+    }
+
+    return val;
+}
+
+static char* gen_expr_ir(IRProgram* prog, ASTNode* node) {
+    if (!node) return NULL;
+
+    switch (node->kind) {
+        case AST_NUMBER:
+            return lower_number(prog, node->data.int_value);
+
+        case AST_FLOAT:
+            return lower_float(prog, node->data.float_value);
+
+        case AST_STRING:
+            return lower_string(prog, node->data.string_value);
+
+        case AST_IDENTIFIER:
+            return lower_load_var(prog, node->stack_offset, node->type);
 
         case AST_BINARY_OP: {
             char* left = gen_expr_ir(prog, node->children[0]);
             char* right = gen_expr_ir(prog, node->children[1]);
-            result = new_temp();
-
-            const char* op;
-            switch (node->data.op) {
-                case TOKEN_PLUS:    op = "add"; break;
-                case TOKEN_MINUS:   op = "sub"; break;
-                case TOKEN_STAR:    op = "mul"; break;
-                case TOKEN_SLASH:   op = "div"; break;
-                case TOKEN_PERCENT: op = "mod"; break;
-                case TOKEN_EQ:      op = "eq";  break;
-                case TOKEN_NE:      op = "ne";  break;
-                case TOKEN_LT:      op = "lt";  break;
-                case TOKEN_GT:      op = "gt";  break;
-                case TOKEN_LE:      op = "le";  break;
-                case TOKEN_GE:      op = "ge";  break;
-                case TOKEN_AND:     op = "and"; break;
-                case TOKEN_OR:      op = "or";  break;
-                case TOKEN_AMP:     op = "and"; break;
-                case TOKEN_PIPE:    op = "or";  break;
-                case TOKEN_CARET:   op = "xor"; break;
-                case TOKEN_LSHIFT:  op = "shl"; break;
-                case TOKEN_RSHIFT:  op = "shr"; break;
-                default:            op = "add"; break;
-            }
-
-            IRInstruction* inst = ir_inst_new(op);
-            ir_inst_add_operand(inst, 0, result);
-            ir_inst_add_operand(inst, 1, left);
-            ir_inst_add_operand(inst, 2, right);
-            ir_program_append(prog, inst);
-
-            free(left);
-            free(right);
-            break;
+            return lower_binary(prog, node->data.op, node->type,
+                                node->children[0]->type, left,
+                                node->children[1]->type, right);
         }
 
+        case AST_NULL:
+            return lower_number(prog, 0);
+
         case AST_UNARY_OP: {
-            char* operand = gen_expr_ir(prog, node->children[0]);
-            result = new_temp();
-
-            const char* op;
-            switch (node->data.op) {
-                case TOKEN_MINUS: op = "neg"; break;
-                case TOKEN_NOT:   op = "not"; break;
-                case TOKEN_TILDE: op = "not"; break;
-                default:          op = "mov"; break;
+            if (node->data.op == TOKEN_AMP) {
+                return gen_addr_ir(prog, node->children[0]);
+            }
+            if (node->data.op == TOKEN_STAR) {
+                return lower_load(prog, gen_addr_ir(prog, node), node->type);
             }
+            char* operand = gen_expr_ir(prog, node->children[0]);
+            return lower_unary(prog, node->data.op, node->type, operand);
+        }
 
-            IRInstruction* inst = ir_inst_new(op);
-            ir_inst_add_operand(inst, 0, result);
-            ir_inst_add_operand(inst, 1, operand);
-            ir_program_append(prog, inst);
+        case AST_INDEX:
+            return lower_load(prog, gen_index_addr_ir(prog, node), node->type);
 
-            free(operand);
-            break;
-        }
+        case AST_ASSIGN:
+            return gen_assign_ir(prog, node);
 
         case AST_CALL: {
-            result = new_temp();
+            char* result = new_temp();
 
             char* args[16] = {NULL};
+            Type* arg_types[16] = {NULL};
             int num_args = node->child_count - 1;
+            if (num_args > MAX_CALL_ARGS) num_args = MAX_CALL_ARGS;
 
             for (int i = 0; i < num_args; i++) {
                 args[i] = gen_expr_ir(prog, node->children[i + 1]);
+                arg_types[i] = node->children[i + 1]->type;
             }
 
-            IRInstruction* call = ir_inst_new("call");
-            ir_inst_add_operand(call, 0, node->children[0]->data.name);
-
-            for (int i = 0; i < num_args; i++) {
-                ir_inst_add_operand(call, i + 1, args[i]);
-            }
-
-            ir_program_append(prog, call);
-
-            IRInstruction* capture = ir_inst_new("getret");
-            ir_inst_add_operand(capture, 0, result);
-            ir_program_append(prog, capture);
-
-            for (int i = 0; i < num_args; i++) {
-                free(args[i]);
-            }
-            break;
+            lower_call(prog, result, node->children[0]->data.name, node->type,
+                       args, arg_types, num_args);
+            return result;
         }
 
         default:
-            result = new_temp();
-            break;
+            return new_temp();
     }
-
-    return result;
 }
 
 static void gen_stmt_ir(IRProgram* prog, ASTNode* node);
@@ -211,77 +790,42 @@ static void gen_stmt_ir(IRProgram* prog, ASTNode* node) {
     if (!node) return;
 
     switch (node->kind) {
-        case AST_RETURN: {
-            IRInstruction* inst = ir_inst_new("ret");
+        case AST_RETURN:
             if (node->child_count > 0) {
-                char* val = gen_expr_ir(prog, node->children[0]);
-                ir_inst_add_operand(inst, 0, val);
-                free(val);
+                lower_return(prog, gen_expr_ir(prog, node->children[0]),
+                             node->children[0]->type);
+            } else {
+                lower_return(prog, NULL, NULL);
             }
-            ir_program_append(prog, inst);
             break;
-        }
 
-        case AST_VAR_DECL: {
+        case AST_VAR_DECL:
             if (node->child_count > 1) {
                 char* val = gen_expr_ir(prog, node->children[1]);
-                IRInstruction* inst = ir_inst_new("mov");
-                char var_name[64];
-                snprintf(var_name, sizeof(var_name), "v%d", node->stack_offset);
-                ir_inst_add_operand(inst, 0, var_name);
-                ir_inst_add_operand(inst, 1, val);
-                ir_program_append(prog, inst);
-                free(val);
+                val = lower_convert(prog, val, node->children[1]->type, node->type);
+                free(lower_store_var(prog, node->stack_offset, node->type, val));
             }
             break;
-        }
-
-        case AST_ASSIGN: {
-            char* val = gen_expr_ir(prog, node->children[1]);
-            IRInstruction* inst = ir_inst_new("mov");
-            ASTNode* lhs = node->children[0];
-            char var_name[64];
-            snprintf(var_name, sizeof(var_name), "v%d", lhs->stack_offset);
-            ir_inst_add_operand(inst, 0, var_name);
-            ir_inst_add_operand(inst, 1, val);
-            ir_program_append(prog, inst);
-            free(val);
-            break;
-        }
 
         case AST_IF: {
             char* cond = gen_expr_ir(prog, node->children[0]);
             char* else_label = new_label();
 
-            IRInstruction* br = ir_inst_new("brz");
-            ir_inst_add_operand(br, 0, cond);
-            ir_inst_add_operand(br, 1, else_label);
-            ir_program_append(prog, br);
+            emit_brz(prog, cond, else_label);
 
             gen_stmt_ir(prog, node->children[1]);
 
             if (node->child_count > 2) {
                 char* end_label = new_label();
 
-                IRInstruction* jmp = ir_inst_new("jmp");
-                ir_inst_add_operand(jmp, 0, end_label);
-                ir_program_append(prog, jmp);
-
-                IRInstruction* lbl_else = ir_inst_new("label");
-                ir_inst_add_operand(lbl_else, 0, else_label);
-                ir_program_append(prog, lbl_else);
-
+                emit_jmp(prog, end_label);
+                emit_label(prog, else_label);
                 gen_stmt_ir(prog, node->children[2]);
-
-                IRInstruction* lbl_end = ir_inst_new("label");
-                ir_inst_add_operand(lbl_end, 0, end_label);
-                ir_program_append(prog, lbl_end);
+                emit_label(prog, end_label);
 
                 free(end_label);
             } else {
-                IRInstruction* lbl = ir_inst_new("label");
-                ir_inst_add_operand(lbl, 0, else_label);
-                ir_program_append(prog, lbl);
+                emit_label(prog, else_label);
             }
 
             free(cond);
@@ -293,25 +837,15 @@ static void gen_stmt_ir(IRProgram* prog, ASTNode* node) {
             char* start = new_label();
             char* end = new_label();
 
-            IRInstruction* lbl_start = ir_inst_new("label");
-            ir_inst_add_operand(lbl_start, 0, start);
-            ir_program_append(prog, lbl_start);
+            emit_label(prog, start);
 
             char* cond = gen_expr_ir(prog, node->children[0]);
-            IRInstruction* br = ir_inst_new("brz");
-            ir_inst_add_operand(br, 0, cond);
-            ir_inst_add_operand(br, 1, end);
-            ir_program_append(prog, br);
+            emit_brz(prog, cond, end);
 
             gen_stmt_ir(prog, node->children[1]);
 
-            IRInstruction* jmp = ir_inst_new("jmp");
-            ir_inst_add_operand(jmp, 0, start);
-            ir_program_append(prog, jmp);
-
-            IRInstruction* lbl_end = ir_inst_new("label");
-            ir_inst_add_operand(lbl_end, 0, end);
-            ir_program_append(prog, lbl_end);
+            emit_jmp(prog, start);
+            emit_label(prog, end);
 
             free(cond);
             free(start);
@@ -324,20 +858,21 @@ static void gen_stmt_ir(IRProgram* prog, ASTNode* node) {
                 gen_stmt_ir(prog, node->children[0]);
             }
 
+            if (opt_level >= 2 || vec_report_enabled) {
+                VecLoop loop;
+                vec_analyze(node, &loop);
+                vectorize_loop(prog, &loop, node->loc);
+            }
+
             char* start = new_label();
             char* end = new_label();
             char* continue_label = new_label();
 
-            IRInstruction* lbl_start = ir_inst_new("label");
-            ir_inst_add_operand(lbl_start, 0, start);
-            ir_program_append(prog, lbl_start);
+            emit_label(prog, start);
 
             if (node->child_count >= 2 && node->children[1]) {
                 char* cond = gen_expr_ir(prog, node->children[1]);
-                IRInstruction* br = ir_inst_new("brz");
-                ir_inst_add_operand(br, 0, cond);
-                ir_inst_add_operand(br, 1, end);
-                ir_program_append(prog, br);
+                emit_brz(prog, cond, end);
                 free(cond);
             }
 
@@ -345,22 +880,15 @@ static void gen_stmt_ir(IRProgram* prog, ASTNode* node) {
                 gen_stmt_ir(prog, node->children[3]);
             }
 
-            IRInstruction* lbl_continue = ir_inst_new("label");
-            ir_inst_add_operand(lbl_continue, 0, continue_label);
-            ir_program_append(prog, lbl_continue);
+            emit_label(prog, continue_label);
 
             if (node->child_count >= 3 && node->children[2]) {
                 char* inc = gen_expr_ir(prog, node->children[2]);
                 free(inc);
             }
 
-            IRInstruction* jmp = ir_inst_new("jmp");
-            ir_inst_add_operand(jmp, 0, start);
-            ir_program_append(prog, jmp);
-
-            IRInstruction* lbl_end = ir_inst_new("label");
-            ir_inst_add_operand(lbl_end, 0, end);
-            ir_program_append(prog, lbl_end);
+            emit_jmp(prog, start);
+            emit_label(prog, end);
 
             free(start);
             free(end);
@@ -398,28 +926,36 @@ static void gen_stmt_ir(IRProgram* prog, ASTNode* node) {
 }
 
 static void gen_function_ir(IRProgram* prog, ASTNode* node) {
-    temp_counter = 0;
-    current_prog = prog;
+    begin_function_ir(prog, node->data.name, node->type);
 
-    IRInstruction* start = ir_inst_new("func");
-    ir_inst_add_operand(start, 0, node->data.name);
-    ir_program_append(prog, start);
+    ASTNode* params = node->children[1];
+    for (int i = 0; i < params->child_count; i++) {
+        ASTNode* param = params->children[i];
+        lower_param(prog, param->stack_offset, i, param->type);
+    }
 
     gen_stmt_ir(prog, node->children[2]);
+    end_function_ir(prog, node->stack_offset);
+}
 
-    int local_size = node->stack_offset * 8;
-    int temp_size = temp_counter * 8;
-    prog->frame_size = ((local_size + temp_size + 15) & ~15);
+void ir_set_options(int level, bool report) {
+    opt_level = level;
+    vec_report_enabled = report;
+}
 
-    ir_program_append(prog, ir_inst_new("endfunc"));
-    current_prog = NULL;
+void ir_set_vectorize(bool enabled) {
+    vectorize_enabled = enabled;
+}
+
+void ir_set_checks(bool bounds_checks, bool null_checks) {
+    bounds_checks_enabled = bounds_checks;
+    null_checks_enabled = null_checks;
 }
 
 IRProgram* ir_generate(ASTNode* root) {
     if (!root || root->kind != AST_PROGRAM) return NULL;
 
-    label_counter = 0;
-    string_counter = 0;
+    ir_reset();
 
     IRProgram* prog = xcalloc(1, sizeof(IRProgram));
 
@@ -432,17 +968,364 @@ IRProgram* ir_generate(ASTNode* root) {
     return prog;
 }
 
+// Same lowering as above, driven by a FlatAST. Children are reached through
+// first_child/next_sibling instead of a pointer array.
+
+#define FLAT_CHILD(ast, n, i) flat_ast_child((ast), (n), (i))
+
+static char* gen_expr_ir_flat(IRProgram* prog, FlatAST* ast, uint32_t node);
+
+static char* gen_index_addr_ir_flat(IRProgram* prog, FlatAST* ast, uint32_t node) {
+    uint32_t base_node = ast->first_child[node];
+    char* base = gen_expr_ir_flat(prog, ast, base_node);
+    char* index = gen_expr_ir_flat(prog, ast, ast->next_sibling[base_node]);
+    lower_index_check(prog, ast->type[base_node], base, index);
+    return lower_index_addr(prog, base, index, ast->type[node]);
+}
+
+static char* gen_addr_ir_flat(IRProgram* prog, FlatAST* ast, uint32_t node) {
+    if (ast->kind[node] == AST_INDEX) {
+        return gen_index_addr_ir_flat(prog, ast, node);
+    }
+    if (ast->kind[node] == AST_UNARY_OP) {
+        uint32_t ptr = ast->first_child[node];
+        return lower_deref_addr(prog, gen_expr_ir_flat(prog, ast, ptr), ast->type[ptr]);
+    }
+    return lower_var_addr(prog, ast->stack_offset[node]);
+}
+
+static char* gen_assign_ir_flat(IRProgram* prog, FlatAST* ast, uint32_t node) {
+    uint32_t target = ast->first_child[node];
+    uint32_t value = ast->next_sibling[target];
+    Type* type = ast->type[target];
+    Type* val_type = ast->type[value];
+    char* val = gen_expr_ir_flat(prog, ast, value);
+    int op = compound_op((int)ast->payload[node]);
+
+    if (ast->kind[target] == AST_INDEX ||
+        (ast->kind[target] == AST_UNARY_OP && ast->payload[target] == TOKEN_STAR)) {
+        char* addr = gen_addr_ir_flat(prog, ast, target);
+        if (op) {
+            char* old = lower_load(prog, xstrdup(addr), type);
+            val = lower_binary(prog, op, type, type, old, val_type, val);
+            val_type = compound_type(type, val_type);
+        }
+        val = lower_convert(prog, val, val_type, type);
+        return lower_store(prog, addr, type, val);
+    }
+
+    if (ast->kind[target] == AST_IDENTIFIER) {
+        if (op) {
+            char* old = lower_load_var(prog, ast->stack_offset[target], type);
+            val = lower_binary(prog, op, type, type, old, val_type, val);
+            val_type = compound_type(type, val_type);
+        }
+        val = lower_convert(prog, val, val_type, type);
+        return lower_store_var(prog, ast->stack_offset[target], type, val);
+    }
+
+    return val;
+}
+
+static char* gen_expr_ir_flat(IRProgram* prog, FlatAST* ast, uint32_t node) {
+    if (node == FLAT_NONE) return NULL;
+
+    switch (ast->kind[node]) {
+        case AST_NUMBER:
+            return lower_number(prog, (long long)ast->payload[node]);
+
+        case AST_FLOAT: {
+            double value;
+            memcpy(&value, &ast->payload[node], sizeof(value));
+            return lower_float(prog, value);
+        }
+
+        case AST_STRING:
+            return lower_string(prog, flat_ast_name(ast, node));
+
+        case AST_IDENTIFIER:
+            return lower_load_var(prog, ast->stack_offset[node], ast->type[node]);
+
+        case AST_BINARY_OP: {
+            uint32_t lhs = ast->first_child[node];
+            uint32_t rhs = ast->next_sibling[lhs];
+            char* left = gen_expr_ir_flat(prog, ast, lhs);
+            char* right = gen_expr_ir_flat(prog, ast, rhs);
+            return lower_binary(prog, (int)ast->payload[node], ast->type[node],
+                                ast->type[lhs], left, ast->type[rhs], right);
+        }
+
+        case AST_NULL:
+            return lower_number(prog, 0);
+
+        case AST_UNARY_OP: {
+            int op = (int)ast->payload[node];
+            if (op == TOKEN_AMP) {
+                return gen_addr_ir_flat(prog, ast, ast->first_child[node]);
+            }
+            if (op == TOKEN_STAR) {
+                return lower_load(prog, gen_addr_ir_flat(prog, ast, node), ast->type[node]);
+            }
+            char* operand = gen_expr_ir_flat(prog, ast, ast->first_child[node]);
+            return lower_unary(prog, op, ast->type[node], operand);
+        }
+
+        case AST_INDEX:
+            return lower_load(prog, gen_index_addr_ir_flat(prog, ast, node),
+                              ast->type[node]);
+
+        case AST_ASSIGN:
+            return gen_assign_ir_flat(prog, ast, node);
+
+        case AST_CALL: {
+            char* result = new_temp();
+
+            char* args[16] = {NULL};
+            Type* arg_types[16] = {NULL};
+            int num_args = 0;
+            uint32_t callee = ast->first_child[node];
+
+            for (uint32_t arg = ast->next_sibling[callee];
+                 arg != FLAT_NONE && num_args < MAX_CALL_ARGS;
+                 arg = ast->next_sibling[arg]) {
+                arg_types[num_args] = ast->type[arg];
+                args[num_args++] = gen_expr_ir_flat(prog, ast, arg);
+            }
+
+            lower_call(prog, result, flat_ast_name(ast, callee), ast->type[node],
+                       args, arg_types, num_args);
+            return result;
+        }
+
+        default:
+            return new_temp();
+    }
+}
+
+static void gen_stmt_ir_flat(IRProgram* prog, FlatAST* ast, uint32_t node);
+
+static void gen_stmt_ir_flat(IRProgram* prog, FlatAST* ast, uint32_t node) {
+    if (node == FLAT_NONE) return;
+
+    uint32_t count = ast->child_count[node];
+
+    switch (ast->kind[node]) {
+        case AST_RETURN:
+            if (count > 0) {
+                uint32_t value = ast->first_child[node];
+                lower_return(prog, gen_expr_ir_flat(prog, ast, value), ast->type[value]);
+            } else {
+                lower_return(prog, NULL, NULL);
+            }
+            break;
+
+        case AST_VAR_DECL:
+            if (count > 1) {
+                uint32_t init = FLAT_CHILD(ast, node, 1);
+                char* val = gen_expr_ir_flat(prog, ast, init);
+                val = lower_convert(prog, val, ast->type[init], ast->type[node]);
+                free(lower_store_var(prog, ast->stack_offset[node], ast->type[node], val));
+            }
+            break;
+
+        case AST_IF: {
+            uint32_t cond_node = ast->first_child[node];
+            uint32_t then_node = ast->next_sibling[cond_node];
+
+            char* cond = gen_expr_ir_flat(prog, ast, cond_node);
+            char* else_label = new_label();
+
+            emit_brz(prog, cond, else_label);
+
+            gen_stmt_ir_flat(prog, ast, then_node);
+
+            if (count > 2) {
+                char* end_label = new_label();
+
+                emit_jmp(prog, end_label);
+                emit_label(prog, else_label);
+                gen_stmt_ir_flat(prog, ast, ast->next_sibling[then_node]);
+                emit_label(prog, end_label);
+
+                free(end_label);
+            } else {
+                emit_label(prog, else_label);
+            }
+
+            free(cond);
+            free(else_label);
+            break;
+        }
+
+        case AST_WHILE: {
+            uint32_t cond_node = ast->first_child[node];
+            char* start = new_label();
+            char* end = new_label();
+
+            emit_label(prog, start);
+
+            char* cond = gen_expr_ir_flat(prog, ast, cond_node);
+            emit_brz(prog, cond, end);
+
+            gen_stmt_ir_flat(prog, ast, ast->next_sibling[cond_node]);
+
+            emit_jmp(prog, start);
+            emit_label(prog, end);
+
+            free(cond);
+            free(start);
+            free(end);
+            break;
+        }
+
+        case AST_FOR: {
+            uint32_t init = FLAT_CHILD(ast, node, 0);
+            uint32_t cond_node = FLAT_CHILD(ast, node, 1);
+            uint32_t inc_node = FLAT_CHILD(ast, node, 2);
+            uint32_t body = FLAT_CHILD(ast, node, 3);
+
+            gen_stmt_ir_flat(prog, ast, init);
+
+            if (opt_level >= 2 || vec_report_enabled) {
+                VecLoop loop;
+                vec_analyze_flat(ast, node, &loop);
+                vectorize_loop(prog, &loop, ast->loc[node]);
+            }
+
+            char* start = new_label();
+            char* end = new_label();
+            char* continue_label = new_label();
+
+            emit_label(prog, start);
+
+            if (cond_node != FLAT_NONE) {
+                char* cond = gen_expr_ir_flat(prog, ast, cond_node);
+                emit_brz(prog, cond, end);
+                free(cond);
+            }
+
+            gen_stmt_ir_flat(prog, ast, body);
+
+            emit_label(prog, continue_label);
+
+            if (inc_node != FLAT_NONE) {
+                char* inc = gen_expr_ir_flat(prog, ast, inc_node);
+                free(inc);
+            }
+
+            emit_jmp(prog, start);
+            emit_label(prog, end);
+
+            free(start);
+            free(end);
+            free(continue_label);
+            break;
+        }
+
+        case AST_BREAK:
+        case AST_CONTINUE:
+            break;
+
+        case AST_BLOCK:
+            for (uint32_t c = ast->first_child[node]; c != FLAT_NONE;
+                 c = ast->next_sibling[c]) {
+                gen_stmt_ir_flat(prog, ast, c);
+            }
+            break;
+
+        default:
+            if (ast->kind[node] >= AST_BINARY_OP && ast->kind[node] <= AST_CALL) {
+                char* tmp = gen_expr_ir_flat(prog, ast, node);
+                free(tmp);
+            }
+            break;
+    }
+}
+
+IRProgram* ir_generate_flat(FlatAST* ast) {
+    if (!ast || ast->count == 0 || ast->kind[0] != AST_PROGRAM) return NULL;
+
+    ir_reset();
+
+    IRProgram* prog = xcalloc(1, sizeof(IRProgram));
+
+    for (uint32_t fn = ast->first_child[0]; fn != FLAT_NONE;
+         fn = ast->next_sibling[fn]) {
+        if (ast->kind[fn] != AST_FUNCTION) continue;
+
+        begin_function_ir(prog, flat_ast_name(ast, fn), ast->type[fn]);
+
+        int index = 0;
+        for (uint32_t param = ast->first_child[FLAT_CHILD(ast, fn, 1)];
+             param != FLAT_NONE; param = ast->next_sibling[param]) {
+            lower_param(prog, ast->stack_offset[param], index++, ast->type[param]);
+        }
+
+        gen_stmt_ir_flat(prog, ast, FLAT_CHILD(ast, fn, 2));
+        end_function_ir(prog, ast->stack_offset[fn]);
+    }
+
+    return prog;
+}
+
+IRInstruction* ir_append(IRProgram* prog, const char* opcode,
+                         const char* const* operands, int operand_count) {
+    IRInstruction* inst = ir_inst_new(opcode);
+    for (int i = 0; i < operand_count; i++) {
+        ir_inst_add_operand(inst, i, operands[i]);
+    }
+    ir_program_append(prog, inst);
+    return inst;
+}
+
+IRInstruction* ir_insert_after(IRProgram* prog, IRInstruction* pos, const char* opcode,
+                               const char* const* operands, int operand_count) {
+    IRInstruction* inst = ir_inst_new(opcode);
+    for (int i = 0; i < operand_count; i++) {
+        ir_inst_add_operand(inst, i, operands[i]);
+    }
+    if (!pos) {
+        inst->next = prog->head;
+        prog->head = inst;
+    } else {
+        inst->next = pos->next;
+        pos->next = inst;
+    }
+    if (prog->tail == pos) {
+        prog->tail = inst;
+    }
+    return inst;
+}
+
+static void ir_inst_free(IRInstruction* inst) {
+    free(inst->opcode);
+    for (int i = 0; i < 16; i++) {
+        free(inst->operands[i]);
+    }
+    free(inst);
+}
+
+void ir_remove_after(IRProgram* prog, IRInstruction* pos) {
+    IRInstruction* inst = pos ? pos->next : prog->head;
+    if (!inst) return;
+    if (pos) {
+        pos->next = inst->next;
+    } else {
+        prog->head = inst->next;
+    }
+    if (prog->tail == inst) {
+        prog->tail = pos;
+    }
+    ir_inst_free(inst);
+}
+
 void ir_program_free(IRProgram* program) {
     if (!program) return;
 
     IRInstruction* cur = program->head;
     while (cur) {
         IRInstruction* next = cur->next;
-        free(cur->opcode);
-        for (int i = 0; i < 16; i++) {
-            free(cur->operands[i]);
-        }
-        free(cur);
+        ir_inst_free(cur);
         cur = next;
     }
 
@@ -461,9 +1344,15 @@ void ir_dump(IRProgram* program, FILE* out) {
     IRInstruction* inst = program->head;
     while (inst) {
         fprintf(out, "  %s", inst->opcode);
+        if (inst->is_float) {
+            fprintf(out, ".f%d", inst->width ? inst->width * 8 : 64);
+        } else if (inst->width && inst->width != 8) {
+            fprintf(out, ".%c%d", inst->is_unsigned ? 'u' : 'i', inst->width * 8);
+        }
         for (int i = 0; i < 16; i++) {
             if (inst->operands[i]) {
-                fprintf(out, " %s", inst->operands[i]);
+                fprintf(out, " %s%s", inst->operands[i],
+                        (inst->float_args >> i) & 1 ? ":f" : "");
             }
         }
         fprintf(out, "\n");
@@ -2,11 +2,30 @@
 #define IR_H
 
 #include "ast.h"
+#include "flat_ast.h"
 #include <stdio.h>
 
+// A call's operands are the callee followed by its arguments.
+#define MAX_CALL_ARGS 15
+
 typedef struct IRInstruction {
     char* opcode;
     char* operands[16]; // Went from only supporting 3 to now support 16
+    // Operand width in bytes (1, 2, 4 or 8; 0 means 8). Memory operands are
+    // read and written at this width, and narrower arithmetic is done in
+    // 32-bit form. Temps always hold the value sign- or zero-extended to 64
+    // bits, depending on is_unsigned.
+    int width;
+    bool is_unsigned;
+    // The operands are floof (width 4) or bigfloof (width 8) values, held
+    // as raw bits. Temps of a floof value have the upper 32 bits clear.
+    bool is_float;
+    // call, tailcall: bit i is set when operand i is passed in a floating-point
+    // register.
+    uint16_t float_args;
+    // Times the instruction ran in the profile given to --profile-use, or -1
+    // when unknown.
+    long long count;
     struct IRInstruction* next;
 } IRInstruction;
 
@@ -17,7 +36,24 @@ typedef struct {
     int temp_count;
 } IRProgram;
 
+// Optimization level (-O) and whether to explain each vectorization
+// decision on stderr.
+void ir_set_options(int opt_level, bool vec_report);
+// Whether fow loops may be vectorized at -O2 (on by default). The JIT
+// (--run) only compiles scalar code.
+void ir_set_vectorize(bool enabled);
+// Safe mode: whether element accesses get bounds and null checks (both on
+// by default).
+void ir_set_checks(bool bounds_checks, bool null_checks);
 IRProgram* ir_generate(ASTNode* root);
+IRProgram* ir_generate_flat(FlatAST* ast);
+IRInstruction* ir_append(IRProgram* prog, const char* opcode,
+                         const char* const* operands, int operand_count);
+// Editing helpers for the optimization passes. A NULL position stands for
+// the start of the program.
+IRInstruction* ir_insert_after(IRProgram* prog, IRInstruction* pos, const char* opcode,
+                               const char* const* operands, int operand_count);
+void ir_remove_after(IRProgram* prog, IRInstruction* pos);
 void ir_program_free(IRProgram* program);
 void ir_dump(IRProgram* program, FILE* out);
 
@@ -0,0 +1,2344 @@
+/**
+ * @file ir_opt.c
+ * @brief Optimizations on the generated IR
+ */
+
+#include "ir_opt.h"
+#include "util.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+static bool op_is(const IRInstruction* inst, const char* opcode) {
+    return strcmp(inst->opcode, opcode) == 0;
+}
+
+static bool is_temp(const char* s) {
+    return s && s[0] == 't' && isdigit((unsigned char)s[1]);
+}
+
+static bool is_var(const char* s) {
+    return s && s[0] == 'v' && isdigit((unsigned char)s[1]);
+}
+
+static bool is_immediate(const char* s) {
+    if (!s) return false;
+    if (*s == '-') s++;
+    return isdigit((unsigned char)*s);
+}
+
+static bool same(const char* a, const char* b) {
+    return a && b && strcmp(a, b) == 0;
+}
+
+static const char* const compare_ops[] = {"lt", "le", "gt", "ge", "eq", "ne"};
+static const char* const inverse_ops[] = {"ge", "gt", "le", "lt", "ne", "eq"};
+
+static int compare_index(const char* opcode) {
+    for (int i = 0; i < 6; i++) {
+        if (strcmp(opcode, compare_ops[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// blt, ble, bgt, bge, beq and bne: "blt a b L" jumps to L when a < b.
+static bool is_compare_branch(const IRInstruction* inst) {
+    return inst->opcode[0] == 'b' && compare_index(inst->opcode + 1) >= 0;
+}
+
+// Whether operand 0 is written rather than read.
+static bool defines_operand0(const IRInstruction* inst) {
+    static const char* const uses[] = {
+        "store", "vstore", "brz", "jz", "jnz", "ret", "call", "param", "label", "jmp",
+        "func", "endfunc", "string", "float", "chkbounds", "chknull", "chkrange",
+        "tailcall", "switch", "case", "count", "cold"
+    };
+    for (size_t i = 0; i < sizeof(uses) / sizeof(uses[0]); i++) {
+        if (op_is(inst, uses[i])) return false;
+    }
+    return !is_compare_branch(inst);
+}
+
+// Instructions that may write any variable whose address has been taken.
+static bool writes_memory(const IRInstruction* inst) {
+    return op_is(inst, "store") || op_is(inst, "vstore") || op_is(inst, "call") ||
+           op_is(inst, "tailcall");
+}
+
+// A variable written directly, or -1.
+static int written_var(const IRInstruction* inst) {
+    if ((op_is(inst, "mov") || op_is(inst, "param")) && is_var(inst->operands[0])) {
+        return atoi(inst->operands[0] + 1);
+    }
+    return -1;
+}
+
+// Whether call is in tail position, "call f ...; getret tX; ret tX", with
+// the callee's result usable as the caller's: the caller's return type must
+// be no wider than the callee's, since the outermost getret only narrows.
+static bool is_tail_call(const IRInstruction* call) {
+    const IRInstruction* getret = call->next;
+    if (!op_is(call, "call") || !getret || !op_is(getret, "getret")) return false;
+    const IRInstruction* ret = getret->next;
+    if (!ret || !op_is(ret, "ret") || !same(ret->operands[0], getret->operands[0])) {
+        return false;
+    }
+    int ret_width = ret->width ? ret->width : 8;
+    int getret_width = getret->width ? getret->width : 8;
+    if (ret->is_float || getret->is_float) {
+        return ret->is_float == getret->is_float && ret_width == getret_width;
+    }
+    return ret_width <= getret_width;
+}
+
+// One function, from its "func" instruction up to (not including) the
+// next one.
+typedef struct {
+    IRInstruction* func;
+    IRInstruction* end;
+    int temp_count;
+    int var_limit;
+    bool* addr_taken;
+} Function;
+
+static void scan_function(Function* fn, IRInstruction* func) {
+    fn->func = func;
+    fn->temp_count = 0;
+    fn->var_limit = 0;
+
+    IRInstruction* inst = func->next;
+    while (inst && !op_is(inst, "func")) {
+        for (int i = 0; i < 16; i++) {
+            const char* op = inst->operands[i];
+            if (is_temp(op) && atoi(op + 1) >= fn->temp_count) {
+                fn->temp_count = atoi(op + 1) + 1;
+            } else if (is_var(op) && atoi(op + 1) >= fn->var_limit) {
+                fn->var_limit = atoi(op + 1) + 1;
+            }
+        }
+        inst = inst->next;
+    }
+    fn->end = inst;
+
+    fn->addr_taken = xcalloc(fn->var_limit + 1, sizeof(bool));
+    for (inst = func->next; inst != fn->end; inst = inst->next) {
+        if (op_is(inst, "addr") && is_var(inst->operands[1])) {
+            fn->addr_taken[atoi(inst->operands[1] + 1)] = true;
+        }
+    }
+}
+
+// A fresh temp for the function; its frame grows by one slot.
+static char* function_temp(IRProgram* prog, Function* fn) {
+    char* temp = xmalloc(16);
+    snprintf(temp, 16, "t%d", fn->temp_count++);
+    prog->temp_count++;
+
+    if (fn->func->operands[1] && fn->func->operands[2]) {
+        int local_size = (atoi(fn->func->operands[2]) + 7) & ~7;
+        int frame_size = (local_size + fn->temp_count * 8 + 15) & ~15;
+        if (frame_size > atoi(fn->func->operands[1])) {
+            char frame[16];
+            snprintf(frame, sizeof(frame), "%d", frame_size);
+            free(fn->func->operands[1]);
+            fn->func->operands[1] = xstrdup(frame);
+        }
+    }
+    return temp;
+}
+
+// ---------------------------------------------------------------------------
+// Redundant checks
+//
+// Within a basic block, temps are numbered by the value they hold: the same
+// constant, the same variable loaded at the same width with no write in
+// between, or the address of a variable. A check on a value that has
+// already passed an equal or stricter check is dropped, as are checks that
+// hold trivially (a constant index inside the array, the address of a
+// variable).
+
+typedef enum {
+    VALUE_CONST,
+    VALUE_VAR,
+    VALUE_ADDR,
+    VALUE_OPAQUE
+} ValueKind;
+
+typedef struct {
+    ValueKind kind;
+    long long n;            // constant, or variable offset
+    int version;
+    int width;
+    bool is_unsigned;
+} Value;
+
+typedef struct {
+    bool is_null;
+    int value;
+    long long length;
+} Check;
+
+typedef struct {
+    Value* values;
+    int value_count;
+    int value_cap;
+    int* temp_value;        // value number of each temp, -1 if unknown
+    int* version;           // bumped on every write of a variable
+    Check* checks;
+    int check_count;
+    int check_cap;
+} Numbering;
+
+static int add_value(Numbering* vn, Value v) {
+    if (v.kind != VALUE_OPAQUE) {
+        for (int i = 0; i < vn->value_count; i++) {
+            Value* w = &vn->values[i];
+            if (w->kind == v.kind && w->n == v.n && w->version == v.version &&
+                w->width == v.width && w->is_unsigned == v.is_unsigned) {
+                return i;
+            }
+        }
+    }
+    if (vn->value_count == vn->value_cap) {
+        vn->value_cap = vn->value_cap ? vn->value_cap * 2 : 64;
+        vn->values = xrealloc(vn->values, vn->value_cap * sizeof(Value));
+    }
+    vn->values[vn->value_count] = v;
+    return vn->value_count++;
+}
+
+static int value_of(Numbering* vn, const char* op) {
+    Value v = {VALUE_OPAQUE, 0, 0, 0, false};
+    if (is_immediate(op)) {
+        v.kind = VALUE_CONST;
+        v.n = atoll(op);
+        return add_value(vn, v);
+    }
+    if (is_temp(op)) {
+        int t = atoi(op + 1);
+        if (vn->temp_value[t] < 0) {
+            vn->temp_value[t] = add_value(vn, v);
+        }
+        return vn->temp_value[t];
+    }
+    return add_value(vn, v);
+}
+
+static void define_temp(Numbering* vn, const IRInstruction* inst) {
+    int t = atoi(inst->operands[0] + 1);
+    const char* src = inst->operands[1];
+    Value v = {VALUE_OPAQUE, 0, 0, 0, false};
+
+    if (op_is(inst, "mov") && !inst->is_float && (is_immediate(src) || is_temp(src))) {
+        vn->temp_value[t] = value_of(vn, src);
+        return;
+    }
+    if (op_is(inst, "mov") && !inst->is_float && is_var(src)) {
+        v.kind = VALUE_VAR;
+        v.n = atoi(src + 1);
+        v.version = vn->version[v.n];
+        v.width = inst->width;
+        v.is_unsigned = inst->is_unsigned;
+    } else if (op_is(inst, "addr") && is_var(src)) {
+        v.kind = VALUE_ADDR;
+        v.n = atoi(src + 1);
+    }
+    vn->temp_value[t] = add_value(vn, v);
+}
+
+static bool check_known(Numbering* vn, bool is_null, int value, long long length) {
+    for (int i = 0; i < vn->check_count; i++) {
+        Check* c = &vn->checks[i];
+        if (c->is_null == is_null && c->value == value && (is_null || c->length <= length)) {
+            return true;
+        }
+    }
+    if (vn->check_count == vn->check_cap) {
+        vn->check_cap = vn->check_cap ? vn->check_cap * 2 : 16;
+        vn->checks = xrealloc(vn->checks, vn->check_cap * sizeof(Check));
+    }
+    vn->checks[vn->check_count++] = (Check){is_null, value, length};
+    return false;
+}
+
+// Whether the check at inst is already known to pass.
+static bool check_redundant(Numbering* vn, const IRInstruction* inst) {
+    int value = value_of(vn, inst->operands[0]);
+    Value* v = &vn->values[value];
+
+    if (op_is(inst, "chkbounds")) {
+        long long length = atoll(inst->operands[1]);
+        if (v->kind == VALUE_CONST && v->n >= 0 && v->n < length) {
+            return true;
+        }
+        return check_known(vn, false, value, length);
+    }
+    if (v->kind == VALUE_ADDR || (v->kind == VALUE_CONST && v->n != 0)) {
+        return true;
+    }
+    return check_known(vn, true, value, 0);
+}
+
+static void remove_redundant_checks(IRProgram* prog, Function* fn) {
+    Numbering vn = {0};
+    vn.temp_value = xmalloc((fn->temp_count + 1) * sizeof(int));
+    vn.version = xcalloc(fn->var_limit + 1, sizeof(int));
+    for (int t = 0; t <= fn->temp_count; t++) {
+        vn.temp_value[t] = -1;
+    }
+
+    IRInstruction* prev = fn->func;
+    while (prev->next != fn->end) {
+        IRInstruction* inst = prev->next;
+
+        if (op_is(inst, "label")) {
+            vn.value_count = 0;
+            vn.check_count = 0;
+            for (int t = 0; t <= fn->temp_count; t++) {
+                vn.temp_value[t] = -1;
+            }
+        } else if (op_is(inst, "chkbounds") || op_is(inst, "chknull")) {
+            if (check_redundant(&vn, inst)) {
+                ir_remove_after(prog, prev);
+                continue;
+            }
+        } else if (is_temp(inst->operands[0]) && defines_operand0(inst)) {
+            define_temp(&vn, inst);
+        }
+
+        int var = written_var(inst);
+        if (var >= 0) {
+            vn.version[var]++;
+        }
+        if (writes_memory(inst)) {
+            for (int v = 0; v < fn->var_limit; v++) {
+                if (fn->addr_taken[v]) vn.version[v]++;
+            }
+        }
+        prev = inst;
+    }
+
+    free(vn.values);
+    free(vn.temp_value);
+    free(vn.version);
+    free(vn.checks);
+}
+
+// ---------------------------------------------------------------------------
+// Loop checks
+//
+// In a loop shaped like a lowered fow or wepeat,
+//
+//     label L
+//     mov tA vI
+//     mov tB n            (a constant, or a variable the loop never writes)
+//     lt tC tA tB
+//     brz tC Lend
+//     ...
+//     mov vI (vI + 1)     (the only write of vI)
+//     jmp L
+//     label Lend
+//
+// vI runs through [vI, n) from its value on entry. A chkbounds on vI + k that
+// every iteration executes, before any branch, passes on every iteration
+// exactly when "chkrange vI+k n+k length" passes on entry, so the check is
+// made once there instead. The loop must not call anything or return, which
+// would make trapping early observable; it is assumed to terminate.
+
+typedef struct {
+    long long offset;
+    long long length;
+    const IRInstruction* add;   // the instruction adding the offset, if any
+} RangeCheck;
+
+#define MAX_LOOP_CHECKS 16
+
+static IRInstruction* find_def(IRInstruction* from, IRInstruction* to, const char* temp) {
+    for (IRInstruction* inst = from; inst != to; inst = inst->next) {
+        if (same(inst->operands[0], temp) && defines_operand0(inst)) {
+            return inst;
+        }
+    }
+    return NULL;
+}
+
+static bool const_operand(IRInstruction* from, IRInstruction* to, const char* op,
+                          long long* value) {
+    if (is_immediate(op)) {
+        *value = atoll(op);
+        return true;
+    }
+    IRInstruction* def = is_temp(op) ? find_def(from, to, op) : NULL;
+    if (def && op_is(def, "mov") && is_immediate(def->operands[1]) && !def->is_float) {
+        *value = atoll(def->operands[1]);
+        return true;
+    }
+    return false;
+}
+
+// Whether temp holds the loop variable loaded like the header does.
+static bool is_index_load(IRInstruction* from, IRInstruction* to, const char* temp,
+                          const IRInstruction* header_load) {
+    IRInstruction* def = find_def(from, to, temp);
+    return def && op_is(def, "mov") && same(def->operands[1], header_load->operands[1]) &&
+           def->width == header_load->width && def->is_unsigned == header_load->is_unsigned;
+}
+
+// The single write of the loop variable must be vI = vI + 1.
+static bool is_unit_step(IRInstruction* body, IRInstruction* end, IRInstruction* write,
+                         const IRInstruction* header_load) {
+    IRInstruction* add = find_def(body, end, write->operands[1]);
+    long long step;
+    if (!add || !op_is(add, "add") || add->width != header_load->width) return false;
+    if (is_index_load(body, end, add->operands[1], header_load)) {
+        return const_operand(body, end, add->operands[2], &step) && step == 1;
+    }
+    return is_index_load(body, end, add->operands[2], header_load) &&
+           const_operand(body, end, add->operands[1], &step) && step == 1;
+}
+
+// Matches index = vI or vI +/- k for the operand of a chkbounds.
+static bool index_offset(IRInstruction* body, IRInstruction* check, const char* index,
+                         const IRInstruction* header_load, RangeCheck* range) {
+    range->offset = 0;
+    range->add = NULL;
+    if (is_index_load(body, check, index, header_load)) {
+        return true;
+    }
+
+    IRInstruction* def = find_def(body, check, index);
+    long long k;
+    if (!def || (!op_is(def, "add") && !op_is(def, "sub")) || def->width != header_load->width) {
+        return false;
+    }
+    if (is_index_load(body, check, def->operands[1], header_load) &&
+        const_operand(body, check, def->operands[2], &k)) {
+        range->offset = op_is(def, "sub") ? -k : k;
+    } else if (op_is(def, "add") && is_index_load(body, check, def->operands[2], header_load) &&
+               const_operand(body, check, def->operands[1], &k)) {
+        range->offset = k;
+    } else {
+        return false;
+    }
+    range->add = def;
+    return true;
+}
+
+static int label_uses(Function* fn, const char* label) {
+    int uses = 0;
+    for (IRInstruction* inst = fn->func->next; inst != fn->end; inst = inst->next) {
+        if (op_is(inst, "label")) continue;
+        for (int i = 0; i < 16; i++) {
+            if (same(inst->operands[i], label)) uses++;
+        }
+    }
+    return uses;
+}
+
+// Emits "dest = src + offset" at the width of the original add.
+static IRInstruction* emit_offset(IRProgram* prog, Function* fn, IRInstruction* pos,
+                                  char** value, const RangeCheck* range) {
+    if (!range->add) return pos;
+
+    char k[32];
+    char* sum = function_temp(prog, fn);
+    snprintf(k, sizeof(k), "%lld", range->offset);
+    const char* ops[] = {sum, *value, k};
+    pos = ir_insert_after(prog, pos, "add", ops, 3);
+    pos->width = range->add->width;
+    free(*value);
+    *value = sum;
+    return pos;
+}
+
+static IRInstruction* copy_load(IRProgram* prog, Function* fn, IRInstruction* pos,
+                                const IRInstruction* load, char** dest) {
+    *dest = function_temp(prog, fn);
+    const char* ops[] = {*dest, load->operands[1]};
+    pos = ir_insert_after(prog, pos, "mov", ops, 2);
+    pos->width = load->width;
+    pos->is_unsigned = load->is_unsigned;
+    return pos;
+}
+
+static void hoist_loop_checks(IRProgram* prog, Function* fn, IRInstruction* pre,
+                              IRInstruction* header) {
+    IRInstruction* load = header->next;
+    if (!load || !op_is(load, "mov") || !is_temp(load->operands[0]) ||
+        !is_var(load->operands[1]) || load->is_float || load->is_unsigned ||
+        (load->width != 0 && load->width != 4)) {
+        return;
+    }
+    IRInstruction* limit = load->next;
+    if (!limit || !op_is(limit, "mov") || !is_temp(limit->operands[0]) || limit->is_float ||
+        !(is_immediate(limit->operands[1]) || is_var(limit->operands[1])) ||
+        same(limit->operands[1], load->operands[1])) {
+        return;
+    }
+    IRInstruction* cmp = limit->next;
+    if (!cmp || !op_is(cmp, "lt") || !same(cmp->operands[1], load->operands[0]) ||
+        !same(cmp->operands[2], limit->operands[0]) || cmp->width != load->width) {
+        return;
+    }
+    // The bound must compare the same at 64 bits as at the loop's width.
+    if (is_var(limit->operands[1]) ? limit->width != load->width || limit->is_unsigned
+                                   : load->width == 4 && (atoll(limit->operands[1]) > INT32_MAX ||
+                                                          atoll(limit->operands[1]) < INT32_MIN)) {
+        return;
+    }
+    IRInstruction* exit = cmp->next;
+    if (!exit || !op_is(exit, "brz") || !same(exit->operands[0], cmp->operands[0])) {
+        return;
+    }
+    if (label_uses(fn, header->operands[0]) != 1) return;
+
+    int index_var = atoi(load->operands[1] + 1);
+    int bound_var = is_var(limit->operands[1]) ? atoi(limit->operands[1] + 1) : -1;
+    if (fn->addr_taken[index_var] || (bound_var >= 0 && fn->addr_taken[bound_var])) {
+        return;
+    }
+
+    IRInstruction* body = exit->next;
+    IRInstruction* back = NULL;
+    IRInstruction* step = NULL;
+    for (IRInstruction* inst = body; inst != fn->end; inst = inst->next) {
+        if (op_is(inst, "jmp") && same(inst->operands[0], header->operands[0])) {
+            back = inst;
+            break;
+        }
+        if (op_is(inst, "call") || op_is(inst, "tailcall") || op_is(inst, "ret")) return;
+
+        int var = written_var(inst);
+        if (var == bound_var && var >= 0) return;
+        if (var == index_var) {
+            if (step) return;
+            step = inst;
+        }
+    }
+    if (!back || !step || !back->next || !op_is(back->next, "label") ||
+        !same(back->next->operands[0], exit->operands[1]) ||
+        !is_unit_step(body, back, step, load)) {
+        return;
+    }
+
+    RangeCheck ranges[MAX_LOOP_CHECKS];
+    int range_count = 0;
+    IRInstruction* prev = exit;
+    while (prev->next != step) {
+        IRInstruction* inst = prev->next;
+        if (op_is(inst, "label") || op_is(inst, "jmp") || op_is(inst, "brz") ||
+            op_is(inst, "jz") || op_is(inst, "jnz")) {
+            break;
+        }
+
+        RangeCheck range;
+        if (op_is(inst, "chkbounds") &&
+            index_offset(body, inst, inst->operands[0], load, &range)) {
+            range.length = atoll(inst->operands[1]);
+            int i = 0;
+            while (i < range_count && (ranges[i].offset != range.offset ||
+                                       ranges[i].length != range.length)) {
+                i++;
+            }
+            if (i == range_count && range_count < MAX_LOOP_CHECKS) {
+                ranges[range_count++] = range;
+            }
+            if (i < range_count) {
+                ir_remove_after(prog, prev);
+                continue;
+            }
+        }
+        prev = inst;
+    }
+
+    IRInstruction* pos = pre;
+    for (int i = 0; i < range_count; i++) {
+        char* lo;
+        char* hi;
+        char length[32];
+        pos = copy_load(prog, fn, pos, load, &lo);
+        pos = copy_load(prog, fn, pos, limit, &hi);
+        pos = emit_offset(prog, fn, pos, &lo, &ranges[i]);
+        pos = emit_offset(prog, fn, pos, &hi, &ranges[i]);
+
+        snprintf(length, sizeof(length), "%lld", ranges[i].length);
+        const char* ops[] = {lo, hi, length};
+        pos = ir_insert_after(prog, pos, "chkrange", ops, 3);
+        free(lo);
+        free(hi);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Inlining
+//
+// Functions are visited callees first, so a callee's body has had its own
+// calls inlined before it is copied into a caller. A call to a function
+// that is still being visited closes a cycle of recursion and is left
+// alone. Every copy gets its own temps and labels; its variables live in a
+// region appended to the caller's locals, shared by all copies of the same
+// callee (they never run at the same time). A tail call is kept when the
+// callee makes tail calls of its own, so mutual recursion stays a chain of
+// jumps rather than growing the stack.
+
+#define INLINE_DEFAULT_THRESHOLD 24
+#define INLINE_MAX_CALLER_SIZE   4096
+#define INLINE_HOT_FACTOR        4
+
+static int inline_threshold = -1;
+
+typedef struct {
+    IRInstruction* func;
+    int state;          // 0 not visited, 1 being visited, 2 done
+    int region;         // offset of its variables in the current caller, or -1
+} InlineFunc;
+
+typedef struct {
+    IRProgram* prog;
+    InlineFunc* funcs;
+    int count;
+    int next_label;
+    int threshold;
+} Inliner;
+
+static bool is_label_name(const char* s) {
+    return s && s[0] == 'L' && isdigit((unsigned char)s[1]);
+}
+
+static IRInstruction* function_end(IRInstruction* func) {
+    IRInstruction* inst = func->next;
+    while (inst && !op_is(inst, "func")) inst = inst->next;
+    return inst;
+}
+
+static bool is_bookkeeping(const IRInstruction* inst) {
+    return op_is(inst, "func") || op_is(inst, "endfunc") || op_is(inst, "param") ||
+           op_is(inst, "label") || op_is(inst, "string") || op_is(inst, "float");
+}
+
+static int function_size(IRInstruction* func) {
+    int size = 0;
+    IRInstruction* end = function_end(func);
+    for (IRInstruction* inst = func->next; inst != end; inst = inst->next) {
+        if (!is_bookkeeping(inst)) size++;
+    }
+    return size;
+}
+
+// One past the largest temp number, or label number for 'L'.
+static int max_operand(IRInstruction* func, char kind) {
+    int limit = 0;
+    IRInstruction* end = function_end(func);
+    for (IRInstruction* inst = func->next; inst != end; inst = inst->next) {
+        for (int i = 0; i < 16; i++) {
+            const char* op = inst->operands[i];
+            bool match = kind == 'L' ? is_label_name(op) : is_temp(op);
+            if (match && atoi(op + 1) >= limit) limit = atoi(op + 1) + 1;
+        }
+    }
+    return limit;
+}
+
+// One past the largest label number in the program.
+static int label_limit(IRProgram* prog) {
+    int limit = 0;
+    for (IRInstruction* inst = prog->head; inst; inst = inst->next) {
+        for (int i = 0; i < 16; i++) {
+            const char* op = inst->operands[i];
+            if (is_label_name(op) && atoi(op + 1) >= limit) limit = atoi(op + 1) + 1;
+        }
+    }
+    return limit;
+}
+
+static int function_locals(IRInstruction* func) {
+    return func->operands[2] ? atoi(func->operands[2]) : 0;
+}
+
+static InlineFunc* find_function(Inliner* in, const char* name) {
+    for (int i = 0; i < in->count; i++) {
+        if (same(in->funcs[i].func->operands[0], name)) return &in->funcs[i];
+    }
+    return NULL;
+}
+
+static int param_count(IRInstruction* func) {
+    int count = 0;
+    IRInstruction* end = function_end(func);
+    for (IRInstruction* inst = func->next; inst != end; inst = inst->next) {
+        if (op_is(inst, "param")) count++;
+    }
+    return count;
+}
+
+static bool makes_tail_calls(IRInstruction* func) {
+    IRInstruction* end = function_end(func);
+    for (IRInstruction* inst = func->next; inst != end; inst = inst->next) {
+        if (is_tail_call(inst)) return true;
+    }
+    return false;
+}
+
+// Whether a backward jump after the call returns to a label before it.
+static bool call_in_loop(IRInstruction* func, IRInstruction* call) {
+    IRInstruction* end = function_end(func);
+    for (IRInstruction* jump = call->next; jump != end; jump = jump->next) {
+        if (!op_is(jump, "jmp")) continue;
+        for (IRInstruction* inst = func->next; inst != call; inst = inst->next) {
+            if (op_is(inst, "label") && same(inst->operands[0], jump->operands[0])) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Constant arguments let the copy fold, so each one raises the limit. With a
+// profile, call sites that never ran are left alone, and those that ran more
+// often than their caller was entered get a larger limit.
+static int inline_limit(Inliner* in, IRInstruction* caller, IRInstruction* call) {
+    if (call->count == 0) return -1;
+
+    int limit = in->threshold;
+    for (int i = 1; i < 16 && call->operands[i]; i++) {
+        long long value;
+        if (const_operand(caller->next, call, call->operands[i], &value)) {
+            limit += 4;
+        }
+    }
+    if (call->count >= 0 && caller->count >= 0) {
+        if (call->count > caller->count) {
+            limit *= INLINE_HOT_FACTOR;
+        }
+    } else if (call_in_loop(caller, call)) {
+        limit *= 2;
+    }
+    return limit;
+}
+
+typedef struct {
+    int temp_base;
+    int var_base;
+    int label_base;
+} Rename;
+
+static char* rename_operand(const char* op, const Rename* r) {
+    char buf[32];
+    if (is_temp(op)) {
+        snprintf(buf, sizeof(buf), "t%d", atoi(op + 1) + r->temp_base);
+    } else if (is_var(op)) {
+        snprintf(buf, sizeof(buf), "v%d", atoi(op + 1) + r->var_base);
+    } else if (is_label_name(op)) {
+        snprintf(buf, sizeof(buf), "L%d", atoi(op + 1) + r->label_base);
+    } else {
+        return xstrdup(op);
+    }
+    return xstrdup(buf);
+}
+
+static IRInstruction* insert_copy(IRProgram* prog, IRInstruction* pos, const IRInstruction* src,
+                                  const Rename* r) {
+    char* ops[16] = {NULL};
+    int count = 0;
+    while (count < 16 && src->operands[count]) {
+        // The callee of a call is a name, not an operand.
+        ops[count] = count == 0 && op_is(src, "call") ? xstrdup(src->operands[0])
+                                                       : rename_operand(src->operands[count], r);
+        count++;
+    }
+    pos = ir_insert_after(prog, pos, src->opcode, (const char* const*)ops, count);
+    pos->width = src->width;
+    pos->is_unsigned = src->is_unsigned;
+    pos->is_float = src->is_float;
+    pos->float_args = src->float_args;
+    pos->count = src->count;
+    for (int i = 0; i < count; i++) free(ops[i]);
+    return pos;
+}
+
+static IRInstruction* insert_mov(IRProgram* prog, IRInstruction* pos, const char* dest,
+                                 const char* src) {
+    const char* ops[] = {dest, src};
+    return ir_insert_after(prog, pos, "mov", ops, 2);
+}
+
+// Whether only string and float constants follow inst before endfunc.
+static bool ends_function(const IRInstruction* inst) {
+    for (inst = inst->next; inst; inst = inst->next) {
+        if (op_is(inst, "endfunc")) return true;
+        if (!op_is(inst, "string") && !op_is(inst, "float")) return false;
+    }
+    return false;
+}
+
+// Replaces call + getret (after prev) by a copy of the callee. Parameters
+// become moves from the arguments and every ret a move into the getret
+// temp, narrowed like getret would.
+static IRInstruction* expand_call(Inliner* in, IRInstruction* caller, int* caller_temps,
+                                  IRInstruction* prev, InlineFunc* callee) {
+    IRInstruction* call = prev->next;
+    IRInstruction* getret = call->next;
+    const char* result = getret->operands[0];
+
+    if (callee->region < 0) {
+        callee->region = (function_locals(caller) + 15) & ~15;
+        char locals[16];
+        snprintf(locals, sizeof(locals), "%d",
+                 callee->region + ((function_locals(callee->func) + 15) & ~15));
+        free(caller->operands[2]);
+        caller->operands[2] = xstrdup(locals);
+    }
+
+    Rename r = {*caller_temps, callee->region, in->next_label};
+    *caller_temps += max_operand(callee->func, 't');
+    in->next_label += max_operand(callee->func, 'L');
+
+    char end_label[16];
+    snprintf(end_label, sizeof(end_label), "L%d", in->next_label++);
+    bool jumps_to_end = false;
+
+    IRInstruction* pos = prev;
+    IRInstruction* end = function_end(callee->func);
+    IRInstruction* last = callee->func;
+    for (IRInstruction* inst = callee->func->next; inst != end; inst = inst->next) {
+        if (op_is(inst, "param")) {
+            char* dest = rename_operand(inst->operands[0], &r);
+            pos = insert_mov(in->prog, pos, dest, call->operands[atoi(inst->operands[1]) + 1]);
+            pos->width = inst->width;
+            pos->is_unsigned = inst->is_unsigned;
+            pos->is_float = inst->is_float;
+            free(dest);
+        } else if (op_is(inst, "ret")) {
+            if (inst->operands[0] && result) {
+                char* value = rename_operand(inst->operands[0], &r);
+                pos = insert_mov(in->prog, pos, result, value);
+                free(value);
+            }
+            if (!ends_function(inst)) {
+                const char* ops[] = {end_label};
+                pos = ir_insert_after(in->prog, pos, "jmp", ops, 1);
+                jumps_to_end = true;
+            }
+            last = inst;
+        } else if (!op_is(inst, "endfunc") && !op_is(inst, "string") && !op_is(inst, "float")) {
+            pos = insert_copy(in->prog, pos, inst, &r);
+            last = inst;
+        }
+    }
+
+    // Falling off the end returns 0.
+    if (!op_is(last, "ret") && result) {
+        pos = insert_mov(in->prog, pos, result, "0");
+    }
+    if (jumps_to_end) {
+        const char* ops[] = {end_label};
+        pos = ir_insert_after(in->prog, pos, "label", ops, 1);
+    }
+    if (result && !getret->is_float && getret->width && getret->width != 8) {
+        const char* ops[] = {result, result};
+        pos = ir_insert_after(in->prog, pos, "ext", ops, 2);
+        pos->width = getret->width;
+        pos->is_unsigned = getret->is_unsigned;
+    }
+
+    ir_remove_after(in->prog, pos);
+    ir_remove_after(in->prog, pos);
+    return pos;
+}
+
+static void update_frame(IRInstruction* func, int temps) {
+    int local_size = (function_locals(func) + 7) & ~7;
+    int frame_size = (local_size + temps * 8 + 15) & ~15;
+    if (func->operands[1] && frame_size > atoi(func->operands[1])) {
+        char frame[16];
+        snprintf(frame, sizeof(frame), "%d", frame_size);
+        free(func->operands[1]);
+        func->operands[1] = xstrdup(frame);
+    }
+}
+
+static void inline_calls(Inliner* in, InlineFunc* f) {
+    f->state = 1;
+
+    IRInstruction* end = function_end(f->func);
+    for (IRInstruction* inst = f->func->next; inst != end; inst = inst->next) {
+        InlineFunc* callee = op_is(inst, "call") ? find_function(in, inst->operands[0]) : NULL;
+        if (callee && callee->state == 0) {
+            inline_calls(in, callee);
+        }
+    }
+
+    for (int i = 0; i < in->count; i++) {
+        in->funcs[i].region = -1;
+    }
+    int temps = max_operand(f->func, 't');
+    int size = function_size(f->func);
+    bool changed = false;
+
+    IRInstruction* prev = f->func;
+    while (prev->next && !op_is(prev->next, "func")) {
+        IRInstruction* call = prev->next;
+        InlineFunc* callee = op_is(call, "call") ? find_function(in, call->operands[0]) : NULL;
+        if (!callee || callee->state != 2 || !call->next || !op_is(call->next, "getret")) {
+            prev = call;
+            continue;
+        }
+
+        int args = 0;
+        while (args < 15 && call->operands[args + 1]) args++;
+        int callee_size = function_size(callee->func);
+        if (args != param_count(callee->func) ||
+            callee_size > inline_limit(in, f->func, call) ||
+            (is_tail_call(call) && makes_tail_calls(callee->func)) ||
+            size + callee_size > INLINE_MAX_CALLER_SIZE) {
+            prev = call;
+            continue;
+        }
+
+        prev = expand_call(in, f->func, &temps, prev, callee);
+        size += callee_size;
+        changed = true;
+    }
+
+    if (changed) {
+        update_frame(f->func, temps);
+    }
+    f->state = 2;
+}
+
+static void inline_functions(IRProgram* prog, int threshold) {
+    Inliner in = {prog, NULL, 0, label_limit(prog), threshold};
+    int cap = 0;
+    for (IRInstruction* inst = prog->head; inst; inst = inst->next) {
+        if (op_is(inst, "func")) {
+            if (in.count == cap) {
+                cap = cap ? cap * 2 : 16;
+                in.funcs = xrealloc(in.funcs, cap * sizeof(InlineFunc));
+            }
+            in.funcs[in.count++] = (InlineFunc){inst, 0, -1};
+        }
+    }
+
+    for (int i = 0; i < in.count; i++) {
+        if (in.funcs[i].state == 0) {
+            inline_calls(&in, &in.funcs[i]);
+        }
+    }
+    free(in.funcs);
+}
+
+void ir_set_inline_threshold(int threshold) {
+    inline_threshold = threshold;
+}
+
+// ---------------------------------------------------------------------------
+// Tail calls
+//
+// A call whose result is returned as it is,
+//
+//     call f a b; getret tX; ret tX
+//
+// needs nothing from the caller's frame once the arguments are loaded. A
+// call to the function itself becomes moves into its parameters and a jump
+// back to the top; any other call becomes a tailcall, which codegen emits
+// as a jump after tearing the frame down. Only calls whose arguments all go
+// in registers qualify, and functions that take the address of a local are
+// left alone, as the callee could still be using it.
+
+#define TAIL_MAX_INT_ARGS   6
+#define TAIL_MAX_FLOAT_ARGS 8
+
+static bool register_args(const IRInstruction* call) {
+    int ints = 0, floats = 0;
+    for (int i = 1; i < 16 && call->operands[i]; i++) {
+        if ((call->float_args >> i) & 1) {
+            floats++;
+        } else {
+            ints++;
+        }
+    }
+    return ints <= TAIL_MAX_INT_ARGS && floats <= TAIL_MAX_FLOAT_ARGS;
+}
+
+// Arguments are temps computed before the call, so moving them into the
+// parameters in order cannot clobber one another.
+static bool temp_args(const IRInstruction* call) {
+    for (int i = 1; i < 16 && call->operands[i]; i++) {
+        if (is_var(call->operands[i])) return false;
+    }
+    return true;
+}
+
+// The label a self tail call jumps to, placed after the parameters are
+// stored; created on first use.
+static IRInstruction* entry_label(IRProgram* prog, Function* fn, IRInstruction** entry,
+                                  int* next_label) {
+    if (!*entry) {
+        IRInstruction* pos = fn->func;
+        while (pos->next != fn->end && op_is(pos->next, "param")) pos = pos->next;
+        char label[16];
+        snprintf(label, sizeof(label), "L%d", (*next_label)++);
+        const char* ops[] = {label};
+        *entry = ir_insert_after(prog, pos, "label", ops, 1);
+    }
+    return *entry;
+}
+
+static IRInstruction* expand_self_call(IRProgram* prog, Function* fn, IRInstruction* prev,
+                                       IRInstruction* entry) {
+    IRInstruction* call = prev->next;
+    IRInstruction* pos = prev;
+    for (IRInstruction* inst = fn->func->next; inst != fn->end; inst = inst->next) {
+        if (!op_is(inst, "param")) continue;
+        pos = insert_mov(prog, pos, inst->operands[0], call->operands[atoi(inst->operands[1]) + 1]);
+        pos->width = inst->width;
+        pos->is_unsigned = inst->is_unsigned;
+        pos->is_float = inst->is_float;
+    }
+    const char* ops[] = {entry->operands[0]};
+    pos = ir_insert_after(prog, pos, "jmp", ops, 1);
+
+    for (int i = 0; i < 3; i++) {
+        ir_remove_after(prog, pos);
+    }
+    return pos;
+}
+
+static void convert_tail_calls(IRProgram* prog, Function* fn, int* next_label) {
+    for (int v = 0; v < fn->var_limit; v++) {
+        if (fn->addr_taken[v]) return;
+    }
+
+    int params = param_count(fn->func);
+    IRInstruction* entry = NULL;
+    IRInstruction* prev = fn->func;
+    while (prev->next != fn->end) {
+        IRInstruction* call = prev->next;
+        if (!is_tail_call(call)) {
+            prev = call;
+            continue;
+        }
+
+        int args = 0;
+        while (args < 15 && call->operands[args + 1]) args++;
+        if (same(call->operands[0], fn->func->operands[0]) && args == params &&
+            temp_args(call)) {
+            prev = expand_self_call(prog, fn, prev, entry_label(prog, fn, &entry, next_label));
+            continue;
+        }
+        if (!register_args(call)) {
+            prev = call;
+            continue;
+        }
+
+        free(call->opcode);
+        call->opcode = xstrdup("tailcall");
+        ir_remove_after(prog, call);
+        ir_remove_after(prog, call);
+        prev = call;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Constant folding
+//
+// Within a basic block, tracks temps and variables holding known integer
+// constants (such as the arguments of an inlined call), rewrites loads of
+// them as immediates and folds arithmetic, extensions and branches on them.
+// Values are computed the way codegen would: 32-bit operations wrap and are
+// extended to 64 bits, division is signed.
+
+static long long extend(long long value, int width, bool is_unsigned) {
+    switch (width) {
+        case 1:  return is_unsigned ? (long long)(uint8_t)value : (long long)(int8_t)value;
+        case 2:  return is_unsigned ? (long long)(uint16_t)value : (long long)(int16_t)value;
+        case 4:  return is_unsigned ? (long long)(uint32_t)value : (long long)(int32_t)value;
+        default: return value;
+    }
+}
+
+static bool fold_binary(const IRInstruction* inst, long long a, long long b, long long* out) {
+    bool narrow = inst->width == 4;
+    unsigned long long ua = (unsigned long long)a;
+    unsigned long long ub = (unsigned long long)b;
+    int bits = narrow ? 32 : 64;
+    long long r;
+
+    if (narrow) {
+        a = (int32_t)a;
+        b = (int32_t)b;
+    }
+
+    if (op_is(inst, "add"))      r = (long long)(ua + ub);
+    else if (op_is(inst, "sub")) r = (long long)(ua - ub);
+    else if (op_is(inst, "mul")) r = (long long)(ua * ub);
+    else if (op_is(inst, "and")) r = a & b;
+    else if (op_is(inst, "or"))  r = a | b;
+    else if (op_is(inst, "xor")) r = a ^ b;
+    else if (op_is(inst, "shl")) r = (long long)(ua << (ub & (bits - 1)));
+    else if (op_is(inst, "shr")) {
+        unsigned count = (unsigned)(ub & (bits - 1));
+        if (inst->is_unsigned) {
+            r = (long long)((narrow ? (uint32_t)ua : ua) >> count);
+        } else {
+            r = a >> count;
+        }
+    }
+    else if (op_is(inst, "div") || op_is(inst, "mod")) {
+        long long min = narrow ? INT32_MIN : LLONG_MIN;
+        if (b == 0 || (a == min && b == -1)) return false;
+        r = op_is(inst, "div") ? a / b : a % b;
+    }
+    else if (op_is(inst, "eq")) { *out = a == b; return true; }
+    else if (op_is(inst, "ne")) { *out = a != b; return true; }
+    else if (op_is(inst, "lt")) { *out = a < b;  return true; }
+    else if (op_is(inst, "le")) { *out = a <= b; return true; }
+    else if (op_is(inst, "gt")) { *out = a > b;  return true; }
+    else if (op_is(inst, "ge")) { *out = a >= b; return true; }
+    else return false;
+
+    *out = narrow ? extend(r, 4, inst->is_unsigned) : r;
+    return true;
+}
+
+static bool fold_unary(const IRInstruction* inst, long long a, long long* out) {
+    long long r;
+    if (op_is(inst, "neg"))      r = (long long)(0ull - (unsigned long long)a);
+    else if (op_is(inst, "not")) r = ~a;
+    else if (op_is(inst, "ext")) { *out = extend(a, inst->width, inst->is_unsigned); return true; }
+    else return false;
+    *out = inst->width == 4 ? extend(r, 4, inst->is_unsigned) : r;
+    return true;
+}
+
+static void set_opcode(IRInstruction* inst, const char* opcode) {
+    free(inst->opcode);
+    inst->opcode = xstrdup(opcode);
+}
+
+// Turns inst into "mov dest value".
+static void make_const(IRInstruction* inst, long long value) {
+    char imm[32];
+    snprintf(imm, sizeof(imm), "%lld", value);
+    set_opcode(inst, "mov");
+    for (int i = 1; i < 16; i++) {
+        free(inst->operands[i]);
+        inst->operands[i] = NULL;
+    }
+    inst->operands[1] = xstrdup(imm);
+    inst->width = 0;
+    inst->is_unsigned = false;
+}
+
+typedef struct {
+    bool known;
+    long long value;
+    int width;          // bytes written, 8 for a full slot
+} KnownVar;
+
+typedef struct {
+    bool* temp_known;
+    long long* temp_value;
+    KnownVar* vars;
+    int temp_limit;
+    int var_limit;
+} Constants;
+
+static bool known_operand(Constants* c, const char* op, long long* value) {
+    if (is_immediate(op)) {
+        *value = atoll(op);
+        return true;
+    }
+    if (is_temp(op) && atoi(op + 1) < c->temp_limit && c->temp_known[atoi(op + 1)]) {
+        *value = c->temp_value[atoi(op + 1)];
+        return true;
+    }
+    return false;
+}
+
+static void fold_constants(IRProgram* prog, Function* fn) {
+    Constants c;
+    c.temp_limit = fn->temp_count + 1;
+    c.var_limit = fn->var_limit + 1;
+    c.temp_known = xcalloc(c.temp_limit, sizeof(bool));
+    c.temp_value = xcalloc(c.temp_limit, sizeof(long long));
+    c.vars = xcalloc(c.var_limit, sizeof(KnownVar));
+
+    IRInstruction* prev = fn->func;
+    while (prev->next != fn->end) {
+        IRInstruction* inst = prev->next;
+        const char* dest = inst->operands[0];
+        long long a, b, value = 0;
+
+        if (op_is(inst, "label")) {
+            memset(c.temp_known, 0, c.temp_limit * sizeof(bool));
+            memset(c.vars, 0, c.var_limit * sizeof(KnownVar));
+        } else if (op_is(inst, "brz") && known_operand(&c, dest, &a)) {
+            if (a != 0) {
+                ir_remove_after(prog, prev);
+                continue;
+            }
+            set_opcode(inst, "jmp");
+            free(inst->operands[0]);
+            inst->operands[0] = inst->operands[1];
+            inst->operands[1] = NULL;
+        } else if (op_is(inst, "mov") && is_var(dest)) {
+            KnownVar* var = &c.vars[atoi(dest + 1)];
+            var->known = !inst->is_float && known_operand(&c, inst->operands[1], &var->value);
+            var->width = inst->width ? inst->width : 8;
+        } else if (is_temp(dest) && defines_operand0(inst)) {
+            int t = atoi(dest + 1);
+            bool known = false;
+            if (inst->is_float) {
+                known = false;
+            } else if (op_is(inst, "mov") && is_var(inst->operands[1])) {
+                KnownVar* var = &c.vars[atoi(inst->operands[1] + 1)];
+                int width = inst->width ? inst->width : 8;
+                if (var->known && width <= var->width) {
+                    value = extend(var->value, width, inst->is_unsigned);
+                    make_const(inst, value);
+                    known = true;
+                }
+            } else if (op_is(inst, "mov")) {
+                known = known_operand(&c, inst->operands[1], &value);
+            } else if (inst->operands[2]) {
+                known = known_operand(&c, inst->operands[1], &a) &&
+                        known_operand(&c, inst->operands[2], &b) &&
+                        fold_binary(inst, a, b, &value);
+            } else if (inst->operands[1]) {
+                known = known_operand(&c, inst->operands[1], &a) && fold_unary(inst, a, &value);
+            }
+            if (known && !op_is(inst, "mov")) {
+                make_const(inst, value);
+            }
+            c.temp_known[t] = known;
+            c.temp_value[t] = value;
+        }
+
+        if (op_is(inst, "param") && is_var(dest)) {
+            c.vars[atoi(dest + 1)].known = false;
+        }
+        if (writes_memory(inst)) {
+            for (int v = 0; v < fn->var_limit; v++) {
+                if (fn->addr_taken[v]) c.vars[v].known = false;
+            }
+        }
+        prev = inst;
+    }
+
+    free(c.temp_known);
+    free(c.temp_value);
+    free(c.vars);
+}
+
+// ---------------------------------------------------------------------------
+// Dead temps
+//
+// Removes instructions whose only effect is to define a temp nothing reads.
+// Walking backwards lets a chain of dead definitions go in one pass.
+
+static bool is_pure(const IRInstruction* inst) {
+    static const char* const pure[] = {
+        "mov", "add", "sub", "mul", "and", "or", "xor", "shl", "shr", "neg", "not",
+        "eq", "ne", "lt", "le", "gt", "ge", "addr", "ext", "fconst", "itof", "ftoi",
+        "fext", "ftrunc"
+    };
+    for (size_t i = 0; i < sizeof(pure) / sizeof(pure[0]); i++) {
+        if (op_is(inst, pure[i])) return true;
+    }
+    return false;
+}
+
+static void remove_dead_temps(IRProgram* prog, Function* fn) {
+    int count = 0;
+    for (IRInstruction* inst = fn->func->next; inst != fn->end; inst = inst->next) count++;
+
+    IRInstruction** insts = xmalloc((count + 1) * sizeof(IRInstruction*));
+    bool* dead = xcalloc(count + 1, sizeof(bool));
+    int* uses = xcalloc(fn->temp_count + 1, sizeof(int));
+
+    int n = 0;
+    for (IRInstruction* inst = fn->func->next; inst != fn->end; inst = inst->next) {
+        insts[n++] = inst;
+        for (int i = defines_operand0(inst) ? 1 : 0; i < 16; i++) {
+            if (is_temp(inst->operands[i])) uses[atoi(inst->operands[i] + 1)]++;
+        }
+    }
+
+    for (int k = count - 1; k >= 0; k--) {
+        IRInstruction* inst = insts[k];
+        if (!is_temp(inst->operands[0]) || !defines_operand0(inst) || !is_pure(inst) ||
+            uses[atoi(inst->operands[0] + 1)] > 0) {
+            continue;
+        }
+        dead[k] = true;
+        for (int i = 1; i < 16; i++) {
+            if (is_temp(inst->operands[i])) uses[atoi(inst->operands[i] + 1)]--;
+        }
+    }
+
+    IRInstruction* prev = fn->func;
+    for (int k = 0; k < count; k++) {
+        if (dead[k]) {
+            ir_remove_after(prog, prev);
+        } else {
+            prev = insts[k];
+        }
+    }
+
+    free(insts);
+    free(dead);
+    free(uses);
+}
+
+// ---------------------------------------------------------------------------
+// Strength reduction
+//
+// A multiply by a power of two becomes a shift, and a div or mod by a
+// constant takes it as an immediate, which codegen divides by with a
+// multiply and shifts instead of a divide.
+//
+// In a loop, label L ... jmp L, entered only by falling into L, a variable
+// written once per iteration as
+//
+//     mov tA vI; add tB tA k; mov vI tB
+//
+// is an induction variable. Each product vI * c of it gets a variable of its
+// own, set to vI * c ahead of the loop and advanced by k * c right after vI
+// is written, and the multiply becomes a load of it. vI is assumed not to
+// overflow when the product is wider than it.
+
+#define MAX_LOOP_PRODUCTS 8
+
+typedef struct {
+    int defs;
+    bool constant;          // every definition is "mov t value"
+    long long value;
+    IRInstruction* def;     // the last definition
+} TempInfo;
+
+typedef struct {
+    TempInfo* temps;
+    int limit;
+} TempTable;
+
+typedef struct {
+    const char* var;
+    int width;              // of vI, 4 or 8
+    long long step;
+    IRInstruction* write;
+} Induction;
+
+typedef struct {
+    IRInstruction* load;    // mov tA vI ahead of the first multiply
+    long long factor;
+    int width;              // of the multiply
+    char* var;
+} Product;
+
+static void scan_temps(TempTable* t, Function* fn) {
+    t->limit = fn->temp_count;
+    t->temps = xcalloc(t->limit + 1, sizeof(TempInfo));
+    for (IRInstruction* inst = fn->func->next; inst != fn->end; inst = inst->next) {
+        const char* op = inst->operands[0];
+        if (!is_temp(op) || !defines_operand0(inst) || atoi(op + 1) >= t->limit) continue;
+        TempInfo* info = &t->temps[atoi(op + 1)];
+        bool constant = op_is(inst, "mov") && !inst->is_float && is_immediate(inst->operands[1]);
+        long long value = constant ? atoll(inst->operands[1]) : 0;
+        info->constant = constant && (info->defs == 0 || (info->constant && info->value == value));
+        info->value = value;
+        info->def = inst;
+        info->defs++;
+    }
+}
+
+static bool constant_value(TempTable* t, const char* op, long long* value) {
+    if (is_immediate(op)) {
+        *value = atoll(op);
+        return true;
+    }
+    if (!is_temp(op) || atoi(op + 1) >= t->limit) return false;
+    TempInfo* info = &t->temps[atoi(op + 1)];
+    *value = info->value;
+    return info->constant;
+}
+
+// The single definition of a temp, or NULL.
+static IRInstruction* only_def(TempTable* t, const char* op) {
+    if (!is_temp(op) || atoi(op + 1) >= t->limit) return NULL;
+    TempInfo* info = &t->temps[atoi(op + 1)];
+    return info->defs == 1 ? info->def : NULL;
+}
+
+static void set_operand(IRInstruction* inst, int i, const char* value) {
+    free(inst->operands[i]);
+    inst->operands[i] = value ? xstrdup(value) : NULL;
+}
+
+static bool fits_width(long long value, int width) {
+    return width != 4 || (value >= INT32_MIN && value <= INT32_MAX);
+}
+
+static void reduce_operators(Function* fn, TempTable* t) {
+    char imm[32];
+    for (IRInstruction* inst = fn->func->next; inst != fn->end; inst = inst->next) {
+        long long c;
+        if (inst->is_float) continue;
+        if (op_is(inst, "mul")) {
+            int side = constant_value(t, inst->operands[2], &c) ? 2
+                     : constant_value(t, inst->operands[1], &c) ? 1 : 0;
+            if (side == 0 || c < 2 || (c & (c - 1)) != 0 || !fits_width(c, inst->width)) {
+                continue;
+            }
+            int k = 0;
+            while (c >>= 1) k++;
+            if (side == 1) {
+                set_operand(inst, 1, inst->operands[2]);
+            }
+            snprintf(imm, sizeof(imm), "%d", k);
+            set_operand(inst, 2, imm);
+            set_opcode(inst, "shl");
+        } else if ((op_is(inst, "div") || op_is(inst, "mod")) && !inst->is_unsigned &&
+                   !is_immediate(inst->operands[2]) &&
+                   constant_value(t, inst->operands[2], &c) && (c >= 2 || c <= -2) &&
+                   fits_width(c, inst->width)) {
+            snprintf(imm, sizeof(imm), "%lld", c);
+            set_operand(inst, 2, imm);
+        }
+    }
+}
+
+// Whether op is a load of var, at the given width.
+static bool loads_var(TempTable* t, const char* op, const char* var, int width) {
+    IRInstruction* def = only_def(t, op);
+    return def && op_is(def, "mov") && !def->is_float && same(def->operands[1], var) &&
+           (def->width ? def->width : 8) == width;
+}
+
+// Matches the single write of an induction variable, mov vI (vI +/- k).
+static bool match_induction(TempTable* t, IRInstruction* write, Induction* iv) {
+    iv->var = write->operands[0];
+    iv->width = write->width ? write->width : 8;
+    iv->write = write;
+    if (!op_is(write, "mov") || write->is_float || (iv->width != 4 && iv->width != 8)) {
+        return false;
+    }
+
+    IRInstruction* step = only_def(t, write->operands[1]);
+    if (!step || step->is_float || (step->width ? step->width : 8) != iv->width) return false;
+    long long k;
+    if (op_is(step, "add") && loads_var(t, step->operands[1], iv->var, iv->width) &&
+        constant_value(t, step->operands[2], &k)) {
+        iv->step = k;
+    } else if (op_is(step, "add") && loads_var(t, step->operands[2], iv->var, iv->width) &&
+               constant_value(t, step->operands[1], &k)) {
+        iv->step = k;
+    } else if (op_is(step, "sub") && loads_var(t, step->operands[1], iv->var, iv->width) &&
+               constant_value(t, step->operands[2], &k)) {
+        iv->step = -k;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// A fresh 8-byte variable for the function, past its locals.
+static char* function_var(Function* fn) {
+    if (!fn->func->operands[1] || !fn->func->operands[2]) return NULL;
+
+    int locals = ((function_locals(fn->func) + 7) & ~7) + 8;
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", locals);
+    set_operand(fn->func, 2, buf);
+    update_frame(fn->func, fn->temp_count);
+
+    fn->addr_taken = xrealloc(fn->addr_taken, (locals + 1) * sizeof(bool));
+    memset(fn->addr_taken + fn->var_limit, 0, (locals + 1 - fn->var_limit) * sizeof(bool));
+    fn->var_limit = locals + 1;
+
+    snprintf(buf, sizeof(buf), "v%d", locals);
+    return xstrdup(buf);
+}
+
+// Whether every use of each label in (header, back] comes from within.
+static bool single_entry(Function* fn, IRInstruction* header, IRInstruction* back) {
+    for (IRInstruction* inst = header; inst != back->next; inst = inst->next) {
+        if (!op_is(inst, "label")) continue;
+        int inside = 0;
+        for (IRInstruction* use = header->next; use != back->next; use = use->next) {
+            if (op_is(use, "label")) continue;
+            for (int i = 0; i < 16; i++) {
+                if (same(use->operands[i], inst->operands[0])) inside++;
+            }
+        }
+        if (inside != label_uses(fn, inst->operands[0])) return false;
+    }
+    return true;
+}
+
+static IRInstruction* insert_op(IRProgram* prog, IRInstruction* pos, const char* opcode,
+                                const char* a, const char* b, const char* c, int width) {
+    const char* ops[] = {a, b, c};
+    pos = ir_insert_after(prog, pos, opcode, ops, c ? 3 : 2);
+    pos->width = width == 8 ? 0 : width;
+    return pos;
+}
+
+// Sets vS = vI * c ahead of the loop and advances it after the write of vI.
+static void start_product(IRProgram* prog, Function* fn, IRInstruction* pre,
+                          const Induction* iv, Product* p) {
+    char factor[32];
+    snprintf(factor, sizeof(factor), "%lld", p->factor);
+    char* index = function_temp(prog, fn);
+    char* product = function_temp(prog, fn);
+    IRInstruction* pos = insert_op(prog, pre, "mov", index, iv->var, NULL, iv->width);
+    pos->is_unsigned = p->load->is_unsigned;
+    pos = insert_op(prog, pos, "mul", product, index, factor, p->width);
+    insert_op(prog, pos, "mov", p->var, product, NULL, 8);
+    free(index);
+    free(product);
+
+    // The step wraps like the multiply would.
+    char step[32];
+    unsigned long long delta = (unsigned long long)iv->step * (unsigned long long)p->factor;
+    snprintf(step, sizeof(step), "%lld", p->width == 4 ? (long long)(int32_t)delta
+                                                          : (long long)delta);
+    char* old = function_temp(prog, fn);
+    char* next = function_temp(prog, fn);
+    pos = insert_op(prog, iv->write, "mov", old, p->var, NULL, 8);
+    pos = insert_op(prog, pos, "add", next, old, step, p->width);
+    insert_op(prog, pos, "mov", p->var, next, NULL, 8);
+    free(old);
+    free(next);
+}
+
+static void reduce_loop(IRProgram* prog, Function* fn, TempTable* t, IRInstruction* pre,
+                        IRInstruction* header) {
+    IRInstruction* back = NULL;
+    for (IRInstruction* inst = header->next; inst != fn->end; inst = inst->next) {
+        if (op_is(inst, "jmp") && same(inst->operands[0], header->operands[0])) back = inst;
+    }
+    if (!back || op_is(pre, "jmp") || op_is(pre, "ret") || op_is(pre, "tailcall") ||
+        op_is(pre, "case") || !single_entry(fn, header, back)) {
+        return;
+    }
+
+    Product products[MAX_LOOP_PRODUCTS];
+    Induction ivs[MAX_LOOP_PRODUCTS];
+    int count = 0;
+    bool* fresh = xcalloc(t->limit + 1, sizeof(bool));
+    for (IRInstruction* inst = header->next; inst != back; inst = inst->next) {
+        if (op_is(inst, "label")) {
+            memset(fresh, 0, t->limit * sizeof(bool));
+            continue;
+        }
+        int v = written_var(inst);
+        if (v >= 0) {
+            // Loads of the variable before its write are stale.
+            for (int i = 0; i < t->limit; i++) {
+                if (fresh[i] && same(t->temps[i].def->operands[1], inst->operands[0])) {
+                    fresh[i] = false;
+                }
+            }
+            continue;
+        }
+        if (op_is(inst, "mov") && is_temp(inst->operands[0]) && is_var(inst->operands[1]) &&
+            atoi(inst->operands[0] + 1) < t->limit && only_def(t, inst->operands[0])) {
+            fresh[atoi(inst->operands[0] + 1)] = true;
+            continue;
+        }
+        if (!op_is(inst, "mul") || inst->is_float || count == MAX_LOOP_PRODUCTS) continue;
+
+        long long c;
+        const char* index = inst->operands[1];
+        if (!constant_value(t, inst->operands[2], &c)) {
+            index = inst->operands[2];
+            if (!constant_value(t, inst->operands[1], &c)) continue;
+        }
+        IRInstruction* load = only_def(t, index);
+        if (!load || !op_is(load, "mov") || atoi(index + 1) >= t->limit ||
+            !fresh[atoi(index + 1)]) {
+            continue;
+        }
+        int v_index = atoi(load->operands[1] + 1);
+        if (v_index >= fn->var_limit || fn->addr_taken[v_index]) continue;
+
+        // vI must be written once in the loop, and loaded at its own width.
+        Induction iv;
+        IRInstruction* write = NULL;
+        int writes = 0;
+        for (IRInstruction* w = header->next; w != back; w = w->next) {
+            if (written_var(w) == v_index) {
+                write = w;
+                writes++;
+            }
+        }
+        if (writes != 1 || !match_induction(t, write, &iv) ||
+            !loads_var(t, index, iv.var, iv.width)) {
+            continue;
+        }
+
+        int width = inst->width == 4 ? 4 : 8;
+        int found = -1;
+        for (int i = 0; i < count; i++) {
+            if (same(ivs[i].var, iv.var) && products[i].factor == c &&
+                products[i].width == width &&
+                products[i].load->is_unsigned == load->is_unsigned) {
+                found = i;
+            }
+        }
+        if (found < 0) {
+            char* var = function_var(fn);
+            if (!var) break;
+            products[count] = (Product){load, c, width, var};
+            ivs[count] = iv;
+            found = count++;
+        }
+
+        set_opcode(inst, "mov");
+        set_operand(inst, 1, products[found].var);
+        set_operand(inst, 2, NULL);
+        inst->width = 0;
+        inst->is_unsigned = false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        start_product(prog, fn, pre, &ivs[i], &products[i]);
+        free(products[i].var);
+    }
+    free(fresh);
+}
+
+static void reduce_strength(IRProgram* prog, Function* fn) {
+    TempTable t;
+    scan_temps(&t, fn);
+    reduce_operators(fn, &t);
+
+    IRInstruction* prev = fn->func;
+    for (IRInstruction* cur = prev->next; cur != fn->end; prev = cur, cur = cur->next) {
+        if (op_is(cur, "label")) {
+            reduce_loop(prog, fn, &t, prev, cur);
+            while (prev->next != cur) prev = prev->next;
+        }
+    }
+    free(t.temps);
+}
+
+// ---------------------------------------------------------------------------
+// Control flow
+//
+// An integer compare whose only use is a brz becomes one compare-and-branch.
+// Jumps to a jmp, or to a brz on a value already known to be zero, go
+// straight to the final target. Code after an unconditional jump up to the
+// next label goes, as do jumps to the next instruction and labels nothing
+// jumps to, and "branch L1; jmp L2; label L1" becomes the inverted branch
+// to L2. Last, a loop tested at the top gets a copy of its test at the
+// bottom, so each iteration ends in one taken branch and the body falls
+// through.
+
+#define MAX_THREAD_HOPS  16
+#define MAX_ROTATE_TEST  4
+
+// The operand holding a jump's target label, or -1. A switch's own
+// target is its default.
+static int target_index(const IRInstruction* inst) {
+    if (op_is(inst, "jmp") || op_is(inst, "case")) return 0;
+    if (op_is(inst, "switch")) return 2;
+    if (op_is(inst, "brz") || op_is(inst, "jz") || op_is(inst, "jnz")) return 1;
+    if (is_compare_branch(inst)) return 2;
+    return -1;
+}
+
+static bool is_conditional(const IRInstruction* inst) {
+    return target_index(inst) > 0 && !op_is(inst, "switch");
+}
+
+static void set_target(IRInstruction* inst, const char* label) {
+    int i = target_index(inst);
+    free(inst->operands[i]);
+    inst->operands[i] = xstrdup(label);
+}
+
+static void invert_branch(IRInstruction* inst) {
+    if (is_compare_branch(inst)) {
+        char opcode[8];
+        snprintf(opcode, sizeof(opcode), "b%s", inverse_ops[compare_index(inst->opcode + 1)]);
+        set_opcode(inst, opcode);
+    } else {
+        set_opcode(inst, op_is(inst, "jnz") ? "brz" : "jnz");
+    }
+}
+
+static IRInstruction* find_label(Function* fn, const char* label) {
+    for (IRInstruction* inst = fn->func->next; inst != fn->end; inst = inst->next) {
+        if (op_is(inst, "label") && same(inst->operands[0], label)) return inst;
+    }
+    return NULL;
+}
+
+// The first instruction from inst on that is not a label.
+static IRInstruction* skip_labels(Function* fn, IRInstruction* inst) {
+    while (inst != fn->end && op_is(inst, "label")) inst = inst->next;
+    return inst;
+}
+
+// Whether only labels, one of them label, separate inst from what follows.
+static bool falls_into(Function* fn, IRInstruction* inst, const char* label) {
+    for (inst = inst->next; inst != fn->end && op_is(inst, "label"); inst = inst->next) {
+        if (same(inst->operands[0], label)) return true;
+    }
+    return false;
+}
+
+static void fuse_compares(IRProgram* prog, Function* fn) {
+    int* uses = xcalloc(fn->temp_count + 1, sizeof(int));
+    for (IRInstruction* inst = fn->func->next; inst != fn->end; inst = inst->next) {
+        for (int i = defines_operand0(inst) ? 1 : 0; i < 16; i++) {
+            if (is_temp(inst->operands[i])) uses[atoi(inst->operands[i] + 1)]++;
+        }
+    }
+
+    for (IRInstruction* cmp = fn->func->next; cmp != fn->end; cmp = cmp->next) {
+        IRInstruction* br = cmp->next;
+        int k = compare_index(cmp->opcode);
+        if (k < 0 || cmp->is_float || br == fn->end || !is_temp(cmp->operands[0]) ||
+            !(op_is(br, "brz") || op_is(br, "jz") || op_is(br, "jnz")) ||
+            !same(br->operands[0], cmp->operands[0]) ||
+            uses[atoi(cmp->operands[0] + 1)] != 1) {
+            continue;
+        }
+
+        char opcode[8];
+        snprintf(opcode, sizeof(opcode), "b%s", op_is(br, "jnz") ? compare_ops[k] : inverse_ops[k]);
+        set_opcode(cmp, opcode);
+        free(cmp->operands[0]);
+        cmp->operands[0] = cmp->operands[1];
+        cmp->operands[1] = cmp->operands[2];
+        cmp->operands[2] = xstrdup(br->operands[1]);
+        ir_remove_after(prog, cmp);
+    }
+    free(uses);
+}
+
+// Where a jump from inst to label ends up, or NULL if it stays there.
+static const char* thread_target(Function* fn, IRInstruction* inst, const char* label) {
+    IRInstruction* target = find_label(fn, label);
+    IRInstruction* next = target ? skip_labels(fn, target) : fn->end;
+    if (next == fn->end || next == inst) return NULL;
+
+    if (op_is(next, "jmp")) {
+        return next->operands[0];
+    }
+    // A brz jumps when its value is zero, so the same test is taken again.
+    bool on_zero = op_is(inst, "brz") || op_is(inst, "jz");
+    if (on_zero && (op_is(next, "brz") || op_is(next, "jz")) &&
+        same(next->operands[0], inst->operands[0])) {
+        return next->operands[1];
+    }
+    if (op_is(inst, "jnz") && op_is(next, "jnz") && same(next->operands[0], inst->operands[0])) {
+        return next->operands[1];
+    }
+    return NULL;
+}
+
+static bool thread_jumps(Function* fn) {
+    bool changed = false;
+    for (IRInstruction* inst = fn->func->next; inst != fn->end; inst = inst->next) {
+        int t = target_index(inst);
+        if (t < 0) continue;
+        for (int hop = 0; hop < MAX_THREAD_HOPS; hop++) {
+            const char* to = thread_target(fn, inst, inst->operands[t]);
+            if (!to || same(to, inst->operands[t])) break;
+            set_target(inst, to);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static bool remove_unreachable(IRProgram* prog, Function* fn) {
+    bool changed = false;
+    for (IRInstruction* inst = fn->func->next; inst != fn->end; inst = inst->next) {
+        if (!op_is(inst, "jmp") && !op_is(inst, "ret") && !op_is(inst, "tailcall") &&
+            !op_is(inst, "case")) {
+            continue;
+        }
+        // Only the last case of a switch ends the block.
+        if (op_is(inst, "case") && inst->next != fn->end && op_is(inst->next, "case")) continue;
+        // Pool constants are data, not code, and stay.
+        IRInstruction* pos = inst;
+        while (pos->next != fn->end && !op_is(pos->next, "label") &&
+               !op_is(pos->next, "endfunc")) {
+            if (op_is(pos->next, "string") || op_is(pos->next, "float")) {
+                pos = pos->next;
+            } else {
+                ir_remove_after(prog, pos);
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+static bool simplify_jumps(IRProgram* prog, Function* fn) {
+    bool changed = false;
+    IRInstruction* prev = fn->func;
+    while (prev->next != fn->end) {
+        IRInstruction* inst = prev->next;
+        IRInstruction* next = inst->next;
+        if (op_is(inst, "jmp") && falls_into(fn, inst, inst->operands[0])) {
+            ir_remove_after(prog, prev);
+            changed = true;
+            continue;
+        }
+        if (is_conditional(inst) && next != fn->end && op_is(next, "jmp") &&
+            falls_into(fn, next, inst->operands[target_index(inst)])) {
+            invert_branch(inst);
+            set_target(inst, next->operands[0]);
+            ir_remove_after(prog, inst);
+            changed = true;
+            continue;
+        }
+        prev = inst;
+    }
+    return changed;
+}
+
+static bool remove_unused_labels(IRProgram* prog, Function* fn) {
+    bool changed = false;
+    IRInstruction* prev = fn->func;
+    while (prev->next != fn->end) {
+        IRInstruction* inst = prev->next;
+        if (op_is(inst, "label") && label_uses(fn, inst->operands[0]) == 0) {
+            ir_remove_after(prog, prev);
+            changed = true;
+            continue;
+        }
+        prev = inst;
+    }
+    return changed;
+}
+
+// jmp L back to "label L; test...; branch X" with X right after the jmp:
+// the jmp becomes a copy of the test branching back into the body.
+static void rotate_loop(IRProgram* prog, Function* fn, IRInstruction* prev, int* next_label) {
+    IRInstruction* jump = prev->next;
+    IRInstruction* header = find_label(fn, jump->operands[0]);
+    IRInstruction* inst = header;
+    while (inst != fn->end && inst != jump) inst = inst->next;
+    if (inst != jump) return;
+
+    IRInstruction* test = header->next;
+    IRInstruction* branch = test;
+    int length = 0;
+    while (branch != fn->end && length <= MAX_ROTATE_TEST && is_pure(branch)) {
+        branch = branch->next;
+        length++;
+    }
+    if (branch == fn->end || length > MAX_ROTATE_TEST || !is_conditional(branch) ||
+        !falls_into(fn, jump, branch->operands[target_index(branch)])) {
+        return;
+    }
+
+    char body[16];
+    snprintf(body, sizeof(body), "L%d", (*next_label)++);
+    const char* ops[] = {body};
+    ir_insert_after(prog, branch, "label", ops, 1);
+
+    Rename none = {0, 0, 0};
+    IRInstruction* pos = prev;
+    for (IRInstruction* inst = test; inst != branch->next; inst = inst->next) {
+        pos = insert_copy(prog, pos, inst, &none);
+    }
+    invert_branch(pos);
+    set_target(pos, body);
+    ir_remove_after(prog, pos);
+}
+
+static void clean_up_jumps(IRProgram* prog, Function* fn) {
+    bool changed = true;
+    for (int round = 0; changed && round < 8; round++) {
+        changed = thread_jumps(fn);
+        changed |= remove_unreachable(prog, fn);
+        changed |= simplify_jumps(prog, fn);
+        changed |= remove_unused_labels(prog, fn);
+    }
+}
+
+static void simplify_cfg(IRProgram* prog, Function* fn, int* next_label) {
+    fuse_compares(prog, fn);
+    clean_up_jumps(prog, fn);
+
+    for (IRInstruction* prev = fn->func; prev->next != fn->end; prev = prev->next) {
+        if (op_is(prev->next, "jmp")) {
+            rotate_loop(prog, fn, prev, next_label);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Switches
+//
+// A pwease/nowu ladder testing one variable against constants,
+//
+//     mov tA vX; mov tK 1; bne tA tK L1; <case 1>; jmp ...
+//     label L1; mov tA vX; mov tK 2; bne tA tK L2; <case 2>; jmp ...
+//     label L2; <default>
+//
+// where each L is only reached by its failed test, dispatches once instead:
+// through a jump table when the values are dense,
+//
+//     switch tA min Ldefault; case L; case L; ...
+//
+// (each case covering one value from min up; codegen bounds-checks the
+// index and puts the table in .rodata), and through a binary search over
+// the values otherwise.
+
+#define MIN_SWITCH_CASES 4
+#define MAX_JUMP_TABLE   1024
+#define MIN_TABLE_DENSITY 3     // at most 1 in 3 table entries unused
+#define SWITCH_LINEAR    3      // ranges this small are searched linearly
+
+typedef struct {
+    IRInstruction* prev;        // instruction before the test
+    IRInstruction* branch;      // its bne
+    int length;                 // instructions in the test
+    const char* temp;
+    const char* var;
+    int width;
+    bool is_unsigned;
+    long long value;
+} CaseTest;
+
+typedef struct {
+    long long value;
+    int order;
+    char label[16];
+} SwitchCase;
+
+// "mov tA vX; mov tK c; bne tA tK L" with the movs in either order and the
+// operands of bne either way round, or "mov tA vX; bne tA c L".
+static bool match_case_test(Function* fn, IRInstruction* prev, CaseTest* t) {
+    IRInstruction* load = NULL;
+    const char* konst = NULL;
+    IRInstruction* inst = prev->next;
+    int length = 0;
+    for (; inst != fn->end && length < 2 && op_is(inst, "mov") && is_temp(inst->operands[0]);
+         inst = inst->next, length++) {
+        if (is_var(inst->operands[1]) && !load) {
+            load = inst;
+        } else if (is_immediate(inst->operands[1]) && !konst) {
+            konst = inst->operands[0];
+        } else {
+            return false;
+        }
+    }
+    if (!load || inst == fn->end || !op_is(inst, "bne")) return false;
+
+    const char* value = NULL;
+    const char* a = inst->operands[0];
+    const char* b = inst->operands[1];
+    if (same(a, load->operands[0])) {
+        value = b;
+    } else if (same(b, load->operands[0])) {
+        value = a;
+    }
+    if (!value) return false;
+    if (konst && same(value, konst)) {
+        IRInstruction* def = load == prev->next ? load->next : prev->next;
+        value = def->operands[1];
+    } else if (!is_immediate(value) || length != 1) {
+        return false;
+    }
+
+    t->value = strtoll(value, NULL, 10);
+    // Compared at 32 bits, a constant out of range would be truncated.
+    if (inst->width == 4 && (t->value < INT32_MIN || t->value > INT32_MAX)) return false;
+    if (inst->width == 4 && (load->width == 0 || load->width == 8)) return false;
+
+    t->prev = prev;
+    t->branch = inst;
+    t->length = length + 1;
+    t->temp = load->operands[0];
+    t->var = load->operands[1];
+    t->width = load->width;
+    t->is_unsigned = load->is_unsigned;
+    return true;
+}
+
+static IRInstruction* instruction_before(Function* fn, IRInstruction* target) {
+    for (IRInstruction* inst = fn->func; inst != fn->end; inst = inst->next) {
+        if (inst->next == target) return inst;
+    }
+    return NULL;
+}
+
+// The test after the one failing to label, when nothing else reaches it.
+static bool next_case_test(Function* fn, const CaseTest* last, CaseTest* t) {
+    const char* label = last->branch->operands[2];
+    IRInstruction* target = find_label(fn, label);
+    if (!target || label_uses(fn, label) != 1) return false;
+
+    IRInstruction* before = instruction_before(fn, target);
+    if (!before || !(op_is(before, "jmp") || op_is(before, "ret") ||
+                     op_is(before, "tailcall"))) {
+        return false;
+    }
+    return match_case_test(fn, target, t) && same(t->var, last->var) &&
+           t->width == last->width && t->is_unsigned == last->is_unsigned;
+}
+
+static int compare_cases(const void* a, const void* b) {
+    long long x = ((const SwitchCase*)a)->value;
+    long long y = ((const SwitchCase*)b)->value;
+    if (x != y) return (x > y) - (x < y);
+    return ((const SwitchCase*)a)->order - ((const SwitchCase*)b)->order;
+}
+
+static IRInstruction* insert_branch(IRProgram* prog, IRInstruction* pos, const char* opcode,
+                                    const char* value, long long constant, const char* label) {
+    char imm[32];
+    snprintf(imm, sizeof(imm), "%lld", constant);
+    const char* ops[] = {value, imm, label};
+    return ir_insert_after(prog, pos, opcode, ops, 3);
+}
+
+// Binary search over cases[lo, hi); values are compared as the extended
+// 64-bit temp.
+static IRInstruction* emit_search(IRProgram* prog, IRInstruction* pos, const char* value,
+                                  SwitchCase* cases, int lo, int hi, const char* fallback,
+                                  int* next_label) {
+    if (hi - lo <= SWITCH_LINEAR) {
+        for (int i = lo; i < hi; i++) {
+            pos = insert_branch(prog, pos, "beq", value, cases[i].value, cases[i].label);
+        }
+        const char* ops[] = {fallback};
+        return ir_insert_after(prog, pos, "jmp", ops, 1);
+    }
+
+    int mid = lo + (hi - lo) / 2;
+    char left[16];
+    snprintf(left, sizeof(left), "L%d", (*next_label)++);
+    pos = insert_branch(prog, pos, "blt", value, cases[mid].value, left);
+    pos = insert_branch(prog, pos, "beq", value, cases[mid].value, cases[mid].label);
+    pos = emit_search(prog, pos, value, cases, mid + 1, hi, fallback, next_label);
+    const char* ops[] = {left};
+    pos = ir_insert_after(prog, pos, "label", ops, 1);
+    return emit_search(prog, pos, value, cases, lo, mid, fallback, next_label);
+}
+
+static IRInstruction* emit_jump_table(IRProgram* prog, IRInstruction* pos, const char* value,
+                                      SwitchCase* cases, int count, const char* fallback) {
+    char min[32];
+    snprintf(min, sizeof(min), "%lld", cases[0].value);
+    const char* ops[] = {value, min, fallback};
+    pos = ir_insert_after(prog, pos, "switch", ops, 3);
+
+    int next = 0;
+    for (long long v = cases[0].value; v <= cases[count - 1].value; v++) {
+        const char* label = fallback;
+        if (cases[next].value == v) {
+            label = cases[next++].label;
+        }
+        pos = ir_insert_after(prog, pos, "case", &label, 1);
+    }
+    return pos;
+}
+
+static void lower_switch(IRProgram* prog, Function* fn, CaseTest* tests, int count,
+                         int* next_label) {
+    SwitchCase* cases = xmalloc(count * sizeof(SwitchCase));
+    // The tests go, and their operands with them.
+    char* value = xstrdup(tests[0].temp);
+    char* var = xstrdup(tests[0].var);
+    const char* fallback = tests[count - 1].branch->operands[2];
+    char* default_label = xstrdup(fallback);
+
+    // Each case body gets a label in place of its test; the labels the
+    // failed tests jumped to go with them.
+    for (int i = 0; i < count; i++) {
+        snprintf(cases[i].label, sizeof(cases[i].label), "L%d", (*next_label)++);
+        cases[i].value = tests[i].value;
+        cases[i].order = i;
+        ir_insert_after(prog, tests[i].branch, "label",
+                        (const char* const[]){cases[i].label}, 1);
+        IRInstruction* prev = tests[i].prev;
+        if (i > 0) {
+            prev = instruction_before(fn, prev);
+            ir_remove_after(prog, prev);
+        }
+        for (int k = 0; k < tests[i].length; k++) {
+            ir_remove_after(prog, prev);
+        }
+        tests[i].prev = prev;
+    }
+
+    IRInstruction* pos = tests[0].prev;
+    const char* load_ops[] = {value, var};
+    pos = ir_insert_after(prog, pos, "mov", load_ops, 2);
+    pos->width = tests[0].width;
+    pos->is_unsigned = tests[0].is_unsigned;
+
+    // The first of equal values wins, as in the ladder.
+    qsort(cases, count, sizeof(SwitchCase), compare_cases);
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        if (unique == 0 || cases[unique - 1].value != cases[i].value) {
+            cases[unique++] = cases[i];
+        }
+    }
+
+    long long range = cases[unique - 1].value - cases[0].value + 1;
+    if (range <= MAX_JUMP_TABLE && range <= (long long)unique * MIN_TABLE_DENSITY &&
+        cases[0].value >= INT32_MIN && cases[unique - 1].value <= INT32_MAX) {
+        emit_jump_table(prog, pos, value, cases, unique, default_label);
+    } else {
+        emit_search(prog, pos, value, cases, 0, unique, default_label, next_label);
+    }
+
+    free(value);
+    free(var);
+    free(default_label);
+    free(cases);
+}
+
+static void lower_switches(IRProgram* prog, Function* fn, int* next_label) {
+    bool changed = false;
+    for (IRInstruction* prev = fn->func; prev->next != fn->end; prev = prev->next) {
+        CaseTest first;
+        if (!match_case_test(fn, prev, &first)) continue;
+
+        int count = 1, cap = 8;
+        CaseTest* tests = xmalloc(cap * sizeof(CaseTest));
+        tests[0] = first;
+        CaseTest t;
+        while (next_case_test(fn, &tests[count - 1], &t)) {
+            if (count == cap) {
+                cap *= 2;
+                tests = xrealloc(tests, cap * sizeof(CaseTest));
+            }
+            tests[count++] = t;
+        }
+
+        if (count >= MIN_SWITCH_CASES) {
+            lower_switch(prog, fn, tests, count, next_label);
+            changed = true;
+        }
+        free(tests);
+    }
+
+    if (changed) {
+        remove_unused_labels(prog, fn);
+        remove_unreachable(prog, fn);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Block layout
+//
+// Cold blocks move out of their function's way, after endfunc behind a
+// "cold <function>" marker; codegen puts them into .text.unlikely. With a
+// profile (--profile-use), a block is cold when it ran at most
+// 1/COLD_BLOCK_RATIO as often as the hottest block of its function (a
+// block's count is the highest of its instructions'; the ones the passes
+// made have none). Without one, blocks that end the program (uwu_exit,
+// uwu_abort) are. The entry block always stays. Blocks keep their order,
+// and one that fell through into a block that no longer follows it jumps
+// there instead.
+
+#define COLD_BLOCK_RATIO 1000
+
+typedef struct {
+    IRInstruction* first;
+    IRInstruction* last;
+    long long count;
+} Block;
+
+static bool ends_block(Function* fn, const IRInstruction* inst) {
+    if (op_is(inst, "case")) return inst->next == fn->end || !op_is(inst->next, "case");
+    return op_is(inst, "ret") || op_is(inst, "tailcall") ||
+           (target_index(inst) >= 0 && !op_is(inst, "switch"));
+}
+
+static bool can_fall_through(const IRInstruction* last) {
+    return !op_is(last, "jmp") && !op_is(last, "ret") && !op_is(last, "tailcall") &&
+           !op_is(last, "case");
+}
+
+// Splits the body before endfunc into blocks; returns their number.
+static int split_blocks(Function* fn, IRInstruction* endfunc, Block** out) {
+    int count = 0;
+    int cap = 16;
+    Block* blocks = xmalloc(cap * sizeof(Block));
+    IRInstruction* start = fn->func->next;
+    for (IRInstruction* inst = start; inst != endfunc; inst = inst->next) {
+        bool last = inst->next == endfunc || ends_block(fn, inst) ||
+                    op_is(inst->next, "label");
+        if (!last) continue;
+        if (count == cap) {
+            cap *= 2;
+            blocks = xrealloc(blocks, cap * sizeof(Block));
+        }
+        Block* b = &blocks[count++];
+        b->first = start;
+        b->last = inst;
+        b->count = -1;
+        for (IRInstruction* i = start; i != inst->next; i = i->next) {
+            if (i->count > b->count) b->count = i->count;
+        }
+        start = inst->next;
+    }
+    *out = blocks;
+    return count;
+}
+
+static bool exits_program(const Block* b) {
+    for (IRInstruction* inst = b->first; inst != b->last->next; inst = inst->next) {
+        if (op_is(inst, "call") &&
+            (same(inst->operands[0], "uwu_exit") || same(inst->operands[0], "uwu_abort"))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void layout_blocks(IRProgram* prog, Function* fn, int* next_label) {
+    IRInstruction* endfunc = fn->func->next;
+    while (endfunc != fn->end && !op_is(endfunc, "endfunc")) endfunc = endfunc->next;
+    if (endfunc == fn->end || endfunc == fn->func->next) return;
+
+    Block* blocks;
+    int count = split_blocks(fn, endfunc, &blocks);
+    long long hottest = 0;
+    for (int i = 0; i < count; i++) {
+        if (blocks[i].count > hottest) hottest = blocks[i].count;
+    }
+
+    // A function that never ran is cold as a whole, not block by block.
+    bool profiled = fn->func->count >= 0;
+    bool* cold = xcalloc(count, sizeof(bool));
+    int hot_count = count;
+    for (int i = 1; i < count; i++) {
+        if (profiled) {
+            cold[i] = hottest > 0 && blocks[i].count >= 0 &&
+                      blocks[i].count * COLD_BLOCK_RATIO <= hottest;
+        } else {
+            cold[i] = exits_program(&blocks[i]);
+        }
+        if (cold[i]) hot_count--;
+    }
+
+    if (hot_count < count) {
+        int* order = xmalloc(count * sizeof(int));
+        int* position = xmalloc(count * sizeof(int));
+        int placed = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            for (int i = 0; i < count; i++) {
+                if (cold[i] == (pass == 1)) {
+                    position[i] = placed;
+                    order[placed++] = i;
+                }
+            }
+        }
+
+        // Block i used to fall into block i + 1, or endfunc (count) for the
+        // last. Now the last hot block falls into endfunc and the last cold
+        // one into nothing (-1).
+        IRInstruction* tail = endfunc;
+        for (int i = 0; i < count; i++) {
+            int p = position[i];
+            int next = p == hot_count - 1 ? count : p + 1 < count ? order[p + 1] : -1;
+            if (next == i + 1 || !can_fall_through(blocks[i].last)) continue;
+
+            IRInstruction* target = i + 1 < count ? blocks[i + 1].first : tail;
+            if (!op_is(target, "label")) {
+                char label[16];
+                snprintf(label, sizeof(label), "L%d", (*next_label)++);
+                const char* ops[] = {label};
+                target = ir_insert_after(prog, blocks[i].last, "label", ops, 1);
+                if (i + 1 < count) {
+                    blocks[i + 1].first = target;
+                } else {
+                    tail = target;
+                }
+            }
+            const char* ops[] = {target->operands[0]};
+            blocks[i].last = ir_insert_after(prog, blocks[i].last, "jmp", ops, 1);
+        }
+
+        const char* ops[] = {fn->func->operands[0]};
+        IRInstruction* marker = ir_insert_after(prog, endfunc, "cold", ops, 1);
+        IRInstruction* rest = marker->next;
+        IRInstruction* prev = fn->func;
+        for (int p = 0; p < count; p++) {
+            if (p == hot_count) {
+                prev->next = tail;
+                prev = marker;
+            }
+            prev->next = blocks[order[p]].first;
+            prev = blocks[order[p]].last;
+        }
+        prev->next = rest;
+        if (!rest) prog->tail = prev;
+        clean_up_jumps(prog, fn);
+
+        free(order);
+        free(position);
+    }
+
+    free(cold);
+    free(blocks);
+}
+
+void ir_optimize(IRProgram* prog, int opt_level) {
+    if (!prog || opt_level < 1) return;
+
+    int threshold = inline_threshold;
+    if (threshold < 0) {
+        threshold = opt_level >= 2 ? INLINE_DEFAULT_THRESHOLD : 0;
+    }
+    if (threshold > 0) {
+        inline_functions(prog, threshold);
+    }
+
+    int next_label = label_limit(prog);
+    IRInstruction* inst = prog->head;
+    while (inst) {
+        if (!op_is(inst, "func")) {
+            inst = inst->next;
+            continue;
+        }
+
+        Function fn;
+        scan_function(&fn, inst);
+
+        convert_tail_calls(prog, &fn, &next_label);
+        if (opt_level >= 2) {
+            fold_constants(prog, &fn);
+        }
+
+        IRInstruction* prev = fn.func;
+        for (IRInstruction* cur = prev->next; cur != fn.end; prev = cur, cur = cur->next) {
+            if (op_is(cur, "label")) {
+                hoist_loop_checks(prog, &fn, prev, cur);
+                // Checks may have been inserted after prev.
+                while (prev->next != cur) prev = prev->next;
+            }
+        }
+        remove_redundant_checks(prog, &fn);
+        reduce_strength(prog, &fn);
+        simplify_cfg(prog, &fn, &next_label);
+        if (opt_level >= 2) {
+            remove_dead_temps(prog, &fn);
+        }
+        // Folded tests only match once their dead temps are gone.
+        lower_switches(prog, &fn, &next_label);
+        layout_blocks(prog, &fn, &next_label);
+
+        free(fn.addr_taken);
+        inst = fn.end;
+    }
+}
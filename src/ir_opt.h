@@ -0,0 +1,43 @@
+#ifndef IR_OPT_H
+#define IR_OPT_H
+
+#include "ir.h"
+
+// Optimizations on the generated IR, run between ir_generate and codegen.
+// Level 0 leaves the program untouched; -O2 also inlines small functions
+// and folds constants.
+//
+// Calls in tail position (gimme f(...)) leave the caller's frame first: a
+// function calling itself loops back to its entry, other callees are
+// jumped to.
+//
+// Safe-mode checks (chkbounds, chknull) are dropped when they are already
+// known to hold, and the bounds checks of a counted loop
+//
+//     label L; mov tA vI; mov tB n; lt tC tA tB; brz tC Lend; ... jmp L
+//
+// are replaced by a single chkrange ahead of it.
+//
+// Multiplies by powers of two become shifts, divisions by constants are
+// left to codegen as multiplies by the reciprocal, and products of a loop's
+// induction variable and a constant are kept up to date by additions.
+//
+// Last, the control flow is cleaned up: compares feeding a branch become
+// compare-and-branch instructions (blt, bge, ...), jump chains are
+// threaded, unreachable code and empty blocks go, and loops are rotated so
+// that their body falls through. Ladders of pwease (x == c) tests on one
+// variable then dispatch in one step, through a jump table when the values
+// are dense and a binary search otherwise.
+//
+// Given a profile (see profile.h), calls that never ran are not inlined and
+// calls hotter than their caller's entry get a larger budget. Blocks that
+// hardly ever run, or without a profile those that end the program, move
+// behind the function's endfunc, after a "cold" marker, for codegen to put
+// into .text.unlikely.
+void ir_optimize(IRProgram* prog, int opt_level);
+
+// Largest callee, in IR instructions, that calls are inlined from; 0
+// disables inlining. By default it is 24 at -O2 and off below.
+void ir_set_inline_threshold(int threshold);
+
+#endif
@@ -1,9 +1,20 @@
+#define _GNU_SOURCE
 #include "jit_engine.h"
+#include "util.h"
+#include "../stdlib/uwu_stdlib.h"
+#include <dlfcn.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
+#define JIT_PAGE_SIZE 4096
+
+static void free_edge_stubs(void);
+
 JITContext *jit_create(TargetArch arch, JITTier tier) {
     JITContext *jit = calloc(1, sizeof(JITContext));
     jit->tier = tier;
@@ -13,28 +24,28 @@ JITContext *jit_create(TargetArch arch, JITTier tier) {
     jit->symtab = NULL;
     jit->reg_alloc = NULL;
     jit->codegen = codegen_create(8192);
-    
+
     jit->config.enable_prof = (tier == JIT_ADAPTIVE);
     jit->config.enable_type_feedback = (tier == JIT_ADAPTIVE);
     jit->config.enable_inline_cache = (tier == JIT_ADAPTIVE);
     jit->config.enable_speculative = (tier == JIT_OPTIMIZED || tier == JIT_ADAPTIVE);
     jit->config.recomp_threshold = 1000;
-    
+
     jit->symbol_resolver = NULL;
-    
+
     return jit;
 }
 
 void jit_destroy(JITContext *jit) {
     if (!jit) return;
-    
+
     CodeBlock *cb = jit->code_blocks;
     while (cb) {
         CodeBlock *next = cb->next;
         free_exec_mem(cb);
         cb = next;
     }
-    
+
     Symbol *sym = jit->symtab;
     while (sym) {
         Symbol *next = sym->next;
@@ -42,40 +53,61 @@ void jit_destroy(JITContext *jit) {
         free(sym);
         sym = next;
     }
-    
+
+    if (jit->funcs) {
+        for (Function *f = jit->module->funcs; f; f = f->next_func) {
+            free(jit->funcs[f->index].blocks);
+        }
+        free(jit->funcs);
+    }
+
     codegen_destroy(jit->codegen);
     free(jit);
+    free_edge_stubs();
 }
 
+// Code goes below the executable where the kernel lets it, so that calls
+// into the runtime reach with a rel32 rather than through a stub (FIX_PLT).
+// mmap takes the hint only where nothing is mapped.
+#define JIT_NEAR_RANGE (1u << 30)
+static uintptr_t code_hint;
+
 CodeBlock *alloc_exec_mem(size_t code_sz, size_t data_sz) {
     CodeBlock *cb = calloc(1, sizeof(CodeBlock));
-    
+
     size_t page_sz = sysconf(_SC_PAGESIZE);
     size_t code_pages = (code_sz + page_sz - 1) / page_sz;
     size_t data_pages = (data_sz + page_sz - 1) / page_sz;
-    
-    cb->code_size = code_pages * page_sz;
+
+    cb->code_size = (code_pages ? code_pages : 1) * page_sz;
     cb->data_size = data_pages * page_sz;
-    
-    cb->code_mem = mmap(NULL, cb->code_size, PROT_READ | PROT_WRITE,
+
+    if (!code_hint) {
+        uintptr_t runtime = (uintptr_t)uwu_init & ~(uintptr_t)(page_sz - 1);
+        code_hint = runtime > JIT_NEAR_RANGE ? runtime - JIT_NEAR_RANGE / 2 : 0;
+    }
+    cb->code_mem = mmap((void *)code_hint, cb->code_size, PROT_READ | PROT_WRITE,
                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    
+
     if (cb->code_mem == MAP_FAILED) {
         free(cb);
         return NULL;
     }
-    
+    if (code_hint && (uintptr_t)cb->code_mem == code_hint) {
+        code_hint += cb->code_size;
+    }
+
     if (data_sz > 0) {
         cb->data_mem = mmap(NULL, cb->data_size, PROT_READ | PROT_WRITE,
                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        
+
         if (cb->data_mem == MAP_FAILED) {
             munmap(cb->code_mem, cb->code_size);
             free(cb);
             return NULL;
         }
     }
-    
+
     cb->is_executable = false;
     cb->next = NULL;
     return cb;
@@ -90,13 +122,25 @@ void free_exec_mem(CodeBlock *cb) {
 
 void make_executable(CodeBlock *cb) {
     if (!cb || cb->is_executable) return;
-    mprotect(cb->code_mem, cb->code_size, PROT_READ | PROT_EXEC);
+    if (mprotect(cb->code_mem, cb->code_size, PROT_READ | PROT_EXEC) != 0) {
+        error("jit: cannot make code executable");
+    }
     cb->is_executable = true;
 }
 
+// Whether pages can be made executable at all: a W^X policy may refuse.
+static bool exec_memory_available(void) {
+    size_t page_sz = sysconf(_SC_PAGESIZE);
+    void *page = mmap(NULL, page_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) return false;
+    bool ok = mprotect(page, page_sz, PROT_READ | PROT_EXEC) == 0;
+    munmap(page, page_sz);
+    return ok;
+}
+
 void jit_add_symbol(JITContext *jit, const char *name, void *addr) {
     if (!jit || !name) return;
-    
+
     Symbol *sym = calloc(1, sizeof(Symbol));
     sym->symbol = strdup(name);
     sym->addr = addr;
@@ -107,7 +151,7 @@ void jit_add_symbol(JITContext *jit, const char *name, void *addr) {
 
 void *jit_lookup_symbol(JITContext *jit, const char *name) {
     if (!jit || !name) return NULL;
-    
+
     Symbol *sym = jit->symtab;
     while (sym) {
         if (strcmp(sym->symbol, name) == 0) {
@@ -115,60 +159,159 @@ void *jit_lookup_symbol(JITContext *jit, const char *name) {
         }
         sym = sym->next;
     }
-    
+
     return NULL;
 }
 
-void *jit_compile_func(JITContext *jit, Function *f) {
-    if (!jit || !f) return NULL;
-    
-    jit->reg_alloc = regalloc_create(f->vreg_counter);
-    regalloc_allocate(jit->reg_alloc, f);
-    
-    jit->codegen->pos = 0;
-    
-    int frame_sz = f->vreg_counter * 8;
-    if (jit->arch == ARCH_X86_64) {
-        x64_emit_prologue(jit->codegen, frame_sz);
-        
-        for (int i = 0; i < f->block_count; i++) {
-            BasicBlock *bb = f->blocks[i];
-            Instruction *inst = bb->first_inst;
-            
-            while (inst) {
-                x64_emit_inst(jit->codegen, inst, jit->reg_alloc);
-                inst = inst->next;
-            }
-        }
-        
-        x64_emit_epilogue(jit->codegen);
+// ---------------------------------------------------------------------------
+// Compiling functions
+//
+// The code of a function goes to jit->codegen; references to other
+// functions and to the module's data are left as fixups, resolved when the
+// code is copied to executable memory.
+
+static void emit_function(CodeGen *cg, Function *f, size_t *block_offsets);
+static void set_emit_tier(JITContext *jit, JITTier tier);
+
+// Emits the stub area and allocates the block the code will run from, with
+// data_size bytes of data alongside. The caller adds the symbols the code
+// defines, which need the block's address, before install_code applies the
+// fixups.
+static CodeBlock *place_code(JITContext *jit, size_t data_size) {
+    codegen_emit_stubs(jit->codegen);
+    CodeBlock *cb = alloc_exec_mem(jit->codegen->pos, data_size);
+    if (!cb) {
+        error("jit: cannot allocate executable memory");
     }
-    
-    CodeBlock *cb = alloc_exec_mem(jit->codegen->pos, 0);
-    if (!cb) return NULL;
-    
+    jit->codegen->base = (uintptr_t)cb->code_mem;
+    return cb;
+}
+
+static void install_code(JITContext *jit, CodeBlock *cb) {
+    codegen_apply_fixups(jit->codegen, jit->symtab);
     memcpy(cb->code_mem, jit->codegen->buf, jit->codegen->pos);
     make_executable(cb);
-    
+
     cb->next = jit->code_blocks;
     jit->code_blocks = cb;
-    
+}
+
+// Looks up each function that m calls but does not define, so that fixups
+// referring to it can be applied.
+static void resolve_externals(JITContext *jit, SSAModule *m) {
+    for (Function *f = m->funcs; f; f = f->next_func) {
+        if (!f->is_external || jit_lookup_symbol(jit, f->name)) continue;
+        void *addr = jit->symbol_resolver ? jit->symbol_resolver(f->name) : NULL;
+        if (!addr) {
+            error("jit: undefined reference to '%s'", f->name);
+        }
+        jit_add_symbol(jit, f->name, addr);
+        jit->symtab->external = true;
+    }
+}
+
+// Compiles f on its own at tier; blocks, if given, receives the address of
+// each of its blocks.
+static void *compile_function(JITContext *jit, Function *f, JITTier tier, void **blocks) {
+    if (jit->arch != ARCH_X86_64) {
+        error("jit: code generation is only implemented for x86-64");
+    }
+
+    set_emit_tier(jit, tier);
+    jit->codegen->pos = 0;
+    size_t *offsets = xmalloc((f->block_count + 1) * sizeof(size_t));
+    emit_function(jit->codegen, f, offsets);
+
+    CodeBlock *cb = place_code(jit, 0);
     jit_add_symbol(jit, f->name, cb->code_mem);
-    
-    regalloc_destroy(jit->reg_alloc);
-    jit->reg_alloc = NULL;
-    
+    install_code(jit, cb);
+    for (int b = 0; blocks && b < f->block_count; b++) {
+        blocks[b] = (uint8_t *)cb->code_mem + offsets[b];
+    }
+    free(offsets);
+    return cb->code_mem;
+}
+
+void *jit_compile_func(JITContext *jit, Function *f) {
+    if (!jit || !f || f->is_external) return NULL;
+    return compile_function(jit, f, jit->tier == JIT_OPTIMIZED ? JIT_OPTIMIZED : JIT_BASELINE,
+                            NULL);
+}
+
+void *jit_compile_module(JITContext *jit, SSAModule *m) {
+    if (!jit || !m) return NULL;
+    if (jit->arch != ARCH_X86_64) {
+        error("jit: code generation is only implemented for x86-64");
+    }
+
+    jit->module = m;
+    resolve_externals(jit, m);
+    set_emit_tier(jit, jit->tier == JIT_OPTIMIZED ? JIT_OPTIMIZED : JIT_BASELINE);
+
+    CodeGen *cg = jit->codegen;
+    cg->pos = 0;
+    int count = 0;
+    for (Function *f = m->funcs; f; f = f->next_func) {
+        if (!f->is_external) count++;
+    }
+    size_t *offsets = xmalloc((count + 1) * sizeof(size_t));
+
+    int n = 0;
+    for (Function *f = m->funcs; f; f = f->next_func) {
+        if (f->is_external) continue;
+        while (cg->pos % 16) codegen_emit_u8(cg, 0xCC);
+        offsets[n++] = cg->pos;
+        emit_function(cg, f, NULL);
+    }
+
+    CodeBlock *cb = place_code(jit, m->data_size);
+    if (m->data_size) {
+        memcpy(cb->data_mem, m->data, m->data_size);
+    }
+    jit_add_symbol(jit, JIT_DATA_SYMBOL, cb->data_mem);
+    n = 0;
+    for (Function *f = m->funcs; f; f = f->next_func) {
+        if (f->is_external) continue;
+        jit_add_symbol(jit, f->name, (uint8_t *)cb->code_mem + offsets[n++]);
+    }
+    free(offsets);
+
+    install_code(jit, cb);
     return cb->code_mem;
 }
 
+// ---------------------------------------------------------------------------
+// Register allocation
+//
+// Linear scan over live intervals, for the optimizing tier. A vreg's
+// interval runs from the first to the last position it is live at, holes
+// included, so a register held for the whole interval is right whichever
+// path reaches a position. Only callee-saved registers are handed out:
+// instruction selection uses rax, rcx, rdx, r10 and r11 as scratch and the
+// argument registers for calls, rsp and rbp hold the frame, and a
+// callee-saved register keeps its value across calls without being saved
+// around them. When none is free, the interval that ends last is split:
+// it keeps its register up to the current position and lives in its frame
+// slot from there on.
+
+static const int alloc_regs[] = {X64_RBX, X64_R12, X64_R13, X64_R14, X64_R15};
+#define NUM_ALLOC_REGS 5
+
 RegisterAlloc *regalloc_create(int vreg_cnt) {
-    RegisterAlloc *ra = calloc(1, sizeof(RegisterAlloc));
+    RegisterAlloc *ra = xcalloc(1, sizeof(RegisterAlloc));
+    int n = vreg_cnt > 0 ? vreg_cnt : 1;
     ra->vreg_count = vreg_cnt;
-    ra->vreg_to_phys = calloc(vreg_cnt, sizeof(int));
-    ra->phys_count = 14;
-    ra->phys_used = calloc(ra->phys_count, sizeof(bool));
-    ra->spill_slots = calloc(vreg_cnt, sizeof(int));
-    ra->spill_count = 0;
+    ra->vreg_to_phys = xmalloc(n * sizeof(int));
+    ra->phys_count = NUM_ALLOC_REGS;
+    ra->phys_used = xcalloc(NUM_ALLOC_REGS, sizeof(bool));
+    ra->live_intervals.start_pos = xmalloc(n * sizeof(int));
+    ra->live_intervals.end_pos = xmalloc(n * sizeof(int));
+    ra->spill_pos = xmalloc(n * sizeof(int));
+    ra->spilled = xmalloc(n * sizeof(int));
+    for (int v = 0; v < vreg_cnt; v++) {
+        ra->vreg_to_phys[v] = -1;
+        ra->spill_pos[v] = INT_MAX;
+    }
     return ra;
 }
 
@@ -176,60 +319,235 @@ void regalloc_destroy(RegisterAlloc *ra) {
     if (!ra) return;
     free(ra->vreg_to_phys);
     free(ra->phys_used);
-    free(ra->spill_slots);
+    free(ra->live_intervals.start_pos);
+    free(ra->live_intervals.end_pos);
+    free(ra->spill_pos);
+    free(ra->spilled);
+    free(ra->block_first);
+    free(ra->block_last);
+    free(ra->live_in);
     free(ra);
 }
 
+static bool falls_through(const Instruction *last) {
+    return !last || (last->op != OP_JMP && last->op != OP_SWITCH && last->op != OP_RET &&
+                     last->op != OP_TAILCALL);
+}
+
+static void set_bit(uint64_t *bits, int n) {
+    bits[n / 64] |= 1ull << (n % 64);
+}
+
+static bool test_bit(const uint64_t *bits, int n) {
+    return (bits[n / 64] >> (n % 64)) & 1;
+}
+
+// Backward dataflow to a fixed point: a vreg is live into a block if the
+// block reads it before writing it, or it is live out and not written.
+static void compute_liveness(RegisterAlloc *ra, Function *f, uint64_t *live_out) {
+    int words = ra->live_words;
+    uint64_t *use = xcalloc((size_t)f->block_count * words, sizeof(uint64_t));
+    uint64_t *def = xcalloc((size_t)f->block_count * words, sizeof(uint64_t));
+    for (int b = 0; b < f->block_count; b++) {
+        for (Instruction *i = f->blocks[b]->first_inst; i; i = i->next) {
+            for (int k = 0; k < i->operand_count; k++) {
+                Value *v = i->operands[k];
+                if (v->kind == VAL_VREG && !test_bit(def + b * words, v->as.vreg_num)) {
+                    set_bit(use + b * words, v->as.vreg_num);
+                }
+            }
+            if (i->result) set_bit(def + b * words, i->result->as.vreg_num);
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = f->block_count - 1; b >= 0; b--) {
+            uint64_t *out = live_out + b * words;
+            Instruction *last = f->blocks[b]->last_inst;
+            if (last && ssa_is_terminator(last)) {
+                for (int k = 0; k < last->operand_count; k++) {
+                    if (last->operands[k]->kind != VAL_BLOCK) continue;
+                    uint64_t *in = ra->live_in + last->operands[k]->as.block->id * words;
+                    for (int w = 0; w < words; w++) out[w] |= in[w];
+                }
+            }
+            if (falls_through(last) && b + 1 < f->block_count) {
+                uint64_t *in = ra->live_in + (b + 1) * words;
+                for (int w = 0; w < words; w++) out[w] |= in[w];
+            }
+            uint64_t *in = ra->live_in + b * words;
+            for (int w = 0; w < words; w++) {
+                uint64_t bits = use[b * words + w] | (out[w] & ~def[b * words + w]);
+                if (bits != in[w]) {
+                    in[w] = bits;
+                    changed = true;
+                }
+            }
+        }
+    }
+    free(use);
+    free(def);
+}
+
+static void extend_interval(RegisterAlloc *ra, int vreg, int pos) {
+    if (pos < ra->live_intervals.start_pos[vreg]) ra->live_intervals.start_pos[vreg] = pos;
+    if (pos > ra->live_intervals.end_pos[vreg]) ra->live_intervals.end_pos[vreg] = pos;
+}
+
+static void build_intervals(RegisterAlloc *ra, Function *f, const uint64_t *live_out) {
+    int *start = ra->live_intervals.start_pos, *end = ra->live_intervals.end_pos;
+    for (int v = 0; v < ra->vreg_count; v++) {
+        start[v] = INT_MAX;
+        end[v] = -1;
+    }
+    int pos = 0;
+    for (int b = 0; b < f->block_count; b++) {
+        ra->block_first[b] = pos++;
+        for (Instruction *i = f->blocks[b]->first_inst; i; i = i->next, pos++) {
+            for (int k = 0; k < i->operand_count; k++) {
+                if (i->operands[k]->kind == VAL_VREG) extend_interval(ra, i->operands[k]->as.vreg_num, pos);
+            }
+            if (i->result) extend_interval(ra, i->result->as.vreg_num, pos);
+        }
+        ra->block_last[b] = pos - 1;
+    }
+    for (int b = 0; b < f->block_count; b++) {
+        for (int v = 0; v < ra->vreg_count; v++) {
+            if (test_bit(ra->live_in + b * ra->live_words, v)) extend_interval(ra, v, ra->block_first[b]);
+            if (test_bit(live_out + b * ra->live_words, v)) extend_interval(ra, v, ra->block_last[b]);
+        }
+    }
+}
+
 void regalloc_allocate(RegisterAlloc *ra, Function *f) {
-    if (!ra || !f) return;
-    
-    for (int i = 0; i < ra->vreg_count; i++) {
-        int assigned = -1;
-        for (int r = 0; r < ra->phys_count; r++) {
-            if (!ra->phys_used[r]) {
-                assigned = r;
-                ra->phys_used[r] = true;
-                break;
+    if (!ra || !f || f->block_count == 0) return;
+
+    int words = (ra->vreg_count + 63) / 64;
+    ra->live_words = words > 0 ? words : 1;
+    ra->block_first = xmalloc(f->block_count * sizeof(int));
+    ra->block_last = xmalloc(f->block_count * sizeof(int));
+    ra->live_in = xcalloc((size_t)f->block_count * ra->live_words, sizeof(uint64_t));
+    uint64_t *live_out = xcalloc((size_t)f->block_count * ra->live_words, sizeof(uint64_t));
+    compute_liveness(ra, f, live_out);
+    build_intervals(ra, f, live_out);
+    free(live_out);
+
+    // The intervals by start, by counting.
+    int *start = ra->live_intervals.start_pos, *end = ra->live_intervals.end_pos;
+    int positions = ra->block_last[f->block_count - 1] + 2;
+    int *first = xcalloc(positions + 1, sizeof(int));
+    int *order = xmalloc((ra->vreg_count + 1) * sizeof(int));
+    int count = 0;
+    for (int v = 0; v < ra->vreg_count; v++) {
+        if (end[v] >= 0) {
+            first[start[v] + 1]++;
+            count++;
+        }
+    }
+    for (int p = 0; p < positions; p++) first[p + 1] += first[p];
+    for (int v = 0; v < ra->vreg_count; v++) {
+        if (end[v] >= 0) order[first[start[v]]++] = v;
+    }
+    free(first);
+    ra->live_intervals.interval_count = count;
+
+    int active[NUM_ALLOC_REGS], active_reg[NUM_ALLOC_REGS];
+    int active_count = 0;
+    bool taken[NUM_ALLOC_REGS] = {false};
+    for (int k = 0; k < count; k++) {
+        int v = order[k], s = start[v];
+        // Intervals ending here give their register up: the instruction
+        // reads its operands before writing its result.
+        for (int a = 0; a < active_count;) {
+            if (end[active[a]] <= s) {
+                taken[active_reg[a]] = false;
+                active_count--;
+                active[a] = active[active_count];
+                active_reg[a] = active_reg[active_count];
+            } else {
+                a++;
             }
         }
-        
-        if (assigned >= 0) {
-            ra->vreg_to_phys[i] = assigned;
-        } else {
-            ra->vreg_to_phys[i] = -1;
-            ra->spill_slots[i] = ra->spill_count++;
+
+        int r = 0;
+        while (r < NUM_ALLOC_REGS && taken[r]) r++;
+        if (r == NUM_ALLOC_REGS) {
+            int last = 0;
+            for (int a = 1; a < active_count; a++) {
+                if (end[active[a]] > end[active[last]]) last = a;
+            }
+            if (end[active[last]] <= end[v]) continue;
+            int victim = active[last];
+            r = active_reg[last];
+            if (start[victim] == s) {
+                ra->vreg_to_phys[victim] = -1;
+            } else {
+                ra->spill_pos[victim] = s;
+                ra->spilled[ra->spill_count++] = victim;
+            }
+            active_count--;
+            active[last] = active[active_count];
+            active_reg[last] = active_reg[active_count];
         }
+        ra->vreg_to_phys[v] = alloc_regs[r];
+        ra->phys_used[r] = true;
+        taken[r] = true;
+        active[active_count] = v;
+        active_reg[active_count++] = r;
     }
+    free(order);
 }
 
 int regalloc_get_phys(RegisterAlloc *ra, int vreg) {
-    if (!ra || vreg < 0 || vreg >= ra->vreg_count) return 0;
-    return ra->vreg_to_phys[vreg] >= 0 ? ra->vreg_to_phys[vreg] : 0;
+    if (!ra || vreg < 0 || vreg >= ra->vreg_count) return -1;
+    return ra->vreg_to_phys[vreg];
 }
 
 bool regalloc_is_spilled(RegisterAlloc *ra, int vreg) {
-    if (!ra || vreg < 0 || vreg >= ra->vreg_count) return false;
-    return ra->vreg_to_phys[vreg] < 0;
+    if (!ra || vreg < 0 || vreg >= ra->vreg_count) return true;
+    return ra->vreg_to_phys[vreg] < 0 || ra->spill_pos[vreg] != INT_MAX;
+}
+
+int regalloc_location(RegisterAlloc *ra, int vreg, int pos) {
+    if (!ra || vreg < 0 || vreg >= ra->vreg_count) return -1;
+    return pos < ra->spill_pos[vreg] ? ra->vreg_to_phys[vreg] : -1;
+}
+
+bool regalloc_live_in(RegisterAlloc *ra, int block, int vreg) {
+    return test_bit(ra->live_in + block * ra->live_words, vreg);
 }
 
+// ---------------------------------------------------------------------------
+// Code buffer
+
 CodeGen *codegen_create(size_t init_sz) {
     CodeGen *cg = calloc(1, sizeof(CodeGen));
     cg->buf = malloc(init_sz);
     cg->cap = init_sz;
     cg->pos = 0;
+    cg->base = 0;
     cg->fixups = NULL;
     cg->fixup_count = 0;
     return cg;
 }
 
-void codegen_destroy(CodeGen *cg) {
-    if (!cg) return;
-    free(cg->buf);
+static void free_fixups(CodeGen *cg) {
     for (int i = 0; i < cg->fixup_count; i++) {
         free(cg->fixups[i]->symbol);
         free(cg->fixups[i]);
     }
+    cg->fixup_count = 0;
+}
+
+void codegen_destroy(CodeGen *cg) {
+    if (!cg) return;
+    free(cg->buf);
+    free_fixups(cg);
     free(cg->fixups);
+    free(cg->labels);
+    free(cg->label_refs);
     free(cg);
 }
 
@@ -257,135 +575,1909 @@ void codegen_emit_u64(CodeGen *cg, uint64_t qw) {
     codegen_emit_u32(cg, (qw >> 32) & 0xFFFFFFFF);
 }
 
-void x64_emit_prologue(CodeGen *cg, int frame_sz) {
-    codegen_emit_u8(cg, 0x55);
-    codegen_emit_u8(cg, 0x48);
-    codegen_emit_u8(cg, 0x89);
-    codegen_emit_u8(cg, 0xE5);
-    
-    if (frame_sz > 0) {
-        codegen_emit_u8(cg, 0x48);
-        codegen_emit_u8(cg, 0x81);
-        codegen_emit_u8(cg, 0xEC);
-        codegen_emit_u32(cg, frame_sz);
+void codegen_emit_bytes(CodeGen *cg, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        codegen_emit_u8(cg, data[i]);
     }
 }
 
-void x64_emit_epilogue(CodeGen *cg) {
-    codegen_emit_u8(cg, 0x48);
-    codegen_emit_u8(cg, 0x89);
-    codegen_emit_u8(cg, 0xEC);
-    codegen_emit_u8(cg, 0x5D);
-    codegen_emit_u8(cg, 0xC3);
+static void codegen_patch_u32(CodeGen *cg, size_t offset, uint32_t dw) {
+    for (int i = 0; i < 4; i++) {
+        cg->buf[offset + i] = (dw >> (8 * i)) & 0xFF;
+    }
 }
 
-void x64_emit_mov(CodeGen *cg, int dst, int src) {
-    codegen_emit_u8(cg, 0x48);
-    codegen_emit_u8(cg, 0x89);
-    codegen_emit_u8(cg, 0xC0 | (src << 3) | dst);
+void codegen_add_fixup(CodeGen *cg, Fixup *fix) {
+    cg->fixups = realloc(cg->fixups, (cg->fixup_count + 1) * sizeof(Fixup *));
+    cg->fixups[cg->fixup_count++] = fix;
 }
 
-void x64_emit_add(CodeGen *cg, int dst, int src) {
-    codegen_emit_u8(cg, 0x48);
-    codegen_emit_u8(cg, 0x01);
-    codegen_emit_u8(cg, 0xC0 | (src << 3) | dst);
+void codegen_apply_fixups(CodeGen *cg, Symbol *syms) {
+    for (int i = 0; i < cg->fixup_count; i++) {
+        Fixup *fix = cg->fixups[i];
+        Symbol *sym = syms;
+        while (sym && strcmp(sym->symbol, fix->symbol) != 0) sym = sym->next;
+        if (!sym) {
+            error("jit: undefined reference to '%s'", fix->symbol);
+        }
+
+        uint64_t value = (uint64_t)(uintptr_t)sym->addr + fix->addend;
+        int64_t rel;
+        switch (fix->type) {
+            case FIX_ABS64:
+                codegen_patch_u32(cg, fix->offset, value & 0xFFFFFFFF);
+                codegen_patch_u32(cg, fix->offset + 4, value >> 32);
+                break;
+            case FIX_ABS32:
+                if (value > UINT32_MAX) {
+                    error("jit: '%s' is out of range of a 32-bit address", fix->symbol);
+                }
+                codegen_patch_u32(cg, fix->offset, (uint32_t)value);
+                break;
+            case FIX_REL32:
+                rel = (int64_t)(value - (cg->base + fix->offset + 4));
+                if (rel < INT32_MIN || rel > INT32_MAX) {
+                    error("jit: '%s' is out of range of a 32-bit displacement", fix->symbol);
+                }
+                codegen_patch_u32(cg, fix->offset, (uint32_t)rel);
+                break;
+            case FIX_PLT:
+                // Straight to the symbol when it is in reach; otherwise
+                // through the stub codegen_emit_stubs pointed it at.
+                rel = (int64_t)(value - (cg->base + fix->offset + 4));
+                if (rel >= INT32_MIN && rel <= INT32_MAX) {
+                    codegen_patch_u32(cg, fix->offset, (uint32_t)rel);
+                }
+                break;
+            default:
+                error("jit: '%s' has no GOT slot", fix->symbol);
+        }
+    }
+    free_fixups(cg);
 }
 
-void x64_emit_ret(CodeGen *cg) {
-    codegen_emit_u8(cg, 0xC3);
+static void add_fixup(CodeGen *cg, size_t offset, int type, const char *symbol, int addend) {
+    Fixup *fix = calloc(1, sizeof(Fixup));
+    fix->offset = offset;
+    fix->type = type;
+    fix->symbol = strdup(symbol);
+    fix->addend = addend;
+    codegen_add_fixup(cg, fix);
 }
 
-void x64_emit_inst(CodeGen *cg, Instruction *i, RegisterAlloc *ra) {
-    if (!cg || !i || !ra) return;
-    
-    int dst_reg = 0, src1_reg = 0, src2_reg = 0;
-    
-    if (i->result && i->result->kind == VAL_VREG) {
-        dst_reg = regalloc_get_phys(ra, i->result->as.vreg_num);
-    }
-    
-    if (i->operand_count > 0 && i->operands[0]->kind == VAL_VREG) {
-        src1_reg = regalloc_get_phys(ra, i->operands[0]->as.vreg_num);
-    }
-    
-    if (i->operand_count > 1 && i->operands[1]->kind == VAL_VREG) {
-        src2_reg = regalloc_get_phys(ra, i->operands[1]->as.vreg_num);
-    }
-    
-    switch (i->op) {
-        case OP_MOV:
-            if (i->operand_count > 0 && i->operands[0]->kind == VAL_IMMEDIATE) {
-                codegen_emit_u8(cg, 0x48);
-                codegen_emit_u8(cg, 0xB8 | dst_reg);
-                codegen_emit_u64(cg, i->operands[0]->as.imm);
-            } else if (src1_reg != dst_reg) {
-                x64_emit_mov(cg, dst_reg, src1_reg);
-            }
-            break;
-            
-        case OP_ADD:
-            if (src1_reg != dst_reg) {
-                x64_emit_mov(cg, dst_reg, src1_reg);
-            }
-            x64_emit_add(cg, dst_reg, src2_reg);
-            break;
-            
-        case OP_RET:
-            if (i->operand_count > 0 && i->operands[0]->kind == VAL_VREG) {
-                if (src1_reg != 0) {
-                    x64_emit_mov(cg, 0, src1_reg);
-                }
+// A slot per symbol, filled in by an ABS64 fixup, and for the symbols
+// called a stub jumping through it. The code stays position-independent
+// apart from fixups, so it can be placed anywhere before they are applied.
+void codegen_emit_stubs(CodeGen *cg) {
+    int count = 0;
+    const char **names = NULL;
+    bool *called = NULL;
+    int *sym_of = xmalloc((cg->fixup_count + 1) * sizeof(int));
+    for (int i = 0; i < cg->fixup_count; i++) {
+        Fixup *fix = cg->fixups[i];
+        sym_of[i] = -1;
+        if (fix->type != FIX_GOT && fix->type != FIX_PLT) continue;
+        int k = 0;
+        while (k < count && strcmp(names[k], fix->symbol) != 0) k++;
+        if (k == count) {
+            names = xrealloc(names, (count + 1) * sizeof(char *));
+            called = xrealloc(called, (count + 1) * sizeof(bool));
+            names[count] = fix->symbol;
+            called[count++] = false;
+        }
+        called[k] |= fix->type == FIX_PLT;
+        sym_of[i] = k;
+    }
+    if (count == 0) {
+        free(sym_of);
+        return;
+    }
+
+    int fixup_count = cg->fixup_count;
+    while (cg->pos % 8) codegen_emit_u8(cg, 0xCC);
+    size_t slots = cg->pos;
+    for (int k = 0; k < count; k++) {
+        add_fixup(cg, cg->pos, FIX_ABS64, names[k], 0);
+        codegen_emit_u64(cg, 0);
+    }
+    size_t *stubs = xmalloc(count * sizeof(size_t));
+    for (int k = 0; k < count; k++) {
+        if (!called[k]) continue;
+        // jmp [rip + slot]
+        stubs[k] = cg->pos;
+        codegen_emit_u8(cg, 0xFF);
+        codegen_emit_u8(cg, 0x25);
+        codegen_emit_u32(cg, (uint32_t)(slots + 8 * k - (cg->pos + 4)));
+        codegen_emit_u16(cg, 0xCCCC);
+    }
+
+    // GOT references are done with; PLT ones may yet go straight to the
+    // symbol.
+    int kept = 0;
+    for (int i = 0; i < cg->fixup_count; i++) {
+        Fixup *fix = cg->fixups[i];
+        if (i < fixup_count && sym_of[i] >= 0) {
+            size_t target = fix->type == FIX_GOT ? slots + 8 * sym_of[i] : stubs[sym_of[i]];
+            codegen_patch_u32(cg, fix->offset, (uint32_t)(target - (fix->offset + 4)));
+            if (fix->type == FIX_GOT) {
+                free(fix->symbol);
+                free(fix);
+                continue;
             }
-            x64_emit_ret(cg);
-            break;
-            
-        default:
-            break;
+        }
+        cg->fixups[kept++] = fix;
     }
+    cg->fixup_count = kept;
+    free(stubs);
+    free(sym_of);
+    free(names);
+    free(called);
 }
 
-ExecEngine *engine_create(JITTier tier) {
-    ExecEngine *ee = calloc(1, sizeof(ExecEngine));
-    ee->jit = jit_create(ARCH_X86_64, tier);
-    ee->func_cache = NULL;
-    ee->cache_size = 0;
-    memset(&ee->stats, 0, sizeof(ee->stats));
-    return ee;
+// ---------------------------------------------------------------------------
+// Labels
+//
+// Branches are emitted in their rel32 form, and shortened once the function
+// is done and the distances are known.
+
+int codegen_new_label(CodeGen *cg) {
+    if (cg->label_count == cg->label_cap) {
+        cg->label_cap = cg->label_cap ? cg->label_cap * 2 : 64;
+        cg->labels = xrealloc(cg->labels, cg->label_cap * sizeof(size_t));
+    }
+    cg->labels[cg->label_count] = SIZE_MAX;
+    return cg->label_count++;
 }
 
-void engine_destroy(ExecEngine *ee) {
-    if (!ee) return;
-    jit_destroy(ee->jit);
-    free(ee->func_cache);
-    free(ee);
+void codegen_bind_label(CodeGen *cg, int label) {
+    cg->labels[label] = cg->pos;
 }
 
-void *engine_get_func_ptr(ExecEngine *ee, const char *name) {
-    if (!ee || !name) return NULL;
-    return jit_lookup_symbol(ee->jit, name);
+size_t codegen_label_offset(CodeGen *cg, int label) {
+    return cg->labels[label];
 }
 
-void engine_finalize_module(ExecEngine *ee, Module *m) {
-    if (!ee || !m) return;
-    
-    Function *f = m->funcs;
-    while (f) {
-        if (!f->is_external) {
-            jit_compile_func(ee->jit, f);
-            ee->stats.total_comps++;
+// References are kept in the order of their offsets.
+static void add_label_ref(CodeGen *cg, size_t offset, int label, int kind, int base) {
+    if (cg->label_ref_count == cg->label_ref_cap) {
+        cg->label_ref_cap = cg->label_ref_cap ? cg->label_ref_cap * 2 : 64;
+        cg->label_refs = xrealloc(cg->label_refs, cg->label_ref_cap * sizeof(LabelRef));
+    }
+    cg->label_refs[cg->label_ref_count++] = (LabelRef){offset, label, kind, base, false};
+}
+
+void codegen_emit_label_rel32(CodeGen *cg, int label, int base) {
+    add_label_ref(cg, cg->pos, label, LABEL_REL32, base);
+    codegen_emit_u32(cg, 0);
+}
+
+// The length of a reference in its rel32 form: jmp is 5 bytes, jcc 6.
+// Either is 2 as rel8.
+static int near_length(CodeGen *cg, const LabelRef *r) {
+    if (r->kind != LABEL_BRANCH) return 4;
+    return cg->buf[r->offset] == 0xE9 ? 5 : 6;
+}
+
+// Where the code at offset goes once the first k references, those before
+// it, have shrunk by saved[k].
+static size_t moved_offset(CodeGen *cg, const size_t *saved, size_t offset) {
+    int lo = 0, hi = cg->label_ref_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cg->label_refs[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
-        f = f->next_func;
     }
+    return offset - saved[lo];
 }
 
-int engine_run_main(ExecEngine *ee) {
-    if (!ee) return -1;
-    
-    typedef int (*MainFunc)(void);
-    MainFunc main_fn = (MainFunc)engine_get_func_ptr(ee, "main");
-    
+void codegen_resolve_labels(CodeGen *cg) {
+    int n = cg->label_ref_count;
+    LabelRef *refs = cg->label_refs;
+    if (n == 0) return;
+    for (int k = 0; k < n; k++) {
+        if (cg->labels[refs[k].label] == SIZE_MAX) {
+            error("jit: reference to a label that is never placed");
+        }
+    }
+
+    // Shortening a branch only brings the others' targets closer, so
+    // shortening whichever reach until none is left is safe, and settles
+    // quickly.
+    size_t *saved = xmalloc((n + 1) * sizeof(size_t));
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        saved[0] = 0;
+        for (int k = 0; k < n; k++) {
+            saved[k + 1] = saved[k] + (refs[k].is_short ? near_length(cg, &refs[k]) - 2 : 0);
+        }
+        for (int k = 0; k < n; k++) {
+            LabelRef *r = &refs[k];
+            if (r->kind != LABEL_BRANCH || r->is_short) continue;
+            int64_t end = (int64_t)(r->offset - saved[k]) + 2;
+            size_t label = cg->labels[r->label];
+            int64_t target = (int64_t)moved_offset(cg, saved, label);
+            if (label > r->offset) target -= near_length(cg, r) - 2;
+            if (target - end >= INT8_MIN && target - end <= INT8_MAX) {
+                r->is_short = true;
+                changed = true;
+            }
+        }
+    }
+
+    // Move the labels and fixups, then the code.
+    for (int l = 0; l < cg->label_count; l++) {
+        if (cg->labels[l] != SIZE_MAX) cg->labels[l] = moved_offset(cg, saved, cg->labels[l]);
+    }
+    for (int i = 0; i < cg->fixup_count; i++) {
+        cg->fixups[i]->offset = moved_offset(cg, saved, cg->fixups[i]->offset);
+    }
+    size_t in = refs[0].offset, out = in;
+    for (int k = 0; k < n; k++) {
+        LabelRef *r = &refs[k];
+        memmove(cg->buf + out, cg->buf + in, r->offset - in);
+        out += r->offset - in;
+        in = r->offset;
+        int length = near_length(cg, r);
+        if (r->is_short) {
+            uint8_t op = cg->buf[in];
+            cg->buf[out] = op == 0xE9 ? 0xEB : 0x70 | (cg->buf[in + 1] & 15);
+            cg->buf[out + 1] = 0;
+        } else {
+            memmove(cg->buf + out, cg->buf + in, length);
+        }
+        r->offset = out;
+        out += r->is_short ? 2 : length;
+        in += length;
+    }
+    memmove(cg->buf + out, cg->buf + in, cg->pos - in);
+    cg->pos = out + (cg->pos - in);
+
+    for (int k = 0; k < n; k++) {
+        LabelRef *r = &refs[k];
+        int64_t target = (int64_t)cg->labels[r->label];
+        int64_t end = (int64_t)r->offset + (r->is_short ? 2 : near_length(cg, r));
+        if (r->kind == LABEL_REL32) {
+            int64_t from = r->base >= 0 ? (int64_t)cg->labels[r->base] : end;
+            codegen_patch_u32(cg, r->offset, (uint32_t)(target - from));
+        } else if (r->is_short) {
+            cg->buf[r->offset + 1] = (uint8_t)(target - end);
+        } else {
+            codegen_patch_u32(cg, end - 4, (uint32_t)(target - end));
+        }
+    }
+    cg->label_ref_count = 0;
+    free(saved);
+}
+
+// ---------------------------------------------------------------------------
+// x86-64 encoding
+//
+// Register numbers are the hardware ones (X64_RAX...X64_R15, or an XMM
+// register's number); the fourth bit goes to the REX prefix. Two-byte
+// opcodes are written as 0x0Fxx. Of the ways to encode an instruction the
+// shortest is taken: no REX prefix unless a register needs one, no or an
+// 8-bit displacement where it fits, sign-extended 8-bit immediates, and the
+// one-byte forms on rax.
+
+static bool fits_int8(int64_t v) {
+    return v >= INT8_MIN && v <= INT8_MAX;
+}
+
+static bool fits_int32(int64_t v) {
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+// A memory operand, [base + index * scale + disp]. index is X64_NOREG for
+// none, and base X64_NOREG for an absolute disp; base X64_RIP makes it
+// [rip + disp], counted from the end of the instruction.
+typedef struct {
+    int base;
+    int index;
+    int scale;
+    int32_t disp;
+} X64Mem;
+
+enum { X64_NOREG = -1, X64_RIP = 16 };
+
+static X64Mem x64_mem(int base, int32_t disp) {
+    return (X64Mem){base, X64_NOREG, 1, disp};
+}
+
+static int rex_bit(int reg) {
+    return reg >= 0 && (reg & 8) ? 1 : 0;
+}
+
+// spl, bpl, sil and dil need a REX prefix to be told apart from ah, ch, dh
+// and bh.
+static bool is_rex_byte_reg(int reg) {
+    return reg >= X64_RSP && reg <= X64_RDI;
+}
+
+static void emit_rex(CodeGen *cg, bool w, int reg, int index, int base, bool byte_reg) {
+    uint8_t rex = 0x40 | w << 3 | rex_bit(reg) << 2 | rex_bit(index) << 1 | rex_bit(base);
+    if (rex != 0x40 || byte_reg) {
+        codegen_emit_u8(cg, rex);
+    }
+}
+
+static void emit_opcode(CodeGen *cg, uint16_t opcode) {
+    if (opcode > 0xFF) codegen_emit_u8(cg, opcode >> 8);
+    codegen_emit_u8(cg, opcode & 0xFF);
+}
+
+// rsp cannot be an index. At scale 1 base and index can trade places, which
+// moves rsp out of the index, and rbp or r13 out of the base, where it
+// would need a displacement.
+static X64Mem normalize_mem(X64Mem m) {
+    if (m.index == X64_NOREG || m.base < 0 || m.base == X64_RIP) return m;
+    bool swap = m.index == X64_RSP ||
+                (m.disp == 0 && (m.base & 7) == X64_RBP && (m.index & 7) != X64_RBP);
+    if (swap && m.scale == 1) {
+        int base = m.base;
+        m.base = m.index;
+        m.index = base;
+    }
+    if (m.index == X64_RSP) {
+        error("jit: rsp cannot be an index register");
+    }
+    return m;
+}
+
+// The ModRM byte of reg and m, and its SIB byte and displacement. Returns
+// where the displacement is.
+static size_t emit_modrm_mem(CodeGen *cg, int reg, X64Mem m) {
+    int scale = m.scale == 8 ? 3 : m.scale == 4 ? 2 : m.scale == 2 ? 1 : 0;
+    int index = m.index == X64_NOREG ? X64_RSP : m.index & 7;
+    size_t disp = 0;
+    if (m.base == X64_RIP || m.base == X64_NOREG) {
+        codegen_emit_u8(cg, (reg & 7) << 3 | (m.base == X64_RIP ? 5 : 4));
+        if (m.base == X64_NOREG) codegen_emit_u8(cg, scale << 6 | index << 3 | 5);
+        disp = cg->pos;
+        codegen_emit_u32(cg, (uint32_t)m.disp);
+        return disp;
+    }
+
+    int mod = m.disp == 0 && (m.base & 7) != X64_RBP ? 0 : fits_int8(m.disp) ? 1 : 2;
+    bool sib = m.index != X64_NOREG || (m.base & 7) == X64_RSP;
+    codegen_emit_u8(cg, mod << 6 | (reg & 7) << 3 | (sib ? 4 : m.base & 7));
+    if (sib) codegen_emit_u8(cg, scale << 6 | index << 3 | (m.base & 7));
+    disp = cg->pos;
+    if (mod == 1) {
+        codegen_emit_u8(cg, (uint8_t)m.disp);
+    } else if (mod == 2) {
+        codegen_emit_u32(cg, (uint32_t)m.disp);
+    }
+    return disp;
+}
+
+// opcode reg, r/m: the register rm, or *m if given. prefix is a mandatory
+// prefix (0x66, 0xF2, 0xF3) or 0; byte_reg forces a REX prefix for an 8-bit
+// spl...dil. Returns where a memory operand's displacement is.
+static size_t emit_modrm(CodeGen *cg, uint8_t prefix, bool w, uint16_t opcode, int reg, int rm,
+                         const X64Mem *m, bool byte_reg) {
+    if (prefix) codegen_emit_u8(cg, prefix);
+    if (!m) {
+        emit_rex(cg, w, reg, X64_NOREG, rm, byte_reg);
+        emit_opcode(cg, opcode);
+        codegen_emit_u8(cg, 0xC0 | (reg & 7) << 3 | (rm & 7));
+        return 0;
+    }
+    X64Mem mem = normalize_mem(*m);
+    emit_rex(cg, w, reg, mem.index, mem.base, byte_reg);
+    emit_opcode(cg, opcode);
+    return emit_modrm_mem(cg, reg, mem);
+}
+
+// opcode reg, rm with both in registers.
+static void emit_rr(CodeGen *cg, uint8_t prefix, bool w, uint16_t opcode, int reg, int rm) {
+    emit_modrm(cg, prefix, w, opcode, reg, rm, NULL, false);
+}
+
+// opcode reg, [base + disp]; byte_reg: reg is an 8-bit register.
+static void emit_rm(CodeGen *cg, uint8_t prefix, bool w, uint16_t opcode, int reg,
+                    int base, int32_t disp, bool byte_reg) {
+    X64Mem m = x64_mem(base, disp);
+    emit_modrm(cg, prefix, w, opcode, reg, 0, &m, byte_reg && is_rex_byte_reg(reg));
+}
+
+// The integer operations, by the forms they come in (x64_ops).
+typedef enum {
+    X64_ADD, X64_OR, X64_AND, X64_SUB, X64_XOR, X64_CMP, X64_TEST, X64_MOV, X64_LEA,
+    X64_IMUL, X64_MUL, X64_DIV, X64_IDIV, X64_NOT, X64_NEG, X64_INC, X64_DEC,
+    X64_SHL, X64_SHR, X64_SAR
+} X64Op;
+
+// The opcode of each form on 16-, 32- and 64-bit operands, or 0 for none;
+// on 8-bit operands it is one less, with an 8-bit immediate, and the forms
+// with imm8 or no such opcode do not exist. ext goes in ModRM.reg for the
+// forms without a register operand; imul's immediate forms put the
+// destination there instead.
+static const struct {
+    uint16_t mr;        // op r/m, reg
+    uint16_t rm;        // op reg, r/m
+    uint8_t unary;      // op r/m; a shift by cl
+    uint8_t one;        // a shift by 1
+    uint8_t imm;        // op r/m, imm32; a shift by imm8
+    uint8_t imm8;       // op r/m, imm8 sign-extended
+    uint8_t acc;        // op rax, imm32
+    uint8_t ext;
+} x64_ops[] = {
+    //              mr    rm      unary one   imm   imm8  acc   ext
+    [X64_ADD]  = {0x01, 0x03,   0,    0,    0x81, 0x83, 0x05, 0},
+    [X64_OR]   = {0x09, 0x0B,   0,    0,    0x81, 0x83, 0x0D, 1},
+    [X64_AND]  = {0x21, 0x23,   0,    0,    0x81, 0x83, 0x25, 4},
+    [X64_SUB]  = {0x29, 0x2B,   0,    0,    0x81, 0x83, 0x2D, 5},
+    [X64_XOR]  = {0x31, 0x33,   0,    0,    0x81, 0x83, 0x35, 6},
+    [X64_CMP]  = {0x39, 0x3B,   0,    0,    0x81, 0x83, 0x3D, 7},
+    [X64_TEST] = {0x85, 0x85,   0,    0,    0xF7, 0,    0xA9, 0},
+    [X64_MOV]  = {0x89, 0x8B,   0,    0,    0xC7, 0,    0,    0},
+    [X64_LEA]  = {0,    0x8D,   0,    0,    0,    0,    0,    0},
+    [X64_IMUL] = {0,    0x0FAF, 0xF7, 0,    0x69, 0x6B, 0,    5},
+    [X64_MUL]  = {0,    0,      0xF7, 0,    0,    0,    0,    4},
+    [X64_DIV]  = {0,    0,      0xF7, 0,    0,    0,    0,    6},
+    [X64_IDIV] = {0,    0,      0xF7, 0,    0,    0,    0,    7},
+    [X64_NOT]  = {0,    0,      0xF7, 0,    0,    0,    0,    2},
+    [X64_NEG]  = {0,    0,      0xF7, 0,    0,    0,    0,    3},
+    [X64_INC]  = {0,    0,      0xFF, 0,    0,    0,    0,    0},
+    [X64_DEC]  = {0,    0,      0xFF, 0,    0,    0,    0,    1},
+    [X64_SHL]  = {0,    0,      0xD3, 0xD1, 0xC1, 0,    0,    4},
+    [X64_SHR]  = {0,    0,      0xD3, 0xD1, 0xC1, 0,    0,    5},
+    [X64_SAR]  = {0,    0,      0xD3, 0xD1, 0xC1, 0,    0,    7},
+};
+
+// opcode of an operation on size bytes. reg_operand: reg is a register
+// rather than an ext.
+static size_t emit_sized(CodeGen *cg, int size, uint16_t opcode, int reg, bool reg_operand,
+                         int rm, const X64Mem *m) {
+    if (!opcode || (size == 1 && !(opcode & 1))) {
+        error("jit: no encoding for a %d-byte operation", size);
+    }
+    bool byte_reg = size == 1 && ((reg_operand && is_rex_byte_reg(reg)) ||
+                                  (!m && is_rex_byte_reg(rm)));
+    return emit_modrm(cg, size == 2 ? 0x66 : 0, size == 8, size == 1 ? opcode - 1 : opcode,
+                      reg, rm, m, byte_reg);
+}
+
+static void emit_imm(CodeGen *cg, int size, int64_t imm) {
+    if (size == 1) {
+        codegen_emit_u8(cg, (uint8_t)imm);
+    } else if (size == 2) {
+        codegen_emit_u16(cg, (uint16_t)imm);
+    } else {
+        codegen_emit_u32(cg, (uint32_t)imm);
+    }
+}
+
+// dst op= src; cmp and test only set the flags.
+static void x64_op_rr(CodeGen *cg, X64Op op, int size, int dst, int src) {
+    if (x64_ops[op].mr) {
+        emit_sized(cg, size, x64_ops[op].mr, src, true, dst, NULL);
+    } else {
+        emit_sized(cg, size, x64_ops[op].rm, dst, true, src, NULL);
+    }
+}
+
+// reg op= [m]: mov loads, lea takes the address. Returns where the
+// displacement is, to fill in a rip-relative one.
+static size_t x64_op_rm(CodeGen *cg, X64Op op, int size, int reg, X64Mem m) {
+    return emit_sized(cg, size, x64_ops[op].rm, reg, true, 0, &m);
+}
+
+// [m] op= reg: mov stores.
+static void x64_op_mr(CodeGen *cg, X64Op op, int size, X64Mem m, int reg) {
+    emit_sized(cg, size, x64_ops[op].mr, reg, true, 0, &m);
+}
+
+// The one-operand forms: not, neg, inc and dec of r/m, mul, div, idiv and
+// imul of rax (and rdx) by it, and shifts of it by cl.
+static void emit_op_unary(CodeGen *cg, X64Op op, int size, int rm, const X64Mem *m) {
+    emit_sized(cg, size, x64_ops[op].unary, x64_ops[op].ext, false, rm, m);
+}
+
+static void x64_op_r(CodeGen *cg, X64Op op, int size, int reg) {
+    emit_op_unary(cg, op, size, reg, NULL);
+}
+
+static void x64_op_m(CodeGen *cg, X64Op op, int size, X64Mem m) {
+    emit_op_unary(cg, op, size, 0, &m);
+}
+
+// r/m op= imm, sign-extended from 32 bits, or from 8 on byte operands; a
+// shift by imm. mov to a register is x64_emit_load_imm's.
+static void emit_op_imm(CodeGen *cg, X64Op op, int size, int rm, const X64Mem *m, int64_t imm) {
+    if (size == 1 ? !fits_int8(imm) && (imm < 0 || imm > UINT8_MAX) : !fits_int32(imm)) {
+        error("jit: immediate %lld does not fit the operation", (long long)imm);
+    }
+    int reg = op == X64_IMUL ? rm : x64_ops[op].ext;
+    if (op == X64_IMUL && m) {
+        error("jit: imul by an immediate needs a register");
+    }
+
+    if (x64_ops[op].one) {
+        if ((imm & 63) == 1) {
+            emit_sized(cg, size, x64_ops[op].one, reg, false, rm, m);
+        } else {
+            emit_sized(cg, size, x64_ops[op].imm, reg, false, rm, m);
+            codegen_emit_u8(cg, imm & 63);
+        }
+    } else if (size > 1 && x64_ops[op].imm8 && fits_int8(imm)) {
+        emit_modrm(cg, size == 2 ? 0x66 : 0, size == 8, x64_ops[op].imm8, reg, rm, m, false);
+        codegen_emit_u8(cg, (uint8_t)imm);
+    } else if (x64_ops[op].acc && !m && rm == X64_RAX) {
+        if (size == 2) codegen_emit_u8(cg, 0x66);
+        if (size == 8) codegen_emit_u8(cg, 0x48);
+        codegen_emit_u8(cg, size == 1 ? x64_ops[op].acc - 1 : x64_ops[op].acc);
+        emit_imm(cg, size, imm);
+    } else {
+        emit_sized(cg, size, x64_ops[op].imm, reg, op == X64_IMUL, rm, m);
+        emit_imm(cg, size, imm);
+    }
+}
+
+static void x64_op_ri(CodeGen *cg, X64Op op, int size, int dst, int64_t imm) {
+    emit_op_imm(cg, op, size, dst, NULL, imm);
+}
+
+static void x64_op_mi(CodeGen *cg, X64Op op, int size, X64Mem m, int64_t imm) {
+    emit_op_imm(cg, op, size, 0, &m, imm);
+}
+
+// type is FIX_REL32, or FIX_PLT for a symbol outside the module.
+static void emit_rel32_call_or_jmp(CodeGen *cg, uint8_t opcode, int type, const char *symbol) {
+    codegen_emit_u8(cg, opcode);
+    add_fixup(cg, cg->pos, type, symbol, 0);
+    codegen_emit_u32(cg, 0);
+}
+
+void x64_emit_mov(CodeGen *cg, int dst, int src) {
+    x64_op_rr(cg, X64_MOV, 8, dst, src);
+}
+
+void x64_emit_add(CodeGen *cg, int dst, int src) {
+    x64_op_rr(cg, X64_ADD, 8, dst, src);
+}
+
+void x64_emit_sub(CodeGen *cg, int dst, int src) {
+    x64_op_rr(cg, X64_SUB, 8, dst, src);
+}
+
+void x64_emit_mul(CodeGen *cg, int dst, int src) {
+    x64_op_rr(cg, X64_IMUL, 8, dst, src);
+}
+
+// Signed rdx:rax / src; dst must be rax.
+void x64_emit_div(CodeGen *cg, int dst, int src) {
+    (void)dst;
+    codegen_emit_u8(cg, 0x48);
+    codegen_emit_u8(cg, 0x99);
+    x64_op_r(cg, X64_IDIV, 8, src);
+}
+
+void x64_emit_and(CodeGen *cg, int dst, int src) {
+    x64_op_rr(cg, X64_AND, 8, dst, src);
+}
+
+void x64_emit_or(CodeGen *cg, int dst, int src) {
+    x64_op_rr(cg, X64_OR, 8, dst, src);
+}
+
+void x64_emit_xor(CodeGen *cg, int dst, int src) {
+    x64_op_rr(cg, X64_XOR, 8, dst, src);
+}
+
+void x64_emit_shl(CodeGen *cg, int dst, int amt) {
+    x64_op_ri(cg, X64_SHL, 8, dst, amt);
+}
+
+void x64_emit_shr(CodeGen *cg, int dst, int amt) {
+    x64_op_ri(cg, X64_SHR, 8, dst, amt);
+}
+
+void x64_emit_cmp(CodeGen *cg, int r1, int r2) {
+    x64_op_rr(cg, X64_CMP, 8, r1, r2);
+}
+
+// cc < 0 for jmp.
+static void x64_emit_jcc(CodeGen *cg, int cc, int32_t off) {
+    if (fits_int8((int64_t)off - 2)) {
+        codegen_emit_u8(cg, cc < 0 ? 0xEB : 0x70 | cc);
+        codegen_emit_u8(cg, (uint8_t)(off - 2));
+    } else if (cc < 0) {
+        codegen_emit_u8(cg, 0xE9);
+        codegen_emit_u32(cg, (uint32_t)(off - 5));
+    } else {
+        codegen_emit_u8(cg, 0x0F);
+        codegen_emit_u8(cg, 0x80 | cc);
+        codegen_emit_u32(cg, (uint32_t)(off - 6));
+    }
+}
+
+void x64_emit_jmp(CodeGen *cg, int32_t off) {
+    x64_emit_jcc(cg, -1, off);
+}
+
+void x64_emit_branch(CodeGen *cg, int cc, int label) {
+    size_t offset = cg->pos;
+    if (cc < 0) {
+        codegen_emit_u8(cg, 0xE9);
+    } else {
+        codegen_emit_u8(cg, 0x0F);
+        codegen_emit_u8(cg, 0x80 | cc);
+    }
+    codegen_emit_u32(cg, 0);
+    add_label_ref(cg, offset, label, LABEL_BRANCH, -1);
+}
+void x64_emit_je(CodeGen *cg, int32_t off) {
+    x64_emit_jcc(cg, X64_CC_E, off);
+}
+
+void x64_emit_jne(CodeGen *cg, int32_t off) {
+    x64_emit_jcc(cg, X64_CC_NE, off);
+}
+
+void x64_emit_jl(CodeGen *cg, int32_t off) {
+    x64_emit_jcc(cg, X64_CC_L, off);
+}
+
+void x64_emit_jle(CodeGen *cg, int32_t off) {
+    x64_emit_jcc(cg, X64_CC_LE, off);
+}
+
+void x64_emit_jg(CodeGen *cg, int32_t off) {
+    x64_emit_jcc(cg, X64_CC_G, off);
+}
+
+void x64_emit_jge(CodeGen *cg, int32_t off) {
+    x64_emit_jcc(cg, X64_CC_GE, off);
+}
+
+// Through r11, which no argument is passed in.
+void x64_emit_call(CodeGen *cg, void *target) {
+    x64_emit_load_imm(cg, X64_R11, (int64_t)(uintptr_t)target);
+    emit_rr(cg, 0, false, 0xFF, 2, X64_R11);
+}
+
+void x64_emit_ret(CodeGen *cg) {
+    codegen_emit_u8(cg, 0xC3);
+}
+
+void x64_emit_push(CodeGen *cg, int reg) {
+    emit_rex(cg, false, 0, X64_NOREG, reg, false);
+    codegen_emit_u8(cg, 0x50 | (reg & 7));
+}
+
+void x64_emit_pop(CodeGen *cg, int reg) {
+    emit_rex(cg, false, 0, X64_NOREG, reg, false);
+    codegen_emit_u8(cg, 0x58 | (reg & 7));
+}
+
+// The shortest of xor, a zero-extended mov, a sign-extended mov and movabs.
+void x64_emit_load_imm(CodeGen *cg, int reg, int64_t val) {
+    if (val == 0) {
+        x64_op_rr(cg, X64_XOR, 4, reg, reg);
+    } else if (val > 0 && val <= UINT32_MAX) {
+        emit_rex(cg, false, 0, X64_NOREG, reg, false);
+        codegen_emit_u8(cg, 0xB8 | (reg & 7));
+        codegen_emit_u32(cg, (uint32_t)val);
+    } else if (fits_int32(val)) {
+        x64_op_ri(cg, X64_MOV, 8, reg, val);
+    } else {
+        emit_rex(cg, true, 0, X64_NOREG, reg, false);
+        codegen_emit_u8(cg, 0xB8 | (reg & 7));
+        codegen_emit_u64(cg, (uint64_t)val);
+    }
+}
+
+void x64_emit_load_mem(CodeGen *cg, int reg, int base, int off) {
+    x64_op_rm(cg, X64_MOV, 8, reg, x64_mem(base, off));
+}
+
+void x64_emit_store_mem(CodeGen *cg, int reg, int base, int off) {
+    x64_op_mr(cg, X64_MOV, 8, x64_mem(base, off), reg);
+}
+
+// movabs reg, symbol + addend.
+static void emit_load_address(CodeGen *cg, int reg, const char *symbol, int addend) {
+    emit_rex(cg, true, 0, X64_NOREG, reg, false);
+    codegen_emit_u8(cg, 0xB8 | (reg & 7));
+    add_fixup(cg, cg->pos, FIX_ABS64, symbol, addend);
+    codegen_emit_u64(cg, 0);
+}
+
+// Loads width bytes from [base + disp] into reg, extended to 64 bits.
+static void emit_load_sized(CodeGen *cg, int reg, int base, int32_t disp, int width,
+                            bool is_unsigned) {
+    switch (width) {
+        case 1:
+            emit_rm(cg, 0, !is_unsigned, is_unsigned ? 0x0FB6 : 0x0FBE, reg, base, disp, false);
+            break;
+        case 2:
+            emit_rm(cg, 0, !is_unsigned, is_unsigned ? 0x0FB7 : 0x0FBF, reg, base, disp, false);
+            break;
+        case 4:
+            emit_rm(cg, 0, !is_unsigned, is_unsigned ? 0x8B : 0x63, reg, base, disp, false);
+            break;
+        default:
+            x64_emit_load_mem(cg, reg, base, disp);
+            break;
+    }
+}
+
+static void emit_store_sized(CodeGen *cg, int reg, int base, int32_t disp, int width) {
+    x64_op_mr(cg, X64_MOV, width, x64_mem(base, disp), reg);
+}
+
+// Re-extends the low width bytes of rax to 64 bits.
+static void emit_extend(CodeGen *cg, int width, bool is_unsigned) {
+    switch (width) {
+        case 1:
+            emit_rr(cg, 0, !is_unsigned, is_unsigned ? 0x0FB6 : 0x0FBE, X64_RAX, X64_RAX);
+            break;
+        case 2:
+            emit_rr(cg, 0, !is_unsigned, is_unsigned ? 0x0FB7 : 0x0FBF, X64_RAX, X64_RAX);
+            break;
+        case 4:
+            if (is_unsigned) {
+                x64_op_rr(cg, X64_MOV, 4, X64_RAX, X64_RAX);
+            } else {
+                codegen_emit_u8(cg, 0x48);
+                codegen_emit_u8(cg, 0x98);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// movq xmm, reg and back; a floof result keeps its upper 32 bits clear.
+static void emit_to_xmm(CodeGen *cg, int xmm, int reg) {
+    emit_rr(cg, 0x66, true, 0x0F6E, xmm, reg);
+}
+
+static void emit_from_xmm(CodeGen *cg, int reg, int xmm, int width) {
+    emit_rr(cg, 0x66, width != 4, 0x0F7E, xmm, reg);
+}
+
+static void emit_setcc(CodeGen *cg, int cc, int reg) {
+    emit_rr(cg, 0, false, 0x0F90 | cc, 0, reg);
+}
+
+// rsp -= size, touching every page on the way so that running out of stack
+// faults on the guard page rather than skipping it.
+static void emit_stack_alloc(CodeGen *cg, int size) {
+    int pages = size / JIT_PAGE_SIZE;
+    if (pages > 0) {
+        x64_op_rm(cg, X64_LEA, 8, X64_RAX, x64_mem(X64_RSP, -pages * JIT_PAGE_SIZE));
+        size_t loop = cg->pos;
+        x64_op_ri(cg, X64_SUB, 8, X64_RSP, JIT_PAGE_SIZE);
+        x64_op_mi(cg, X64_OR, 8, x64_mem(X64_RSP, 0), 0);
+        x64_emit_cmp(cg, X64_RSP, X64_RAX);
+        x64_emit_jne(cg, (int32_t)(loop - cg->pos));
+    }
+
+    int rest = size - pages * JIT_PAGE_SIZE;
+    if (rest > 0) {
+        x64_op_ri(cg, X64_SUB, 8, X64_RSP, rest);
+    }
+}
+
+void x64_emit_prologue(CodeGen *cg, int frame_sz) {
+    x64_emit_push(cg, X64_RBP);
+    x64_emit_mov(cg, X64_RBP, X64_RSP);
+    emit_stack_alloc(cg, frame_sz);
+}
+
+void x64_emit_epilogue(CodeGen *cg) {
+    codegen_emit_u8(cg, 0xC9);
+    x64_emit_ret(cg);
+}
+
+// ---------------------------------------------------------------------------
+// Baseline instruction selection
+//
+// Mirrors the AOT backend (codegen.c): the same widths, extensions, calling
+// convention and check semantics, so a program behaves the same under --run
+// as compiled. Variables sit at the string IR's offsets below rbp, vregs in
+// 8-byte slots below them.
+
+static const int x64_arg_regs[] = {X64_RDI, X64_RSI, X64_RDX, X64_RCX, X64_R8, X64_R9};
+#define X64_NUM_ARG_REGS 6
+
+static const char bounds_message[] = "runtime error: array index out of bounds\n";
+static const char null_message[] = "runtime error: null pointer dereference\n";
+
+enum { STUB_NONE = -1, STUB_BOUNDS, STUB_NULL, STUB_COUNT };
+
+// The labels of the function being emitted: each block's, and each check
+// failure stub's once something branches to it, -1 before.
+static int *block_labels;
+static int stub_labels[STUB_COUNT];
+
+static int vreg_base;
+// Below the vregs: a slot for each allocatable register, saved there by
+// code that uses it.
+static int save_base;
+static int params_gp, params_fp, params_stack;
+
+// The tier being emitted. Under JIT_ADAPTIVE, emit_funcs holds the records
+// calls to module functions go through; otherwise they are called directly.
+static JITTier emit_tier;
+static FuncTier *emit_funcs;
+static void *tier_up_stub;
+static int64_t emit_opt_threshold;
+// JIT_OPTIMIZED: the vreg whose value rax still holds, or -1. The last
+// result stays in rax, so reading it next does not go through memory.
+static int rax_vreg = -1;
+// JIT_OPTIMIZED: the register allocation, the position being emitted and
+// its block.
+static RegisterAlloc *emit_ra;
+static int emit_pos;
+static int emit_block = -1;
+// Edges whose vregs change places, from a split, get a stub of moves that
+// a branch along them goes through.
+typedef struct {
+    int from;
+    BasicBlock *target;
+    int label;
+} EdgeStub;
+static EdgeStub *edge_stubs;
+static int edge_stub_count, edge_stub_cap;
+
+static void free_edge_stubs(void) {
+    free(edge_stubs);
+    edge_stubs = NULL;
+    edge_stub_count = edge_stub_cap = 0;
+}
+
+static int align_to(int value, int alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static int32_t vreg_disp(int vreg) {
+    return -(vreg_base + 8 * (vreg + 1));
+}
+
+int jit_frame_size(const Function *f) {
+    return align_to(align_to(f->locals, 8) + 8 * (f->vreg_counter + NUM_ALLOC_REGS), 16);
+}
+
+int jit_vreg_offset(const Function *f, int vreg) {
+    return align_to(f->locals, 8) + 8 * (vreg + 1);
+}
+
+static void set_emit_tier(JITContext *jit, JITTier tier) {
+    emit_tier = tier;
+    emit_funcs = jit->tier == JIT_ADAPTIVE ? jit->funcs : NULL;
+    tier_up_stub = jit->tier_up_stub;
+    int64_t threshold = (int64_t)jit->config.recomp_threshold * JIT_OPT_FACTOR;
+    emit_opt_threshold = threshold < INT32_MAX ? threshold : INT32_MAX;
+}
+
+static bool edge_has_moves(int from, BasicBlock *to) {
+    RegisterAlloc *ra = emit_ra;
+    for (int k = 0; k < ra->spill_count; k++) {
+        int v = ra->spilled[k];
+        if (!regalloc_live_in(ra, to->id, v)) continue;
+        if (regalloc_location(ra, v, ra->block_last[from]) !=
+            regalloc_location(ra, v, ra->block_first[to->id])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Only a split vreg changes places. Stores first: a reload may take over a
+// register a store reads.
+static void emit_edge_moves(CodeGen *cg, int from, BasicBlock *to) {
+    RegisterAlloc *ra = emit_ra;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int k = 0; k < ra->spill_count; k++) {
+            int v = ra->spilled[k];
+            if (!regalloc_live_in(ra, to->id, v)) continue;
+            int out = regalloc_location(ra, v, ra->block_last[from]);
+            int in = regalloc_location(ra, v, ra->block_first[to->id]);
+            if (pass == 0 && out >= 0 && in < 0) {
+                x64_emit_store_mem(cg, out, X64_RBP, vreg_disp(v));
+            } else if (pass == 1 && out < 0 && in >= 0) {
+                x64_emit_load_mem(cg, in, X64_RBP, vreg_disp(v));
+            }
+        }
+    }
+}
+
+static int edge_stub(CodeGen *cg, int from, BasicBlock *target) {
+    for (int e = 0; e < edge_stub_count; e++) {
+        if (edge_stubs[e].from == from && edge_stubs[e].target == target) return edge_stubs[e].label;
+    }
+    if (edge_stub_count == edge_stub_cap) {
+        edge_stub_cap = edge_stub_cap ? edge_stub_cap * 2 : 16;
+        edge_stubs = xrealloc(edge_stubs, edge_stub_cap * sizeof(EdgeStub));
+    }
+    edge_stubs[edge_stub_count] = (EdgeStub){from, target, codegen_new_label(cg)};
+    return edge_stubs[edge_stub_count++].label;
+}
+
+// Where a branch from the block being emitted to target, or to stub when
+// target is NULL, goes.
+static int branch_label(CodeGen *cg, BasicBlock *target, int stub) {
+    if (!target) {
+        if (stub_labels[stub] < 0) stub_labels[stub] = codegen_new_label(cg);
+        return stub_labels[stub];
+    }
+    if (emit_ra && emit_block >= 0 && edge_has_moves(emit_block, target)) {
+        return edge_stub(cg, emit_block, target);
+    }
+    return block_labels[target->id];
+}
+
+static void emit_jump_to(CodeGen *cg, int cc, BasicBlock *target, int stub) {
+    x64_emit_branch(cg, cc, branch_label(cg, target, stub));
+}
+
+static bool is_module_function(const Value *v) {
+    return v->kind == VAL_SYMBOL && v->function && !v->function->is_external;
+}
+
+static int vreg_location(int vreg) {
+    return emit_ra ? regalloc_location(emit_ra, vreg, emit_pos) : -1;
+}
+
+static void emit_load_value(CodeGen *cg, int reg, Value *v) {
+    int home;
+    switch (v->kind) {
+        case VAL_VREG:
+            home = vreg_location(v->as.vreg_num);
+            if (v->as.vreg_num == rax_vreg) {
+                if (reg != X64_RAX) x64_emit_mov(cg, reg, X64_RAX);
+            } else if (home >= 0) {
+                x64_emit_mov(cg, reg, home);
+            } else {
+                x64_emit_load_mem(cg, reg, X64_RBP, vreg_disp(v->as.vreg_num));
+            }
+            break;
+        case VAL_IMMEDIATE:
+            x64_emit_load_imm(cg, reg, v->as.imm);
+            break;
+        case VAL_DATA:
+            emit_load_address(cg, reg, JIT_DATA_SYMBOL, (int)v->as.data);
+            break;
+        case VAL_SYMBOL:
+            if (is_module_function(v) && emit_funcs) {
+                // The function's current code.
+                x64_emit_load_imm(cg, reg, (int64_t)(uintptr_t)&emit_funcs[v->function->index].entry);
+                x64_emit_load_mem(cg, reg, reg, 0);
+            } else if (is_module_function(v)) {
+                size_t disp = x64_op_rm(cg, X64_LEA, 8, reg, x64_mem(X64_RIP, 0));
+                add_fixup(cg, disp, FIX_REL32, v->as.symbol, 0);
+            } else {
+                size_t disp = x64_op_rm(cg, X64_MOV, 8, reg, x64_mem(X64_RIP, 0));
+                add_fixup(cg, disp, FIX_GOT, v->as.symbol, 0);
+            }
+            break;
+        default:
+            error("jit: operand cannot be loaded");
+    }
+    if (reg == X64_RAX) {
+        rax_vreg = v->kind == VAL_VREG ? v->as.vreg_num : -1;
+    }
+}
+
+static void emit_store_result(CodeGen *cg, Instruction *i) {
+    if (i->result) {
+        int home = vreg_location(i->result->as.vreg_num);
+        if (home >= 0) {
+            x64_emit_mov(cg, home, X64_RAX);
+        } else {
+            x64_emit_store_mem(cg, X64_RAX, X64_RBP, vreg_disp(i->result->as.vreg_num));
+        }
+        rax_vreg = emit_tier == JIT_OPTIMIZED ? i->result->as.vreg_num : -1;
+    }
+}
+
+// Saves the allocated registers the code uses to their slots, or restores
+// them, before the frame goes.
+static void emit_saved_regs(CodeGen *cg, bool restore) {
+    if (!emit_ra) return;
+    for (int r = 0; r < NUM_ALLOC_REGS; r++) {
+        if (!emit_ra->phys_used[r]) continue;
+        int32_t disp = -(save_base + 8 * (r + 1));
+        if (restore) {
+            x64_emit_load_mem(cg, alloc_regs[r], X64_RBP, disp);
+        } else {
+            x64_emit_store_mem(cg, alloc_regs[r], X64_RBP, disp);
+        }
+    }
+}
+
+static bool is_float_arg(Instruction *i, int n) {
+    return (i->float_args >> n) & 1;
+}
+
+static void emit_call(CodeGen *cg, Instruction *i, bool tail) {
+    int num_args = i->operand_count - 1;
+    int reg[16];
+    int stack_slots[16];
+    int gp = 0, fp = 0, stack_args = 0;
+    for (int n = 1; n <= num_args; n++) {
+        if (is_float_arg(i, n) && fp < 8) {
+            reg[n] = fp++;
+        } else if (!is_float_arg(i, n) && gp < X64_NUM_ARG_REGS) {
+            reg[n] = gp++;
+        } else {
+            reg[n] = -1;
+            stack_slots[stack_args++] = n;
+        }
+    }
+
+    bool need_align = (stack_args * 8) % 16 != 0;
+    if (need_align) {
+        x64_op_ri(cg, X64_SUB, 8, X64_RSP, 8);
+    }
+    for (int s = stack_args - 1; s >= 0; s--) {
+        emit_load_value(cg, X64_RAX, i->operands[stack_slots[s]]);
+        x64_emit_push(cg, X64_RAX);
+    }
+    for (int n = 1; n <= num_args; n++) {
+        if (reg[n] < 0) continue;
+        if (is_float_arg(i, n)) {
+            emit_load_value(cg, X64_RAX, i->operands[n]);
+            emit_to_xmm(cg, reg[n], X64_RAX);
+        } else {
+            emit_load_value(cg, x64_arg_regs[reg[n]], i->operands[n]);
+        }
+    }
+
+    // Variadic callees read the number of vector registers used from al.
+    if (fp > 0) {
+        x64_emit_load_imm(cg, X64_RAX, fp);
+        rax_vreg = -1;
+    }
+
+    // Under JIT_ADAPTIVE a module function is called through its record,
+    // so that the call reaches whatever tier it is at. Functions outside
+    // the module are called through the code block's stubs.
+    Value *callee = i->operands[0];
+    bool external = callee->kind == VAL_SYMBOL && !is_module_function(callee);
+    bool direct = (is_module_function(callee) && !emit_funcs) || external;
+    bool via_record = is_module_function(callee) && emit_funcs;
+    int type = external ? FIX_PLT : FIX_REL32;
+    if (via_record) {
+        x64_emit_load_imm(cg, X64_R11, (int64_t)(uintptr_t)&emit_funcs[callee->function->index].entry);
+    } else if (!direct) {
+        emit_load_value(cg, X64_R11, callee);
+    }
+    if (tail) {
+        emit_saved_regs(cg, true);
+        codegen_emit_u8(cg, 0xC9);
+        if (direct) {
+            emit_rel32_call_or_jmp(cg, 0xE9, type, callee->as.symbol);
+        } else if (via_record) {
+            emit_rm(cg, 0, false, 0xFF, 4, X64_R11, 0, false);
+        } else {
+            emit_rr(cg, 0, false, 0xFF, 4, X64_R11);
+        }
+        return;
+    }
+    if (direct) {
+        emit_rel32_call_or_jmp(cg, 0xE8, type, callee->as.symbol);
+    } else if (via_record) {
+        emit_rm(cg, 0, false, 0xFF, 2, X64_R11, 0, false);
+    } else {
+        emit_rr(cg, 0, false, 0xFF, 2, X64_R11);
+    }
+    rax_vreg = -1;
+
+    if (stack_args > 0 || need_align) {
+        x64_op_ri(cg, X64_ADD, 8, X64_RSP, stack_args * 8 + (need_align ? 8 : 0));
+    }
+
+    if (!i->result) return;
+    if (i->is_float) {
+        emit_from_xmm(cg, X64_RAX, 0, i->width);
+    } else {
+        emit_extend(cg, i->width, i->is_unsigned);
+    }
+    emit_store_result(cg, i);
+}
+
+static const uint8_t compare_cc[] = {
+    X64_CC_E, X64_CC_NE, X64_CC_L, X64_CC_LE, X64_CC_G, X64_CC_GE
+};
+
+// add, sub, mul and div of floofs and bigfloofs, and their compares.
+// ucomis sets CF/ZF like an unsigned compare and all of CF, ZF and PF for
+// unordered operands, so lt/le are done as gt/ge with the operands swapped
+// to make NaN compare false.
+static void emit_float_binary(CodeGen *cg, Instruction *i) {
+    uint8_t p = i->width == 4 ? 0xF3 : 0xF2;
+    emit_load_value(cg, X64_RAX, i->operands[0]);
+    emit_to_xmm(cg, 0, X64_RAX);
+    emit_load_value(cg, X64_RAX, i->operands[1]);
+    emit_to_xmm(cg, 1, X64_RAX);
+
+    if (i->op < OP_EQ) {
+        static const uint8_t ops[] = {0x58, 0x5C, 0x59, 0x5E};
+        emit_rr(cg, p, false, 0x0F00 | ops[i->op - OP_ADD], 0, 1);
+        emit_from_xmm(cg, X64_RAX, 0, i->width);
+        emit_store_result(cg, i);
+        return;
+    }
+
+    bool swap = i->op == OP_LT || i->op == OP_LE;
+    emit_rr(cg, i->width == 4 ? 0 : 0x66, false, 0x0F2E, swap ? 1 : 0, swap ? 0 : 1);
+    if (i->op == OP_EQ) {
+        emit_setcc(cg, X64_CC_E, X64_RAX);
+        emit_setcc(cg, X64_CC_NP, X64_RCX);
+        x64_op_rr(cg, X64_AND, 1, X64_RAX, X64_RCX);
+    } else if (i->op == OP_NE) {
+        emit_setcc(cg, X64_CC_NE, X64_RAX);
+        emit_setcc(cg, X64_CC_P, X64_RCX);
+        x64_op_rr(cg, X64_OR, 1, X64_RAX, X64_RCX);
+    } else {
+        bool strict = i->op == OP_LT || i->op == OP_GT;
+        emit_setcc(cg, strict ? X64_CC_A : X64_CC_AE, X64_RAX);
+    }
+    emit_rr(cg, 0, false, 0x0FB6, X64_RAX, X64_RAX);
+    emit_store_result(cg, i);
+}
+
+static void emit_float_convert(CodeGen *cg, Instruction *i) {
+    uint8_t p = i->width == 4 ? 0xF3 : 0xF2;
+    emit_load_value(cg, X64_RAX, i->operands[0]);
+    switch (i->op) {
+        case OP_ITOF:
+            emit_rr(cg, p, true, 0x0F2A, 0, X64_RAX);
+            emit_from_xmm(cg, X64_RAX, 0, i->width);
+            break;
+        case OP_FTOI:
+            emit_to_xmm(cg, 0, X64_RAX);
+            emit_rr(cg, p, true, 0x0F2C, X64_RAX, 0);
+            break;
+        default:
+            // fext to a bigfloof, ftrunc to a floof.
+            emit_to_xmm(cg, 0, X64_RAX);
+            emit_rr(cg, i->width == 4 ? 0xF2 : 0xF3, false, 0x0F5A, 0, 0);
+            emit_from_xmm(cg, X64_RAX, 0, i->width);
+            break;
+    }
+    emit_store_result(cg, i);
+}
+
+static void emit_switch(CodeGen *cg, Instruction *i) {
+    int count = i->operand_count - 3;
+    int64_t min = i->operands[1]->as.imm;
+    emit_load_value(cg, X64_RAX, i->operands[0]);
+    if (fits_int32(min)) {
+        x64_op_ri(cg, X64_SUB, 8, X64_RAX, min);
+    } else {
+        x64_emit_load_imm(cg, X64_RCX, min);
+        x64_emit_sub(cg, X64_RAX, X64_RCX);
+    }
+    rax_vreg = -1;
+    x64_op_ri(cg, X64_CMP, 8, X64_RAX, count);
+    emit_jump_to(cg, X64_CC_AE, i->operands[2]->as.block, STUB_NONE);
+
+    // Entries are relative to the table.
+    int table = codegen_new_label(cg);
+    size_t disp = x64_op_rm(cg, X64_LEA, 8, X64_RCX, x64_mem(X64_RIP, 0));
+    add_label_ref(cg, disp, table, LABEL_REL32, -1);
+    emit_modrm(cg, 0, true, 0x63, X64_RAX, 0, &(X64Mem){X64_RCX, X64_RAX, 4, 0}, false);
+    x64_emit_add(cg, X64_RAX, X64_RCX);
+    emit_rr(cg, 0, false, 0xFF, 4, X64_RAX);
+    codegen_bind_label(cg, table);
+    for (int n = 0; n < count; n++) {
+        codegen_emit_label_rel32(cg, branch_label(cg, i->operands[3 + n]->as.block, STUB_NONE),
+                                 table);
+    }
+}
+
+static void emit_param(CodeGen *cg, Instruction *i) {
+    int32_t disp = -i->operands[0]->as.slot;
+    if (i->is_float && params_fp < 8) {
+        emit_rm(cg, i->width == 4 ? 0xF3 : 0xF2, false, 0x0F11, params_fp++, X64_RBP, disp,
+                false);
+    } else if (!i->is_float && params_gp < X64_NUM_ARG_REGS) {
+        emit_store_sized(cg, x64_arg_regs[params_gp++], X64_RBP, disp, i->width);
+    } else {
+        // Above the saved rbp and the return address.
+        x64_emit_load_mem(cg, X64_RAX, X64_RBP, 16 + params_stack++ * 8);
+        emit_store_sized(cg, X64_RAX, X64_RBP, disp, i->width);
+        rax_vreg = -1;
+    }
+}
+
+static void emit_check(CodeGen *cg, Instruction *i) {
+    switch (i->op) {
+        case OP_CHKBOUNDS:
+            // Unsigned, so that a negative index fails as well.
+            emit_load_value(cg, X64_RAX, i->operands[0]);
+            emit_load_value(cg, X64_RCX, i->operands[1]);
+            x64_emit_cmp(cg, X64_RAX, X64_RCX);
+            emit_jump_to(cg, X64_CC_AE, NULL, STUB_BOUNDS);
+            break;
+        case OP_CHKRANGE: {
+            // An empty range lo >= hi accesses nothing.
+            emit_load_value(cg, X64_RCX, i->operands[0]);
+            emit_load_value(cg, X64_RAX, i->operands[1]);
+            x64_emit_cmp(cg, X64_RCX, X64_RAX);
+            int skip = codegen_new_label(cg);
+            x64_emit_branch(cg, X64_CC_GE, skip);
+            x64_op_rr(cg, X64_TEST, 8, X64_RCX, X64_RCX);
+            emit_jump_to(cg, X64_CC_S, NULL, STUB_BOUNDS);
+            emit_load_value(cg, X64_RCX, i->operands[2]);
+            x64_emit_cmp(cg, X64_RAX, X64_RCX);
+            emit_jump_to(cg, X64_CC_G, NULL, STUB_BOUNDS);
+            codegen_bind_label(cg, skip);
+            break;
+        }
+        default:
+            emit_load_value(cg, X64_RAX, i->operands[0]);
+            x64_op_rr(cg, X64_TEST, 8, X64_RAX, X64_RAX);
+            emit_jump_to(cg, X64_CC_E, NULL, STUB_NULL);
+            break;
+    }
+}
+
+void x64_emit_inst(CodeGen *cg, Instruction *i, RegisterAlloc *ra) {
+    if (!cg || !i) return;
+    emit_ra = ra;
+
+    bool w = i->width != 4;
+    int size = w ? 8 : 4;
+    int32_t slot;
+
+    switch (i->op) {
+        case OP_MOV:
+            emit_load_value(cg, X64_RAX, i->operands[0]);
+            emit_store_result(cg, i);
+            break;
+        case OP_LOAD_SLOT:
+            slot = -i->operands[0]->as.slot;
+            emit_load_sized(cg, X64_RAX, X64_RBP, slot, i->width, i->is_unsigned);
+            emit_store_result(cg, i);
+            break;
+        case OP_STORE_SLOT:
+            slot = -i->operands[0]->as.slot;
+            emit_load_value(cg, X64_RAX, i->operands[1]);
+            emit_store_sized(cg, X64_RAX, X64_RBP, slot, i->width);
+            break;
+        case OP_ADDR:
+            x64_op_rm(cg, X64_LEA, 8, X64_RAX, x64_mem(X64_RBP, -i->operands[0]->as.slot));
+            emit_store_result(cg, i);
+            break;
+        case OP_LOAD:
+            emit_load_value(cg, X64_RAX, i->operands[0]);
+            emit_load_sized(cg, X64_RAX, X64_RAX, 0, i->width, i->is_unsigned);
+            emit_store_result(cg, i);
+            break;
+        case OP_STORE:
+            emit_load_value(cg, X64_RCX, i->operands[0]);
+            emit_load_value(cg, X64_RAX, i->operands[1]);
+            emit_store_sized(cg, X64_RAX, X64_RCX, 0, i->width);
+            break;
+
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+        case OP_SHL:
+        case OP_SHR:
+            if (i->is_float && i->op <= OP_DIV) {
+                emit_float_binary(cg, i);
+                break;
+            }
+            emit_load_value(cg, X64_RAX, i->operands[0]);
+            emit_load_value(cg, X64_RCX, i->operands[1]);
+            switch (i->op) {
+                case OP_ADD: x64_op_rr(cg, X64_ADD, size, X64_RAX, X64_RCX); break;
+                case OP_SUB: x64_op_rr(cg, X64_SUB, size, X64_RAX, X64_RCX); break;
+                case OP_MUL: x64_op_rr(cg, X64_IMUL, size, X64_RAX, X64_RCX); break;
+                case OP_AND: x64_op_rr(cg, X64_AND, size, X64_RAX, X64_RCX); break;
+                case OP_OR:  x64_op_rr(cg, X64_OR, size, X64_RAX, X64_RCX); break;
+                case OP_XOR: x64_op_rr(cg, X64_XOR, size, X64_RAX, X64_RCX); break;
+                case OP_SHL: x64_op_r(cg, X64_SHL, size, X64_RAX); break;
+                case OP_SHR: x64_op_r(cg, i->is_unsigned ? X64_SHR : X64_SAR, size, X64_RAX); break;
+                default:
+                    // cqo or cdq, then idiv rcx.
+                    if (w) codegen_emit_u8(cg, 0x48);
+                    codegen_emit_u8(cg, 0x99);
+                    x64_op_r(cg, X64_IDIV, size, X64_RCX);
+                    if (i->op == OP_MOD) x64_emit_mov(cg, X64_RAX, X64_RDX);
+                    break;
+            }
+            if (i->width == 4) emit_extend(cg, 4, i->is_unsigned);
+            emit_store_result(cg, i);
+            break;
+
+        case OP_NEG:
+        case OP_NOT:
+            emit_load_value(cg, X64_RAX, i->operands[0]);
+            if (i->is_float && i->op == OP_NEG) {
+                // Flip the sign bit.
+                emit_rr(cg, 0, w, 0x0FBA, 7, X64_RAX);
+                codegen_emit_u8(cg, w ? 63 : 31);
+            } else {
+                x64_op_r(cg, i->op == OP_NEG ? X64_NEG : X64_NOT, size, X64_RAX);
+                if (i->width == 4) emit_extend(cg, 4, i->is_unsigned);
+            }
+            emit_store_result(cg, i);
+            break;
+        case OP_EXT:
+            emit_load_value(cg, X64_RAX, i->operands[0]);
+            emit_extend(cg, i->width, i->is_unsigned);
+            emit_store_result(cg, i);
+            break;
+
+        case OP_EQ:
+        case OP_NE:
+        case OP_LT:
+        case OP_LE:
+        case OP_GT:
+        case OP_GE:
+            if (i->is_float) {
+                emit_float_binary(cg, i);
+                break;
+            }
+            emit_load_value(cg, X64_RAX, i->operands[0]);
+            emit_load_value(cg, X64_RCX, i->operands[1]);
+            x64_op_rr(cg, X64_CMP, size, X64_RAX, X64_RCX);
+            emit_setcc(cg, compare_cc[i->op - OP_EQ], X64_RAX);
+            emit_rr(cg, 0, false, 0x0FB6, X64_RAX, X64_RAX);
+            emit_store_result(cg, i);
+            break;
+
+        case OP_ITOF:
+        case OP_FTOI:
+        case OP_FEXT:
+        case OP_FTRUNC:
+            emit_float_convert(cg, i);
+            break;
+
+        case OP_PARAM:
+            emit_param(cg, i);
+            break;
+        case OP_CALL:
+            emit_call(cg, i, false);
+            break;
+        case OP_TAILCALL:
+            emit_call(cg, i, true);
+            break;
+        case OP_CHKBOUNDS:
+        case OP_CHKRANGE:
+        case OP_CHKNULL:
+            emit_check(cg, i);
+            break;
+
+        case OP_JMP:
+            emit_jump_to(cg, -1, i->operands[0]->as.block, STUB_NONE);
+            break;
+        case OP_BRZ:
+        case OP_BRNZ:
+            emit_load_value(cg, X64_RAX, i->operands[0]);
+            x64_op_rr(cg, X64_TEST, 8, X64_RAX, X64_RAX);
+            emit_jump_to(cg, i->op == OP_BRZ ? X64_CC_E : X64_CC_NE,
+                         i->operands[1]->as.block, STUB_NONE);
+            break;
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BLE:
+        case OP_BGT:
+        case OP_BGE:
+            emit_load_value(cg, X64_RAX, i->operands[0]);
+            emit_load_value(cg, X64_RCX, i->operands[1]);
+            x64_op_rr(cg, X64_CMP, size, X64_RAX, X64_RCX);
+            emit_jump_to(cg, compare_cc[i->op - OP_BEQ], i->operands[2]->as.block, STUB_NONE);
+            break;
+        case OP_SWITCH:
+            emit_switch(cg, i);
+            break;
+        case OP_RET:
+            if (i->operand_count > 0) {
+                emit_load_value(cg, X64_RAX, i->operands[0]);
+                if (i->is_float) emit_to_xmm(cg, 0, X64_RAX);
+            }
+            emit_saved_regs(cg, true);
+            x64_emit_epilogue(cg);
+            break;
+    }
+}
+
+// Reports a failed check; reached with the stack in any alignment.
+static void emit_fail_stub(CodeGen *cg, const char *message, void (*handler)(const char *)) {
+    x64_op_ri(cg, X64_AND, 8, X64_RSP, -16);
+    x64_emit_load_imm(cg, X64_RDI, (int64_t)(uintptr_t)message);
+    x64_emit_call(cg, (void *)handler);
+}
+
+// Baseline code under JIT_ADAPTIVE counts calls and loop back edges as the
+// interpreter does, and once the count reaches the optimizing tier's
+// threshold calls the tier-up stub with r11 pointing at the record. At a
+// loop header it then jumps to the same block of the optimized code: both
+// tiers lay out the frame the same way, so the frame carries over as is.
+static void emit_tier_check(CodeGen *cg, FuncTier *t, BasicBlock *header) {
+    x64_emit_load_imm(cg, X64_R11, (int64_t)(uintptr_t)t);
+    x64_op_m(cg, X64_INC, 8, x64_mem(X64_R11, 0));
+    x64_op_mi(cg, X64_CMP, 8, x64_mem(X64_R11, 0), emit_opt_threshold);
+    int skip = codegen_new_label(cg);
+    x64_emit_branch(cg, X64_CC_B, skip);
+
+    x64_emit_load_imm(cg, X64_R10, (int64_t)(uintptr_t)tier_up_stub);
+    emit_rr(cg, 0, false, 0xFF, 2, X64_R10);
+    if (header) {
+        x64_emit_load_imm(cg, X64_R11, (int64_t)(uintptr_t)t);
+        x64_emit_load_mem(cg, X64_R11, X64_R11, offsetof(FuncTier, blocks));
+        emit_rm(cg, 0, false, 0xFF, 4, X64_R11, header->id * 8, false);
+    }
+    codegen_bind_label(cg, skip);
+}
+
+// Blocks some branch goes back to.
+static bool *find_loop_headers(Function *f) {
+    bool *headers = xcalloc(f->block_count, sizeof(bool));
+    for (int b = 0; b < f->block_count; b++) {
+        Instruction *last = f->blocks[b]->last_inst;
+        if (!last || !ssa_is_terminator(last)) continue;
+        for (int n = 0; n < last->operand_count; n++) {
+            Value *v = last->operands[n];
+            if (v->kind == VAL_BLOCK && v->as.block->id <= b) headers[v->as.block->id] = true;
+        }
+    }
+    return headers;
+}
+
+// Enters the optimized code at a loop header from a frame in memory, as
+// moving up a tier does: saves the allocated registers, as the prologue
+// would have, and loads the vregs that live in registers at the header.
+static void emit_osr_entry(CodeGen *cg, BasicBlock *header) {
+    RegisterAlloc *ra = emit_ra;
+    emit_saved_regs(cg, false);
+    for (int v = 0; v < ra->vreg_count; v++) {
+        int reg = regalloc_location(ra, v, ra->block_first[header->id]);
+        if (reg >= 0 && regalloc_live_in(ra, header->id, v)) {
+            x64_emit_load_mem(cg, reg, X64_RBP, vreg_disp(v));
+        }
+    }
+    x64_emit_branch(cg, -1, block_labels[header->id]);
+}
+
+// block_offsets, if given, receives where to enter each block; under
+// JIT_ADAPTIVE a loop header of optimized code is entered through its OSR
+// entry. The function's branches are shortened once it is done.
+static void emit_function(CodeGen *cg, Function *f, size_t *block_offsets) {
+    vreg_base = align_to(f->locals, 8);
+    save_base = vreg_base + 8 * f->vreg_counter;
+    params_gp = params_fp = params_stack = 0;
+    edge_stub_count = 0;
+    cg->label_count = 0;
+    block_labels = xmalloc((f->block_count + 1) * sizeof(int));
+    int *entry_labels = xmalloc((f->block_count + 1) * sizeof(int));
+    for (int b = 0; b < f->block_count; b++) {
+        block_labels[b] = entry_labels[b] = codegen_new_label(cg);
+    }
+    for (int s = 0; s < STUB_COUNT; s++) stub_labels[s] = -1;
+    FuncTier *t = emit_funcs && emit_tier == JIT_BASELINE ? &emit_funcs[f->index] : NULL;
+    bool *headers = t ? find_loop_headers(f) : NULL;
+
+    RegisterAlloc *ra = NULL;
+    if (emit_tier == JIT_OPTIMIZED) {
+        ra = regalloc_create(f->vreg_counter);
+        regalloc_allocate(ra, f);
+    }
+    emit_ra = ra;
+    int next_spill = 0;
+
+    x64_emit_push(cg, X64_RBP);
+    x64_emit_mov(cg, X64_RBP, X64_RSP);
+    if (t) emit_tier_check(cg, t, NULL);
+    emit_stack_alloc(cg, jit_frame_size(f));
+    emit_saved_regs(cg, false);
+    for (int b = 0; b < f->block_count; b++) {
+        codegen_bind_label(cg, block_labels[b]);
+        rax_vreg = -1;
+        emit_block = b;
+        if (headers && headers[b]) emit_tier_check(cg, t, f->blocks[b]);
+        if (ra) {
+            emit_pos = ra->block_first[b];
+            // Splits at a block's entry are moved on its incoming edges.
+            while (next_spill < ra->spill_count && ra->spill_pos[ra->spilled[next_spill]] <= emit_pos) {
+                next_spill++;
+            }
+        }
+        for (Instruction *i = f->blocks[b]->first_inst; i; i = i->next) {
+            if (ra) {
+                emit_pos++;
+                for (; next_spill < ra->spill_count &&
+                       ra->spill_pos[ra->spilled[next_spill]] == emit_pos; next_spill++) {
+                    int v = ra->spilled[next_spill];
+                    x64_emit_store_mem(cg, ra->vreg_to_phys[v], X64_RBP, vreg_disp(v));
+                }
+            }
+            x64_emit_inst(cg, i, ra);
+        }
+        if (ra && falls_through(f->blocks[b]->last_inst) && b + 1 < f->block_count) {
+            emit_edge_moves(cg, b, f->blocks[b + 1]);
+        }
+    }
+    emit_block = -1;
+    free(headers);
+
+    for (int e = 0; e < edge_stub_count; e++) {
+        codegen_bind_label(cg, edge_stubs[e].label);
+        emit_edge_moves(cg, edge_stubs[e].from, edge_stubs[e].target);
+        x64_emit_branch(cg, -1, block_labels[edge_stubs[e].target->id]);
+    }
+    if (ra && emit_funcs && block_offsets) {
+        bool *loops = find_loop_headers(f);
+        for (int b = 0; b < f->block_count; b++) {
+            if (!loops[b]) continue;
+            entry_labels[b] = codegen_new_label(cg);
+            codegen_bind_label(cg, entry_labels[b]);
+            emit_osr_entry(cg, f->blocks[b]);
+        }
+        free(loops);
+    }
+
+    if (stub_labels[STUB_BOUNDS] >= 0) {
+        codegen_bind_label(cg, stub_labels[STUB_BOUNDS]);
+        emit_fail_stub(cg, bounds_message, uwu_bounds_error);
+    }
+    if (stub_labels[STUB_NULL] >= 0) {
+        codegen_bind_label(cg, stub_labels[STUB_NULL]);
+        emit_fail_stub(cg, null_message, uwu_null_error);
+    }
+
+    codegen_resolve_labels(cg);
+    for (int b = 0; block_offsets && b < f->block_count; b++) {
+        block_offsets[b] = codegen_label_offset(cg, entry_labels[b]);
+    }
+    free(entry_labels);
+    free(block_labels);
+    block_labels = NULL;
+    emit_ra = NULL;
+    regalloc_destroy(ra);
+}
+
+// ---------------------------------------------------------------------------
+// Execution
+
+// The runtime the compiled program would be linked with; anything else
+// (libc) is looked up in the process.
+static const struct {
+    const char *name;
+    void *addr;
+} runtime_symbols[] = {
+#define RUNTIME(fn) {#fn, (void *)fn}
+    RUNTIME(print_str), RUNTIME(print_int), RUNTIME(read_int),
+    RUNTIME(uwu_malloc), RUNTIME(uwu_calloc), RUNTIME(uwu_realloc), RUNTIME(uwu_free),
+    RUNTIME(uwu_report_leaks), RUNTIME(uwu_print), RUNTIME(uwu_printf), RUNTIME(uwu_scanf),
+    RUNTIME(uwu_fopen), RUNTIME(uwu_fclose), RUNTIME(uwu_fread), RUNTIME(uwu_fwrite),
+    RUNTIME(uwu_strlen), RUNTIME(uwu_strcpy), RUNTIME(uwu_strncpy), RUNTIME(uwu_strcat),
+    RUNTIME(uwu_strncat), RUNTIME(uwu_strcmp), RUNTIME(uwu_strncmp), RUNTIME(uwu_strchr),
+    RUNTIME(uwu_strrchr), RUNTIME(uwu_strdup),
+    RUNTIME(uwu_sqrt), RUNTIME(uwu_pow), RUNTIME(uwu_abs), RUNTIME(uwu_fabs),
+    RUNTIME(uwu_sin), RUNTIME(uwu_cos), RUNTIME(uwu_tan), RUNTIME(uwu_asin),
+    RUNTIME(uwu_acos), RUNTIME(uwu_atan), RUNTIME(uwu_atan2), RUNTIME(uwu_log),
+    RUNTIME(uwu_log10), RUNTIME(uwu_exp), RUNTIME(uwu_floor), RUNTIME(uwu_ceil),
+    RUNTIME(uwu_round),
+    RUNTIME(uwu_exit), RUNTIME(uwu_abort), RUNTIME(uwu_rand), RUNTIME(uwu_srand),
+    RUNTIME(uwu_time), RUNTIME(uwu_sleep),
+    RUNTIME(uwu_bounds_error), RUNTIME(uwu_null_error), RUNTIME(uwu_stack_overflow),
+    RUNTIME(uwu_check_bounds), RUNTIME(uwu_check_null),
+    RUNTIME(uwu_memcpy), RUNTIME(uwu_memmove), RUNTIME(uwu_memset), RUNTIME(uwu_memcmp),
+    RUNTIME(uwu_init), RUNTIME(uwu_cleanup),
+#undef RUNTIME
+};
+
+static void *resolve_runtime_symbol(const char *name) {
+    for (size_t i = 0; i < sizeof(runtime_symbols) / sizeof(runtime_symbols[0]); i++) {
+        if (strcmp(runtime_symbols[i].name, name) == 0) {
+            return runtime_symbols[i].addr;
+        }
+    }
+    return dlsym(RTLD_DEFAULT, name);
+}
+
+// ---------------------------------------------------------------------------
+// Tiers
+//
+// JIT_ADAPTIVE starts every function in the interpreter. A function that
+// reaches recomp_threshold calls and loop back edges is compiled by the
+// baseline JIT, whose code keeps counting, and at JIT_OPT_FACTOR times that
+// is compiled again by the optimizing tier. Calls between module functions
+// go through their records, so each call reaches the current tier, and a
+// running frame moves up at its next loop header: from the interpreter
+// through osr_enter, from baseline code by a jump (emit_tier_check).
+
+static ExecEngine *tiered_engine;
+
+static int64_t elapsed_ms(clock_t start) {
+    return (int64_t)(clock() - start) * 1000 / CLOCKS_PER_SEC;
+}
+
+static void promote(FuncTier *t, JITTier tier) {
+    ExecEngine *ee = tiered_engine;
+    clock_t start = clock();
+    void **blocks = xmalloc(t->func->block_count * sizeof(void *));
+    t->entry = compile_function(ee->jit, t->func, tier, blocks);
+    free(t->blocks);
+    t->blocks = blocks;
+    t->tier = tier;
+    if (tier == JIT_BASELINE) {
+        ee->stats.total_comps++;
+    } else {
+        ee->stats.total_recomps++;
+    }
+    ee->stats.comp_time += elapsed_ms(start);
+}
+
+// From the tier-up stub.
+static void tier_up(FuncTier *t) {
+    if (t->tier == JIT_BASELINE) promote(t, JIT_OPTIMIZED);
+}
+
+static void *adaptive_on_entry(Function *f) {
+    FuncTier *t = &tiered_engine->jit->funcs[f->index];
+    if (f->is_external || t->tier != JIT_INTERP) return t->entry;
+    if (++t->counter < tiered_engine->jit->config.recomp_threshold) return NULL;
+    promote(t, JIT_BASELINE);
+    return t->entry;
+}
+
+static void *adaptive_on_backedge(Function *f, BasicBlock *header) {
+    FuncTier *t = &tiered_engine->jit->funcs[f->index];
+    if (++t->counter >= tiered_engine->jit->config.recomp_threshold && t->tier == JIT_INTERP) {
+        promote(t, JIT_BASELINE);
+    }
+    return t->tier != JIT_INTERP && t->can_osr ? t->blocks[header->id] : NULL;
+}
+
+static void *interp_on_entry(Function *f) {
+    return f->is_external ? tiered_engine->jit->funcs[f->index].entry : NULL;
+}
+
+// Continues an interpreted frame in compiled code. The code runs with rbp
+// at the frame's top in the interpreter's memory and rsp on the native
+// stack; the osr stub writes a return linkage above the frame, so the
+// function's own leave/ret comes back to the stub, which restores rsp. A
+// tail call would run the callee on that linkage, so functions with one
+// do not move (can_osr).
+static NativeResult osr_enter(uint8_t *frame_top, void *code) {
+    return ((NativeResult (*)(uint8_t *, void *))tiered_engine->jit->osr_stub)(frame_top, code);
+}
+
+// Native entry into the interpreter, from the stub standing in for t's
+// code: regs holds rdi...r9 then xmm0...xmm7, stack the arguments passed on
+// the stack. The arguments are picked up as the PARAMs would pick them.
+static NativeResult interp_entry(FuncTier *t, int64_t *regs, int64_t *stack) {
+    Function *f = t->func;
+    if (t->tier == JIT_INTERP && ++t->counter >= tiered_engine->jit->config.recomp_threshold) {
+        promote(t, JIT_BASELINE);
+    }
+
+    int64_t args[16] = {0};
+    int argc = 0, gp = 0, fp = 0, on_stack = 0;
+    for (int b = 0; b < f->block_count; b++) {
+        for (Instruction *i = f->blocks[b]->first_inst; i; i = i->next) {
+            if (i->op != OP_PARAM) continue;
+            int n = (int)i->operands[1]->as.imm;
+            if (n >= 16) continue;
+            if (i->is_float && fp < 8) {
+                args[n] = regs[X64_NUM_ARG_REGS + fp++];
+            } else if (!i->is_float && gp < X64_NUM_ARG_REGS) {
+                args[n] = regs[gp++];
+            } else {
+                args[n] = stack[on_stack++];
+            }
+            if (n >= argc) argc = n + 1;
+        }
+    }
+    return interp_exec_func(f, args, argc);
+}
+
+static void emit_save_xmm(CodeGen *cg, int disp, bool load) {
+    for (int x = 0; x < 8; x++) {
+        emit_rm(cg, 0xF2, false, load ? 0x0F10 : 0x0F11, x, X64_RSP, disp + 8 * x, false);
+    }
+}
+
+// Entered by call with r11 at the record; keeps every argument register.
+static void emit_tier_up_stub(CodeGen *cg) {
+    static const int saved[] = {X64_RDI, X64_RSI, X64_RDX, X64_RCX, X64_R8, X64_R9, X64_RAX};
+    for (int r = 0; r < 7; r++) x64_emit_push(cg, saved[r]);
+    x64_op_ri(cg, X64_SUB, 8, X64_RSP, 64);
+    emit_save_xmm(cg, 0, false);
+    x64_emit_mov(cg, X64_RDI, X64_R11);
+    x64_emit_call(cg, (void *)tier_up);
+    emit_save_xmm(cg, 0, true);
+    x64_op_ri(cg, X64_ADD, 8, X64_RSP, 64);
+    for (int r = 6; r >= 0; r--) x64_emit_pop(cg, saved[r]);
+    x64_emit_ret(cg);
+}
+
+// osr(frame_top, code), see osr_enter.
+static void emit_osr_stub(CodeGen *cg) {
+    x64_emit_push(cg, X64_RBP);
+    x64_emit_mov(cg, X64_RBP, X64_RSP);
+    x64_emit_store_mem(cg, X64_RBP, X64_RDI, 0);
+    size_t disp = x64_op_rm(cg, X64_LEA, 8, X64_RAX, x64_mem(X64_RIP, 0));
+    x64_emit_store_mem(cg, X64_RAX, X64_RDI, 8);
+    x64_emit_store_mem(cg, X64_RSP, X64_RDI, 16);
+    x64_emit_mov(cg, X64_RBP, X64_RDI);
+    emit_rr(cg, 0, false, 0xFF, 4, X64_RSI);
+
+    // back: the function's ret lands here with rsp at frame_top + 16.
+    codegen_patch_u32(cg, disp, (uint32_t)(cg->pos - (disp + 4)));
+    x64_emit_load_mem(cg, X64_RSP, X64_RSP, 0);
+    x64_emit_pop(cg, X64_RBP);
+    x64_emit_ret(cg);
+}
+
+// Stands in for t's code until it is compiled.
+static void emit_interp_stub(CodeGen *cg, FuncTier *t) {
+    x64_emit_push(cg, X64_RBP);
+    x64_emit_mov(cg, X64_RBP, X64_RSP);
+    x64_op_ri(cg, X64_SUB, 8, X64_RSP, 8 * (X64_NUM_ARG_REGS + 8));
+    for (int r = 0; r < X64_NUM_ARG_REGS; r++) {
+        x64_emit_store_mem(cg, x64_arg_regs[r], X64_RSP, 8 * r);
+    }
+    emit_save_xmm(cg, 8 * X64_NUM_ARG_REGS, false);
+    x64_emit_load_imm(cg, X64_RDI, (int64_t)(uintptr_t)t);
+    x64_emit_mov(cg, X64_RSI, X64_RSP);
+    x64_op_rm(cg, X64_LEA, 8, X64_RDX, x64_mem(X64_RBP, 16));
+    x64_emit_call(cg, (void *)interp_entry);
+    x64_emit_epilogue(cg);
+}
+
+static bool has_tail_call(Function *f) {
+    for (int b = 0; b < f->block_count; b++) {
+        Instruction *last = f->blocks[b]->last_inst;
+        if (last && last->op == OP_TAILCALL) return true;
+    }
+    return false;
+}
+
+// Sets up JIT_INTERP and JIT_ADAPTIVE: a record per function, the
+// externals resolved, and under JIT_ADAPTIVE the stubs and the module's
+// data in executable memory.
+static void prepare_tiers(ExecEngine *ee, SSAModule *m) {
+    JITContext *jit = ee->jit;
+    jit->module = m;
+    resolve_externals(jit, m);
+
+    int count = 0;
+    for (Function *f = m->funcs; f; f = f->next_func) count++;
+    jit->funcs = xcalloc(count ? count : 1, sizeof(FuncTier));
+    for (Function *f = m->funcs; f; f = f->next_func) {
+        FuncTier *t = &jit->funcs[f->index];
+        t->func = f;
+        t->tier = JIT_INTERP;
+        t->can_osr = !f->is_external && !has_tail_call(f);
+        if (f->is_external) t->entry = jit_lookup_symbol(jit, f->name);
+    }
+
+    InterpHooks hooks = {m->data, interp_on_entry, NULL, osr_enter};
+    if (jit->tier == JIT_ADAPTIVE) {
+        if (jit->arch != ARCH_X86_64) {
+            error("jit: code generation is only implemented for x86-64");
+        }
+        CodeGen *cg = jit->codegen;
+        cg->pos = 0;
+        size_t *offsets = xmalloc((count + 2) * sizeof(size_t));
+        offsets[count] = cg->pos;
+        emit_tier_up_stub(cg);
+        offsets[count + 1] = cg->pos;
+        emit_osr_stub(cg);
+        for (Function *f = m->funcs; f; f = f->next_func) {
+            if (f->is_external) continue;
+            offsets[f->index] = cg->pos;
+            emit_interp_stub(cg, &jit->funcs[f->index]);
+        }
+
+        CodeBlock *cb = place_code(jit, m->data_size);
+        if (m->data_size) {
+            memcpy(cb->data_mem, m->data, m->data_size);
+        }
+        jit_add_symbol(jit, JIT_DATA_SYMBOL, cb->data_mem);
+        install_code(jit, cb);
+
+        uint8_t *code = cb->code_mem;
+        jit->tier_up_stub = code + offsets[count];
+        jit->osr_stub = code + offsets[count + 1];
+        for (Function *f = m->funcs; f; f = f->next_func) {
+            if (!f->is_external) jit->funcs[f->index].entry = code + offsets[f->index];
+        }
+        free(offsets);
+
+        hooks.data = cb->data_mem;
+        hooks.on_entry = adaptive_on_entry;
+        hooks.on_backedge = adaptive_on_backedge;
+    }
+
+    ee->interp = interp_create();
+    interp_set_hooks(ee->interp, &hooks);
+    tiered_engine = ee;
+}
+
+// ---------------------------------------------------------------------------
+// Execution
+
+ExecEngine *engine_create(JITTier tier) {
+    ExecEngine *ee = calloc(1, sizeof(ExecEngine));
+    ee->jit = jit_create(ARCH_X86_64, tier);
+    ee->jit->symbol_resolver = resolve_runtime_symbol;
+    ee->func_cache = NULL;
+    ee->cache_size = 0;
+    memset(&ee->stats, 0, sizeof(ee->stats));
+    return ee;
+}
+
+void engine_destroy(ExecEngine *ee) {
+    if (!ee) return;
+    if (tiered_engine == ee) tiered_engine = NULL;
+    interp_destroy(ee->interp);
+    jit_destroy(ee->jit);
+    free(ee->func_cache);
+    free(ee);
+}
+
+void *engine_get_func_ptr(ExecEngine *ee, const char *name) {
+    if (!ee || !name) return NULL;
+    return jit_lookup_symbol(ee->jit, name);
+}
+
+void engine_finalize_module(ExecEngine *ee, SSAModule *m) {
+    if (!ee || !m) return;
+    // Without executable memory only the interpreter can run.
+    if (ee->jit->tier == JIT_ADAPTIVE && !exec_memory_available()) {
+        ee->jit->tier = JIT_INTERP;
+    }
+    if (ee->jit->tier == JIT_INTERP || ee->jit->tier == JIT_ADAPTIVE) {
+        prepare_tiers(ee, m);
+        return;
+    }
+
+    clock_t start = clock();
+    jit_compile_module(ee->jit, m);
+    for (Function *f = m->funcs; f; f = f->next_func) {
+        if (!f->is_external) ee->stats.total_comps++;
+    }
+    ee->stats.comp_time += elapsed_ms(start);
+}
+
+int engine_run_main(ExecEngine *ee) {
+    if (!ee) return -1;
+
+    // The runtime built into the compiler leaves its stack overflow guard
+    // to be installed here, once the program is about to run.
+    uwu_install_stack_guard();
+
+    typedef int (*MainFunc)(void);
+    MainFunc main_fn = (MainFunc)engine_get_func_ptr(ee, "main");
+    Function *main_func = ee->jit->funcs ? ssa_find_function(ee->jit->module, "main") : NULL;
+    if (main_func && !main_func->is_external) {
+        if (ee->jit->tier == JIT_INTERP) {
+            clock_t start = clock();
+            int status = (int)interp_exec_func(main_func, NULL, 0).rax;
+            ee->stats.exec_time += elapsed_ms(start);
+            return status;
+        }
+        main_fn = (MainFunc)ee->jit->funcs[main_func->index].entry;
+    }
+
     if (!main_fn) return -1;
-    return main_fn();
+    clock_t start = clock();
+    int status = main_fn();
+    ee->stats.exec_time += elapsed_ms(start);
+    return status;
 }
 
 void engine_print_stats(ExecEngine *ee) {
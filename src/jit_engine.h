@@ -3,6 +3,7 @@
 
 #include "ssa_ir.h"
 #include <stddef.h>
+#include <stdint.h>
 
 typedef enum {
     JIT_INTERP,
@@ -17,7 +18,7 @@ typedef enum {
     ARCH_X86_32
 } TargetArch;
 
-typedef struct {
+typedef struct CodeBlock {
     void *code_mem;
     void *data_mem;
     size_t code_size;
@@ -26,35 +27,57 @@ typedef struct {
     struct CodeBlock *next;
 } CodeBlock;
 
-typedef struct {
+typedef struct Symbol {
     char *symbol;
     void *addr;
     bool external;
     struct Symbol *next;
 } Symbol;
 
+// The optimizing tier's allocation of vregs to registers (regalloc_allocate
+// in jit_engine.c). Positions number each block's entry and then its
+// instructions, in layout order. A vreg is in vreg_to_phys from the start
+// of its interval up to spill_pos, and in its frame slot from there on.
 typedef struct {
-    int *vreg_to_phys;
+    int *vreg_to_phys;      // -1: always in its frame slot
     int vreg_count;
-    bool *phys_used;
+    bool *phys_used;        // by index in the allocatable registers
     int phys_count;
     struct {
         int *start_pos;
         int *end_pos;
         int interval_count;
     } live_intervals;
-    int *spill_slots;
+    int *spill_pos;         // INT_MAX: never split
+    int *spilled;           // the split vregs, by spill_pos
     int spill_count;
+    int *block_first;
+    int *block_last;
+    uint64_t *live_in;      // live_words per block, a bit per vreg
+    int live_words;
 } RegisterAlloc;
 
 typedef struct {
     uint8_t *buf;
     size_t cap;
     size_t pos;
+    // Address buf will be copied to; REL32 fixups are relative to it.
+    uintptr_t base;
     struct Fixup **fixups;
     int fixup_count;
+    // Labels by number: their offsets once bound, and the references to
+    // them that codegen_resolve_labels fills in.
+    size_t *labels;
+    int label_count, label_cap;
+    struct LabelRef *label_refs;
+    int label_ref_count, label_ref_cap;
 } CodeGen;
 
+// A reference from the code at offset to symbol + addend, patched once the
+// code's address is known. REL32 is relative to the end of the 4 bytes.
+// GOT is a REL32 to a slot holding the symbol's address, and PLT a call or
+// jmp rel32 to the symbol, through a stub that jumps through its slot when
+// the symbol is out of reach; codegen_emit_stubs lays both out.
 typedef struct Fixup {
     size_t offset;
     enum {
@@ -64,10 +87,52 @@ typedef struct Fixup {
     int addend;
 } Fixup;
 
+// A reference from the code at offset to a label. A branch is a jmp or jcc,
+// emitted in its rel32 form and shortened to its rel8 one when the label is
+// in reach. A LABEL_REL32 is a 32-bit displacement from label base, or from
+// the end of its 4 bytes when base is -1.
+typedef struct LabelRef {
+    size_t offset;
+    int label;
+    enum { LABEL_BRANCH, LABEL_REL32 } kind;
+    int base;
+    bool is_short;
+} LabelRef;
+
+// The module's string constants, for fixups.
+#define JIT_DATA_SYMBOL ".Ldata"
+
+enum {
+    X64_RAX, X64_RCX, X64_RDX, X64_RBX, X64_RSP, X64_RBP, X64_RSI, X64_RDI,
+    X64_R8, X64_R9, X64_R10, X64_R11, X64_R12, X64_R13, X64_R14, X64_R15
+};
+
+// Condition codes, as in the low nibble of jcc and setcc.
+enum {
+    X64_CC_O, X64_CC_NO, X64_CC_B, X64_CC_AE, X64_CC_E, X64_CC_NE, X64_CC_BE, X64_CC_A,
+    X64_CC_S, X64_CC_NS, X64_CC_P, X64_CC_NP, X64_CC_L, X64_CC_GE, X64_CC_LE, X64_CC_G
+};
+
+// A module function under JIT_ADAPTIVE. Compiled code calls it through
+// entry, which starts out as a stub into the interpreter; counter counts its
+// calls and loop back edges towards the next tier.
+typedef struct FuncTier {
+    int64_t counter;    // first, so that code can bump it at the record's address
+    JITTier tier;       // JIT_INTERP, JIT_BASELINE or JIT_OPTIMIZED
+    void *entry;
+    void **blocks;      // each block's address in the current code, for OSR
+    Function *func;
+    bool can_osr;       // from the interpreter; see osr_enter in jit_engine.c
+} FuncTier;
+
+// JIT_ADAPTIVE compiles a function once counter reaches recomp_threshold,
+// and again with the optimizing tier at this many times that.
+#define JIT_OPT_FACTOR 10
+
 typedef struct {
     JITTier tier;
     TargetArch arch;
-    Module *module;
+    SSAModule *module;
     CodeBlock *code_blocks;
     Symbol *symtab;
     RegisterAlloc *reg_alloc;
@@ -85,10 +150,18 @@ typedef struct {
         void **call_targets;
     } profile_data;
     void *(*symbol_resolver)(const char *);
+    // JIT_ADAPTIVE: a record per module function, by Function.index, and
+    // the stubs compiled code calls to move up a tier.
+    FuncTier *funcs;
+    void *tier_up_stub;
+    void *osr_stub;
 } JITContext;
 
+typedef struct InterpState InterpState;
+
 typedef struct {
     JITContext *jit;
+    InterpState *interp;
     void **func_cache;
     int cache_size;
     struct {
@@ -102,8 +175,16 @@ typedef struct {
 JITContext *jit_create(TargetArch arch, JITTier tier);
 void jit_destroy(JITContext *jit);
 
+// Frame layout shared by compiled code and the interpreter, so that a
+// running frame can move between them: variables at their offsets below the
+// frame's top, then an 8-byte slot per vreg.
+int jit_frame_size(const Function *f);
+int jit_vreg_offset(const Function *f, int vreg);
+
 void *jit_compile_func(JITContext *jit, Function *f);
-void *jit_compile_module(JITContext *jit, Module *m);
+// Compiles every function of m into one code block, with m's data, and
+// resolves the external ones through symbol_resolver.
+void *jit_compile_module(JITContext *jit, SSAModule *m);
 
 void jit_add_symbol(JITContext *jit, const char *name, void *addr);
 void *jit_lookup_symbol(JITContext *jit, const char *name);
@@ -117,15 +198,19 @@ void engine_destroy(ExecEngine *ee);
 
 void *engine_get_func_ptr(ExecEngine *ee, const char *name);
 int engine_run_main(ExecEngine *ee);
-void engine_finalize_module(ExecEngine *ee, Module *m);
+void engine_finalize_module(ExecEngine *ee, SSAModule *m);
 
 void engine_print_stats(ExecEngine *ee);
 
 RegisterAlloc *regalloc_create(int vreg_cnt);
 void regalloc_destroy(RegisterAlloc *ra);
 void regalloc_allocate(RegisterAlloc *ra, Function *f);
+// The register vreg is given, or -1.
 int regalloc_get_phys(RegisterAlloc *ra, int vreg);
 bool regalloc_is_spilled(RegisterAlloc *ra, int vreg);
+// Where vreg is at pos: its register, or -1 for its frame slot.
+int regalloc_location(RegisterAlloc *ra, int vreg, int pos);
+bool regalloc_live_in(RegisterAlloc *ra, int block, int vreg);
 
 CodeGen *codegen_create(size_t init_sz);
 void codegen_destroy(CodeGen *cg);
@@ -135,10 +220,25 @@ void codegen_emit_u32(CodeGen *cg, uint32_t dw);
 void codegen_emit_u64(CodeGen *cg, uint64_t qw);
 void codegen_emit_bytes(CodeGen *cg, const uint8_t *data, size_t len);
 void codegen_add_fixup(CodeGen *cg, Fixup *fix);
+// Appends the slots and stubs GOT and PLT fixups go through, and points
+// them there; needed before codegen_apply_fixups if there are any.
+void codegen_emit_stubs(CodeGen *cg);
 void codegen_apply_fixups(CodeGen *cg, Symbol *syms);
 
+int codegen_new_label(CodeGen *cg);
+void codegen_bind_label(CodeGen *cg, int label);
+size_t codegen_label_offset(CodeGen *cg, int label);
+void codegen_emit_label_rel32(CodeGen *cg, int label, int base);
+// Shortens the branches whose label is in reach, moving the code after
+// them with its fixups and labels, and fills in every label reference.
+// Offsets taken before then are stale past the first branch.
+void codegen_resolve_labels(CodeGen *cg);
+
 void x64_emit_prologue(CodeGen *cg, int frame_sz);
 void x64_emit_epilogue(CodeGen *cg);
+// Baseline code: every vreg lives in a frame slot, and values pass through
+// rax, rcx and xmm0/xmm1. The register allocation may be NULL; given one,
+// vregs live where it puts them.
 void x64_emit_inst(CodeGen *cg, Instruction *i, RegisterAlloc *ra);
 void x64_emit_mov(CodeGen *cg, int dst, int src);
 void x64_emit_add(CodeGen *cg, int dst, int src);
@@ -151,6 +251,8 @@ void x64_emit_xor(CodeGen *cg, int dst, int src);
 void x64_emit_shl(CodeGen *cg, int dst, int amt);
 void x64_emit_shr(CodeGen *cg, int dst, int amt);
 void x64_emit_cmp(CodeGen *cg, int r1, int r2);
+// off is from the start of the jump to its target; the two-byte form is
+// used when it reaches.
 void x64_emit_jmp(CodeGen *cg, int32_t off);
 void x64_emit_je(CodeGen *cg, int32_t off);
 void x64_emit_jne(CodeGen *cg, int32_t off);
@@ -158,6 +260,8 @@ void x64_emit_jl(CodeGen *cg, int32_t off);
 void x64_emit_jle(CodeGen *cg, int32_t off);
 void x64_emit_jg(CodeGen *cg, int32_t off);
 void x64_emit_jge(CodeGen *cg, int32_t off);
+// jmp, for cc < 0, or jcc to a label.
+void x64_emit_branch(CodeGen *cg, int cc, int label);
 void x64_emit_call(CodeGen *cg, void *target);
 void x64_emit_ret(CodeGen *cg);
 void x64_emit_push(CodeGen *cg, int reg);
@@ -168,7 +272,8 @@ void x64_emit_store_mem(CodeGen *cg, int reg, int base, int off);
 
 void arm64_emit_inst(CodeGen *cg, Instruction *i, RegisterAlloc *ra);
 
-typedef struct {
+// Frames live in mem, laid out as compiled code's are, from offset sp on.
+struct InterpState {
     int64_t *regs;
     int reg_count;
     uint8_t *mem;
@@ -178,11 +283,37 @@ typedef struct {
     int sp;
     BasicBlock *cur_block;
     Instruction *cur_inst;
-} InterpState;
+    // Each function's bytecode, by Function.index, translated on first run.
+    struct Bytecode **bytecode;
+    int bytecode_count;
+};
+
+// Both result registers of a call: SysV returns this struct in rax and
+// xmm0, so calling native code as a function returning it reads the result
+// whichever kind it is.
+typedef struct {
+    int64_t rax;
+    double xmm0;
+} NativeResult;
+
+// What the interpreter asks of the engine. on_entry runs before every call,
+// external functions included, and returns native code to call instead of
+// interpreting f, or NULL. on_backedge runs on every loop back edge and
+// returns header's address in compiled code, to continue the frame at
+// through osr_enter, or NULL.
+typedef struct {
+    uint8_t *data;      // the module's string constants
+    void *(*on_entry)(Function *f);
+    void *(*on_backedge)(Function *f, BasicBlock *header);
+    NativeResult (*osr_enter)(uint8_t *frame_top, void *code);
+} InterpHooks;
 
 InterpState *interp_create(void);
 void interp_destroy(InterpState *is);
-int64_t interp_exec_func(Function *f, int64_t *args, int argc);
+void interp_set_hooks(InterpState *is, const InterpHooks *hooks);
+// Runs f with args in order, floating ones as raw bits, and returns its
+// result as native code would.
+NativeResult interp_exec_func(Function *f, int64_t *args, int argc);
 
 typedef struct PGO {
     struct {
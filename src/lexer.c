@@ -88,7 +88,7 @@ static Token read_number(Lexer* lex) {
     strncpy(lexeme, &lex->source[start], length);
     lexeme[length] = '\0';
     
-    Token token = make_token(lex, TOKEN_NUMBER, lexeme);
+    Token token = make_token(lex, is_float ? TOKEN_FLOAT : TOKEN_NUMBER, lexeme);
     if (is_float) {
         token.value.float_value = atof(lexeme);
     } else {
@@ -267,6 +267,7 @@ const char* token_kind_to_string(TokenKind kind) {
         case TOKEN_GIMME: return "gimme";
         case TOKEN_IDENT: return "identifier";
         case TOKEN_NUMBER: return "number";
+        case TOKEN_FLOAT: return "float";
         case TOKEN_EOF: return "EOF";
         default: return "unknown";
     }
@@ -16,7 +16,7 @@ typedef enum {
     TOKEN_FLOOF, TOKEN_BIGFLOOF, TOKEN_BOOP, TOKEN_VOID, TOKEN_BYTE,
     
     // Literals
-    TOKEN_IDENT, TOKEN_NUMBER, TOKEN_STRING, TOKEN_TRUE, TOKEN_FALSE,
+    TOKEN_IDENT, TOKEN_NUMBER, TOKEN_FLOAT, TOKEN_STRING, TOKEN_TRUE, TOKEN_FALSE,
     
     // Operators
     TOKEN_PLUS, TOKEN_MINUS, TOKEN_STAR, TOKEN_SLASH, TOKEN_PERCENT,
@@ -2,16 +2,24 @@
  * UwUCC compiler entry point
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "platform.h"
 #include "lexer.h"
 #include "parser.h"
 #include "semantic.h"
 #include "ir.h"
+#include "ir_opt.h"
 #include "codegen.h"
+#include "flat_ast.h"
+#include "module.h"
+#include "profile.h"
+#include "ssa_ir.h"
+#include "jit_engine.h"
 #include "util.h"
 
 static void print_usage(const char* program) {
@@ -20,12 +28,84 @@ static void print_usage(const char* program) {
     fprintf(stderr, "  -o <file>        Output binary (default: a.out)\n");
     fprintf(stderr, "  --stdlib <file>  Path to uwu_stdlib.o\n");
     fprintf(stderr, "  --dump-ast       Print AST and exit\n");
+    fprintf(stderr, "  --dump-ast=bin   Write the AST in compact binary form and exit\n");
     fprintf(stderr, "  --dump-ir        Print IR and exit\n");
     fprintf(stderr, "  --emit-asm       Keep assembly file\n");
+    fprintf(stderr, "  --stats          Print compiler statistics to stderr\n");
+    fprintf(stderr, "  --max-errors=N   Stop after N errors (default 20, 0 for no limit)\n");
+    fprintf(stderr, "  -O<level>        Optimization level (0-2, default 0)\n");
+    fprintf(stderr, "  --vec-report     Explain which fow loops were vectorized\n");
+    fprintf(stderr, "  --inline-threshold=N  Inline callees of up to N IR instructions (default 24 at -O2, 0 disables)\n");
+    fprintf(stderr, "  --no-bounds-checks  Do not check array indices\n");
+    fprintf(stderr, "  --no-null-checks    Do not check pointers before dereferencing\n");
+    fprintf(stderr, "  --flat-ast       Analyze and lower via the flat (struct-of-arrays) AST\n");
+    fprintf(stderr, "  --emit-module <file>  Write a precompiled .uwumod module and exit\n");
+    fprintf(stderr, "  --module <file>  Link a precompiled .uwumod module (repeatable)\n");
+    fprintf(stderr, "  --profile-generate[=file]  Count block executions; the program writes them to\n"
+                    "                   file (default <output>.uwuprof) when it exits\n");
+    fprintf(stderr, "  --profile-use=<file>  Lay out code and inline by a profile from the same -O level\n");
+    fprintf(stderr, "  --run            Compile in memory and run main instead of writing a binary\n"
+                    "                   (x86-64 only); exits with main's return value\n");
+    fprintf(stderr, "  --tier=<tier>    How --run executes: interp, baseline, optimized, or adaptive\n"
+                    "                   (default: interpret, then compile hot functions)\n");
+    fprintf(stderr, "  --jit-threshold=N  Calls and loop iterations before --tier=adaptive compiles\n"
+                    "                   a function (default 1000; ten times that to optimize it)\n");
     fprintf(stderr, "  --version, -v    Show version\n");
     fprintf(stderr, "  --help, -h       Show this help\n");
 }
 
+// --run: lowers the optimized IR to the execution engine's IR, compiles it
+// to memory and calls main, with the runtime linked into the compiler.
+static int run_program(IRProgram* ir, JITTier tier, int threshold, bool show_stats) {
+#ifndef UWUCC_ARCH_X86_64
+    (void)ir;
+    (void)tier;
+    (void)threshold;
+    (void)show_stats;
+    error("--run is only supported on x86-64");
+    return 1;
+#else
+    SSAModule* module = ssa_lower(ir);
+    Function* main_func = ssa_find_function(module, "main");
+    if (!main_func || main_func->is_external) {
+        error("--run: the program has no main function");
+    }
+    ExecEngine* engine = engine_create(tier);
+    if (threshold > 0) engine->jit->config.recomp_threshold = threshold;
+    engine_finalize_module(engine, module);
+
+    int status = engine_run_main(engine);
+    if (show_stats) {
+        fflush(stdout);
+        fprintf(stderr, "jit: %d functions compiled, %d recompiled by the optimizing tier, "
+                        "%lld ms compiling, %lld ms running\n",
+                engine->stats.total_comps, engine->stats.total_recomps,
+                (long long)engine->stats.comp_time, (long long)engine->stats.exec_time);
+    }
+    engine_destroy(engine);
+    ssa_module_free(module);
+    return status;
+#endif
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Parse and semantic errors are collected rather than fatal. Print them all
+// and stop before anything is lowered.
+static void report_diagnostics(void) {
+    diag_flush();
+
+    int errors = diag_error_count();
+    if (errors > 0) {
+        fprintf(stderr, "%d error%s generated\n", errors, errors == 1 ? "" : "s");
+        exit(1);
+    }
+}
+
 static void print_version(void) {
     printf("uwucc 1.0\n");
     printf("Platform: %s (%s)\n", UWUCC_PLATFORM_NAME, UWUCC_ARCH_NAME);
@@ -52,8 +132,24 @@ int main(int argc, char** argv) {
     const char* output_file = "a.out";
     const char* manual_stdlib_path = NULL;
     bool dump_ast = false;
+    bool dump_ast_binary = false;
     bool dump_ir = false;
     bool keep_asm = false;
+    bool show_stats = false;
+    bool use_flat_ast = false;
+    int opt_level = 0;
+    bool vec_report = false;
+    bool bounds_checks = true;
+    bool null_checks = true;
+    const char* emit_module_path = NULL;
+    const char* module_paths[64];
+    int module_count = 0;
+    bool profile_generate = false;
+    const char* profile_generate_path = NULL;
+    const char* profile_use_path = NULL;
+    bool run = false;
+    JITTier run_tier = JIT_ADAPTIVE;
+    int jit_threshold = 0;
 
     for (int i = 2; i < argc; i++) {
         if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
@@ -62,21 +158,88 @@ int main(int argc, char** argv) {
             manual_stdlib_path = argv[++i];
         } else if (strcmp(argv[i], "--dump-ast") == 0) {
             dump_ast = true;
+        } else if (strcmp(argv[i], "--dump-ast=bin") == 0) {
+            dump_ast = true;
+            dump_ast_binary = true;
         } else if (strcmp(argv[i], "--dump-ir") == 0) {
             dump_ir = true;
         } else if (strcmp(argv[i], "--emit-asm") == 0) {
             keep_asm = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = true;
+        } else if (strncmp(argv[i], "--max-errors=", 13) == 0) {
+            diag_set_max_errors(atoi(argv[i] + 13));
+        } else if (strncmp(argv[i], "-O", 2) == 0) {
+            opt_level = argv[i][2] ? atoi(argv[i] + 2) : 1;
+        } else if (strncmp(argv[i], "--inline-threshold=", 19) == 0) {
+            ir_set_inline_threshold(atoi(argv[i] + 19));
+        } else if (strcmp(argv[i], "--vec-report") == 0) {
+            vec_report = true;
+        } else if (strcmp(argv[i], "--no-bounds-checks") == 0) {
+            bounds_checks = false;
+        } else if (strcmp(argv[i], "--no-null-checks") == 0) {
+            null_checks = false;
+        } else if (strcmp(argv[i], "--flat-ast") == 0) {
+            use_flat_ast = true;
+        } else if (strcmp(argv[i], "--emit-module") == 0 && i + 1 < argc) {
+            emit_module_path = argv[++i];
+        } else if (strcmp(argv[i], "--profile-generate") == 0) {
+            profile_generate = true;
+        } else if (strncmp(argv[i], "--profile-generate=", 19) == 0) {
+            profile_generate = true;
+            profile_generate_path = argv[i] + 19;
+        } else if (strncmp(argv[i], "--profile-use=", 14) == 0) {
+            profile_use_path = argv[i] + 14;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            run = true;
+        } else if (strncmp(argv[i], "--tier=", 7) == 0) {
+            const char* tier = argv[i] + 7;
+            if (strcmp(tier, "interp") == 0) {
+                run_tier = JIT_INTERP;
+            } else if (strcmp(tier, "baseline") == 0) {
+                run_tier = JIT_BASELINE;
+            } else if (strcmp(tier, "optimized") == 0) {
+                run_tier = JIT_OPTIMIZED;
+            } else if (strcmp(tier, "adaptive") == 0) {
+                run_tier = JIT_ADAPTIVE;
+            } else {
+                error("Unknown tier '%s' (expected interp, baseline, optimized or adaptive)", tier);
+            }
+        } else if (strncmp(argv[i], "--jit-threshold=", 16) == 0) {
+            jit_threshold = atoi(argv[i] + 16);
+        } else if (strcmp(argv[i], "--module") == 0 && i + 1 < argc) {
+            if (module_count == 64) {
+                error("Too many modules");
+            }
+            module_paths[module_count++] = argv[++i];
         } else {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
             return 1;
         }
     }
 
+    if (emit_module_path && (profile_generate || profile_use_path)) {
+        error("--profile-generate and --profile-use do not apply to modules");
+    }
+    if (run && (emit_module_path || profile_generate)) {
+        error("--run cannot be combined with --emit-module or --profile-generate");
+    }
+
     char* source = read_file(input_file);
     if (!source) {
         error("Failed to read file: %s", input_file);
     }
 
+    double t_start = now_ms();
+
+    Module* modules[64];
+    for (int i = 0; i < module_count; i++) {
+        modules[i] = module_load(module_paths[i]);
+        module_declare(modules[i]);
+    }
+    double t_modules = now_ms() - t_start;
+    t_start += t_modules;
+
     Lexer* lexer = lexer_new(source);
     Parser* parser = parser_new(lexer);
 
@@ -89,23 +252,120 @@ int main(int argc, char** argv) {
         error("Parsing failed");
     }
 
+    double t_parse = now_ms();
+
+    if (show_stats) {
+        ASTStats st;
+        ast_stats(ast, &st);
+        size_t bytes = st.node_bytes + st.side_array_bytes;
+        fprintf(stderr, "ast: %zu nodes, %zu side arrays, %zu bytes (%.1f bytes/node)\n",
+                st.node_count, st.side_array_count, bytes,
+                st.node_count ? (double)bytes / st.node_count : 0.0);
+    }
+
     if (dump_ast) {
-        ast_dump(ast, stdout);
+        report_diagnostics();
+        if (dump_ast_binary) {
+            ast_dump_binary(ast, stdout);
+        } else {
+            ast_dump(ast, stdout);
+        }
         return 0;
     }
 
-    semantic_analyze(ast);
+    ir_set_options(opt_level, vec_report);
+    // The JIT has no vector instructions, and a module may end up linked
+    // into a --run program, so neither gets vectorized loops.
+    ir_set_vectorize(!run && !emit_module_path);
+    ir_set_checks(bounds_checks, null_checks);
+    codegen_set_config(bounds_checks, null_checks, true, opt_level);
+
+    IRProgram* ir = NULL;
+    double t_sema;
+    double t_flat = t_parse;
+
+    if (use_flat_ast) {
+        FlatAST* flat = flat_ast_from_tree(ast);
+        if (!emit_module_path) {
+            ast_node_free(ast);
+            ast = NULL;
+        }
+        t_flat = now_ms();
+
+        if (show_stats) {
+            size_t bytes = flat_ast_bytes(flat);
+            fprintf(stderr, "flat ast: %u nodes, %zu bytes (%.1f bytes/node)\n",
+                    flat->count, bytes,
+                    flat->count ? (double)bytes / flat->count : 0.0);
+        }
+
+        semantic_analyze_flat(flat);
+        report_diagnostics();
+        t_sema = now_ms();
+        ir = ir_generate_flat(flat);
+        flat_ast_free(flat);
+    } else {
+        semantic_analyze(ast);
+        report_diagnostics();
+        t_sema = now_ms();
+        ir = ir_generate(ast);
+    }
 
-    IRProgram* ir = ir_generate(ast);
     if (!ir) {
         error("IR generation failed");
     }
 
+    // Both see the IR before it is optimized, so profiles carry over between
+    // the instrumented build and the optimized one.
+    char profile_path[512];
+    if (profile_generate) {
+        if (!profile_generate_path) {
+            snprintf(profile_path, sizeof(profile_path), "%s.uwuprof", output_file);
+            profile_generate_path = profile_path;
+        }
+        profile_instrument(ir, profile_generate_path);
+    }
+    if (profile_use_path) {
+        profile_use(ir, profile_use_path);
+    }
+    ir_optimize(ir, opt_level);
+
+    if (emit_module_path) {
+        module_write(emit_module_path, ast, ir);
+        return 0;
+    }
+
+    double t_ir = now_ms();
+    for (int i = 0; i < module_count; i++) {
+        module_link(modules[i], ir);
+        module_close(modules[i]);
+    }
+    double t_link = now_ms() - t_ir;
+
+    if (show_stats) {
+        fprintf(stderr, "time: parse %.1f ms, flatten %.1f ms, semantic %.1f ms, ir %.1f ms\n",
+                t_parse - t_start, t_flat - t_parse, t_sema - t_flat, t_ir - t_sema);
+        if (module_count > 0) {
+            fprintf(stderr, "modules: %d loaded in %.2f ms, linked in %.1f ms\n",
+                    module_count, t_modules, t_link);
+        }
+    }
+
     if (dump_ir) {
         ir_dump(ir, stdout);
         return 0;
     }
 
+    if (run) {
+        int status = run_program(ir, run_tier, jit_threshold, show_stats);
+        ir_program_free(ir);
+        ast_node_free(ast);
+        parser_free(parser);
+        lexer_free(lexer);
+        free(source);
+        return status;
+    }
+
     char asm_file[512];
     snprintf(asm_file, sizeof(asm_file), "%s.s", output_file);
 
@@ -0,0 +1,476 @@
+/**
+ * @file module.c
+ * @brief Writer and loader for precompiled .uwumod modules
+ * @author Bober
+ * @version 1.0.0
+ *
+ * A module stores the IR of a checked source file so that library code
+ * which never changes does not have to be lexed, parsed and analysed on
+ * every build. The loader maps the file read-only and reads the tables in
+ * place; the only work per instruction when linking is copying its
+ * strings into the caller's IRProgram.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "module.h"
+#include "semantic.h"
+#include "util.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+
+    uint32_t* offsets;              // string index -> offset into data
+    uint32_t count;
+    uint32_t offsets_cap;
+
+    uint32_t* table;                // open-addressing table of string indices
+    size_t table_cap;
+} StringTable;
+
+typedef struct {
+    StringTable strings;
+
+    ModuleType* types;
+    uint32_t type_count;
+    uint32_t type_cap;
+
+    ModuleFunc* funcs;
+    uint32_t func_count;
+    uint32_t func_cap;
+
+    uint32_t* params;
+    uint32_t param_count;
+    uint32_t param_cap;
+
+    ModuleInst* insts;
+    uint32_t inst_count;
+    uint32_t inst_cap;
+
+    uint32_t* operands;
+    uint32_t operand_count;
+    uint32_t operand_cap;
+
+    char prefix[16];
+} ModuleWriter;
+
+#define GROW(ptr, count, cap) do {                                  \
+        if ((count) == (cap)) {                                     \
+            (cap) = (cap) ? (cap) * 2 : 64;                         \
+            (ptr) = xrealloc((ptr), (cap) * sizeof(*(ptr)));        \
+        }                                                           \
+    } while (0)
+
+static uint64_t hash_string(const char* s) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void strings_rehash(StringTable* st) {
+    free(st->table);
+    st->table_cap = st->table_cap ? st->table_cap * 2 : 1024;
+    st->table = xmalloc(st->table_cap * sizeof(uint32_t));
+    for (size_t i = 0; i < st->table_cap; i++) {
+        st->table[i] = MODULE_NONE;
+    }
+
+    size_t mask = st->table_cap - 1;
+    for (uint32_t s = 0; s < st->count; s++) {
+        size_t i = hash_string(st->data + st->offsets[s]) & mask;
+        while (st->table[i] != MODULE_NONE) {
+            i = (i + 1) & mask;
+        }
+        st->table[i] = s;
+    }
+}
+
+static uint32_t intern(StringTable* st, const char* s) {
+    if (!s) return MODULE_NONE;
+
+    if ((st->count + 1) * 2 > st->table_cap) {
+        strings_rehash(st);
+    }
+
+    size_t mask = st->table_cap - 1;
+    size_t i = hash_string(s) & mask;
+    while (st->table[i] != MODULE_NONE) {
+        if (strcmp(st->data + st->offsets[st->table[i]], s) == 0) {
+            return st->table[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    size_t len = strlen(s) + 1;
+    while (st->len + len > st->cap) {
+        st->cap = st->cap ? st->cap * 2 : 4096;
+        st->data = xrealloc(st->data, st->cap);
+    }
+    memcpy(st->data + st->len, s, len);
+
+    GROW(st->offsets, st->count, st->offsets_cap);
+    st->offsets[st->count] = (uint32_t)st->len;
+    st->len += len;
+
+    st->table[i] = st->count;
+    return st->count++;
+}
+
+static bool all_digits(const char* s) {
+    if (!*s) return false;
+    for (; *s; s++) {
+        if (!isdigit((unsigned char)*s)) return false;
+    }
+    return true;
+}
+
+// L<n>, .Lstr<n> and .Lfp<n> are numbered per compilation, so two modules
+// (or a module and the program importing it) would otherwise define the
+// same local symbols.
+static uint32_t intern_operand(ModuleWriter* w, const char* op) {
+    char renamed[64];
+
+    if (op && op[0] == 'L' && all_digits(op + 1)) {
+        snprintf(renamed, sizeof(renamed), "L%s_%s", w->prefix, op + 1);
+        return intern(&w->strings, renamed);
+    }
+    if (op && strncmp(op, ".Lstr", 5) == 0 && all_digits(op + 5)) {
+        snprintf(renamed, sizeof(renamed), ".L%s_str%s", w->prefix, op + 5);
+        return intern(&w->strings, renamed);
+    }
+    if (op && strncmp(op, ".Lfp", 4) == 0 && all_digits(op + 4)) {
+        snprintf(renamed, sizeof(renamed), ".L%s_fp%s", w->prefix, op + 4);
+        return intern(&w->strings, renamed);
+    }
+    return intern(&w->strings, op);
+}
+
+static uint32_t add_type(ModuleWriter* w, Type* t) {
+    if (!t) return MODULE_NONE;
+
+    ModuleType rec = {
+        .kind = (uint32_t)t->kind,
+        .size = t->size,
+        .align = t->align,
+        .array_size = t->array_size,
+        .base = add_type(w, t->base),
+        .name = intern(&w->strings, t->name),
+    };
+
+    for (uint32_t i = 0; i < w->type_count; i++) {
+        if (memcmp(&w->types[i], &rec, sizeof(rec)) == 0) {
+            return i;
+        }
+    }
+
+    GROW(w->types, w->type_count, w->type_cap);
+    w->types[w->type_count] = rec;
+    return w->type_count++;
+}
+
+static ASTNode* find_function(ASTNode* root, const char* name) {
+    for (int i = 0; root && i < root->child_count; i++) {
+        ASTNode* fn = root->children[i];
+        if (fn->kind == AST_FUNCTION && strcmp(fn->data.name, name) == 0) {
+            return fn;
+        }
+    }
+    return NULL;
+}
+
+static void add_signature(ModuleWriter* w, ModuleFunc* func, ASTNode* fn) {
+    func->ret_type = MODULE_NONE;
+    func->first_param = w->param_count;
+    func->param_count = 0;
+    if (!fn) return;
+
+    Type* ret = semantic_resolve_type(fn->children[0]);
+    func->ret_type = add_type(w, ret);
+    type_free(ret);
+
+    ASTNode* params = fn->children[1];
+    for (int i = 0; i < params->child_count; i++) {
+        if (params->children[i]->kind != AST_VAR_DECL) continue;
+
+        Type* pt = semantic_resolve_type(params->children[i]->children[0]);
+        GROW(w->params, w->param_count, w->param_cap);
+        w->params[w->param_count++] = add_type(w, pt);
+        func->param_count++;
+        type_free(pt);
+    }
+}
+
+static void add_instruction(ModuleWriter* w, IRInstruction* inst) {
+    int n = 16;
+    while (n > 0 && !inst->operands[n - 1]) n--;
+
+    GROW(w->insts, w->inst_count, w->inst_cap);
+    ModuleInst* rec = &w->insts[w->inst_count++];
+    rec->opcode = intern(&w->strings, inst->opcode);
+    rec->first_operand = w->operand_count;
+    rec->operand_count = (uint16_t)n;
+    rec->width = (uint8_t)inst->width;
+    rec->flags = (inst->is_unsigned ? MODULE_INST_UNSIGNED : 0) |
+                 (inst->is_float ? MODULE_INST_FLOAT : 0);
+    rec->float_args = inst->float_args;
+    rec->reserved = 0;
+
+    for (int i = 0; i < n; i++) {
+        GROW(w->operands, w->operand_count, w->operand_cap);
+        w->operands[w->operand_count++] = intern_operand(w, inst->operands[i]);
+    }
+}
+
+static void write_padded(FILE* f, const void* data, size_t size, uint64_t* pos) {
+    static const char zeros[8] = {0};
+    if (size && fwrite(data, 1, size, f) != size) {
+        error("Failed to write module");
+    }
+    *pos += size;
+
+    size_t pad = (size_t)((8 - (*pos & 7)) & 7);
+    if (pad && fwrite(zeros, 1, pad, f) != pad) {
+        error("Failed to write module");
+    }
+    *pos += pad;
+}
+
+static uint64_t padded(uint64_t size) {
+    return (size + 7) & ~(uint64_t)7;
+}
+
+void module_write(const char* path, ASTNode* root, IRProgram* ir) {
+    ModuleWriter w = {0};
+
+    const char* base = strrchr(path, '/');
+    snprintf(w.prefix, sizeof(w.prefix), "m%08x",
+             (unsigned)(hash_string(base ? base + 1 : path) & 0xffffffffu));
+
+    ModuleFunc* func = NULL;
+    for (IRInstruction* inst = ir->head; inst; inst = inst->next) {
+        if (strcmp(inst->opcode, "func") == 0) {
+            GROW(w.funcs, w.func_count, w.func_cap);
+            func = &w.funcs[w.func_count++];
+            func->name = intern(&w.strings, inst->operands[0]);
+            func->frame_size = inst->operands[1] ? (uint32_t)atoi(inst->operands[1])
+                                                 : (uint32_t)ir->frame_size;
+            func->first_inst = w.inst_count;
+            add_signature(&w, func, find_function(root, inst->operands[0]));
+        }
+
+        add_instruction(&w, inst);
+
+        // Cold blocks (ir_optimize) follow endfunc.
+        if (func && (!inst->next || strcmp(inst->next->opcode, "func") == 0)) {
+            func->inst_count = w.inst_count - func->first_inst;
+            func = NULL;
+        }
+    }
+
+    ModuleHeader h = {0};
+    memcpy(h.magic, MODULE_MAGIC, sizeof(h.magic));
+    h.version = MODULE_VERSION;
+    h.byte_order = MODULE_BYTE_ORDER;
+    h.string_count = w.strings.count;
+    h.type_count = w.type_count;
+    h.func_count = w.func_count;
+    h.param_count = w.param_count;
+    h.inst_count = w.inst_count;
+    h.operand_count = w.operand_count;
+    h.strings_size = w.strings.len;
+
+    uint64_t pos = padded(sizeof(h));
+    h.string_index_offset = pos; pos += padded(w.strings.count * sizeof(uint32_t));
+    h.strings_offset = pos;      pos += padded(w.strings.len);
+    h.types_offset = pos;        pos += padded(w.type_count * sizeof(ModuleType));
+    h.funcs_offset = pos;        pos += padded(w.func_count * sizeof(ModuleFunc));
+    h.params_offset = pos;       pos += padded(w.param_count * sizeof(uint32_t));
+    h.insts_offset = pos;        pos += padded(w.inst_count * sizeof(ModuleInst));
+    h.operands_offset = pos;     pos += padded(w.operand_count * sizeof(uint32_t));
+    h.file_size = pos;
+
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        error("Cannot open module file: %s", path);
+    }
+
+    pos = 0;
+    write_padded(f, &h, sizeof(h), &pos);
+    write_padded(f, w.strings.offsets, w.strings.count * sizeof(uint32_t), &pos);
+    write_padded(f, w.strings.data, w.strings.len, &pos);
+    write_padded(f, w.types, w.type_count * sizeof(ModuleType), &pos);
+    write_padded(f, w.funcs, w.func_count * sizeof(ModuleFunc), &pos);
+    write_padded(f, w.params, w.param_count * sizeof(uint32_t), &pos);
+    write_padded(f, w.insts, w.inst_count * sizeof(ModuleInst), &pos);
+    write_padded(f, w.operands, w.operand_count * sizeof(uint32_t), &pos);
+
+    if (fclose(f) != 0) {
+        error("Failed to write module: %s", path);
+    }
+
+    free(w.strings.data);
+    free(w.strings.offsets);
+    free(w.strings.table);
+    free(w.types);
+    free(w.funcs);
+    free(w.params);
+    free(w.insts);
+    free(w.operands);
+}
+
+static bool section_ok(const ModuleHeader* h, uint64_t offset,
+                       uint64_t count, size_t elem) {
+    if (offset % 4 != 0 || offset > h->file_size) return false;
+    return count <= (h->file_size - offset) / elem;
+}
+
+Module* module_load(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        error("Failed to open module: %s", path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ModuleHeader)) {
+        error("Not a uwu module: %s", path);
+    }
+
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        error("Failed to map module: %s", path);
+    }
+
+    const ModuleHeader* h = map;
+    if (memcmp(h->magic, MODULE_MAGIC, sizeof(h->magic)) != 0) {
+        error("Not a uwu module: %s", path);
+    }
+    if (h->byte_order != MODULE_BYTE_ORDER) {
+        error("Module %s was written on a machine with a different byte order", path);
+    }
+    if (h->version != MODULE_VERSION) {
+        error("Module %s has version %u, expected %u; rebuild it with --emit-module",
+              path, h->version, MODULE_VERSION);
+    }
+    if (h->file_size != (uint64_t)st.st_size ||
+        !section_ok(h, h->string_index_offset, h->string_count, sizeof(uint32_t)) ||
+        !section_ok(h, h->strings_offset, h->strings_size, 1) ||
+        !section_ok(h, h->types_offset, h->type_count, sizeof(ModuleType)) ||
+        !section_ok(h, h->funcs_offset, h->func_count, sizeof(ModuleFunc)) ||
+        !section_ok(h, h->params_offset, h->param_count, sizeof(uint32_t)) ||
+        !section_ok(h, h->insts_offset, h->inst_count, sizeof(ModuleInst)) ||
+        !section_ok(h, h->operands_offset, h->operand_count, sizeof(uint32_t))) {
+        error("Corrupt module: %s", path);
+    }
+
+    const char* base = map;
+    if (h->strings_size == 0 || base[h->strings_offset + h->strings_size - 1] != '\0') {
+        error("Corrupt module: %s", path);
+    }
+
+    Module* mod = xcalloc(1, sizeof(Module));
+    mod->path = path;
+    mod->map = map;
+    mod->map_size = (size_t)st.st_size;
+    mod->header = h;
+    mod->string_index = (const uint32_t*)(base + h->string_index_offset);
+    mod->strings = base + h->strings_offset;
+    mod->types = (const ModuleType*)(base + h->types_offset);
+    mod->funcs = (const ModuleFunc*)(base + h->funcs_offset);
+    mod->params = (const uint32_t*)(base + h->params_offset);
+    mod->insts = (const ModuleInst*)(base + h->insts_offset);
+    mod->operands = (const uint32_t*)(base + h->operands_offset);
+    return mod;
+}
+
+const char* module_string(const Module* mod, uint32_t index) {
+    if (index == MODULE_NONE) return NULL;
+    if (index >= mod->header->string_count ||
+        mod->string_index[index] >= mod->header->strings_size) {
+        error("Corrupt module: %s", mod->path);
+    }
+    return mod->strings + mod->string_index[index];
+}
+
+Type* module_type(const Module* mod, uint32_t index) {
+    if (index == MODULE_NONE) return NULL;
+    if (index >= mod->header->type_count) {
+        error("Corrupt module: %s", mod->path);
+    }
+
+    // Types are appended after their base, so base indices always point
+    // backwards and the recursion terminates.
+    const ModuleType* rec = &mod->types[index];
+    if (rec->base != MODULE_NONE && rec->base >= index) {
+        error("Corrupt module: %s", mod->path);
+    }
+
+    Type* t = type_new((TypeKind)rec->kind);
+    t->size = rec->size;
+    t->align = rec->align;
+    t->array_size = rec->array_size;
+    t->base = module_type(mod, rec->base);
+    if (rec->name != MODULE_NONE) {
+        t->name = xstrdup(module_string(mod, rec->name));
+    }
+    return t;
+}
+
+void module_declare(const Module* mod) {
+    for (uint32_t i = 0; i < mod->header->func_count; i++) {
+        const ModuleFunc* fn = &mod->funcs[i];
+        if (fn->param_count > 255 || fn->first_param > mod->header->param_count ||
+            fn->param_count > mod->header->param_count - fn->first_param) {
+            error("Corrupt module: %s", mod->path);
+        }
+
+        Type* params[255];
+        for (uint32_t p = 0; p < fn->param_count; p++) {
+            params[p] = module_type(mod, mod->params[fn->first_param + p]);
+        }
+        semantic_declare_extern(module_string(mod, fn->name),
+                                module_type(mod, fn->ret_type), params,
+                                (int)fn->param_count);
+    }
+}
+
+void module_link(const Module* mod, IRProgram* prog) {
+    const char* operands[16];
+
+    for (uint32_t i = 0; i < mod->header->inst_count; i++) {
+        const ModuleInst* inst = &mod->insts[i];
+        if (inst->opcode == MODULE_NONE || inst->operand_count > 16 ||
+            inst->first_operand > mod->header->operand_count ||
+            inst->operand_count > mod->header->operand_count - inst->first_operand) {
+            error("Corrupt module: %s", mod->path);
+        }
+
+        for (uint32_t j = 0; j < inst->operand_count; j++) {
+            operands[j] = module_string(mod, mod->operands[inst->first_operand + j]);
+        }
+        IRInstruction* appended = ir_append(prog, module_string(mod, inst->opcode),
+                                            operands, (int)inst->operand_count);
+        appended->width = inst->width;
+        appended->is_unsigned = (inst->flags & MODULE_INST_UNSIGNED) != 0;
+        appended->is_float = (inst->flags & MODULE_INST_FLOAT) != 0;
+        appended->float_args = inst->float_args;
+    }
+}
+
+void module_close(Module* mod) {
+    if (!mod) return;
+    munmap(mod->map, mod->map_size);
+    free(mod);
+}
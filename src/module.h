@@ -0,0 +1,99 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "ast.h"
+#include "ir.h"
+#include <stdint.h>
+
+// Precompiled .uwumod modules. A module is the checked, lowered IR of one
+// source file plus the signatures of the functions it defines, laid out so
+// that it can be mmapped and used in place: a fixed header, then string,
+// type, function, parameter, instruction and operand tables. Every table
+// entry is a fixed-size record and every reference is a 32-bit index.
+#define MODULE_MAGIC "UWUMOD\0"
+#define MODULE_VERSION 3
+#define MODULE_BYTE_ORDER 0x01020304u
+#define MODULE_NONE UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+
+    uint32_t string_count;
+    uint32_t type_count;
+    uint32_t func_count;
+    uint32_t param_count;
+    uint32_t inst_count;
+    uint32_t operand_count;
+
+    uint64_t strings_size;
+    uint64_t string_index_offset;   // uint32_t[string_count], offsets into strings
+    uint64_t strings_offset;        // NUL-terminated strings
+    uint64_t types_offset;          // ModuleType[type_count]
+    uint64_t funcs_offset;          // ModuleFunc[func_count]
+    uint64_t params_offset;         // uint32_t[param_count], type indices
+    uint64_t insts_offset;          // ModuleInst[inst_count]
+    uint64_t operands_offset;       // uint32_t[operand_count], string indices
+    uint64_t file_size;
+} ModuleHeader;
+
+typedef struct {
+    uint32_t kind;
+    int32_t size;
+    int32_t align;
+    int32_t array_size;
+    uint32_t base;                  // type index or MODULE_NONE
+    uint32_t name;                  // string index or MODULE_NONE
+} ModuleType;
+
+typedef struct {
+    uint32_t name;
+    uint32_t ret_type;
+    uint32_t first_param;
+    uint32_t param_count;
+    uint32_t frame_size;
+    uint32_t first_inst;
+    uint32_t inst_count;
+} ModuleFunc;
+
+typedef struct {
+    uint32_t opcode;
+    uint32_t first_operand;
+    uint16_t operand_count;         // empty slots are stored as MODULE_NONE
+    uint8_t width;
+    uint8_t flags;                  // MODULE_INST_* bits
+    uint16_t float_args;
+    uint16_t reserved;
+} ModuleInst;
+
+#define MODULE_INST_UNSIGNED 0x01
+#define MODULE_INST_FLOAT 0x02
+
+typedef struct {
+    const char* path;
+    void* map;
+    size_t map_size;
+
+    const ModuleHeader* header;
+    const uint32_t* string_index;
+    const char* strings;
+    const ModuleType* types;
+    const ModuleFunc* funcs;
+    const uint32_t* params;
+    const ModuleInst* insts;
+    const uint32_t* operands;
+} Module;
+
+// Labels and string constants are renamed to a prefix derived from the
+// module path so that several modules can be linked into one program.
+void module_write(const char* path, ASTNode* root, IRProgram* ir);
+
+Module* module_load(const char* path);
+const char* module_string(const Module* mod, uint32_t index);
+Type* module_type(const Module* mod, uint32_t index);
+void module_declare(const Module* mod);
+void module_link(const Module* mod, IRProgram* prog);
+void module_close(Module* mod);
+
+#endif
@@ -5,8 +5,10 @@
  * @version 1.0.0
  *
  * This file implements a complete recursive descent parser for the UwU-C language.
- * The parser consumes tokens from the lexer and produces an Abstract Syntax Tree
- * suitable for semantic analysis and IR generation.
+ * Statements are parsed by plain recursive descent; binary expressions go
+ * through a table-driven precedence climber. The parser consumes tokens from
+ * the lexer and produces an Abstract Syntax Tree suitable for semantic
+ * analysis and IR generation.
  */
 
 #include "parser.h"
@@ -23,17 +25,7 @@ static ASTNode* parse_function(Parser* p);
 static ASTNode* parse_block(Parser* p);
 static ASTNode* parse_statement(Parser* p);
 static ASTNode* parse_expression(Parser* p);
-static ASTNode* parse_assignment(Parser* p);
-static ASTNode* parse_logical_or(Parser* p);
-static ASTNode* parse_logical_and(Parser* p);
-static ASTNode* parse_bitwise_or(Parser* p);
-static ASTNode* parse_bitwise_xor(Parser* p);
-static ASTNode* parse_bitwise_and(Parser* p);
-static ASTNode* parse_equality(Parser* p);
-static ASTNode* parse_relational(Parser* p);
-static ASTNode* parse_shift(Parser* p);
-static ASTNode* parse_additive(Parser* p);
-static ASTNode* parse_multiplicative(Parser* p);
+static ASTNode* parse_precedence(Parser* p, int min_prec);
 static ASTNode* parse_unary(Parser* p);
 static ASTNode* parse_postfix(Parser* p);
 static ASTNode* parse_primary(Parser* p);
@@ -51,6 +43,16 @@ static bool match(Parser* p, TokenKind kind);
 static void consume(Parser* p, TokenKind kind, const char* message);
 static bool is_type_token(TokenKind kind);
 
+// Reports an error at the current token. After the first error the parser
+// is likely to trip over the same broken construct again, so further
+// reports are suppressed until synchronize() has skipped past it.
+static void error_at_current(Parser* p, const char* message) {
+    if (panic_mode) return;
+    panic_mode = true;
+    error_at(p->current.line, p->current.column, "%s", message);
+    p->error_count++;
+}
+
 static void advance(Parser* p) {
     p->previous = p->current;
 
@@ -58,8 +60,7 @@ static void advance(Parser* p) {
         p->current = lexer_next_token(p->lexer);
         if (p->current.kind != TOKEN_ERROR) break;
 
-        error_at(p->current.line, p->current.column, "%s", p->current.lexeme);
-        p->error_count++;
+        error_at_current(p, p->current.lexeme);
     }
 }
 
@@ -83,9 +84,7 @@ static void consume(Parser* p, TokenKind kind, const char* message) {
         return;
     }
 
-    error_at(p->current.line, p->current.column, "%s", message);
-    p->error_count++;
-    panic_mode = true;
+    error_at_current(p, message);
 }
 
 static bool is_type_token(TokenKind kind) {
@@ -109,6 +108,7 @@ static void synchronize(Parser* p) {
             case TOKEN_GIMME:
             case TOKEN_STWUCT:
             case TOKEN_ENUM:
+            case TOKEN_RBRACE:
                 return;
             default:
                 ;
@@ -118,6 +118,13 @@ static void synchronize(Parser* p) {
     }
 }
 
+// Nodes are stamped with the location of the token that was just consumed.
+static ASTNode* node_new(Parser* p, ASTNodeKind kind) {
+    ASTNode* node = ast_node_new(kind);
+    node->loc = ast_loc_pack(p->previous.line, p->previous.column);
+    return node;
+}
+
 static Token peek_ahead(Parser* p) {
     int saved_pos = p->lexer->pos;
     int saved_line = p->lexer->line;
@@ -133,9 +140,11 @@ static Token peek_ahead(Parser* p) {
 }
 
 static ASTNode* parse_program(Parser* p) {
-    ASTNode* program = ast_node_new(AST_PROGRAM);
+    ASTNode* program = node_new(p, AST_PROGRAM);
 
     while (!is_at_end(p)) {
+        int start = p->lexer->pos;
+
         ASTNode* decl = parse_declaration(p);
         if (decl != NULL) {
             ast_node_add_child(program, decl);
@@ -144,6 +153,9 @@ static ASTNode* parse_program(Parser* p) {
         if (panic_mode) {
             synchronize(p);
         }
+        if (p->lexer->pos == start) {
+            advance(p);
+        }
     }
 
     return program;
@@ -163,27 +175,24 @@ static ASTNode* parse_declaration(Parser* p) {
         }
     }
 
-    error_at(p->current.line, p->current.column, "Expected declaration");
-    p->error_count++;
+    error_at_current(p, "Expected declaration");
     return NULL;
 }
 
 static ASTNode* parse_function(Parser* p) {
-    ASTNode* fn = ast_node_new(AST_FUNCTION);
+    ASTNode* fn = node_new(p, AST_FUNCTION);
 
     consume(p, TOKEN_IDENT, "Expected function name");
     fn->data.name = xstrdup(p->previous.lexeme);
 
     consume(p, TOKEN_LPAREN, "Expected '(' after function name");
 
-    ASTNode* params = ast_node_new(AST_BLOCK);
+    ASTNode* params = node_new(p, AST_BLOCK);
 
     if (!check(p, TOKEN_RPAREN)) {
         do {
             if (params->child_count >= 255) {
-                error_at(p->current.line, p->current.column,
-                        "Cannot have more than 255 parameters");
-                p->error_count++;
+                error_at_current(p, "Cannot have more than 255 parameters");
                 break;
             }
 
@@ -200,11 +209,11 @@ static ASTNode* parse_function(Parser* p) {
     if (match(p, TOKEN_ARROW)) {
         ret_type = parse_type(p);
         if (ret_type == NULL) {
-            ret_type = ast_node_new(AST_TYPE);
+            ret_type = node_new(p, AST_TYPE);
             ret_type->data.name = xstrdup("void");
         }
     } else {
-        ret_type = ast_node_new(AST_TYPE);
+        ret_type = node_new(p, AST_TYPE);
         ret_type->data.name = xstrdup("void");
     }
 
@@ -219,9 +228,11 @@ static ASTNode* parse_function(Parser* p) {
 }
 
 static ASTNode* parse_block(Parser* p) {
-    ASTNode* block = ast_node_new(AST_BLOCK);
+    ASTNode* block = node_new(p, AST_BLOCK);
 
     while (!check(p, TOKEN_RBRACE) && !is_at_end(p)) {
+        int start = p->lexer->pos;
+
         ASTNode* stmt = parse_statement(p);
         if (stmt != NULL) {
             ast_node_add_child(block, stmt);
@@ -230,6 +241,9 @@ static ASTNode* parse_block(Parser* p) {
         if (panic_mode) {
             synchronize(p);
         }
+        if (p->lexer->pos == start && !check(p, TOKEN_RBRACE)) {
+            advance(p);
+        }
     }
 
     consume(p, TOKEN_RBRACE, "Expected '}' after block");
@@ -238,7 +252,7 @@ static ASTNode* parse_block(Parser* p) {
 
 static ASTNode* parse_statement(Parser* p) {
     if (match(p, TOKEN_PWEASE)) {
-        ASTNode* node = ast_node_new(AST_IF);
+        ASTNode* node = node_new(p, AST_IF);
 
         consume(p, TOKEN_LPAREN, "Expected '(' after 'pwease'");
         ASTNode* condition = parse_expression(p);
@@ -264,7 +278,7 @@ static ASTNode* parse_statement(Parser* p) {
     }
 
     if (match(p, TOKEN_WEPEAT)) {
-        ASTNode* node = ast_node_new(AST_WHILE);
+        ASTNode* node = node_new(p, AST_WHILE);
 
         consume(p, TOKEN_LPAREN, "Expected '(' after 'wepeat'");
         ASTNode* condition = parse_expression(p);
@@ -283,7 +297,7 @@ static ASTNode* parse_statement(Parser* p) {
     }
 
     if (match(p, TOKEN_FOW)) {
-        ASTNode* node = ast_node_new(AST_FOR);
+        ASTNode* node = node_new(p, AST_FOR);
 
         consume(p, TOKEN_LPAREN, "Expected '(' after 'fow'");
 
@@ -327,7 +341,7 @@ static ASTNode* parse_statement(Parser* p) {
     }
 
     if (match(p, TOKEN_GIMME)) {
-        ASTNode* node = ast_node_new(AST_RETURN);
+        ASTNode* node = node_new(p, AST_RETURN);
 
         if (!check(p, TOKEN_SEMICOLON)) {
             ASTNode* value = parse_expression(p);
@@ -341,13 +355,13 @@ static ASTNode* parse_statement(Parser* p) {
     }
 
     if (match(p, TOKEN_BWEAK)) {
-        ASTNode* node = ast_node_new(AST_BREAK);
+        ASTNode* node = node_new(p, AST_BREAK);
         consume(p, TOKEN_SEMICOLON, "Expected ';' after 'bweak'");
         return node;
     }
 
     if (match(p, TOKEN_CONTINYUE)) {
-        ASTNode* node = ast_node_new(AST_CONTINUE);
+        ASTNode* node = node_new(p, AST_CONTINUE);
         consume(p, TOKEN_SEMICOLON, "Expected ';' after 'continyue'");
         return node;
     }
@@ -373,223 +387,84 @@ static ASTNode* parse_statement(Parser* p) {
     return expr;
 }
 
-static ASTNode* parse_expression(Parser* p) {
-    return parse_assignment(p);
-}
-
-static ASTNode* parse_assignment(Parser* p) {
-    ASTNode* expr = parse_logical_or(p);
-
-    if (match(p, TOKEN_ASSIGN) || match(p, TOKEN_PLUS_EQ) ||
-        match(p, TOKEN_MINUS_EQ) || match(p, TOKEN_STAR_EQ) ||
-        match(p, TOKEN_SLASH_EQ)) {
-
-        TokenKind op = p->previous.kind;
-        ASTNode* node = ast_node_new(AST_ASSIGN);
-        node->data.op = op;
-        ast_node_add_child(node, expr);
-
-        ASTNode* value = parse_assignment(p);
-        if (value != NULL) {
-            ast_node_add_child(node, value);
-        } else {
-            error_at(p->current.line, p->current.column,
-                    "Expected expression after assignment operator");
-            p->error_count++;
-        }
-
-        return node;
-    }
-
-    return expr;
-}
-
-static ASTNode* parse_logical_or(Parser* p) {
-    ASTNode* expr = parse_logical_and(p);
-
-    while (match(p, TOKEN_OR)) {
-        ASTNode* node = ast_node_new(AST_BINARY_OP);
-        node->data.op = TOKEN_OR;
-        ast_node_add_child(node, expr);
-
-        ASTNode* right = parse_logical_and(p);
-        if (right != NULL) {
-            ast_node_add_child(node, right);
-        }
-
-        expr = node;
-    }
-
-    return expr;
-}
-
-static ASTNode* parse_logical_and(Parser* p) {
-    ASTNode* expr = parse_bitwise_or(p);
-
-    while (match(p, TOKEN_AND)) {
-        ASTNode* node = ast_node_new(AST_BINARY_OP);
-        node->data.op = TOKEN_AND;
-        ast_node_add_child(node, expr);
-
-        ASTNode* right = parse_bitwise_or(p);
-        if (right != NULL) {
-            ast_node_add_child(node, right);
-        }
-
-        expr = node;
-    }
-
-    return expr;
-}
-
-static ASTNode* parse_bitwise_or(Parser* p) {
-    ASTNode* expr = parse_bitwise_xor(p);
-
-    while (match(p, TOKEN_PIPE)) {
-        ASTNode* node = ast_node_new(AST_BINARY_OP);
-        node->data.op = TOKEN_PIPE;
-        ast_node_add_child(node, expr);
-
-        ASTNode* right = parse_bitwise_xor(p);
-        if (right != NULL) {
-            ast_node_add_child(node, right);
-        }
-
-        expr = node;
-    }
-
-    return expr;
-}
-
-static ASTNode* parse_bitwise_xor(Parser* p) {
-    ASTNode* expr = parse_bitwise_and(p);
-
-    while (match(p, TOKEN_CARET)) {
-        ASTNode* node = ast_node_new(AST_BINARY_OP);
-        node->data.op = TOKEN_CARET;
-        ast_node_add_child(node, expr);
-
-        ASTNode* right = parse_bitwise_and(p);
-        if (right != NULL) {
-            ast_node_add_child(node, right);
-        }
-
-        expr = node;
-    }
-
-    return expr;
-}
-
-static ASTNode* parse_bitwise_and(Parser* p) {
-    ASTNode* expr = parse_equality(p);
-
-    while (match(p, TOKEN_AMP)) {
-        ASTNode* node = ast_node_new(AST_BINARY_OP);
-        node->data.op = TOKEN_AMP;
-        ast_node_add_child(node, expr);
-
-        ASTNode* right = parse_equality(p);
-        if (right != NULL) {
-            ast_node_add_child(node, right);
-        }
-
-        expr = node;
-    }
-
-    return expr;
-}
-
-static ASTNode* parse_equality(Parser* p) {
-    ASTNode* expr = parse_relational(p);
-
-    while (match(p, TOKEN_EQ) || match(p, TOKEN_NE)) {
-        TokenKind op = p->previous.kind;
-        ASTNode* node = ast_node_new(AST_BINARY_OP);
-        node->data.op = op;
-        ast_node_add_child(node, expr);
-
-        ASTNode* right = parse_relational(p);
-        if (right != NULL) {
-            ast_node_add_child(node, right);
-        }
-
-        expr = node;
-    }
-
-    return expr;
-}
-
-static ASTNode* parse_relational(Parser* p) {
-    ASTNode* expr = parse_shift(p);
+// Binding power of each infix token. parse_precedence() keeps folding
+// operators whose precedence is at least min_prec into the left operand.
+typedef enum {
+    PREC_NONE,
+    PREC_ASSIGNMENT,     // = += -= *= /=   (right associative)
+    PREC_LOGICAL_OR,     // ||
+    PREC_LOGICAL_AND,    // &&
+    PREC_BITWISE_OR,     // |
+    PREC_BITWISE_XOR,    // ^
+    PREC_BITWISE_AND,    // &
+    PREC_EQUALITY,       // == !=
+    PREC_RELATIONAL,     // < > <= >=
+    PREC_SHIFT,          // << >>
+    PREC_ADDITIVE,       // + -
+    PREC_MULTIPLICATIVE  // * / %
+} Precedence;
+
+static const Precedence infix_precedence[TOKEN_ERROR + 1] = {
+    [TOKEN_ASSIGN]   = PREC_ASSIGNMENT,
+    [TOKEN_PLUS_EQ]  = PREC_ASSIGNMENT,
+    [TOKEN_MINUS_EQ] = PREC_ASSIGNMENT,
+    [TOKEN_STAR_EQ]  = PREC_ASSIGNMENT,
+    [TOKEN_SLASH_EQ] = PREC_ASSIGNMENT,
+    [TOKEN_OR]       = PREC_LOGICAL_OR,
+    [TOKEN_AND]      = PREC_LOGICAL_AND,
+    [TOKEN_PIPE]     = PREC_BITWISE_OR,
+    [TOKEN_CARET]    = PREC_BITWISE_XOR,
+    [TOKEN_AMP]      = PREC_BITWISE_AND,
+    [TOKEN_EQ]       = PREC_EQUALITY,
+    [TOKEN_NE]       = PREC_EQUALITY,
+    [TOKEN_LT]       = PREC_RELATIONAL,
+    [TOKEN_GT]       = PREC_RELATIONAL,
+    [TOKEN_LE]       = PREC_RELATIONAL,
+    [TOKEN_GE]       = PREC_RELATIONAL,
+    [TOKEN_LSHIFT]   = PREC_SHIFT,
+    [TOKEN_RSHIFT]   = PREC_SHIFT,
+    [TOKEN_PLUS]     = PREC_ADDITIVE,
+    [TOKEN_MINUS]    = PREC_ADDITIVE,
+    [TOKEN_STAR]     = PREC_MULTIPLICATIVE,
+    [TOKEN_SLASH]    = PREC_MULTIPLICATIVE,
+    [TOKEN_PERCENT]  = PREC_MULTIPLICATIVE,
+};
 
-    while (match(p, TOKEN_LT) || match(p, TOKEN_GT) ||
-           match(p, TOKEN_LE) || match(p, TOKEN_GE)) {
-        TokenKind op = p->previous.kind;
-        ASTNode* node = ast_node_new(AST_BINARY_OP);
-        node->data.op = op;
-        ast_node_add_child(node, expr);
-
-        ASTNode* right = parse_shift(p);
-        if (right != NULL) {
-            ast_node_add_child(node, right);
-        }
-
-        expr = node;
-    }
-
-    return expr;
+static ASTNode* parse_expression(Parser* p) {
+    return parse_precedence(p, PREC_ASSIGNMENT);
 }
 
-static ASTNode* parse_shift(Parser* p) {
-    ASTNode* expr = parse_additive(p);
-
-    while (match(p, TOKEN_LSHIFT) || match(p, TOKEN_RSHIFT)) {
-        TokenKind op = p->previous.kind;
-        ASTNode* node = ast_node_new(AST_BINARY_OP);
-        node->data.op = op;
-        ast_node_add_child(node, expr);
-
-        ASTNode* right = parse_additive(p);
-        if (right != NULL) {
-            ast_node_add_child(node, right);
-        }
+static ASTNode* parse_precedence(Parser* p, int min_prec) {
+    ASTNode* expr = parse_unary(p);
+    if (expr == NULL) return NULL;
 
-        expr = node;
-    }
+    for (;;) {
+        TokenKind op = p->current.kind;
+        int prec = infix_precedence[op];
+        if (prec == PREC_NONE || prec < min_prec) break;
 
-    return expr;
-}
+        advance(p);
 
-static ASTNode* parse_additive(Parser* p) {
-    ASTNode* expr = parse_multiplicative(p);
+        if (prec == PREC_ASSIGNMENT) {
+            ASTNode* node = node_new(p, AST_ASSIGN);
+            node->data.op = op;
+            ast_node_add_child(node, expr);
 
-    while (match(p, TOKEN_PLUS) || match(p, TOKEN_MINUS)) {
-        TokenKind op = p->previous.kind;
-        ASTNode* node = ast_node_new(AST_BINARY_OP);
-        node->data.op = op;
-        ast_node_add_child(node, expr);
+            ASTNode* value = parse_precedence(p, PREC_ASSIGNMENT);
+            if (value != NULL) {
+                ast_node_add_child(node, value);
+            } else {
+                error_at_current(p, "Expected expression after assignment operator");
+            }
 
-        ASTNode* right = parse_multiplicative(p);
-        if (right != NULL) {
-            ast_node_add_child(node, right);
+            return node;
         }
 
-        expr = node;
-    }
-
-    return expr;
-}
-
-static ASTNode* parse_multiplicative(Parser* p) {
-    ASTNode* expr = parse_unary(p);
-
-    while (match(p, TOKEN_STAR) || match(p, TOKEN_SLASH) || match(p, TOKEN_PERCENT)) {
-        TokenKind op = p->previous.kind;
-        ASTNode* node = ast_node_new(AST_BINARY_OP);
+        ASTNode* node = node_new(p, AST_BINARY_OP);
         node->data.op = op;
         ast_node_add_child(node, expr);
 
-        ASTNode* right = parse_unary(p);
+        ASTNode* right = parse_precedence(p, prec + 1);
         if (right != NULL) {
             ast_node_add_child(node, right);
         }
@@ -605,7 +480,7 @@ static ASTNode* parse_unary(Parser* p) {
         match(p, TOKEN_TILDE) || match(p, TOKEN_AMP) || match(p, TOKEN_STAR)) {
 
         TokenKind op = p->previous.kind;
-        ASTNode* node = ast_node_new(AST_UNARY_OP);
+        ASTNode* node = node_new(p, AST_UNARY_OP);
         node->data.op = op;
 
         ASTNode* operand = parse_unary(p);
@@ -617,7 +492,7 @@ static ASTNode* parse_unary(Parser* p) {
     }
 
     if (match(p, TOKEN_SIZEOF)) {
-        ASTNode* node = ast_node_new(AST_SIZEOF);
+        ASTNode* node = node_new(p, AST_SIZEOF);
 
         consume(p, TOKEN_LPAREN, "Expected '(' after 'sizeof'");
 
@@ -642,18 +517,17 @@ static ASTNode* parse_unary(Parser* p) {
 
 static ASTNode* parse_postfix(Parser* p) {
     ASTNode* expr = parse_primary(p);
+    if (expr == NULL) return NULL;
 
     while (true) {
         if (match(p, TOKEN_LPAREN)) {
-            ASTNode* call = ast_node_new(AST_CALL);
+            ASTNode* call = node_new(p, AST_CALL);
             ast_node_add_child(call, expr);
 
             if (!check(p, TOKEN_RPAREN)) {
                 do {
                     if (call->child_count >= 256) {
-                        error_at(p->current.line, p->current.column,
-                                "Cannot have more than 255 arguments");
-                        p->error_count++;
+                        error_at_current(p, "Cannot have more than 255 arguments");
                         break;
                     }
 
@@ -667,7 +541,7 @@ static ASTNode* parse_postfix(Parser* p) {
             consume(p, TOKEN_RPAREN, "Expected ')' after arguments");
             expr = call;
         } else if (match(p, TOKEN_LBRACKET)) {
-            ASTNode* index = ast_node_new(AST_INDEX);
+            ASTNode* index = node_new(p, AST_INDEX);
             ast_node_add_child(index, expr);
 
             ASTNode* idx_expr = parse_expression(p);
@@ -678,11 +552,11 @@ static ASTNode* parse_postfix(Parser* p) {
             consume(p, TOKEN_RBRACKET, "Expected ']' after array index");
             expr = index;
         } else if (match(p, TOKEN_DOT)) {
-            ASTNode* member = ast_node_new(AST_MEMBER);
+            ASTNode* member = node_new(p, AST_MEMBER);
             ast_node_add_child(member, expr);
 
             consume(p, TOKEN_IDENT, "Expected member name after '.'");
-            ASTNode* name = ast_node_new(AST_IDENTIFIER);
+            ASTNode* name = node_new(p, AST_IDENTIFIER);
             name->data.name = xstrdup(p->previous.lexeme);
             ast_node_add_child(member, name);
 
@@ -697,36 +571,42 @@ static ASTNode* parse_postfix(Parser* p) {
 
 static ASTNode* parse_primary(Parser* p) {
     if (match(p, TOKEN_NUMBER)) {
-        ASTNode* node = ast_node_new(AST_NUMBER);
+        ASTNode* node = node_new(p, AST_NUMBER);
         node->data.int_value = p->previous.value.int_value;
         return node;
     }
 
+    if (match(p, TOKEN_FLOAT)) {
+        ASTNode* node = node_new(p, AST_FLOAT);
+        node->data.float_value = p->previous.value.float_value;
+        return node;
+    }
+
     if (match(p, TOKEN_STRING)) {
-        ASTNode* node = ast_node_new(AST_STRING);
+        ASTNode* node = node_new(p, AST_STRING);
         node->data.string_value = xstrdup(p->previous.lexeme);
         return node;
     }
 
     if (match(p, TOKEN_TRUE)) {
-        ASTNode* node = ast_node_new(AST_NUMBER);
+        ASTNode* node = node_new(p, AST_NUMBER);
         node->data.int_value = 1;
         return node;
     }
 
     if (match(p, TOKEN_FALSE)) {
-        ASTNode* node = ast_node_new(AST_NUMBER);
+        ASTNode* node = node_new(p, AST_NUMBER);
         node->data.int_value = 0;
         return node;
     }
 
     if (match(p, TOKEN_NUWW)) {
-        ASTNode* node = ast_node_new(AST_NULL);
+        ASTNode* node = node_new(p, AST_NULL);
         return node;
     }
 
     if (match(p, TOKEN_IDENT)) {
-        ASTNode* node = ast_node_new(AST_IDENTIFIER);
+        ASTNode* node = node_new(p, AST_IDENTIFIER);
         node->data.name = xstrdup(p->previous.lexeme);
         return node;
     }
@@ -737,8 +617,7 @@ static ASTNode* parse_primary(Parser* p) {
         return expr;
     }
 
-    error_at(p->current.line, p->current.column, "Expected expression");
-    p->error_count++;
+    error_at_current(p, "Expected expression");
     return NULL;
 }
 
@@ -754,20 +633,32 @@ static ASTNode* parse_type(Parser* p) {
     else if (match(p, TOKEN_BYTE)) type_name = "byte";
     else if (match(p, TOKEN_VOID)) type_name = "void";
     else {
-        error_at(p->current.line, p->current.column, "Expected type name");
-        p->error_count++;
+        error_at_current(p, "Expected type name");
         return NULL;
     }
 
-    ASTNode* node = ast_node_new(AST_TYPE);
+    ASTNode* node = node_new(p, AST_TYPE);
     node->data.name = xstrdup(type_name);
 
     while (match(p, TOKEN_STAR)) {
-        ASTNode* ptr = ast_node_new(AST_POINTER_TYPE);
+        ASTNode* ptr = node_new(p, AST_POINTER_TYPE);
         ast_node_add_child(ptr, node);
         node = ptr;
     }
 
+    if (match(p, TOKEN_LBRACKET)) {
+        ASTNode* arr = node_new(p, AST_ARRAY_TYPE);
+        ast_node_add_child(arr, node);
+
+        consume(p, TOKEN_NUMBER, "Expected array length");
+        ASTNode* len = node_new(p, AST_NUMBER);
+        len->data.int_value = p->previous.value.int_value;
+        ast_node_add_child(arr, len);
+
+        consume(p, TOKEN_RBRACKET, "Expected ']' after array length");
+        node = arr;
+    }
+
     return node;
 }
 
@@ -777,7 +668,7 @@ static ASTNode* parse_parameter(Parser* p) {
 
     consume(p, TOKEN_IDENT, "Expected parameter name");
 
-    ASTNode* param = ast_node_new(AST_VAR_DECL);
+    ASTNode* param = node_new(p, AST_VAR_DECL);
     param->data.name = xstrdup(p->previous.lexeme);
     ast_node_add_child(param, type);
 
@@ -787,7 +678,7 @@ static ASTNode* parse_parameter(Parser* p) {
 static ASTNode* parse_var_decl(Parser* p) {
     consume(p, TOKEN_IDENT, "Expected variable name");
 
-    ASTNode* decl = ast_node_new(AST_VAR_DECL);
+    ASTNode* decl = node_new(p, AST_VAR_DECL);
     decl->data.name = xstrdup(p->previous.lexeme);
 
     consume(p, TOKEN_COLON, "Expected ':' after variable name");
@@ -0,0 +1,260 @@
+/**
+ * @file profile.c
+ * @brief Block counters and profile-guided function order
+ * @author Bober
+ * @version 1.0.0
+ *
+ * The counters are plain 64-bit slots, one per block, incremented by a
+ * single "count N" instruction at the start of the block; the runtime
+ * (uwu_profile_register in the stdlib) writes them out at exit. Reading a
+ * profile back only annotates the IR: the optimizer decides what to do
+ * with the counts.
+ */
+
+#include "profile.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_VERSION 1
+
+typedef struct {
+    char* name;
+    int blocks;
+    long long* counts;
+} FunctionProfile;
+
+typedef struct {
+    IRInstruction* first;
+    IRInstruction* last;
+    long long weight;       // sum of block counts, -1 without a profile
+    int order;
+} FunctionRange;
+
+static bool op_is(const IRInstruction* inst, const char* opcode) {
+    return strcmp(inst->opcode, opcode) == 0;
+}
+
+static bool is_conditional_branch(const IRInstruction* inst) {
+    static const char* const compares[] = {"lt", "le", "gt", "ge", "eq", "ne"};
+    if (op_is(inst, "brz") || op_is(inst, "jz") || op_is(inst, "jnz")) return true;
+    if (inst->opcode[0] != 'b') return false;
+    for (size_t i = 0; i < sizeof(compares) / sizeof(compares[0]); i++) {
+        if (strcmp(inst->opcode + 1, compares[i]) == 0) return true;
+    }
+    return false;
+}
+
+static IRInstruction* function_end(IRInstruction* func) {
+    IRInstruction* inst = func->next;
+    while (inst && !op_is(inst, "func")) inst = inst->next;
+    return inst;
+}
+
+// The instructions the blocks of func start after: its last parameter (or
+// func itself) for the entry, then each label and conditional branch.
+static int find_blocks(IRInstruction* func, IRInstruction*** starts) {
+    int count = 0;
+    int cap = 16;
+    IRInstruction** list = xmalloc(cap * sizeof(IRInstruction*));
+
+    IRInstruction* entry = func;
+    while (entry->next && op_is(entry->next, "param")) entry = entry->next;
+    list[count++] = entry;
+
+    IRInstruction* end = function_end(func);
+    for (IRInstruction* inst = entry->next; inst != end; inst = inst->next) {
+        if (!op_is(inst, "label") && !is_conditional_branch(inst)) continue;
+        if (count == cap) {
+            cap *= 2;
+            list = xrealloc(list, cap * sizeof(IRInstruction*));
+        }
+        list[count++] = inst;
+    }
+    *starts = list;
+    return count;
+}
+
+void profile_instrument(IRProgram* prog, const char* path) {
+    const char* header_ops[] = {path, "0"};
+    IRInstruction* header = ir_insert_after(prog, NULL, "profile", header_ops, 2);
+    IRInstruction* meta = header;
+    int total = 0;
+
+    for (IRInstruction* inst = header->next; inst; inst = inst->next) {
+        if (!op_is(inst, "func")) continue;
+
+        IRInstruction** starts;
+        int blocks = find_blocks(inst, &starts);
+        for (int i = 0; i < blocks; i++) {
+            char index[16];
+            snprintf(index, sizeof(index), "%d", total + i);
+            const char* ops[] = {index};
+            ir_insert_after(prog, starts[i], "count", ops, 1);
+        }
+        free(starts);
+
+        char count[16];
+        snprintf(count, sizeof(count), "%d", blocks);
+        const char* ops[] = {inst->operands[0], count};
+        meta = ir_insert_after(prog, meta, "profunc", ops, 2);
+        total += blocks;
+    }
+
+    char count[16];
+    snprintf(count, sizeof(count), "%d", total);
+    free(header->operands[1]);
+    header->operands[1] = xstrdup(count);
+}
+
+static FunctionProfile* read_profile(const char* path, int* count) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        error("Cannot read profile: %s", path);
+    }
+    int version;
+    if (fscanf(f, " uwuprof %d", &version) != 1 || version != PROFILE_VERSION) {
+        error("%s: not a uwucc profile", path);
+    }
+
+    FunctionProfile* profiles = NULL;
+    int cap = 0;
+    *count = 0;
+    char name[256];
+    int blocks;
+    while (fscanf(f, "%255s %d", name, &blocks) == 2) {
+        if (blocks <= 0) {
+            error("%s: bad block count for %s", path, name);
+        }
+        if (*count == cap) {
+            cap = cap ? cap * 2 : 16;
+            profiles = xrealloc(profiles, cap * sizeof(FunctionProfile));
+        }
+        FunctionProfile* p = &profiles[(*count)++];
+        p->name = xstrdup(name);
+        p->blocks = blocks;
+        p->counts = xmalloc(blocks * sizeof(long long));
+        for (int i = 0; i < blocks; i++) {
+            if (fscanf(f, "%lld", &p->counts[i]) != 1) {
+                error("%s: truncated profile for %s", path, name);
+            }
+        }
+    }
+    fclose(f);
+    return profiles;
+}
+
+// Gives each instruction of func the count of its block. A label starts
+// its block; a conditional branch ends one.
+static bool annotate(IRInstruction* func, const FunctionProfile* p) {
+    IRInstruction** starts;
+    int blocks = find_blocks(func, &starts);
+    if (blocks != p->blocks) {
+        free(starts);
+        return false;
+    }
+
+    int b = 0;
+    IRInstruction* end = function_end(func);
+    for (IRInstruction* inst = func; inst != end; inst = inst->next) {
+        bool starts_next = b + 1 < blocks && starts[b + 1] == inst;
+        if (starts_next && op_is(inst, "label")) b++;
+        inst->count = p->counts[b];
+        if (starts_next && !op_is(inst, "label")) b++;
+    }
+    free(starts);
+    return true;
+}
+
+// Hot functions by weight, then those the profile does not cover, then the
+// ones that never ran, each group otherwise in program order.
+static int compare_ranges(const void* a, const void* b) {
+    const FunctionRange* x = a;
+    const FunctionRange* y = b;
+    int gx = x->weight > 0 ? 0 : x->weight < 0 ? 1 : 2;
+    int gy = y->weight > 0 ? 0 : y->weight < 0 ? 1 : 2;
+    if (gx != gy) return gx - gy;
+    if (gx == 0 && x->weight != y->weight) return x->weight > y->weight ? -1 : 1;
+    return x->order - y->order;
+}
+
+static void order_functions(IRProgram* prog, const long long* weights) {
+    IRInstruction* prefix = NULL;
+    IRInstruction* inst = prog->head;
+    while (inst && !op_is(inst, "func")) {
+        prefix = inst;
+        inst = inst->next;
+    }
+
+    int count = 0;
+    for (IRInstruction* i = inst; i; i = i->next) {
+        if (op_is(i, "func")) count++;
+    }
+    if (count < 2) return;
+
+    FunctionRange* ranges = xmalloc(count * sizeof(FunctionRange));
+    for (int n = 0; n < count; n++) {
+        IRInstruction* last = inst;
+        while (last->next && !op_is(last->next, "func")) last = last->next;
+        ranges[n] = (FunctionRange){inst, last, weights[n], n};
+        inst = last->next;
+    }
+    qsort(ranges, count, sizeof(FunctionRange), compare_ranges);
+
+    for (int n = 0; n < count; n++) {
+        if (n == 0) {
+            if (prefix) {
+                prefix->next = ranges[n].first;
+            } else {
+                prog->head = ranges[n].first;
+            }
+        } else {
+            ranges[n - 1].last->next = ranges[n].first;
+        }
+    }
+    ranges[count - 1].last->next = NULL;
+    prog->tail = ranges[count - 1].last;
+    free(ranges);
+}
+
+void profile_use(IRProgram* prog, const char* path) {
+    int profile_count;
+    FunctionProfile* profiles = read_profile(path, &profile_count);
+
+    int count = 0;
+    for (IRInstruction* inst = prog->head; inst; inst = inst->next) {
+        if (op_is(inst, "func")) count++;
+    }
+    long long* weights = xmalloc((count + 1) * sizeof(long long));
+
+    int n = 0;
+    for (IRInstruction* func = prog->head; func; func = func->next) {
+        if (!op_is(func, "func")) continue;
+
+        weights[n] = -1;
+        for (int i = 0; i < profile_count; i++) {
+            FunctionProfile* p = &profiles[i];
+            if (strcmp(p->name, func->operands[0]) != 0) continue;
+            if (!annotate(func, p)) {
+                fprintf(stderr, "warning: profile for '%s' does not match the program; "
+                        "ignored\n", p->name);
+                break;
+            }
+            weights[n] = 0;
+            for (int b = 0; b < p->blocks; b++) {
+                weights[n] += p->counts[b];
+            }
+            break;
+        }
+        n++;
+    }
+    order_functions(prog, weights);
+
+    for (int i = 0; i < profile_count; i++) {
+        free(profiles[i].name);
+        free(profiles[i].counts);
+    }
+    free(profiles);
+    free(weights);
+}
@@ -0,0 +1,26 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "ir.h"
+
+// Profile-guided optimization. Both steps work on the IR as ir_generate
+// leaves it, before ir_optimize, so the profile of a build matches another
+// build of the same source at the same -O level.
+//
+// Blocks are numbered per function: the entry, then one at each label and
+// one after each conditional branch. An instrumented build counts how often
+// each runs and writes the counts when the program exits, as
+//
+//     uwuprof 1
+//     <function> <blocks> <count>...
+
+// Adds the block counters ("count N") and the "profile"/"profunc" entries
+// codegen emits them from; the counts are written to path.
+void profile_instrument(IRProgram* prog, const char* path);
+
+// Reads a profile and sets the count of every instruction of the functions
+// it matches; a function whose blocks no longer match is skipped with a
+// warning. Functions are then ordered hottest first, never-run ones last.
+void profile_use(IRProgram* prog, const char* path);
+
+#endif
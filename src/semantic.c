@@ -14,6 +14,9 @@
  */
 
 #include "semantic.h"
+#include "flat_ast.h"
+#include "lexer.h"
+#include "ir.h"
 #include "util.h"
 #include <stdlib.h>
 #include <string.h>
@@ -40,6 +43,22 @@ static SymbolTable* symtab_new(SymbolTable* parent) {
 static SymbolTable* current_scope = NULL;
 static int current_stack_offset = 0;
 
+// Signatures of every function a program can call: the runtime builtins,
+// functions imported from modules and the program's own functions. All of
+// them are visible in every global scope, and IR generation uses the
+// parameter types to convert arguments.
+#define SIGNATURE_BUCKETS 1024
+
+typedef struct Signature {
+    char* name;
+    Type* ret_type;
+    Type** params;
+    int param_count;
+    struct Signature* next;
+} Signature;
+
+static Signature* signatures[SIGNATURE_BUCKETS];
+
 static void symtab_add(SymbolTable* st, const char* name, Type* type, bool is_func) {
     Symbol* sym = xmalloc(sizeof(Symbol));
     sym->name = xstrdup(name);
@@ -47,9 +66,14 @@ static void symtab_add(SymbolTable* st, const char* name, Type* type, bool is_fu
     sym->is_function = is_func;
     sym->stack_offset = 0;
 
+    // Locals are packed downwards from the frame base by size and
+    // alignment. stack_offset is the distance from the base to the end of
+    // the variable, so that base - stack_offset is its (aligned) address.
     if (!is_func && type) {
+        int size = type->size > 0 ? type->size : 8;
+        int align = type->align > 0 ? type->align : 8;
+        current_stack_offset = (current_stack_offset + size + align - 1) / align * align;
         sym->stack_offset = current_stack_offset;
-        current_stack_offset++;
     }
 
     sym->next = st->head;
@@ -67,41 +91,45 @@ static Symbol* symtab_lookup(SymbolTable* st, const char* name) {
     return NULL;
 }
 
+static Type* type_from_name(const char* name) {
+    Type* t = NULL;
+
+    if (strcmp(name, "chonk") == 0) {
+        t = type_new(TYPE_CHONK);
+    }
+    else if (strcmp(name, "smol") == 0) {
+        t = type_new(TYPE_SMOL);
+    }
+    else if (strcmp(name, "megachonk") == 0) {
+        t = type_new(TYPE_MEGACHONK);
+    }
+    else if (strcmp(name, "floof") == 0) {
+        t = type_new(TYPE_FLOOF);
+    }
+    else if (strcmp(name, "bigfloof") == 0) {
+        t = type_new(TYPE_BIGFLOOF);
+    }
+    else if (strcmp(name, "boop") == 0) {
+        t = type_new(TYPE_BOOP);
+    }
+    else if (strcmp(name, "byte") == 0) {
+        t = type_new(TYPE_BYTE);
+    }
+    else if (strcmp(name, "void") == 0) {
+        t = type_new(TYPE_VOID);
+    }
+    else {
+        t = type_new(TYPE_STRUCT);
+        t->name = xstrdup(name);
+    }
+    return t;
+}
+
 static Type* resolve_type(ASTNode* type_node) {
     if (!type_node) return NULL;
 
     if (type_node->kind == AST_TYPE) {
-        Type* t = NULL;
-
-        if (strcmp(type_node->data.name, "chonk") == 0) {
-            t = type_new(TYPE_CHONK);
-        }
-        else if (strcmp(type_node->data.name, "smol") == 0) {
-            t = type_new(TYPE_SMOL);
-        }
-        else if (strcmp(type_node->data.name, "megachonk") == 0) {
-            t = type_new(TYPE_MEGACHONK);
-        }
-        else if (strcmp(type_node->data.name, "floof") == 0) {
-            t = type_new(TYPE_FLOOF);
-        }
-        else if (strcmp(type_node->data.name, "bigfloof") == 0) {
-            t = type_new(TYPE_BIGFLOOF);
-        }
-        else if (strcmp(type_node->data.name, "boop") == 0) {
-            t = type_new(TYPE_BOOP);
-        }
-        else if (strcmp(type_node->data.name, "byte") == 0) {
-            t = type_new(TYPE_BYTE);
-        }
-        else if (strcmp(type_node->data.name, "void") == 0) {
-            t = type_new(TYPE_VOID);
-        }
-        else {
-            t = type_new(TYPE_STRUCT);
-            t->name = xstrdup(type_node->data.name);
-        }
-        return t;
+        return type_from_name(type_node->data.name);
     }
     else if (type_node->kind == AST_POINTER_TYPE) {
         Type* base = resolve_type(type_node->children[0]);
@@ -120,10 +148,230 @@ static Type* resolve_type(ASTNode* type_node) {
     return NULL;
 }
 
+Type* semantic_resolve_type(ASTNode* type_node) {
+    return resolve_type(type_node);
+}
+
+static unsigned signature_bucket(const char* name) {
+    unsigned h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h & (SIGNATURE_BUCKETS - 1);
+}
+
+static Signature* signature_lookup(const char* name) {
+    for (Signature* sig = signatures[signature_bucket(name)]; sig; sig = sig->next) {
+        if (strcmp(sig->name, name) == 0) return sig;
+    }
+    return NULL;
+}
+
+// A later declaration of the same name replaces the earlier one.
+static void declare_signature(const char* name, Type* ret_type, Type** params,
+                              int param_count) {
+    Signature* sig = signature_lookup(name);
+    if (!sig) {
+        unsigned b = signature_bucket(name);
+        sig = xcalloc(1, sizeof(Signature));
+        sig->name = xstrdup(name);
+        sig->next = signatures[b];
+        signatures[b] = sig;
+    }
+    free(sig->params);
+    sig->ret_type = ret_type;
+    sig->params = param_count > 0 ? xmalloc(param_count * sizeof(Type*)) : NULL;
+    sig->param_count = param_count;
+    for (int i = 0; i < param_count; i++) {
+        sig->params[i] = params[i];
+    }
+}
+
+// uwu_stdlib functions that take or return something other than a machine
+// word. Everything else in the runtime is called without a signature.
+static const struct {
+    const char* name;
+    TypeKind ret;
+    int param_count;
+    TypeKind params[2];
+} builtin_signatures[] = {
+    {"uwu_sqrt",  TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_pow",   TYPE_BIGFLOOF, 2, {TYPE_BIGFLOOF, TYPE_BIGFLOOF}},
+    {"uwu_fabs",  TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_sin",   TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_cos",   TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_tan",   TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_asin",  TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_acos",  TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_atan",  TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_atan2", TYPE_BIGFLOOF, 2, {TYPE_BIGFLOOF, TYPE_BIGFLOOF}},
+    {"uwu_log",   TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_log10", TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_exp",   TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_floor", TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_ceil",  TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_round", TYPE_BIGFLOOF, 1, {TYPE_BIGFLOOF}},
+    {"uwu_abs",   TYPE_CHONK,    1, {TYPE_CHONK}},
+    {"read_int",  TYPE_CHONK,    0, {0}},
+    {"print_int", TYPE_VOID,     1, {TYPE_CHONK}},
+};
+
+static void declare_builtins(void) {
+    static bool declared = false;
+    if (declared) return;
+    declared = true;
+
+    for (size_t i = 0; i < sizeof(builtin_signatures) / sizeof(builtin_signatures[0]); i++) {
+        Type* params[2];
+        for (int p = 0; p < builtin_signatures[i].param_count; p++) {
+            params[p] = type_new(builtin_signatures[i].params[p]);
+        }
+        declare_signature(builtin_signatures[i].name, type_new(builtin_signatures[i].ret),
+                          params, builtin_signatures[i].param_count);
+    }
+}
+
+void semantic_declare_extern(const char* name, Type* ret_type, Type** params,
+                             int param_count) {
+    declare_signature(name, ret_type, params, param_count);
+}
+
+Type* semantic_param_type(const char* func, int index) {
+    Signature* sig = signature_lookup(func);
+    if (!sig || index < 0 || index >= sig->param_count) return NULL;
+    return sig->params[index];
+}
+
+static SymbolTable* global_scope_new(void) {
+    declare_builtins();
+
+    SymbolTable* st = symtab_new(NULL);
+    for (int b = 0; b < SIGNATURE_BUCKETS; b++) {
+        for (Signature* sig = signatures[b]; sig; sig = sig->next) {
+            symtab_add(st, sig->name, sig->ret_type, true);
+        }
+    }
+    return st;
+}
+
+// Function signatures are collected before any body is checked, so that a
+// function can call one defined further down.
+static void declare_function(const char* name, Type* ret_type, Type** params,
+                             int param_count) {
+    declare_signature(name, ret_type, params, param_count);
+    symtab_add(current_scope, name, ret_type, true);
+}
+
 static Type* check_expression(ASTNode* node);
 static void check_statement(ASTNode* node);
 static void check_block_for_declarations(ASTNode* node);
 
+// After a syntax error the parser leaves out children it could not parse,
+// so optional operands are fetched with a bounds check.
+static ASTNode* child(ASTNode* node, int i) {
+    return i < node->child_count ? node->children[i] : NULL;
+}
+
+static Type* element_type(Type* t) {
+    if (t && (t->kind == TYPE_ARRAY || t->kind == TYPE_POINTER) && t->base) {
+        return t->base;
+    }
+    return type_new(TYPE_CHONK);
+}
+
+static bool is_pointer(Type* t) {
+    return t && (t->kind == TYPE_POINTER || t->kind == TYPE_ARRAY);
+}
+
+static bool is_comparison(int op) {
+    return op == TOKEN_EQ || op == TOKEN_NE || op == TOKEN_LT ||
+           op == TOKEN_GT || op == TOKEN_LE || op == TOKEN_GE;
+}
+
+// Comparisons yield a chonk. Shifts keep the type of their left operand and
+// other integer operations take the common integer type; the difference of
+// two pointers is a megachonk. With a floating operand, arithmetic is done in
+// the common floating type; anything else is an error.
+static Type* binary_type(int op, Type* left, Type* right, uint32_t loc) {
+    if (is_comparison(op)) return type_new(TYPE_CHONK);
+
+    Type* common = type_float_common(left, right);
+    if (!common) {
+        if (op == TOKEN_LSHIFT || op == TOKEN_RSHIFT) return left;
+        if (op == TOKEN_PLUS && is_pointer(left) && is_pointer(right)) {
+            error_at(AST_LOC_LINE(loc), AST_LOC_COLUMN(loc), "Cannot add two pointers");
+            return left;
+        }
+        if (op == TOKEN_MINUS && is_pointer(right)) {
+            if (is_pointer(left)) return type_new(TYPE_MEGACHONK);
+            error_at(AST_LOC_LINE(loc), AST_LOC_COLUMN(loc),
+                     "Cannot subtract a pointer from an integer");
+            return right;
+        }
+        return type_int_common(left, right);
+    }
+
+    if (op == TOKEN_PLUS || op == TOKEN_MINUS || op == TOKEN_STAR || op == TOKEN_SLASH) {
+        return common;
+    }
+    error_at(AST_LOC_LINE(loc), AST_LOC_COLUMN(loc),
+             "Invalid operands to binary expression (floof)");
+    return left;
+}
+
+// Calls carry the callee and their arguments in one IR instruction.
+static void check_arg_count(int count, uint32_t loc) {
+    if (count > MAX_CALL_ARGS) {
+        error_at(AST_LOC_LINE(loc), AST_LOC_COLUMN(loc),
+                 "Too many arguments in call (at most %d)", MAX_CALL_ARGS);
+    }
+}
+
+static bool is_addressable(int kind, int op) {
+    return kind == AST_IDENTIFIER || kind == AST_INDEX ||
+           (kind == AST_UNARY_OP && op == TOKEN_STAR);
+}
+
+// There are no struct declarations yet, so no member has a known offset.
+static void member_unsupported(uint32_t loc) {
+    error_at(AST_LOC_LINE(loc), AST_LOC_COLUMN(loc),
+             "Member access is not supported: struct types have no layout");
+}
+
+// addressable says whether the operand names storage: a variable, an
+// element or a dereferenced pointer.
+static Type* unary_type(int op, Type* operand, bool addressable, uint32_t loc) {
+    if (op == TOKEN_AMP) {
+        if (!addressable) {
+            error_at(AST_LOC_LINE(loc), AST_LOC_COLUMN(loc),
+                     "Cannot take the address of this expression");
+        }
+        return type_pointer(operand);
+    }
+    if (op == TOKEN_STAR) {
+        if (!operand || operand->kind != TYPE_POINTER || !operand->base) {
+            error_at(AST_LOC_LINE(loc), AST_LOC_COLUMN(loc),
+                     "Cannot dereference a non-pointer value");
+            return type_new(TYPE_CHONK);
+        }
+        return operand->base;
+    }
+    if (type_is_float(operand) && op != TOKEN_MINUS) {
+        error_at(AST_LOC_LINE(loc), AST_LOC_COLUMN(loc),
+                 "Invalid operand to unary expression (floof)");
+    }
+    return operand;
+}
+
+// Reports an undefined name and declares it, so that later uses of the same
+// name do not report it again.
+static Symbol* undefined_identifier(int line, int col, const char* name) {
+    error_at(line, col, "Undefined identifier: %s", name);
+    symtab_add(current_scope, name, type_new(TYPE_CHONK), false);
+    return symtab_lookup(current_scope, name);
+}
+
 static void check_statement(ASTNode* node) {
     if (!node) return;
 
@@ -136,11 +384,9 @@ static void check_statement(ASTNode* node) {
 
         case AST_IF:
         case AST_WHILE:
-            check_expression(node->children[0]);
-            check_statement(node->children[1]);
-            if (node->child_count > 2) {
-                check_statement(node->children[2]);
-            }
+            check_expression(child(node, 0));
+            check_statement(child(node, 1));
+            check_statement(child(node, 2));
             break;
 
         case AST_FOR:
@@ -174,12 +420,17 @@ static void check_statement(ASTNode* node) {
     }
 }
 
+// An integer literal is a chonk unless its value needs 64 bits.
+static Type* number_type(long long value) {
+    return type_new(value < INT32_MIN || value > INT32_MAX ? TYPE_MEGACHONK : TYPE_CHONK);
+}
+
 static Type* check_expression(ASTNode* node) {
     if (!node) return NULL;
 
     switch (node->kind) {
         case AST_NUMBER:
-            node->type = type_new(TYPE_CHONK);
+            node->type = number_type(node->data.int_value);
             return node->type;
 
         case AST_FLOAT:
@@ -201,8 +452,8 @@ static Type* check_expression(ASTNode* node) {
         case AST_IDENTIFIER: {
             Symbol* sym = symtab_lookup(current_scope, node->data.name);
             if (!sym) {
-                error_at(node->line, node->column,
-                         "Undefined identifier: %s", node->data.name);
+                sym = undefined_identifier(AST_LOC_LINE(node->loc),
+                                           AST_LOC_COLUMN(node->loc), node->data.name);
             }
             node->type = sym->type;
             node->stack_offset = sym->stack_offset;
@@ -210,31 +461,54 @@ static Type* check_expression(ASTNode* node) {
         }
 
         case AST_BINARY_OP: {
-            Type* left = check_expression(node->children[0]);
-            Type* right = check_expression(node->children[1]);
-            node->type = left;
+            Type* left = check_expression(child(node, 0));
+            Type* right = check_expression(child(node, 1));
+            node->type = binary_type(node->data.op, left, right, node->loc);
             return node->type;
         }
 
-        case AST_UNARY_OP:
-            node->type = check_expression(node->children[0]);
+        case AST_UNARY_OP: {
+            ASTNode* operand = child(node, 0);
+            bool addressable = operand && is_addressable(operand->kind,
+                operand->kind == AST_UNARY_OP ? operand->data.op : 0);
+            node->type = unary_type(node->data.op, check_expression(operand),
+                                    addressable, node->loc);
             return node->type;
+        }
 
         case AST_ASSIGN: {
-            Type* left = check_expression(node->children[0]);
-            Type* right = check_expression(node->children[1]);
+            Type* left = check_expression(child(node, 0));
+            check_expression(child(node, 1));
             node->type = left;
             return node->type;
         }
 
+        case AST_INDEX: {
+            Type* base = check_expression(child(node, 0));
+            check_expression(child(node, 1));
+            node->type = element_type(base);
+            return node->type;
+        }
+
+        case AST_MEMBER:
+            member_unsupported(node->loc);
+            node->type = type_new(TYPE_CHONK);
+            return node->type;
+
         case AST_CALL: {
-            Symbol* sym = symtab_lookup(
-                current_scope, node->children[0]->data.name);
+            ASTNode* callee = node->children[0];
+            Symbol* sym = NULL;
+            if (callee->kind == AST_IDENTIFIER) {
+                sym = symtab_lookup(current_scope, callee->data.name);
+            }
+            // Functions we know nothing about (the C runtime) may return
+            // pointers, so their result is kept at full width.
             if (sym && sym->is_function) {
                 node->type = sym->type;
             } else {
-                node->type = type_new(TYPE_CHONK);
+                node->type = type_new(TYPE_MEGACHONK);
             }
+            check_arg_count(node->child_count - 1, node->loc);
             for (int i = 1; i < node->child_count; i++) {
                 check_expression(node->children[i]);
             }
@@ -257,15 +531,12 @@ static void check_block_for_declarations(ASTNode* node) {
             if (stmt->kind == AST_VAR_DECL) {
                 Type* var_type = resolve_type(stmt->children[0]);
                 symtab_add(current_scope, stmt->data.name, var_type, false);
+                stmt->type = var_type;
 
                 Symbol* sym = symtab_lookup(current_scope, stmt->data.name);
                 if (sym) {
                     stmt->stack_offset = sym->stack_offset;
                 }
-
-                if (stmt->child_count > 1) {
-                    check_expression(stmt->children[1]);
-                }
             }
             else if (stmt->kind == AST_BLOCK || stmt->kind == AST_IF ||
                      stmt->kind == AST_WHILE || stmt->kind == AST_FOR) {
@@ -292,8 +563,8 @@ static void check_declaration(ASTNode* node) {
         SymbolTable* old_scope = current_scope;
         current_scope = func_scope;
 
-        symtab_add(current_scope, node->data.name,
-                   resolve_type(node->children[0]), true);
+        node->type = resolve_type(node->children[0]);
+        symtab_add(current_scope, node->data.name, node->type, true);
 
         ASTNode* params = node->children[1];
         for (int i = 0; i < params->child_count; i++) {
@@ -301,6 +572,7 @@ static void check_declaration(ASTNode* node) {
             if (param->kind == AST_VAR_DECL) {
                 Type* param_type = resolve_type(param->children[0]);
                 symtab_add(current_scope, param->data.name, param_type, false);
+                param->type = param_type;
 
                 Symbol* sym = symtab_lookup(current_scope, param->data.name);
                 if (sym) {
@@ -320,6 +592,7 @@ static void check_declaration(ASTNode* node) {
     else if (node->kind == AST_VAR_DECL) {
         Type* var_type = resolve_type(node->children[0]);
         symtab_add(current_scope, node->data.name, var_type, false);
+        node->type = var_type;
 
         Symbol* sym = symtab_lookup(current_scope, node->data.name);
         if (sym) {
@@ -337,9 +610,306 @@ void semantic_analyze(ASTNode* root) {
         error("Invalid AST");
     }
 
-    current_scope = symtab_new(NULL);
+    current_scope = global_scope_new();
+
+    for (int i = 0; i < root->child_count; i++) {
+        ASTNode* fn = root->children[i];
+        if (fn->kind != AST_FUNCTION) continue;
+
+        ASTNode* params = fn->children[1];
+        Type** param_types = xmalloc((params->child_count + 1) * sizeof(Type*));
+        int count = 0;
+        for (int p = 0; p < params->child_count; p++) {
+            if (params->children[p]->kind == AST_VAR_DECL) {
+                param_types[count++] = resolve_type(params->children[p]->children[0]);
+            }
+        }
+        declare_function(fn->data.name, resolve_type(fn->children[0]), param_types, count);
+        free(param_types);
+    }
 
     for (int i = 0; i < root->child_count; i++) {
         check_declaration(root->children[i]);
     }
 }
+
+// Flat AST variant. Results go to ast->type[] and ast->stack_offset[]
+// instead of onto nodes; the symbol tables are the same as above.
+
+static Type* resolve_type_flat(FlatAST* ast, uint32_t n) {
+    if (n == FLAT_NONE) return NULL;
+
+    switch (ast->kind[n]) {
+        case AST_TYPE:
+            return type_from_name(flat_ast_name(ast, n));
+        case AST_POINTER_TYPE:
+            return type_pointer(resolve_type_flat(ast, ast->first_child[n]));
+        case AST_ARRAY_TYPE: {
+            uint32_t base = ast->first_child[n];
+            uint32_t len = ast->next_sibling[base];
+            int size = 0;
+            if (len != FLAT_NONE && ast->kind[len] == AST_NUMBER) {
+                size = (int)ast->payload[len];
+            }
+            return type_array(resolve_type_flat(ast, base), size);
+        }
+        default:
+            return NULL;
+    }
+}
+
+static Type* check_expression_flat(FlatAST* ast, uint32_t n);
+static void check_statement_flat(FlatAST* ast, uint32_t n);
+
+static void check_children_flat(FlatAST* ast, uint32_t n, uint32_t skip) {
+    uint32_t c = flat_ast_child(ast, n, skip);
+    for (; c != FLAT_NONE; c = ast->next_sibling[c]) {
+        check_expression_flat(ast, c);
+    }
+}
+
+static void check_statement_flat(FlatAST* ast, uint32_t n) {
+    if (n == FLAT_NONE) return;
+
+    uint32_t first = ast->first_child[n];
+
+    switch (ast->kind[n]) {
+        case AST_RETURN:
+            if (first != FLAT_NONE) check_expression_flat(ast, first);
+            break;
+
+        case AST_IF:
+        case AST_WHILE:
+            check_expression_flat(ast, first);
+            check_statement_flat(ast, flat_ast_child(ast, n, 1));
+            check_statement_flat(ast, flat_ast_child(ast, n, 2));
+            break;
+
+        case AST_FOR:
+            check_statement_flat(ast, flat_ast_child(ast, n, 0));
+            check_expression_flat(ast, flat_ast_child(ast, n, 1));
+            check_expression_flat(ast, flat_ast_child(ast, n, 2));
+            check_statement_flat(ast, flat_ast_child(ast, n, 3));
+            break;
+
+        case AST_BLOCK:
+        case AST_UNSAFE_BLOCK:
+            for (uint32_t c = first; c != FLAT_NONE; c = ast->next_sibling[c]) {
+                check_statement_flat(ast, c);
+            }
+            break;
+
+        case AST_VAR_DECL:
+            check_expression_flat(ast, flat_ast_child(ast, n, 1));
+            break;
+
+        default:
+            check_expression_flat(ast, n);
+            break;
+    }
+}
+
+static Type* check_expression_flat(FlatAST* ast, uint32_t n) {
+    if (n == FLAT_NONE) return NULL;
+
+    switch (ast->kind[n]) {
+        case AST_NUMBER:
+        case AST_FLOAT:
+        case AST_BOOLEAN:
+        case AST_STRING:
+        case AST_NULL:
+            // Typed by the linear sweep in semantic_analyze_flat.
+            return ast->type[n];
+
+        case AST_IDENTIFIER: {
+            Symbol* sym = symtab_lookup(current_scope, flat_ast_name(ast, n));
+            if (!sym) {
+                sym = undefined_identifier(AST_LOC_LINE(ast->loc[n]),
+                                           AST_LOC_COLUMN(ast->loc[n]), flat_ast_name(ast, n));
+            }
+            ast->type[n] = sym->type;
+            ast->stack_offset[n] = sym->stack_offset;
+            return ast->type[n];
+        }
+
+        case AST_BINARY_OP: {
+            uint32_t lhs = ast->first_child[n];
+            Type* left = check_expression_flat(ast, lhs);
+            Type* right = lhs != FLAT_NONE ? check_expression_flat(ast, ast->next_sibling[lhs]) : NULL;
+            ast->type[n] = binary_type((int)ast->payload[n], left, right, ast->loc[n]);
+            return ast->type[n];
+        }
+
+        case AST_ASSIGN: {
+            uint32_t lhs = ast->first_child[n];
+            ast->type[n] = check_expression_flat(ast, lhs);
+            if (lhs != FLAT_NONE) check_expression_flat(ast, ast->next_sibling[lhs]);
+            return ast->type[n];
+        }
+
+        case AST_UNARY_OP: {
+            uint32_t operand = ast->first_child[n];
+            bool addressable = operand != FLAT_NONE && is_addressable(ast->kind[operand],
+                ast->kind[operand] == AST_UNARY_OP ? (int)ast->payload[operand] : 0);
+            ast->type[n] = unary_type((int)ast->payload[n],
+                                      check_expression_flat(ast, operand),
+                                      addressable, ast->loc[n]);
+            return ast->type[n];
+        }
+
+        case AST_MEMBER:
+            member_unsupported(ast->loc[n]);
+            ast->type[n] = type_new(TYPE_CHONK);
+            return ast->type[n];
+
+        case AST_INDEX: {
+            uint32_t base = ast->first_child[n];
+            Type* base_type = check_expression_flat(ast, base);
+            if (base != FLAT_NONE) check_expression_flat(ast, ast->next_sibling[base]);
+            ast->type[n] = element_type(base_type);
+            return ast->type[n];
+        }
+
+        case AST_CALL: {
+            uint32_t callee = ast->first_child[n];
+            Symbol* sym = NULL;
+            if (ast->kind[callee] == AST_IDENTIFIER) {
+                sym = symtab_lookup(current_scope, flat_ast_name(ast, callee));
+            }
+            if (sym && sym->is_function) {
+                ast->type[n] = sym->type;
+            } else {
+                ast->type[n] = type_new(TYPE_MEGACHONK);
+            }
+            int count = 0;
+            for (uint32_t arg = ast->next_sibling[callee]; arg != FLAT_NONE; arg = ast->next_sibling[arg]) {
+                count++;
+            }
+            check_arg_count(count, ast->loc[n]);
+            check_children_flat(ast, n, 1);
+            return ast->type[n];
+        }
+
+        default:
+            ast->type[n] = type_new(TYPE_CHONK);
+            return ast->type[n];
+    }
+}
+
+static void declare_var_flat(FlatAST* ast, uint32_t n) {
+    Type* var_type = resolve_type_flat(ast, ast->first_child[n]);
+    symtab_add(current_scope, flat_ast_name(ast, n), var_type, false);
+    ast->type[n] = var_type;
+
+    Symbol* sym = symtab_lookup(current_scope, flat_ast_name(ast, n));
+    if (sym) {
+        ast->stack_offset[n] = sym->stack_offset;
+    }
+}
+
+static void check_block_for_declarations_flat(FlatAST* ast, uint32_t n) {
+    if (n == FLAT_NONE) return;
+
+    switch (ast->kind[n]) {
+        case AST_BLOCK:
+            for (uint32_t c = ast->first_child[n]; c != FLAT_NONE;
+                 c = ast->next_sibling[c]) {
+                uint8_t kind = ast->kind[c];
+                if (kind == AST_VAR_DECL) {
+                    declare_var_flat(ast, c);
+                } else if (kind == AST_BLOCK || kind == AST_IF ||
+                           kind == AST_WHILE || kind == AST_FOR) {
+                    check_block_for_declarations_flat(ast, c);
+                }
+            }
+            break;
+
+        case AST_IF:
+            check_block_for_declarations_flat(ast, flat_ast_child(ast, n, 1));
+            check_block_for_declarations_flat(ast, flat_ast_child(ast, n, 2));
+            break;
+
+        case AST_WHILE:
+        case AST_FOR:
+            check_block_for_declarations_flat(ast, flat_ast_child(ast, n, 1));
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void check_declaration_flat(FlatAST* ast, uint32_t n) {
+    if (ast->kind[n] == AST_FUNCTION) {
+        current_stack_offset = 0;
+
+        SymbolTable* old_scope = current_scope;
+        current_scope = symtab_new(current_scope);
+
+        uint32_t ret = ast->first_child[n];
+        uint32_t params = ast->next_sibling[ret];
+        uint32_t body = ast->next_sibling[params];
+
+        ast->type[n] = resolve_type_flat(ast, ret);
+        symtab_add(current_scope, flat_ast_name(ast, n), ast->type[n], true);
+
+        for (uint32_t p = ast->first_child[params]; p != FLAT_NONE;
+             p = ast->next_sibling[p]) {
+            if (ast->kind[p] == AST_VAR_DECL) {
+                declare_var_flat(ast, p);
+            }
+        }
+
+        check_block_for_declarations_flat(ast, body);
+        check_statement_flat(ast, body);
+
+        ast->stack_offset[n] = current_stack_offset;
+
+        current_scope = old_scope;
+    }
+    else if (ast->kind[n] == AST_VAR_DECL) {
+        declare_var_flat(ast, n);
+        check_expression_flat(ast, flat_ast_child(ast, n, 1));
+    }
+}
+
+void semantic_analyze_flat(FlatAST* ast) {
+    if (!ast || ast->count == 0 || ast->kind[0] != AST_PROGRAM) {
+        error("Invalid AST");
+    }
+
+    // Literal types do not depend on scope, so assign them in one pass over
+    // the kind array before the scoped walk.
+    for (uint32_t i = 0; i < ast->count; i++) {
+        switch (ast->kind[i]) {
+            case AST_NUMBER:  ast->type[i] = number_type((long long)ast->payload[i]); break;
+            case AST_FLOAT:   ast->type[i] = type_new(TYPE_BIGFLOOF); break;
+            case AST_BOOLEAN: ast->type[i] = type_new(TYPE_BOOP); break;
+            case AST_STRING:  ast->type[i] = type_pointer(type_new(TYPE_BYTE)); break;
+            case AST_NULL:    ast->type[i] = type_new(TYPE_POINTER); break;
+            default: break;
+        }
+    }
+
+    current_scope = global_scope_new();
+
+    for (uint32_t fn = ast->first_child[0]; fn != FLAT_NONE; fn = ast->next_sibling[fn]) {
+        if (ast->kind[fn] != AST_FUNCTION) continue;
+
+        uint32_t ret = ast->first_child[fn];
+        uint32_t params = ast->next_sibling[ret];
+        Type** param_types = xmalloc((ast->child_count[params] + 1) * sizeof(Type*));
+        int count = 0;
+        for (uint32_t p = ast->first_child[params]; p != FLAT_NONE; p = ast->next_sibling[p]) {
+            if (ast->kind[p] == AST_VAR_DECL) {
+                param_types[count++] = resolve_type_flat(ast, ast->first_child[p]);
+            }
+        }
+        declare_function(flat_ast_name(ast, fn), resolve_type_flat(ast, ret), param_types, count);
+        free(param_types);
+    }
+
+    for (uint32_t d = ast->first_child[0]; d != FLAT_NONE; d = ast->next_sibling[d]) {
+        check_declaration_flat(ast, d);
+    }
+}
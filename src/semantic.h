@@ -2,7 +2,17 @@
 #define SEMANTIC_H
 
 #include "ast.h"
+#include "flat_ast.h"
 
 void semantic_analyze(ASTNode* root);
+void semantic_analyze_flat(FlatAST* ast);
+
+Type* semantic_resolve_type(ASTNode* type_node);
+void semantic_declare_extern(const char* name, Type* ret_type, Type** params,
+                             int param_count);
+
+// Declared type of a function's index-th parameter, or NULL if the function
+// or parameter is not known (C runtime functions, variadic arguments).
+Type* semantic_param_type(const char* func, int index);
 
 #endif
@@ -0,0 +1,667 @@
+/**
+ * @file ssa_ir.c
+ * @brief Lowering of the string IR to the execution engine's IR
+ * @author Bober
+ * @version 1.0.0
+ *
+ * One pass per function: a label opens a block unless the current one is
+ * still empty, and the instruction after a terminator opens another. Branch
+ * targets are recorded by label and bound to blocks once the function is
+ * done. String constants are gathered from the whole program first, since
+ * inlined code refers to the callee's.
+ */
+
+#include "ssa_ir.h"
+#include "util.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Borrowed names (they live in the IRProgram) to an int.
+typedef struct {
+    const char **keys;
+    int *values;
+    size_t cap;
+    size_t count;
+} NameMap;
+
+typedef struct {
+    Value *value;
+    const char *label;
+} LabelRef;
+
+typedef struct {
+    SSAModule *module;
+    NameMap strings;    // .Lstr name -> data offset
+    NameMap floats;     // .Lfp name -> index into float_bits
+    uint64_t *float_bits;
+    int float_count;
+
+    Function *func;
+    BasicBlock *block;
+    bool open;          // block can take more instructions
+    NameMap labels;     // label -> block id
+    LabelRef *refs;
+    int ref_count;
+    int ref_cap;
+} Lowering;
+
+static uint64_t hash_name(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void map_put(NameMap *map, const char *key, int value);
+
+static void map_grow(NameMap *map) {
+    NameMap old = *map;
+    map->cap = old.cap ? old.cap * 2 : 64;
+    map->keys = xcalloc(map->cap, sizeof(char *));
+    map->values = xmalloc(map->cap * sizeof(int));
+    map->count = 0;
+    for (size_t i = 0; i < old.cap; i++) {
+        if (old.keys[i]) map_put(map, old.keys[i], old.values[i]);
+    }
+    free(old.keys);
+    free(old.values);
+}
+
+static void map_put(NameMap *map, const char *key, int value) {
+    if ((map->count + 1) * 2 > map->cap) map_grow(map);
+    size_t i = hash_name(key) & (map->cap - 1);
+    while (map->keys[i] && strcmp(map->keys[i], key) != 0) {
+        i = (i + 1) & (map->cap - 1);
+    }
+    if (!map->keys[i]) map->count++;
+    map->keys[i] = key;
+    map->values[i] = value;
+}
+
+static bool map_get(const NameMap *map, const char *key, int *value) {
+    if (!map->cap) return false;
+    size_t i = hash_name(key) & (map->cap - 1);
+    while (map->keys[i]) {
+        if (strcmp(map->keys[i], key) == 0) {
+            *value = map->values[i];
+            return true;
+        }
+        i = (i + 1) & (map->cap - 1);
+    }
+    return false;
+}
+
+static void map_clear(NameMap *map) {
+    if (map->cap) memset(map->keys, 0, map->cap * sizeof(char *));
+    map->count = 0;
+}
+
+static void map_free(NameMap *map) {
+    free(map->keys);
+    free(map->values);
+}
+
+static bool op_is(const IRInstruction *inst, const char *opcode) {
+    return strcmp(inst->opcode, opcode) == 0;
+}
+
+static bool is_number(const char *s) {
+    if (*s == '-' || *s == '+') s++;
+    if (!*s) return false;
+    while (*s) {
+        if (!isdigit((unsigned char)*s++)) return false;
+    }
+    return true;
+}
+
+static bool is_temp(const char *s) {
+    return s[0] == 't' && isdigit((unsigned char)s[1]);
+}
+
+static bool is_var(const char *s) {
+    return s[0] == 'v' && isdigit((unsigned char)s[1]);
+}
+
+// ---------------------------------------------------------------------------
+// Constants
+
+static int unescape_digit(char c, int base) {
+    if (c >= '0' && c <= '9' && c - '0' < base) return c - '0';
+    if (base == 16 && c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (base == 16 && c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// String operands hold the literal as written, escapes included; the AOT
+// backend hands them to the assembler's .asciz, which takes the same ones.
+static void add_string(SSAModule *m, const char *text) {
+    m->data = xrealloc(m->data, m->data_size + strlen(text) + 1);
+    uint8_t *out = m->data + m->data_size;
+    for (const char *s = text; *s; s++) {
+        if (*s != '\\' || !s[1]) {
+            *out++ = (uint8_t)*s;
+            continue;
+        }
+        s++;
+        int d;
+        switch (*s) {
+            case 'n': *out++ = '\n'; break;
+            case 't': *out++ = '\t'; break;
+            case 'r': *out++ = '\r'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'x': {
+                int v = 0;
+                while ((d = unescape_digit(s[1], 16)) >= 0) {
+                    v = v * 16 + d;
+                    s++;
+                }
+                *out++ = (uint8_t)v;
+                break;
+            }
+            default:
+                if (unescape_digit(*s, 8) >= 0) {
+                    int v = 0;
+                    for (int n = 0; n < 3 && (d = unescape_digit(*s, 8)) >= 0; n++) {
+                        v = v * 8 + d;
+                        s++;
+                    }
+                    s--;
+                    *out++ = (uint8_t)v;
+                } else {
+                    *out++ = (uint8_t)*s;
+                }
+                break;
+        }
+    }
+    *out++ = 0;
+    m->data_size = (size_t)(out - m->data);
+}
+
+static void collect_constants(Lowering *l, IRProgram *prog) {
+    for (IRInstruction *inst = prog->head; inst; inst = inst->next) {
+        int index;
+        if (op_is(inst, "string") && !map_get(&l->strings, inst->operands[0], &index)) {
+            map_put(&l->strings, inst->operands[0], (int)l->module->data_size);
+            add_string(l->module, inst->operands[1] ? inst->operands[1] : "");
+        } else if (op_is(inst, "float") && !map_get(&l->floats, inst->operands[0], &index)) {
+            l->float_bits = xrealloc(l->float_bits, (l->float_count + 1) * sizeof(uint64_t));
+            l->float_bits[l->float_count] = strtoull(inst->operands[1], NULL, 0);
+            map_put(&l->floats, inst->operands[0], l->float_count++);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Values and instructions
+
+static Value *new_value(ValueKind kind) {
+    Value *v = xcalloc(1, sizeof(Value));
+    v->kind = kind;
+    return v;
+}
+
+static Value *vreg_value(int n) {
+    Value *v = new_value(VAL_VREG);
+    v->as.vreg_num = n;
+    return v;
+}
+
+static Value *imm_value(int64_t n) {
+    Value *v = new_value(VAL_IMMEDIATE);
+    v->as.imm = n;
+    return v;
+}
+
+static Value *slot_value(const char *var) {
+    Value *v = new_value(VAL_SLOT);
+    v->as.slot = atoi(var + 1);
+    return v;
+}
+
+static Value *block_value(Lowering *l, const char *label) {
+    Value *v = new_value(VAL_BLOCK);
+    if (l->ref_count == l->ref_cap) {
+        l->ref_cap = l->ref_cap ? l->ref_cap * 2 : 64;
+        l->refs = xrealloc(l->refs, l->ref_cap * sizeof(LabelRef));
+    }
+    l->refs[l->ref_count++] = (LabelRef){v, label};
+    return v;
+}
+
+static int new_vreg(Lowering *l) {
+    return l->func->vreg_counter++;
+}
+
+static void start_block(Lowering *l) {
+    Function *f = l->func;
+    f->blocks = xrealloc(f->blocks, (f->block_count + 1) * sizeof(BasicBlock *));
+    BasicBlock *bb = xcalloc(1, sizeof(BasicBlock));
+    bb->id = f->block_count;
+    f->blocks[f->block_count++] = bb;
+    l->block = bb;
+    l->open = true;
+}
+
+static Instruction *append(Lowering *l, Opcode op, const IRInstruction *src, int operand_count) {
+    if (!l->open) start_block(l);
+    Instruction *inst = xcalloc(1, sizeof(Instruction));
+    inst->op = op;
+    inst->operand_count = operand_count;
+    inst->operands = operand_count ? xcalloc(operand_count, sizeof(Value *)) : NULL;
+    inst->width = src && src->width ? src->width : 8;
+    inst->is_unsigned = src && src->is_unsigned;
+    inst->is_float = src && src->is_float;
+
+    if (l->block->last_inst) {
+        l->block->last_inst->next = inst;
+    } else {
+        l->block->first_inst = inst;
+    }
+    l->block->last_inst = inst;
+    if (ssa_is_terminator(inst)) l->open = false;
+    return inst;
+}
+
+// A string IR operand being read. Variables are read as 8 bytes, as the
+// AOT backend does outside of mov.
+static Value *read_operand(Lowering *l, const char *s) {
+    int index;
+    if (is_temp(s)) {
+        return vreg_value(atoi(s + 1));
+    }
+    if (is_number(s)) {
+        return imm_value(strtoll(s, NULL, 10));
+    }
+    if (is_var(s)) {
+        Instruction *load = append(l, OP_LOAD_SLOT, NULL, 1);
+        load->operands[0] = slot_value(s);
+        load->result = vreg_value(new_vreg(l));
+        return vreg_value(load->result->as.vreg_num);
+    }
+    if (map_get(&l->strings, s, &index)) {
+        Value *v = new_value(VAL_DATA);
+        v->as.data = (size_t)index;
+        return v;
+    }
+    if (map_get(&l->floats, s, &index)) {
+        return imm_value((int64_t)l->float_bits[index]);
+    }
+    if (s[0] == 'q' && isdigit((unsigned char)s[1])) {
+        error("--run: vector registers are not supported");
+    }
+    Value *v = new_value(VAL_SYMBOL);
+    v->as.symbol = xstrdup(s);
+    return v;
+}
+
+// Makes dest the result of inst. A variable gets the value through a fresh
+// vreg and an 8-byte store.
+static void set_result(Lowering *l, Instruction *inst, const char *dest) {
+    if (is_temp(dest)) {
+        inst->result = vreg_value(atoi(dest + 1));
+        return;
+    }
+    if (!is_var(dest)) {
+        error("--run: cannot assign to '%s'", dest);
+    }
+    int n = new_vreg(l);
+    inst->result = vreg_value(n);
+    Instruction *store = append(l, OP_STORE_SLOT, NULL, 2);
+    store->operands[0] = slot_value(dest);
+    store->operands[1] = vreg_value(n);
+}
+
+static Opcode compare_op(const char *cc) {
+    static const char *const names[] = {"eq", "ne", "lt", "le", "gt", "ge"};
+    for (int i = 0; i < 6; i++) {
+        if (strcmp(cc, names[i]) == 0) return (Opcode)(OP_EQ + i);
+    }
+    return OP_MOV;
+}
+
+static Opcode arith_op(const char *opcode) {
+    static const struct {
+        const char *name;
+        Opcode op;
+    } ops[] = {
+        {"add", OP_ADD}, {"sub", OP_SUB}, {"mul", OP_MUL}, {"div", OP_DIV},
+        {"mod", OP_MOD}, {"and", OP_AND}, {"or", OP_OR}, {"xor", OP_XOR},
+        {"shl", OP_SHL}, {"shr", OP_SHR}, {"neg", OP_NEG}, {"not", OP_NOT},
+        {"ext", OP_EXT}, {"itof", OP_ITOF}, {"ftoi", OP_FTOI}, {"fext", OP_FEXT},
+        {"ftrunc", OP_FTRUNC},
+    };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(opcode, ops[i].name) == 0) return ops[i].op;
+    }
+    return OP_MOV;
+}
+
+static int count_operands(const IRInstruction *inst) {
+    int n = 0;
+    while (n < 16 && inst->operands[n]) n++;
+    return n;
+}
+
+// ---------------------------------------------------------------------------
+// Lowering
+
+static void lower_mov(Lowering *l, IRInstruction *src) {
+    const char *dest = src->operands[0];
+    const char *from = src->operands[1];
+    Value *value;
+
+    // Variables are read and written at the instruction's width.
+    if (is_var(from)) {
+        Instruction *load = append(l, OP_LOAD_SLOT, src, 1);
+        load->operands[0] = slot_value(from);
+        load->result = is_temp(dest) ? vreg_value(atoi(dest + 1)) : vreg_value(new_vreg(l));
+        if (is_temp(dest)) return;
+        value = vreg_value(load->result->as.vreg_num);
+    } else {
+        value = read_operand(l, from);
+    }
+
+    if (is_var(dest)) {
+        Instruction *store = append(l, OP_STORE_SLOT, src, 2);
+        store->operands[0] = slot_value(dest);
+        store->operands[1] = value;
+    } else {
+        Instruction *mov = append(l, OP_MOV, src, 1);
+        mov->operands[0] = value;
+        set_result(l, mov, dest);
+    }
+}
+
+// call f args... with the getret that follows it, if any. Returns the last
+// string IR instruction consumed.
+static IRInstruction *lower_call(Lowering *l, IRInstruction *src, bool tail) {
+    int n = count_operands(src);
+    Value **args = xmalloc(n * sizeof(Value *));
+    // The AOT backend calls puts for print_str.
+    const char *callee = strcmp(src->operands[0], "print_str") == 0 ? "puts" : src->operands[0];
+    args[0] = read_operand(l, callee);
+    for (int i = 1; i < n; i++) {
+        args[i] = read_operand(l, src->operands[i]);
+    }
+
+    Instruction *call = append(l, tail ? OP_TAILCALL : OP_CALL, src, n);
+    memcpy(call->operands, args, n * sizeof(Value *));
+    free(args);
+    call->float_args = src->float_args;
+
+    IRInstruction *getret = src->next;
+    if (tail || !getret || !op_is(getret, "getret")) return src;
+    call->width = getret->width ? getret->width : 8;
+    call->is_unsigned = getret->is_unsigned;
+    call->is_float = getret->is_float;
+    set_result(l, call, getret->operands[0]);
+    return getret;
+}
+
+static IRInstruction *lower_switch(Lowering *l, IRInstruction *src) {
+    int cases = 0;
+    for (IRInstruction *c = src->next; c && op_is(c, "case"); c = c->next) cases++;
+
+    Value *value = read_operand(l, src->operands[0]);
+    Instruction *sw = append(l, OP_SWITCH, src, 3 + cases);
+    sw->operands[0] = value;
+    sw->operands[1] = imm_value(strtoll(src->operands[1], NULL, 10));
+    sw->operands[2] = block_value(l, src->operands[2]);
+    IRInstruction *c = src;
+    for (int i = 0; i < cases; i++) {
+        c = c->next;
+        sw->operands[3 + i] = block_value(l, c->operands[0]);
+    }
+    return c;
+}
+
+// Lowers one string IR instruction; returns the last one it consumed.
+static IRInstruction *lower_instruction(Lowering *l, IRInstruction *src) {
+    const char *opcode = src->opcode;
+    Opcode op;
+
+    if (op_is(src, "label")) {
+        if (!l->open || l->block->first_inst) start_block(l);
+        map_put(&l->labels, src->operands[0], l->block->id);
+        if (!l->block->label) l->block->label = xstrdup(src->operands[0]);
+    }
+    else if (op_is(src, "string") || op_is(src, "float") || op_is(src, "cold")) {
+        // Constants are collected up front; cold blocks are just blocks here.
+    }
+    else if (op_is(src, "mov")) {
+        lower_mov(l, src);
+    }
+    else if (op_is(src, "fconst")) {
+        Instruction *mov = append(l, OP_MOV, src, 1);
+        mov->operands[0] = read_operand(l, src->operands[1]);
+        set_result(l, mov, src->operands[0]);
+    }
+    else if ((op = arith_op(opcode)) != OP_MOV || (op = compare_op(opcode)) != OP_MOV) {
+        bool unary = (op >= OP_NEG && op <= OP_EXT) || (op >= OP_ITOF && op <= OP_FTRUNC);
+        Value *a = read_operand(l, src->operands[1]);
+        Value *b = unary ? NULL : read_operand(l, src->operands[2]);
+        Instruction *inst = append(l, op, src, unary ? 1 : 2);
+        inst->operands[0] = a;
+        if (b) inst->operands[1] = b;
+        set_result(l, inst, src->operands[0]);
+    }
+    else if (op_is(src, "addr")) {
+        Instruction *inst = append(l, OP_ADDR, src, 1);
+        inst->operands[0] = slot_value(src->operands[1]);
+        set_result(l, inst, src->operands[0]);
+    }
+    else if (op_is(src, "load")) {
+        Value *ptr = read_operand(l, src->operands[1]);
+        Instruction *inst = append(l, OP_LOAD, src, 1);
+        inst->operands[0] = ptr;
+        set_result(l, inst, src->operands[0]);
+    }
+    else if (op_is(src, "store")) {
+        Value *ptr = read_operand(l, src->operands[0]);
+        Value *value = read_operand(l, src->operands[1]);
+        Instruction *inst = append(l, OP_STORE, src, 2);
+        inst->operands[0] = ptr;
+        inst->operands[1] = value;
+    }
+    else if (op_is(src, "param")) {
+        Instruction *inst = append(l, OP_PARAM, src, 2);
+        inst->operands[0] = slot_value(src->operands[0]);
+        inst->operands[1] = imm_value(atoi(src->operands[1]));
+    }
+    else if (op_is(src, "chkbounds") || op_is(src, "chkrange") || op_is(src, "chknull")) {
+        int n = count_operands(src);
+        Value *ops[3];
+        for (int i = 0; i < n; i++) {
+            ops[i] = read_operand(l, src->operands[i]);
+        }
+        op = op_is(src, "chkbounds") ? OP_CHKBOUNDS : op_is(src, "chkrange") ? OP_CHKRANGE
+                                                                           : OP_CHKNULL;
+        Instruction *inst = append(l, op, src, n);
+        memcpy(inst->operands, ops, n * sizeof(Value *));
+    }
+    else if (op_is(src, "call") || op_is(src, "tailcall")) {
+        return lower_call(l, src, op_is(src, "tailcall"));
+    }
+    else if (op_is(src, "getret")) {
+        // Separated from its call: the result of a call that returned nothing.
+        Instruction *mov = append(l, OP_MOV, src, 1);
+        mov->operands[0] = imm_value(0);
+        set_result(l, mov, src->operands[0]);
+    }
+    else if (op_is(src, "jmp")) {
+        Instruction *inst = append(l, OP_JMP, src, 1);
+        inst->operands[0] = block_value(l, src->operands[0]);
+    }
+    else if (op_is(src, "jz") || op_is(src, "brz") || op_is(src, "jnz")) {
+        Value *cond = read_operand(l, src->operands[0]);
+        Instruction *inst = append(l, op_is(src, "jnz") ? OP_BRNZ : OP_BRZ, src, 2);
+        inst->operands[0] = cond;
+        inst->operands[1] = block_value(l, src->operands[1]);
+    }
+    else if (opcode[0] == 'b' && (op = compare_op(opcode + 1)) != OP_MOV) {
+        Value *a = read_operand(l, src->operands[0]);
+        Value *b = read_operand(l, src->operands[1]);
+        Instruction *inst = append(l, (Opcode)(OP_BEQ + (op - OP_EQ)), src, 3);
+        inst->operands[0] = a;
+        inst->operands[1] = b;
+        inst->operands[2] = block_value(l, src->operands[2]);
+    }
+    else if (op_is(src, "switch")) {
+        return lower_switch(l, src);
+    }
+    else if (op_is(src, "ret")) {
+        Value *value = src->operands[0] ? read_operand(l, src->operands[0]) : NULL;
+        Instruction *inst = append(l, OP_RET, src, value ? 1 : 0);
+        if (value) inst->operands[0] = value;
+    }
+    else if (op_is(src, "endfunc")) {
+        // Falling off the end returns 0.
+        Instruction *inst = append(l, OP_RET, NULL, 1);
+        inst->operands[0] = imm_value(0);
+    }
+    else {
+        error("--run: IR instruction '%s' is not supported", opcode);
+    }
+    return src;
+}
+
+static int max_temp(IRInstruction *func, IRInstruction *end) {
+    int max = -1;
+    for (IRInstruction *inst = func; inst != end; inst = inst->next) {
+        for (int i = 0; i < 16 && inst->operands[i]; i++) {
+            if (is_temp(inst->operands[i])) {
+                int n = atoi(inst->operands[i] + 1);
+                if (n > max) max = n;
+            }
+        }
+    }
+    return max;
+}
+
+static Function *lower_function(Lowering *l, IRInstruction *func, IRInstruction *end) {
+    Function *f = xcalloc(1, sizeof(Function));
+    f->name = xstrdup(func->operands[0]);
+    f->locals = func->operands[2] ? atoi(func->operands[2]) : 0;
+    f->vreg_counter = max_temp(func, end) + 1;
+
+    l->func = f;
+    l->ref_count = 0;
+    map_clear(&l->labels);
+    start_block(l);
+    for (IRInstruction *inst = func->next; inst != end; inst = inst->next) {
+        inst = lower_instruction(l, inst);
+    }
+
+    for (int i = 0; i < l->ref_count; i++) {
+        int id;
+        if (!map_get(&l->labels, l->refs[i].label, &id)) {
+            error("--run: unknown label '%s' in %s", l->refs[i].label, f->name);
+        }
+        l->refs[i].value->as.block = f->blocks[id];
+    }
+    return f;
+}
+
+// Gives every function called but not defined an external entry, and binds
+// each symbol to its function.
+static void resolve_symbols(SSAModule *m, Function ***tail) {
+    for (Function *f = m->funcs; f; f = f->next_func) {
+        for (int b = 0; b < f->block_count; b++) {
+            for (Instruction *inst = f->blocks[b]->first_inst; inst; inst = inst->next) {
+                for (int i = 0; i < inst->operand_count; i++) {
+                    Value *v = inst->operands[i];
+                    if (v->kind != VAL_SYMBOL) continue;
+                    v->function = ssa_find_function(m, v->as.symbol);
+                    if (v->function) continue;
+                    Function *ext = xcalloc(1, sizeof(Function));
+                    ext->name = xstrdup(v->as.symbol);
+                    ext->is_external = true;
+                    **tail = ext;
+                    *tail = &ext->next_func;
+                    v->function = ext;
+                }
+            }
+        }
+    }
+    int index = 0;
+    for (Function *f = m->funcs; f; f = f->next_func) {
+        f->index = index++;
+    }
+}
+
+SSAModule *ssa_lower(IRProgram *prog) {
+    Lowering l = {0};
+    l.module = xcalloc(1, sizeof(SSAModule));
+    collect_constants(&l, prog);
+
+    Function **tail = &l.module->funcs;
+    for (IRInstruction *inst = prog->head; inst;) {
+        if (!op_is(inst, "func")) {
+            inst = inst->next;
+            continue;
+        }
+        IRInstruction *end = inst->next;
+        while (end && !op_is(end, "func")) end = end->next;
+        *tail = lower_function(&l, inst, end);
+        tail = &(*tail)->next_func;
+        inst = end;
+    }
+    resolve_symbols(l.module, &tail);
+
+    map_free(&l.strings);
+    map_free(&l.floats);
+    map_free(&l.labels);
+    free(l.float_bits);
+    free(l.refs);
+    return l.module;
+}
+
+Function *ssa_find_function(SSAModule *m, const char *name) {
+    for (Function *f = m->funcs; f; f = f->next_func) {
+        if (strcmp(f->name, name) == 0) return f;
+    }
+    return NULL;
+}
+
+bool ssa_is_terminator(const Instruction *inst) {
+    return inst->op >= OP_JMP;
+}
+
+static void free_value(Value *v) {
+    if (!v) return;
+    if (v->kind == VAL_SYMBOL) free(v->as.symbol);
+    free(v);
+}
+
+void ssa_module_free(SSAModule *m) {
+    if (!m) return;
+    Function *f = m->funcs;
+    while (f) {
+        for (int b = 0; b < f->block_count; b++) {
+            Instruction *inst = f->blocks[b]->first_inst;
+            while (inst) {
+                Instruction *next = inst->next;
+                free_value(inst->result);
+                for (int i = 0; i < inst->operand_count; i++) {
+                    free_value(inst->operands[i]);
+                }
+                free(inst->operands);
+                free(inst);
+                inst = next;
+            }
+            free(f->blocks[b]->label);
+            free(f->blocks[b]);
+        }
+        Function *next = f->next_func;
+        free(f->blocks);
+        free(f->name);
+        free(f);
+        f = next;
+    }
+    free(m->data);
+    free(m);
+}
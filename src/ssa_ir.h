@@ -0,0 +1,142 @@
+#ifndef SSA_IR_H
+#define SSA_IR_H
+
+#include "ir.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The execution engine's IR (jit_engine.h): functions made of basic blocks
+// of three-address instructions on virtual registers, lowered from the
+// optimized string IR. Temps become vregs; named variables keep the frame
+// slot the string IR gave them, so that their address can be taken, and are
+// read and written through OP_LOAD_SLOT/OP_STORE_SLOT. Vregs are not
+// strictly single-assignment: ext narrows in place, and an inlined call
+// assigns its result on every return path.
+//
+// Widths, signedness and float-ness mean what they mean in ir.h: vregs hold
+// 64-bit values, sign- or zero-extended from the instruction's width, and
+// floating values as raw bits.
+
+typedef enum {
+    VAL_VREG,
+    VAL_IMMEDIATE,
+    VAL_SLOT,           // frame slot of a variable, by its offset (vN)
+    VAL_BLOCK,          // branch target
+    VAL_SYMBOL,         // function, defined in the module or external
+    VAL_DATA            // address of a string constant in the module's data
+} ValueKind;
+
+typedef struct Value {
+    ValueKind kind;
+    union {
+        int vreg_num;
+        int64_t imm;
+        int slot;
+        struct BasicBlock *block;
+        char *symbol;
+        size_t data;    // offset into SSAModule.data
+    } as;
+    struct Function *function;  // VAL_SYMBOL: the function of that name
+} Value;
+
+typedef enum {
+    OP_MOV,             // result = operands[0]
+    OP_LOAD_SLOT,       // result = slot operands[0]
+    OP_STORE_SLOT,      // slot operands[0] = operands[1]
+    OP_ADDR,            // result = address of slot operands[0]
+    OP_LOAD,            // result = *operands[0]
+    OP_STORE,           // *operands[0] = operands[1]
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_SHL,
+    OP_SHR,
+    OP_NEG,
+    OP_NOT,
+    OP_EXT,
+    OP_EQ,              // result = operands[0] == operands[1], 0 or 1
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_ITOF,
+    OP_FTOI,
+    OP_FEXT,            // floof to bigfloof
+    OP_FTRUNC,          // bigfloof to floof
+    OP_PARAM,           // slot operands[0] = argument number operands[1]
+    OP_CALL,            // result = operands[0](operands[1], ...)
+    OP_CHKBOUNDS,       // 0 <= operands[0] < operands[1], unsigned
+    OP_CHKRANGE,        // operands[0] < operands[1] => 0 <= both <= operands[2]
+    OP_CHKNULL,
+
+    // Terminators; a block without one falls through to the next block.
+    OP_JMP,             // operands[0]
+    OP_BRZ,             // to operands[1] when operands[0] is 0
+    OP_BRNZ,
+    OP_BEQ,             // to operands[2] when operands[0] == operands[1]
+    OP_BNE,
+    OP_BLT,
+    OP_BLE,
+    OP_BGT,
+    OP_BGE,
+    OP_SWITCH,          // operands[0] - operands[1] indexes operands[3...],
+                        // operands[2] when out of range
+    OP_RET,             // operands[0], if any
+    OP_TAILCALL         // return operands[0](operands[1], ...)
+} Opcode;
+
+typedef struct Instruction {
+    Opcode op;
+    Value *result;
+    Value **operands;
+    int operand_count;
+    int width;          // 1, 2, 4 or 8
+    bool is_unsigned;
+    bool is_float;
+    uint16_t float_args;    // OP_CALL, OP_TAILCALL: as in ir.h
+    struct Instruction *next;
+} Instruction;
+
+typedef struct BasicBlock {
+    int id;             // index in the function's blocks
+    char *label;        // the string IR's label, if it had one
+    Instruction *first_inst;
+    Instruction *last_inst;
+} BasicBlock;
+
+typedef struct Function {
+    char *name;
+    int index;          // position in the module's list
+    // Blocks in layout order; blocks[0] is the entry.
+    BasicBlock **blocks;
+    int block_count;
+    int vreg_counter;
+    int locals;         // bytes of variable slots
+    // Called but not defined in the module: no blocks, resolved at run time.
+    bool is_external;
+    struct Function *next_func;
+} Function;
+
+typedef struct SSAModule {
+    Function *funcs;
+    // String constants, NUL-terminated, referenced by VAL_DATA.
+    uint8_t *data;
+    size_t data_size;
+} SSAModule;
+
+// Lowers a whole program. Vector instructions and profiling counters have
+// no lowering; they are reported as errors.
+SSAModule *ssa_lower(IRProgram *prog);
+void ssa_module_free(SSAModule *m);
+Function *ssa_find_function(SSAModule *m, const char *name);
+
+bool ssa_is_terminator(const Instruction *inst);
+
+#endif
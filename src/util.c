@@ -61,7 +61,73 @@ char* read_file(const char* filename) {
     return buffer;
 }
 
+// Diagnostics with a source location are buffered rather than fatal, so the
+// parser and semantic analysis can keep going and report everything they
+// find in one run. They are printed in source order by diag_flush().
+typedef struct {
+    int line;
+    int col;
+    int seq;
+    bool is_error;
+    char* message;
+} Diagnostic;
+
+static Diagnostic* diagnostics = NULL;
+static int diag_count = 0;
+static int diag_cap = 0;
+static int diag_errors = 0;
+static int diag_max_errors = 20;
+
+static void diag_push(int line, int col, bool is_error, const char* fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+
+    char* message = xmalloc((size_t)len + 1);
+    vsnprintf(message, (size_t)len + 1, fmt, args);
+
+    if (diag_count == diag_cap) {
+        diag_cap = diag_cap ? diag_cap * 2 : 32;
+        diagnostics = xrealloc(diagnostics, diag_cap * sizeof(Diagnostic));
+    }
+    diagnostics[diag_count] = (Diagnostic){ line, col, diag_count, is_error, message };
+    diag_count++;
+}
+
+static int diag_compare(const void* a, const void* b) {
+    const Diagnostic* x = a;
+    const Diagnostic* y = b;
+    if (x->line != y->line) return x->line < y->line ? -1 : 1;
+    if (x->col != y->col) return x->col < y->col ? -1 : 1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+void diag_set_max_errors(int max_errors) {
+    diag_max_errors = max_errors;
+}
+
+int diag_error_count(void) {
+    return diag_errors;
+}
+
+void diag_flush(void) {
+    if (diag_count > 0) {
+        qsort(diagnostics, diag_count, sizeof(Diagnostic), diag_compare);
+    }
+
+    for (int i = 0; i < diag_count; i++) {
+        Diagnostic* d = &diagnostics[i];
+        fprintf(stderr, "%s at %d:%d: %s\n", d->is_error ? "error" : "warning",
+                d->line, d->col, d->message);
+        free(d->message);
+    }
+    diag_count = 0;
+}
+
 void error(const char* fmt, ...) {
+    diag_flush();
+
     va_list args;
     va_start(args, fmt);
     fprintf(stderr, "error: ");
@@ -74,18 +140,20 @@ void error(const char* fmt, ...) {
 void error_at(int line, int col, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    fprintf(stderr, "error at %d:%d: ", line, col);
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, "\n");
+    diag_push(line, col, true, fmt, args);
     va_end(args);
-    exit(1);
+
+    diag_errors++;
+    if (diag_max_errors > 0 && diag_errors >= diag_max_errors) {
+        diag_flush();
+        fprintf(stderr, "error: too many errors (%d), stopping\n", diag_errors);
+        exit(1);
+    }
 }
 
 void warn_at(int line, int col, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    fprintf(stderr, "warning at %d:%d: ", line, col);
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, "\n");
+    diag_push(line, col, false, fmt, args);
     va_end(args);
 }
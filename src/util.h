@@ -14,9 +14,14 @@ char* xstrdup(const char* s);
 bool str_eq(const char* a, const char* b);
 char* read_file(const char* filename);
 
-// Error handling
+// Error handling. error() is fatal; error_at() and warn_at() are buffered
+// until diag_flush(), and error_at() only exits once max_errors is reached
+// (0 means no limit).
 void error(const char* fmt, ...);
 void error_at(int line, int col, const char* fmt, ...);
 void warn_at(int line, int col, const char* fmt, ...);
+void diag_set_max_errors(int max_errors);
+int diag_error_count(void);
+void diag_flush(void);
 
 #endif
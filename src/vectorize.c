@@ -0,0 +1,716 @@
+/**
+ * @file vectorize.c
+ * @brief Finds fow loops that can run on 16-byte vectors
+ * @author Bober
+ *
+ * Only the shape of the loop is checked here; ir.c does the lowering. Every
+ * array access must use the loop index itself, so iteration k only ever
+ * touches element k of each array and running the statements for several
+ * iterations at once cannot change the result.
+ */
+
+#include "vectorize.h"
+#include "lexer.h"
+#include <stdio.h>
+#include <string.h>
+
+static bool fail(VecLoop* loop, const char* reason) {
+    if (!loop->reason) {
+        loop->reason = reason;
+    }
+    return false;
+}
+
+static bool is_integer(Type* t) {
+    if (!t) return false;
+    return t->kind == TYPE_CHONK || t->kind == TYPE_SMOL ||
+           t->kind == TYPE_MEGACHONK || t->kind == TYPE_BYTE;
+}
+
+static int compound_op(int op) {
+    switch (op) {
+        case TOKEN_PLUS_EQ:  return TOKEN_PLUS;
+        case TOKEN_MINUS_EQ: return TOKEN_MINUS;
+        case TOKEN_STAR_EQ:  return TOKEN_STAR;
+        case TOKEN_SLASH_EQ: return TOKEN_SLASH;
+        default:             return 0;
+    }
+}
+
+static bool set_element(VecLoop* loop, Type* elem) {
+    if (!is_integer(elem) && !type_is_float(elem)) {
+        return fail(loop, "element type has no vector form");
+    }
+    if (!loop->elem) {
+        loop->elem = elem;
+        loop->lanes = VEC_BYTES / elem->size;
+        return true;
+    }
+    if (elem->kind != loop->elem->kind) {
+        return fail(loop, "element types differ");
+    }
+    return true;
+}
+
+// Integer values only matter modulo the lane width, since the additions,
+// multiplications and bitwise operations allowed here never look at higher
+// bits. Floating values must stay in the element's precision throughout.
+static bool check_value(VecLoop* loop, Type* t) {
+    if (type_is_float(loop->elem)) {
+        if (t && t->kind == loop->elem->kind) return true;
+        return fail(loop, type_is_float(t) ? "mixes floof and bigfloof"
+                                           : "mixes integer and floating-point values");
+    }
+    if (!is_integer(t)) {
+        return fail(loop, "mixes integer and floating-point values");
+    }
+    return true;
+}
+
+static bool check_binary(VecLoop* loop, int op) {
+    bool fp = type_is_float(loop->elem);
+    switch (op) {
+        case TOKEN_PLUS:
+        case TOKEN_MINUS:
+            return true;
+        case TOKEN_STAR:
+            if (fp || loop->elem->size == 2 || loop->elem->size == 4) return true;
+            return fail(loop, "no vector multiply for this element width");
+        case TOKEN_SLASH:
+            return fp || fail(loop, "integer division has no vector form");
+        case TOKEN_AMP:
+        case TOKEN_PIPE:
+        case TOKEN_CARET:
+            return !fp || fail(loop, "operator has no vector form");
+        default:
+            return fail(loop, "operator has no vector form");
+    }
+}
+
+static int add_node(VecLoop* loop, VecExprKind kind) {
+    if (loop->node_count == VEC_MAX_NODES) {
+        fail(loop, "loop body is too large");
+        return -1;
+    }
+    VecExpr* e = &loop->nodes[loop->node_count];
+    memset(e, 0, sizeof(*e));
+    e->kind = kind;
+    e->left = e->right = -1;
+    return loop->node_count++;
+}
+
+static void note_array(VecLoop* loop, Type* array_type) {
+    int length = array_type->array_size;
+    if (length > 0 && (!loop->min_length || length < loop->min_length)) {
+        loop->min_length = length;
+    }
+}
+
+static int load_node(VecLoop* loop, int array_offset, Type* array_type, Type* elem,
+                     bool indexed_by_loop) {
+    if (!array_type || array_type->kind != TYPE_ARRAY) {
+        fail(loop, "indexes something other than a local array");
+        return -1;
+    }
+    if (!indexed_by_loop) {
+        fail(loop, "array index is not the loop index");
+        return -1;
+    }
+    if (!set_element(loop, elem)) return -1;
+    note_array(loop, array_type);
+
+    int n = add_node(loop, VEC_LOAD);
+    if (n >= 0) loop->nodes[n].stack_offset = array_offset;
+    return n;
+}
+
+static int scalar_node(VecLoop* loop, int offset, Type* type) {
+    if (offset == loop->index_offset) {
+        fail(loop, "loop index is used as a value");
+        return -1;
+    }
+    for (int i = 0; i < loop->stmt_count; i++) {
+        if (loop->stmts[i].is_reduction && loop->stmts[i].stack_offset == offset) {
+            fail(loop, "reduction variable is read in the loop body");
+            return -1;
+        }
+    }
+    if (!check_value(loop, type)) return -1;
+
+    int n = add_node(loop, VEC_SCALAR);
+    if (n >= 0) {
+        loop->nodes[n].stack_offset = offset;
+        loop->nodes[n].type = type;
+    }
+    return n;
+}
+
+static int int_const(VecLoop* loop, long long value) {
+    int n = add_node(loop, VEC_CONST);
+    if (n >= 0) loop->nodes[n].int_value = value;
+    return n;
+}
+
+// Float literals are bigfloof.
+static int float_const(VecLoop* loop, double value) {
+    if (loop->elem->kind != TYPE_BIGFLOOF) {
+        fail(loop, type_is_float(loop->elem) ? "mixes floof and bigfloof"
+                                             : "mixes integer and floating-point values");
+        return -1;
+    }
+    int n = add_node(loop, VEC_CONST);
+    if (n >= 0) {
+        loop->nodes[n].is_float_const = true;
+        loop->nodes[n].float_value = value;
+    }
+    return n;
+}
+
+static int binary_node(VecLoop* loop, int op, Type* type, int left, int right) {
+    if (left < 0 || right < 0) return -1;
+    if (!check_binary(loop, op) || !check_value(loop, type)) return -1;
+
+    int n = add_node(loop, VEC_BINARY);
+    if (n >= 0) {
+        loop->nodes[n].op = op;
+        loop->nodes[n].left = left;
+        loop->nodes[n].right = right;
+    }
+    return n;
+}
+
+static int unary_node(VecLoop* loop, int op, Type* type, int operand) {
+    if (operand < 0) return -1;
+    if (op != TOKEN_MINUS && (op != TOKEN_TILDE || type_is_float(loop->elem))) {
+        fail(loop, "operator has no vector form");
+        return -1;
+    }
+    if (!check_value(loop, type)) return -1;
+
+    int n = add_node(loop, VEC_UNARY);
+    if (n >= 0) {
+        loop->nodes[n].op = op;
+        loop->nodes[n].left = operand;
+    }
+    return n;
+}
+
+static bool add_stmt(VecLoop* loop, bool is_reduction, int offset, int op) {
+    if (loop->stmt_count == VEC_MAX_STMTS) {
+        return fail(loop, "loop body is too large");
+    }
+    VecStmt* s = &loop->stmts[loop->stmt_count++];
+    s->is_reduction = is_reduction;
+    s->stack_offset = offset;
+    s->op = op;
+    s->expr = -1;
+    return true;
+}
+
+static bool add_store(VecLoop* loop, int array_offset, Type* array_type, Type* elem,
+                      bool indexed_by_loop, int assign_op) {
+    if (!array_type || array_type->kind != TYPE_ARRAY) {
+        return fail(loop, "indexes something other than a local array");
+    }
+    if (!indexed_by_loop) {
+        return fail(loop, "array index is not the loop index");
+    }
+    if (!set_element(loop, elem)) return false;
+    note_array(loop, array_type);
+    if (assign_op != TOKEN_ASSIGN && !compound_op(assign_op)) {
+        return fail(loop, "operator has no vector form");
+    }
+    return add_stmt(loop, false, array_offset, compound_op(assign_op));
+}
+
+// Integer add, xor, or and and are associative, so the lanes can keep
+// partial results that are combined after the loop. Floating sums would be
+// rounded differently and are left to the scalar loop.
+static bool add_reduction(VecLoop* loop, int offset, Type* type, int op) {
+    if (offset == loop->index_offset) {
+        return fail(loop, "loop index is modified in the body");
+    }
+    if (op != TOKEN_PLUS && op != TOKEN_CARET && op != TOKEN_PIPE && op != TOKEN_AMP) {
+        return fail(loop, "assigns a scalar other than by reduction");
+    }
+    if (!is_integer(type) || type->size < 4) {
+        return fail(loop, "reduction is not over chonk or megachonk");
+    }
+    for (int i = 0; i < loop->stmt_count; i++) {
+        if (loop->stmts[i].is_reduction && loop->stmts[i].stack_offset == offset) {
+            return fail(loop, "reduction variable is updated twice");
+        }
+    }
+    if (!set_element(loop, type)) return false;
+    loop->reduction_count++;
+    return add_stmt(loop, true, offset, op);
+}
+
+// Operands of a binary node go to the next register up from the result, so
+// the right operand needs one more than its own count.
+static int regs_needed(const VecLoop* loop, int n) {
+    const VecExpr* e = &loop->nodes[n];
+    if (e->kind == VEC_BINARY) {
+        int left = regs_needed(loop, e->left);
+        int right = regs_needed(loop, e->right) + 1;
+        return left > right ? left : right;
+    }
+    if (e->kind == VEC_UNARY) {
+        return regs_needed(loop, e->left);
+    }
+    return 1;
+}
+
+static bool finish(VecLoop* loop) {
+    if (loop->reason) return false;
+
+    int regs = 0;
+    for (int i = 0; i < loop->stmt_count; i++) {
+        int r = regs_needed(loop, loop->stmts[i].expr);
+        if (r > regs) regs = r;
+        if (!loop->bound_is_const && loop->stmts[i].is_reduction &&
+            loop->stmts[i].stack_offset == loop->bound_offset) {
+            return fail(loop, "loop bound changes in the body");
+        }
+    }
+    if (regs + loop->reduction_count > VEC_REGS) {
+        return fail(loop, "loop body needs too many vector registers");
+    }
+    return true;
+}
+
+static void begin(VecLoop* loop) {
+    memset(loop, 0, sizeof(*loop));
+    loop->index_offset = -1;
+}
+
+// ---------------------------------------------------------------------------
+// ASTNode
+
+static int build_expr(VecLoop* loop, ASTNode* node) {
+    switch (node->kind) {
+        case AST_NUMBER:
+            return int_const(loop, node->data.int_value);
+
+        case AST_FLOAT:
+            return float_const(loop, node->data.float_value);
+
+        case AST_IDENTIFIER:
+            if (node->type && node->type->kind == TYPE_ARRAY) {
+                fail(loop, "array is used without an index");
+                return -1;
+            }
+            return scalar_node(loop, node->stack_offset, node->type);
+
+        case AST_INDEX: {
+            ASTNode* base = node->children[0];
+            ASTNode* index = node->children[1];
+            if (base->kind != AST_IDENTIFIER) {
+                fail(loop, "indexes something other than a local array");
+                return -1;
+            }
+            return load_node(loop, base->stack_offset, base->type, node->type,
+                             index->kind == AST_IDENTIFIER &&
+                             index->stack_offset == loop->index_offset);
+        }
+
+        case AST_BINARY_OP: {
+            int left = build_expr(loop, node->children[0]);
+            int right = left < 0 ? -1 : build_expr(loop, node->children[1]);
+            return binary_node(loop, node->data.op, node->type, left, right);
+        }
+
+        case AST_UNARY_OP:
+            return unary_node(loop, node->data.op, node->type,
+                              build_expr(loop, node->children[0]));
+
+        default:
+            fail(loop, "expression has no vector form");
+            return -1;
+    }
+}
+
+static bool is_loop_index(VecLoop* loop, ASTNode* node) {
+    return node->kind == AST_IDENTIFIER && node->stack_offset == loop->index_offset;
+}
+
+static bool is_one(ASTNode* node) {
+    return node->kind == AST_NUMBER && node->data.int_value == 1;
+}
+
+static bool match_header(VecLoop* loop, ASTNode* node) {
+    if (node->child_count != 4) {
+        return fail(loop, "loop header is incomplete");
+    }
+
+    ASTNode* cond = node->children[1];
+    if (cond->kind != AST_BINARY_OP || cond->data.op != TOKEN_LT ||
+        cond->children[0]->kind != AST_IDENTIFIER || !is_integer(cond->children[0]->type)) {
+        return fail(loop, "loop condition is not index < bound");
+    }
+    loop->index_offset = cond->children[0]->stack_offset;
+    loop->index_type = cond->children[0]->type;
+
+    ASTNode* bound = cond->children[1];
+    if (bound->kind == AST_NUMBER) {
+        loop->bound_is_const = true;
+        loop->bound_value = bound->data.int_value;
+    } else if (bound->kind == AST_IDENTIFIER && is_integer(bound->type)) {
+        loop->bound_offset = bound->stack_offset;
+        loop->bound_type = bound->type;
+    } else {
+        return fail(loop, "loop bound is not a constant or variable");
+    }
+
+    ASTNode* inc = node->children[2];
+    bool unit_step = false;
+    if (inc->kind == AST_ASSIGN && is_loop_index(loop, inc->children[0])) {
+        ASTNode* value = inc->children[1];
+        if (inc->data.op == TOKEN_PLUS_EQ) {
+            unit_step = is_one(value);
+        } else if (inc->data.op == TOKEN_ASSIGN && value->kind == AST_BINARY_OP &&
+                   value->data.op == TOKEN_PLUS) {
+            unit_step = (is_loop_index(loop, value->children[0]) && is_one(value->children[1])) ||
+                        (is_one(value->children[0]) && is_loop_index(loop, value->children[1]));
+        }
+    }
+    if (!unit_step) {
+        return fail(loop, "loop does not step the index by 1");
+    }
+    return true;
+}
+
+// s = s + a + b parses as (s + a) + b: a chain of the same operator with
+// the variable at the bottom of its left spine.
+static bool is_reduction_chain(ASTNode* value, int op, int offset) {
+    while (value->kind == AST_BINARY_OP && value->data.op == op) {
+        value = value->children[0];
+    }
+    return value->kind == AST_IDENTIFIER && value->stack_offset == offset;
+}
+
+// The terms of a reduction chain without the variable itself.
+static int build_chain(VecLoop* loop, ASTNode* node, int op, int offset) {
+    ASTNode* left = node->children[0];
+    ASTNode* right = node->children[1];
+    if (left->kind == AST_IDENTIFIER && left->stack_offset == offset) {
+        int expr = build_expr(loop, right);
+        if (expr >= 0 && !check_value(loop, right->type)) return -1;
+        return expr;
+    }
+    int terms = build_chain(loop, left, op, offset);
+    int term = terms < 0 ? -1 : build_expr(loop, right);
+    return binary_node(loop, op, node->type, terms, term);
+}
+
+static bool classify_stmt(VecLoop* loop, ASTNode* stmt) {
+    if (stmt->kind != AST_ASSIGN) {
+        return fail(loop, "loop body has a statement with no vector form");
+    }
+
+    ASTNode* target = stmt->children[0];
+    ASTNode* value = stmt->children[1];
+    if (target->kind == AST_INDEX) {
+        ASTNode* base = target->children[0];
+        if (base->kind != AST_IDENTIFIER) {
+            return fail(loop, "indexes something other than a local array");
+        }
+        return add_store(loop, base->stack_offset, base->type, target->type,
+                         is_loop_index(loop, target->children[1]), stmt->data.op);
+    }
+    if (target->kind == AST_IDENTIFIER) {
+        if (stmt->data.op == TOKEN_PLUS_EQ) {
+            return add_reduction(loop, target->stack_offset, target->type, TOKEN_PLUS);
+        }
+        if (stmt->data.op == TOKEN_ASSIGN && value->kind == AST_BINARY_OP &&
+            is_reduction_chain(value, value->data.op, target->stack_offset)) {
+            return add_reduction(loop, target->stack_offset, target->type, value->data.op);
+        }
+        return fail(loop, target->stack_offset == loop->index_offset
+                              ? "loop index is modified in the body"
+                              : "assigns a scalar other than by reduction");
+    }
+    return fail(loop, "loop body has a statement with no vector form");
+}
+
+static int build_stmt(VecLoop* loop, VecStmt* s, ASTNode* stmt) {
+    ASTNode* target = stmt->children[0];
+    ASTNode* value = stmt->children[1];
+
+    if (s->is_reduction) {
+        if (stmt->data.op == TOKEN_ASSIGN) {
+            return build_chain(loop, value, s->op, s->stack_offset);
+        }
+        int expr = build_expr(loop, value);
+        if (expr >= 0 && !check_value(loop, value->type)) return -1;
+        return expr;
+    }
+
+    int expr = build_expr(loop, value);
+    if (expr < 0 || !check_value(loop, value->type)) return -1;
+    if (s->op) {
+        int old = load_node(loop, s->stack_offset, target->children[0]->type, target->type, true);
+        expr = binary_node(loop, s->op, target->type, old, expr);
+    }
+    return expr;
+}
+
+bool vec_analyze(ASTNode* node, VecLoop* loop) {
+    begin(loop);
+    if (!match_header(loop, node)) return false;
+
+    ASTNode* body = node->children[3];
+    ASTNode** stmts = &body;
+    int count = 1;
+    if (body->kind == AST_BLOCK) {
+        stmts = body->children;
+        count = body->child_count;
+    }
+    if (count == 0) {
+        return fail(loop, "loop body is empty");
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!classify_stmt(loop, stmts[i])) return false;
+    }
+    for (int i = 0; i < count; i++) {
+        loop->stmts[i].expr = build_stmt(loop, &loop->stmts[i], stmts[i]);
+        if (loop->stmts[i].expr < 0) return false;
+    }
+    return finish(loop);
+}
+
+// ---------------------------------------------------------------------------
+// FlatAST
+
+#define FLAT_CHILD(ast, n, i) flat_ast_child((ast), (n), (i))
+
+static int build_expr_flat(VecLoop* loop, FlatAST* ast, uint32_t n) {
+    switch (ast->kind[n]) {
+        case AST_NUMBER:
+            return int_const(loop, (long long)ast->payload[n]);
+
+        case AST_FLOAT: {
+            double value;
+            memcpy(&value, &ast->payload[n], sizeof(value));
+            return float_const(loop, value);
+        }
+
+        case AST_IDENTIFIER:
+            if (ast->type[n] && ast->type[n]->kind == TYPE_ARRAY) {
+                fail(loop, "array is used without an index");
+                return -1;
+            }
+            return scalar_node(loop, ast->stack_offset[n], ast->type[n]);
+
+        case AST_INDEX: {
+            uint32_t base = FLAT_CHILD(ast, n, 0);
+            uint32_t index = FLAT_CHILD(ast, n, 1);
+            if (ast->kind[base] != AST_IDENTIFIER) {
+                fail(loop, "indexes something other than a local array");
+                return -1;
+            }
+            return load_node(loop, ast->stack_offset[base], ast->type[base], ast->type[n],
+                             ast->kind[index] == AST_IDENTIFIER &&
+                             ast->stack_offset[index] == loop->index_offset);
+        }
+
+        case AST_BINARY_OP: {
+            int left = build_expr_flat(loop, ast, FLAT_CHILD(ast, n, 0));
+            int right = left < 0 ? -1 : build_expr_flat(loop, ast, FLAT_CHILD(ast, n, 1));
+            return binary_node(loop, (int)ast->payload[n], ast->type[n], left, right);
+        }
+
+        case AST_UNARY_OP:
+            return unary_node(loop, (int)ast->payload[n], ast->type[n],
+                              build_expr_flat(loop, ast, FLAT_CHILD(ast, n, 0)));
+
+        default:
+            fail(loop, "expression has no vector form");
+            return -1;
+    }
+}
+
+static bool is_loop_index_flat(VecLoop* loop, FlatAST* ast, uint32_t n) {
+    return ast->kind[n] == AST_IDENTIFIER && ast->stack_offset[n] == loop->index_offset;
+}
+
+static bool is_one_flat(FlatAST* ast, uint32_t n) {
+    return ast->kind[n] == AST_NUMBER && ast->payload[n] == 1;
+}
+
+static bool match_header_flat(VecLoop* loop, FlatAST* ast, uint32_t node) {
+    if (ast->child_count[node] != 4) {
+        return fail(loop, "loop header is incomplete");
+    }
+
+    uint32_t cond = FLAT_CHILD(ast, node, 1);
+    uint32_t index = FLAT_CHILD(ast, cond, 0);
+    if (ast->kind[cond] != AST_BINARY_OP || ast->payload[cond] != TOKEN_LT ||
+        ast->kind[index] != AST_IDENTIFIER || !is_integer(ast->type[index])) {
+        return fail(loop, "loop condition is not index < bound");
+    }
+    loop->index_offset = ast->stack_offset[index];
+    loop->index_type = ast->type[index];
+
+    uint32_t bound = FLAT_CHILD(ast, cond, 1);
+    if (ast->kind[bound] == AST_NUMBER) {
+        loop->bound_is_const = true;
+        loop->bound_value = (long long)ast->payload[bound];
+    } else if (ast->kind[bound] == AST_IDENTIFIER && is_integer(ast->type[bound])) {
+        loop->bound_offset = ast->stack_offset[bound];
+        loop->bound_type = ast->type[bound];
+    } else {
+        return fail(loop, "loop bound is not a constant or variable");
+    }
+
+    uint32_t inc = FLAT_CHILD(ast, node, 2);
+    bool unit_step = false;
+    if (ast->kind[inc] == AST_ASSIGN && is_loop_index_flat(loop, ast, FLAT_CHILD(ast, inc, 0))) {
+        uint32_t value = FLAT_CHILD(ast, inc, 1);
+        if (ast->payload[inc] == TOKEN_PLUS_EQ) {
+            unit_step = is_one_flat(ast, value);
+        } else if (ast->payload[inc] == TOKEN_ASSIGN && ast->kind[value] == AST_BINARY_OP &&
+                   ast->payload[value] == TOKEN_PLUS) {
+            uint32_t l = FLAT_CHILD(ast, value, 0);
+            uint32_t r = FLAT_CHILD(ast, value, 1);
+            unit_step = (is_loop_index_flat(loop, ast, l) && is_one_flat(ast, r)) ||
+                        (is_one_flat(ast, l) && is_loop_index_flat(loop, ast, r));
+        }
+    }
+    if (!unit_step) {
+        return fail(loop, "loop does not step the index by 1");
+    }
+    return true;
+}
+
+static bool is_reduction_chain_flat(FlatAST* ast, uint32_t value, int op, int offset) {
+    while (ast->kind[value] == AST_BINARY_OP && ast->payload[value] == (uint64_t)op) {
+        value = FLAT_CHILD(ast, value, 0);
+    }
+    return ast->kind[value] == AST_IDENTIFIER && ast->stack_offset[value] == offset;
+}
+
+static int build_chain_flat(VecLoop* loop, FlatAST* ast, uint32_t node, int op, int offset) {
+    uint32_t left = FLAT_CHILD(ast, node, 0);
+    uint32_t right = FLAT_CHILD(ast, node, 1);
+    if (ast->kind[left] == AST_IDENTIFIER && ast->stack_offset[left] == offset) {
+        int expr = build_expr_flat(loop, ast, right);
+        if (expr >= 0 && !check_value(loop, ast->type[right])) return -1;
+        return expr;
+    }
+    int terms = build_chain_flat(loop, ast, left, op, offset);
+    int term = terms < 0 ? -1 : build_expr_flat(loop, ast, right);
+    return binary_node(loop, op, ast->type[node], terms, term);
+}
+
+static bool classify_stmt_flat(VecLoop* loop, FlatAST* ast, uint32_t stmt) {
+    if (ast->kind[stmt] != AST_ASSIGN) {
+        return fail(loop, "loop body has a statement with no vector form");
+    }
+
+    int op = (int)ast->payload[stmt];
+    uint32_t target = FLAT_CHILD(ast, stmt, 0);
+    uint32_t value = FLAT_CHILD(ast, stmt, 1);
+    if (ast->kind[target] == AST_INDEX) {
+        uint32_t base = FLAT_CHILD(ast, target, 0);
+        if (ast->kind[base] != AST_IDENTIFIER) {
+            return fail(loop, "indexes something other than a local array");
+        }
+        return add_store(loop, ast->stack_offset[base], ast->type[base], ast->type[target],
+                         is_loop_index_flat(loop, ast, FLAT_CHILD(ast, target, 1)), op);
+    }
+    if (ast->kind[target] == AST_IDENTIFIER) {
+        int offset = ast->stack_offset[target];
+        if (op == TOKEN_PLUS_EQ) {
+            return add_reduction(loop, offset, ast->type[target], TOKEN_PLUS);
+        }
+        if (op == TOKEN_ASSIGN && ast->kind[value] == AST_BINARY_OP &&
+            is_reduction_chain_flat(ast, value, (int)ast->payload[value], offset)) {
+            return add_reduction(loop, offset, ast->type[target], (int)ast->payload[value]);
+        }
+        return fail(loop, offset == loop->index_offset
+                              ? "loop index is modified in the body"
+                              : "assigns a scalar other than by reduction");
+    }
+    return fail(loop, "loop body has a statement with no vector form");
+}
+
+static int build_stmt_flat(VecLoop* loop, FlatAST* ast, VecStmt* s, uint32_t stmt) {
+    uint32_t target = FLAT_CHILD(ast, stmt, 0);
+    uint32_t value = FLAT_CHILD(ast, stmt, 1);
+
+    if (s->is_reduction) {
+        if (ast->payload[stmt] == TOKEN_ASSIGN) {
+            return build_chain_flat(loop, ast, value, s->op, s->stack_offset);
+        }
+        int expr = build_expr_flat(loop, ast, value);
+        if (expr >= 0 && !check_value(loop, ast->type[value])) return -1;
+        return expr;
+    }
+
+    int expr = build_expr_flat(loop, ast, value);
+    if (expr < 0 || !check_value(loop, ast->type[value])) return -1;
+    if (s->op) {
+        int old = load_node(loop, s->stack_offset, ast->type[FLAT_CHILD(ast, target, 0)],
+                            ast->type[target], true);
+        expr = binary_node(loop, s->op, ast->type[target], old, expr);
+    }
+    return expr;
+}
+
+// The statements of a loop body: the children of a block, or the body
+// itself.
+static uint32_t first_stmt_flat(FlatAST* ast, uint32_t body) {
+    return ast->kind[body] == AST_BLOCK ? ast->first_child[body] : body;
+}
+
+static uint32_t next_stmt_flat(FlatAST* ast, uint32_t body, uint32_t stmt) {
+    return ast->kind[body] == AST_BLOCK ? ast->next_sibling[stmt] : FLAT_NONE;
+}
+
+bool vec_analyze_flat(FlatAST* ast, uint32_t node, VecLoop* loop) {
+    begin(loop);
+    if (!match_header_flat(loop, ast, node)) return false;
+
+    uint32_t body = FLAT_CHILD(ast, node, 3);
+    uint32_t first = first_stmt_flat(ast, body);
+    if (first == FLAT_NONE) {
+        return fail(loop, "loop body is empty");
+    }
+
+    for (uint32_t s = first; s != FLAT_NONE; s = next_stmt_flat(ast, body, s)) {
+        if (!classify_stmt_flat(loop, ast, s)) return false;
+    }
+    int i = 0;
+    for (uint32_t s = first; s != FLAT_NONE; s = next_stmt_flat(ast, body, s), i++) {
+        loop->stmts[i].expr = build_stmt_flat(loop, ast, &loop->stmts[i], s);
+        if (loop->stmts[i].expr < 0) return false;
+    }
+    return finish(loop);
+}
+
+// ---------------------------------------------------------------------------
+
+static const char* type_name(Type* t) {
+    switch (t->kind) {
+        case TYPE_BYTE:      return "byte";
+        case TYPE_SMOL:      return "smol";
+        case TYPE_CHONK:     return "chonk";
+        case TYPE_MEGACHONK: return "megachonk";
+        case TYPE_FLOOF:     return "floof";
+        case TYPE_BIGFLOOF:  return "bigfloof";
+        default:             return "?";
+    }
+}
+
+void vec_report(uint32_t loc, const VecLoop* loop) {
+    if (loop->reason) {
+        fprintf(stderr, "remark at %d:%d: loop not vectorized: %s\n",
+                AST_LOC_LINE(loc), AST_LOC_COLUMN(loc), loop->reason);
+    } else {
+        fprintf(stderr, "remark at %d:%d: loop vectorized (%d x %s%s)\n",
+                AST_LOC_LINE(loc), AST_LOC_COLUMN(loc), loop->lanes, type_name(loop->elem),
+                loop->reduction_count ? ", with reduction" : "");
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef VECTORIZE_H
+#define VECTORIZE_H
+
+#include "ast.h"
+#include "flat_ast.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Loop vectorizer front end. A counted loop
+//
+//     fow (i = ...; i < n; i = i + 1) { a[i] = <expr>; s = s + <expr>; }
+//
+// whose body only touches local arrays at index i is described by a
+// VecLoop. The IR generator lowers it to a 16-byte vector loop followed by
+// the unchanged scalar loop, which runs the remaining iterations.
+
+#define VEC_BYTES     16
+#define VEC_REGS      8
+#define VEC_MAX_NODES 64
+#define VEC_MAX_STMTS 16
+
+typedef enum {
+    VEC_LOAD,      // array[i]
+    VEC_SCALAR,    // loop-invariant variable, splat to every lane
+    VEC_CONST,     // literal, splat to every lane
+    VEC_BINARY,
+    VEC_UNARY
+} VecExprKind;
+
+typedef struct {
+    VecExprKind kind;
+    int op;                 // token kind of a binary or unary operator
+    int stack_offset;       // array of a load, variable of a scalar
+    Type* type;             // type of a scalar
+    bool is_float_const;
+    long long int_value;
+    double float_value;
+    int left;
+    int right;
+} VecExpr;
+
+// Either array[i] = expr or a reduction var = var op expr.
+typedef struct {
+    bool is_reduction;
+    int stack_offset;
+    int op;
+    int expr;
+} VecStmt;
+
+typedef struct {
+    int index_offset;
+    Type* index_type;
+
+    // The loop runs while index < bound.
+    bool bound_is_const;
+    long long bound_value;
+    int bound_offset;
+    Type* bound_type;
+
+    Type* elem;
+    int lanes;
+    // Length of the shortest array the body indexes, for the bounds check.
+    int min_length;
+
+    VecExpr nodes[VEC_MAX_NODES];
+    int node_count;
+    VecStmt stmts[VEC_MAX_STMTS];
+    int stmt_count;
+    int reduction_count;
+
+    // Why the loop was rejected, or NULL.
+    const char* reason;
+} VecLoop;
+
+bool vec_analyze(ASTNode* loop_node, VecLoop* loop);
+bool vec_analyze_flat(FlatAST* ast, uint32_t loop_node, VecLoop* loop);
+void vec_report(uint32_t loc, const VecLoop* loop);
+
+#endif
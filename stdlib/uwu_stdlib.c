@@ -1,3 +1,4 @@
+#define _XOPEN_SOURCE 700
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,6 +6,10 @@
 #include <math.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
 #define UWU_MAX_ALLOCS 10000
 #define UWU_ENABLE_LEAK_DETECTION 1
@@ -254,11 +259,71 @@ void uwu_null_error(const char* msg) {
     abort();
 }
 
+// Called from the SIGSEGV handler, so it only uses async-signal-safe calls
+// (no leak report: the fault may have hit inside stdio).
 void uwu_stack_overflow(void) {
-    uwu_report_leaks();
+    static const char msg[] = "runtime error: stack overflow\n";
+    ssize_t written = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    (void)written;
     abort();
 }
 
+// Compiled code probes every page of a large frame, so running out of
+// stack faults on the guard page just below the stack's limit. The handler
+// runs on its own stack and reports faults there as a stack overflow; any
+// other fault gets the default action.
+#define UWU_ALT_STACK_SIZE  65536
+#define UWU_STACK_GUARD_GAP (1024 * 1024)
+
+static char uwu_alt_stack[UWU_ALT_STACK_SIZE];
+static uintptr_t uwu_stack_top;
+static uintptr_t uwu_stack_low;
+
+static void uwu_segv_handler(int sig, siginfo_t* info, void* context) {
+    (void)context;
+    uintptr_t addr = (uintptr_t)info->si_addr;
+    if (addr < uwu_stack_top && addr + UWU_STACK_GUARD_GAP >= uwu_stack_low) {
+        uwu_stack_overflow();
+    }
+    signal(sig, SIG_DFL);
+}
+
+// A program installs the guard before main. Built into the compiler for
+// --run (UWU_HOSTED_RUNTIME), it is installed only just before the program
+// runs, so that the compiler's own faults are not reported as the program's.
+#ifndef UWU_HOSTED_RUNTIME
+__attribute__((constructor))
+#endif
+void uwu_install_stack_guard(void) {
+    char here;
+    uwu_stack_top = (uintptr_t)&here;
+
+    // An unlimited stack is taken to end 4 GiB down, which keeps faults
+    // on low addresses (null dereferences) out of the range.
+    uint64_t size = (uint64_t)1 << 32;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        size = limit.rlim_cur;
+    }
+    uwu_stack_low = size < uwu_stack_top ? uwu_stack_top - size : 0;
+
+    stack_t ss;
+    ss.ss_sp = uwu_alt_stack;
+    ss.ss_size = sizeof(uwu_alt_stack);
+    ss.ss_flags = 0;
+    if (sigaltstack(&ss, NULL) != 0) return;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = uwu_segv_handler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+#ifdef __APPLE__
+    sigaction(SIGBUS, &sa, NULL);
+#endif
+}
+
 void uwu_check_bounds(int i, int n, const char* f, int l) {
     (void)f;
     (void)l;
@@ -287,6 +352,59 @@ int uwu_memcmp(const void* a, const void* b, size_t n) {
     return (a && b) ? memcmp(a, b, n) : 0;
 }
 
+// Block counters of a program built with --profile-generate, written out
+// once when it exits. layout has a "<function> <blocks>" line for each
+// function, in the order of its counters.
+#define UWU_MAX_PROFILES 16
+
+typedef struct {
+    const char* path;
+    const char* layout;
+    const long long* counters;
+} UwuProfile;
+
+static UwuProfile uwu_profiles[UWU_MAX_PROFILES];
+static int uwu_profile_count;
+
+static void uwu_write_profiles(void) {
+    for (int i = 0; i < uwu_profile_count; i++) {
+        UwuProfile* p = &uwu_profiles[i];
+        FILE* f = fopen(p->path, "w");
+        if (!f) {
+            fprintf(stderr, "cannot write profile %s\n", p->path);
+            continue;
+        }
+        fprintf(f, "uwuprof 1\n");
+        const long long* counter = p->counters;
+        const char* line = p->layout;
+        char name[256];
+        int blocks, length;
+        while (sscanf(line, "%255s %d%n", name, &blocks, &length) == 2) {
+            fprintf(f, "%s %d", name, blocks);
+            for (int b = 0; b < blocks; b++) {
+                fprintf(f, " %lld", *counter++);
+            }
+            fprintf(f, "\n");
+            line += length;
+        }
+        fclose(f);
+    }
+    uwu_profile_count = 0;
+}
+
+void uwu_profile_register(const char* path, const char* layout, long long* counters) {
+    if (uwu_profile_count >= UWU_MAX_PROFILES) {
+        fprintf(stderr, "too many profiled modules\n");
+        return;
+    }
+    static bool registered = false;
+    if (!registered) {
+        atexit(uwu_write_profiles);
+        registered = true;
+    }
+    uwu_profiles[uwu_profile_count++] = (UwuProfile){path, layout, counters};
+}
+
 void uwu_init(void) {
     srand((unsigned)time(NULL));
     memset(uwu_allocs, 0, sizeof(uwu_allocs));
@@ -297,4 +415,5 @@ void uwu_init(void) {
 
 void uwu_cleanup(void) {
     uwu_report_leaks();
+    uwu_write_profiles();
 }
\ No newline at end of file
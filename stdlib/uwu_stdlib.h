@@ -17,6 +17,9 @@ void  uwu_report_leaks(void);
 void  uwu_print(const char* str);
 void  uwu_printf(const char* format, ...);
 int   uwu_scanf(const char* format, ...);
+void  print_str(const char* str);
+void  print_int(int n);
+int   read_int(void);
 
 FILE* uwu_fopen(const char* filename, const char* mode);
 int   uwu_fclose(FILE* stream);
@@ -70,7 +73,10 @@ void* uwu_memmove(void* dest, const void* src, size_t n);
 void* uwu_memset(void* ptr, int value, size_t n);
 int   uwu_memcmp(const void* ptr1, const void* ptr2, size_t n);
 
+void  uwu_profile_register(const char* path, const char* layout, long long* counters);
+
 void  uwu_init(void);
+void  uwu_install_stack_guard(void);
 void  uwu_cleanup(void);
 
 #define UWU_MALLOC(type) ((type*)uwu_malloc(sizeof(type)))
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Round-trips the JIT's x86-64 encoder through objdump. x64_encoder_test
+# writes its encodings to a file and lists what each must disassemble to,
+# and the disassembly of the file has to match the list line for line.
+#
+#   test/encoder/check_encoder.sh [x64_encoder_test]
+
+TEST=${1:-build/x64_encoder_test}
+OUT=${TMPDIR:-/tmp}/uwu_encoder_$$
+trap 'rm -f "$OUT".*' EXIT
+
+# Both sides are put in one form: objdump's spacing and comments go, and a
+# zero disp8 (needed with rbp and r13 as base) reads as no disp. With a
+# scale of 1 the encoder may swap base and index, so those are sorted.
+normalize() {
+    sed -e 's/^ *[0-9a-f]*:\t//' -e 's/ *#.*//' -e 's/  */ /g' -e 's/ $//' \
+        -e 's/+0x0\]/]/' |
+    awk '{
+        if (match($0, /\[[a-z0-9]+\+[a-z0-9]+\*1/)) {
+            inner = substr($0, RSTART + 1, RLENGTH - 3)
+            split(inner, r, "+")
+            if (r[1] != "rip" && r[1] > r[2]) {
+                $0 = substr($0, 1, RSTART) r[2] "+" r[1] "*1" substr($0, RSTART + RLENGTH)
+            }
+        }
+        print
+    }'
+}
+
+"$TEST" "$OUT.bin" > "$OUT.list" || exit 1
+objdump -D -b binary -m i386:x86-64 -M intel --no-show-raw-insn "$OUT.bin" |
+    grep -E '^ *[0-9a-f]+:' | normalize > "$OUT.actual"
+normalize < "$OUT.list" > "$OUT.expected"
+
+if diff "$OUT.expected" "$OUT.actual" > "$OUT.diff"; then
+    echo "encoder: $(wc -l < "$OUT.expected") instructions match objdump"
+else
+    echo "encoder: disassembly differs (- expected, + objdump):"
+    diff -u "$OUT.expected" "$OUT.actual" | sed -n '3,60p'
+    exit 1
+fi
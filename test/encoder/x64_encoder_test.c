@@ -0,0 +1,306 @@
+// Round-trips the x86-64 encoder in src/jit_engine.c through a disassembler.
+// Every form of every x64_ops entry is encoded with each register, a spread
+// of memory operands and immediates, followed by the jump, label, load and
+// push/pop helpers. The code goes to the file named by argv[1], and each
+// instruction it must disassemble to is printed, one per line, in objdump's
+// Intel syntax. check_encoder.sh compares the two.
+
+#include "../../src/jit_engine.c"
+
+static const char *reg_names[4][16] = {
+    {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+     "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"},
+    {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+     "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"},
+    {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+     "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"},
+    {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+     "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"}
+};
+
+static const char *ptr_names[4] = {"BYTE PTR ", "WORD PTR ", "DWORD PTR ", "QWORD PTR "};
+
+static const char *op_names[] = {
+    [X64_ADD] = "add", [X64_OR] = "or", [X64_AND] = "and", [X64_SUB] = "sub",
+    [X64_XOR] = "xor", [X64_CMP] = "cmp", [X64_TEST] = "test", [X64_MOV] = "mov",
+    [X64_LEA] = "lea", [X64_IMUL] = "imul", [X64_MUL] = "mul", [X64_DIV] = "div",
+    [X64_IDIV] = "idiv", [X64_NOT] = "not", [X64_NEG] = "neg", [X64_INC] = "inc",
+    [X64_DEC] = "dec", [X64_SHL] = "shl", [X64_SHR] = "shr", [X64_SAR] = "sar"
+};
+
+static const char *cc_names[16] = {
+    "jo", "jno", "jb", "jae", "je", "jne", "jbe", "ja",
+    "js", "jns", "jp", "jnp", "jl", "jge", "jle", "jg"
+};
+
+static const int sizes[4] = {1, 2, 4, 8};
+
+static CodeGen *cg;
+
+static const char *reg(int size, int r) {
+    return reg_names[size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3][r];
+}
+
+static const char *ptr(int size) {
+    return ptr_names[size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3];
+}
+
+// An immediate as objdump shows it: in hex, truncated to the operand size.
+static const char *imm(int size, int64_t v) {
+    static char buf[4][32];
+    static int next;
+    char *s = buf[next++ & 3];
+    uint64_t u = size == 8 ? (uint64_t)v : (uint64_t)v & ((1ull << (size * 8)) - 1);
+    snprintf(s, 32, "0x%llx", (unsigned long long)u);
+    return s;
+}
+
+// [base+index*scale+disp]; objdump leaves out a zero disp, shows a negative
+// one off rip as a 64-bit unsigned value, and shows an absolute address
+// without base or index as ds:disp.
+static const char *mem(X64Mem m) {
+    static char buf[2][96];
+    static int next;
+    char *s = buf[next++ & 1];
+    if (m.base == X64_NOREG && m.index == X64_NOREG) {
+        snprintf(s, 96, "ds:0x%x", (unsigned)m.disp);
+        return s;
+    }
+    int n = snprintf(s, 96, "[");
+    if (m.base != X64_NOREG) {
+        n += snprintf(s + n, 96 - n, "%s", m.base == X64_RIP ? "rip" : reg(8, m.base));
+    }
+    if (m.index != X64_NOREG) {
+        n += snprintf(s + n, 96 - n, "%s%s*%d", m.base != X64_NOREG ? "+" : "",
+                      reg(8, m.index), m.scale);
+    }
+    if (m.base == X64_RIP && m.disp < 0) {
+        n += snprintf(s + n, 96 - n, "+0x%llx", (unsigned long long)(int64_t)m.disp);
+    } else if (m.disp) {
+        n += snprintf(s + n, 96 - n, "%s0x%x", m.disp < 0 ? "-" : "+",
+                      m.disp < 0 ? (unsigned)-(int64_t)m.disp : (unsigned)m.disp);
+    }
+    snprintf(s + n, 96 - n, "]");
+    return s;
+}
+
+#define expect(...) (printf(__VA_ARGS__), putchar('\n'))
+
+// Bases and indexes that take special encodings: rsp and r12 need a SIB
+// byte, rbp and r13 a displacement, and rsp cannot be an index.
+static X64Mem mems[512];
+static int mem_count;
+
+static void build_mems(void) {
+    static const int bases[] = {X64_RAX, X64_RSP, X64_RBP, X64_R12, X64_R13, X64_R11,
+                                X64_NOREG, X64_RIP};
+    static const int indexes[] = {X64_NOREG, X64_RAX, X64_RBP, X64_R12, X64_R13, X64_R15};
+    static const int32_t disps[] = {0, 8, -128, 127, 128, -129, 0x12345678};
+    for (int b = 0; b < 8; b++) {
+        for (int x = 0; x < 6; x++) {
+            for (int d = 0; d < 7; d++) {
+                if (bases[b] == X64_RIP && indexes[x] != X64_NOREG) continue;
+                if (bases[b] == X64_NOREG && disps[d] != 8 && disps[d] != 0x12345678) continue;
+                int scale = indexes[x] == X64_NOREG ? 1 : 1 << (d % 4);
+                mems[mem_count++] = (X64Mem){bases[b], indexes[x], scale, disps[d]};
+            }
+        }
+    }
+}
+
+static void test_register_forms(void) {
+    static const X64Op ops[] = {X64_ADD, X64_OR, X64_AND, X64_SUB, X64_XOR, X64_CMP,
+                                X64_TEST, X64_MOV, X64_IMUL};
+    for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+        for (int s = 0; s < 4; s++) {
+            if (ops[o] == X64_IMUL && sizes[s] == 1) continue;
+            for (int a = 0; a < 16; a++) {
+                for (int b = 0; b < 16; b++) {
+                    x64_op_rr(cg, ops[o], sizes[s], a, b);
+                    expect("%s %s,%s", op_names[ops[o]], reg(sizes[s], a), reg(sizes[s], b));
+                }
+            }
+        }
+    }
+}
+
+static void test_memory_forms(void) {
+    static const X64Op ops[] = {X64_ADD, X64_OR, X64_AND, X64_SUB, X64_XOR, X64_CMP,
+                                X64_TEST, X64_MOV, X64_LEA, X64_IMUL};
+    for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+        X64Op op = ops[o];
+        for (int s = 0; s < 4; s++) {
+            int size = sizes[s];
+            if ((op == X64_IMUL || op == X64_LEA) && size == 1) continue;
+            for (int r = 0; r < 16; r += 3) {
+                for (int m = 0; m < mem_count; m++) {
+                    // test has no reg, [mem] form; objdump shows both alike.
+                    x64_op_rm(cg, op, size, r, mems[m]);
+                    if (op == X64_TEST) {
+                        expect("test %s%s,%s", ptr(size), mem(mems[m]), reg(size, r));
+                    } else {
+                        expect("%s %s,%s%s", op_names[op], reg(size, r),
+                               op == X64_LEA ? "" : ptr(size), mem(mems[m]));
+                    }
+                    if (op == X64_LEA || op == X64_IMUL) continue;
+                    x64_op_mr(cg, op, size, mems[m], r);
+                    expect("%s %s%s,%s", op_names[op], ptr(size), mem(mems[m]), reg(size, r));
+                }
+            }
+        }
+    }
+}
+
+static void test_unary_forms(void) {
+    static const X64Op ops[] = {X64_IMUL, X64_MUL, X64_DIV, X64_IDIV, X64_NOT, X64_NEG,
+                                X64_INC, X64_DEC, X64_SHL, X64_SHR, X64_SAR};
+    for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+        X64Op op = ops[o];
+        const char *count = op >= X64_SHL ? ",cl" : "";
+        for (int s = 0; s < 4; s++) {
+            for (int r = 0; r < 16; r++) {
+                x64_op_r(cg, op, sizes[s], r);
+                expect("%s %s%s", op_names[op], reg(sizes[s], r), count);
+            }
+            for (int m = 0; m < mem_count; m += 5) {
+                x64_op_m(cg, op, sizes[s], mems[m]);
+                expect("%s %s%s%s", op_names[op], ptr(sizes[s]), mem(mems[m]), count);
+            }
+        }
+    }
+}
+
+// Immediates on either side of the imm8 and imm32 limits, and the
+// accumulator and shift-by-one short forms.
+static void test_immediate_forms(void) {
+    static const X64Op ops[] = {X64_ADD, X64_OR, X64_AND, X64_SUB, X64_XOR, X64_CMP,
+                                X64_TEST, X64_MOV, X64_IMUL, X64_SHL, X64_SHR, X64_SAR};
+    static const int64_t imms[] = {0, 1, 5, -1, 127, -128, 128, -129, 255, 300,
+                                   0x12345, -0x7fffffff, 0x7fffffff};
+    for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+        X64Op op = ops[o];
+        for (int s = 0; s < 4; s++) {
+            int size = sizes[s];
+            for (size_t k = 0; k < sizeof(imms) / sizeof(imms[0]); k++) {
+                int64_t v = imms[k];
+                if (op == X64_IMUL && size == 1) continue;
+                if (op >= X64_SHL) {
+                    if (v < 0 || v >= size * 8) continue;
+                } else if (size == 1 && (v < -128 || v > 255)) {
+                    continue;
+                } else if (size == 2 && (v < -32768 || v > 65535)) {
+                    continue;
+                }
+                // A shift by one has no immediate; objdump shows the count as 1.
+                const char *count = op >= X64_SHL && v == 1 ? "1" : imm(size, v);
+                // mov reg, imm goes through x64_emit_load_imm instead.
+                for (int r = 0; r < 16 && op != X64_MOV; r += 5) {
+                    x64_op_ri(cg, op, size, r, v);
+                    if (op == X64_IMUL) {
+                        expect("imul %s,%s,%s", reg(size, r), reg(size, r), count);
+                    } else {
+                        expect("%s %s,%s", op_names[op], reg(size, r), count);
+                    }
+                }
+                if (op == X64_IMUL) continue;
+                for (int m = 0; m < mem_count; m += 7) {
+                    x64_op_mi(cg, op, size, mems[m], v);
+                    expect("%s %s%s,%s", op_names[op], ptr(size), mem(mems[m]), count);
+                }
+            }
+        }
+    }
+}
+
+static void test_helpers(void) {
+    static const int64_t values[] = {0, 1, -1, 0x7fffffff, 0x80000000LL, 0xffffffffLL,
+                                     0x100000000LL, -0x80000000LL, -0x80000001LL};
+    for (int r = 0; r < 16; r++) {
+        for (size_t k = 0; k < sizeof(values) / sizeof(values[0]); k++) {
+            int64_t v = values[k];
+            x64_emit_load_imm(cg, r, v);
+            if (v == 0) {
+                expect("xor %s,%s", reg(4, r), reg(4, r));
+            } else if (v > 0 && v <= 0xffffffffLL) {
+                expect("mov %s,%s", reg(4, r), imm(4, v));
+            } else if (fits_int32(v)) {
+                expect("mov %s,%s", reg(8, r), imm(8, v));
+            } else {
+                expect("movabs %s,%s", reg(8, r), imm(8, v));
+            }
+        }
+        x64_emit_push(cg, r);
+        expect("push %s", reg(8, r));
+        x64_emit_pop(cg, r);
+        expect("pop %s", reg(8, r));
+    }
+    x64_emit_ret(cg);
+    expect("ret");
+
+    // Jumps by offsets from their own start, short and near.
+    static const int32_t offsets[] = {0, 2, -126, 129, 130, -127, 0x1000, -0x1000};
+    for (int cc = -1; cc < 16; cc++) {
+        for (size_t k = 0; k < sizeof(offsets) / sizeof(offsets[0]); k++) {
+            size_t at = cg->pos;
+            x64_emit_jcc(cg, cc, offsets[k]);
+            expect("%s 0x%llx", cc < 0 ? "jmp" : cc_names[cc],
+                   (unsigned long long)(at + offsets[k]));
+        }
+    }
+}
+
+// Branches to labels, forward and backward, some within rel8 reach once
+// the others have been shortened and some beyond it. Their targets are
+// known only after codegen_resolve_labels, so they are printed last.
+static void test_labels(void) {
+    enum { LABELS = 6, PER_LABEL = 8 };
+    struct { int cc, label, filler; } rows[LABELS * PER_LABEL];
+    int labels[LABELS];
+    int count = 0;
+
+    for (int i = 0; i < LABELS; i++) labels[i] = codegen_new_label(cg);
+    for (int i = 0; i < LABELS; i++) {
+        if (i % 2 == 0) codegen_bind_label(cg, labels[i]);
+        for (int j = 0; j < PER_LABEL; j++, count++) {
+            rows[count].cc = count % 17 - 1;
+            rows[count].label = (i + j) % LABELS;
+            rows[count].filler = j % 3 == 2 ? 40 : 2;
+            x64_emit_branch(cg, rows[count].cc, labels[rows[count].label]);
+            for (int f = 0; f < rows[count].filler; f++) {
+                x64_op_rr(cg, X64_ADD, 8, X64_RAX, X64_RCX);
+            }
+        }
+        if (i % 2 == 1) codegen_bind_label(cg, labels[i]);
+    }
+    codegen_resolve_labels(cg);
+
+    for (int i = 0; i < count; i++) {
+        expect("%s 0x%llx", rows[i].cc < 0 ? "jmp" : cc_names[rows[i].cc],
+               (unsigned long long)codegen_label_offset(cg, labels[rows[i].label]));
+        for (int f = 0; f < rows[i].filler; f++) {
+            expect("add rax,rcx");
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s code.bin\n", argv[0]);
+        return 2;
+    }
+    cg = codegen_create(1 << 20);
+    build_mems();
+    test_register_forms();
+    test_memory_forms();
+    test_unary_forms();
+    test_immediate_forms();
+    test_helpers();
+    test_labels();
+
+    FILE *out = fopen(argv[1], "wb");
+    if (!out || fwrite(cg->buf, 1, cg->pos, out) != cg->pos || fclose(out) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    return 0;
+}
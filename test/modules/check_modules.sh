@@ -0,0 +1,50 @@
+#!/bin/sh
+# Builds lib.uwu into a module at -O0, -O1 and -O2 and links each one into
+# main.uwu, both in memory with --run at every tier and as a binary; every
+# run has to print main.expected.
+#
+#   test/modules/check_modules.sh [uwucc] [uwu_stdlib.o]
+
+UWUCC=${1:-build/uwucc}
+STDLIB=${2:-build/uwu_stdlib.o}
+DIR=$(dirname "$0")
+OUT=${TMPDIR:-/tmp}/uwu_modules_$$
+trap 'rm -f "$OUT" "$OUT".*' EXIT
+
+RUN_MODES="--run
+-O2 --run
+-O2 --run --tier=interp
+-O2 --run --tier=baseline
+-O2 --run --tier=optimized"
+
+failed=0
+check() {
+    if [ "$2" != "$(cat "$DIR/main.expected")" ]; then
+        echo "FAIL module $1"
+        echo "$2" | diff "$DIR/main.expected" - | sed 's/^/    /'
+        failed=1
+    fi
+}
+
+for level in -O0 -O1 -O2; do
+    if ! "$UWUCC" "$DIR/lib.uwu" $level --emit-module "$OUT.uwumod" 2> "$OUT.err"; then
+        echo "FAIL module $level: cannot build lib.uwu"
+        sed 's/^/    /' "$OUT.err"
+        failed=1
+        continue
+    fi
+    while IFS= read -r mode; do
+        check "$level, main $mode" \
+            "$("$UWUCC" "$DIR/main.uwu" --module "$OUT.uwumod" $mode 2>&1 < /dev/null)"
+    done <<EOF
+$RUN_MODES
+EOF
+    if "$UWUCC" "$DIR/main.uwu" -O2 --module "$OUT.uwumod" -o "$OUT" --stdlib "$STDLIB" > /dev/null 2>&1; then
+        check "$level, main -O2" "$("$OUT" 2>&1 < /dev/null)"
+    else
+        check "$level, main -O2" "compile error"
+    fi
+done
+
+[ $failed = 0 ] && echo "modules: every module runs in memory and as a binary"
+exit $failed
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Round-trips a profile: hot.uwu is built with --profile-generate and run to
+# write its block counts, then rebuilt with --profile-use and run again.
+# The profile has to put the hottest function first, change nothing in the
+# output and draw no warning; used on changed.uwu, whose classify has one
+# more branch, it has to draw a warning for classify alone.
+#
+#   test/profile/check_profile.sh [uwucc] [uwu_stdlib.o]
+
+UWUCC=${1:-build/uwucc}
+STDLIB=${2:-build/uwu_stdlib.o}
+DIR=$(dirname "$0")
+OUT=${TMPDIR:-/tmp}/uwu_profile_$$
+trap 'rm -f "$OUT" "$OUT".*' EXIT
+
+fail() {
+    echo "profile: $1"
+    [ -f "$OUT.err" ] && sed 's/^/    /' "$OUT.err"
+    exit 1
+}
+
+build() {
+    "$UWUCC" "$@" -O2 -o "$OUT" --stdlib "$STDLIB" 2> "$OUT.err" ||
+        fail "cannot build $*"
+    grep -v "^/usr/bin/ld" "$OUT.err" > "$OUT.warn"
+}
+
+build "$DIR/hot.uwu" --profile-generate="$OUT.uwuprof"
+expected=$("$OUT")
+[ -s "$OUT.uwuprof" ] || fail "hot.uwu wrote no profile"
+grep -q "^classify 3 100000 1000 99000$" "$OUT.uwuprof" ||
+    fail "wrong counts for classify: $(grep classify "$OUT.uwuprof")"
+
+build "$DIR/hot.uwu" --profile-use="$OUT.uwuprof"
+[ -s "$OUT.warn" ] && fail "unexpected warning with a matching profile"
+[ "$("$OUT")" = "$expected" ] || fail "output changed with the profile"
+order=$("$UWUCC" "$DIR/hot.uwu" -O2 --profile-use="$OUT.uwuprof" --dump-ir 2>&1 |
+    awk '$1 == "func" { printf "%s ", $2 }')
+[ "$order" = "main classify cold " ] || fail "functions not laid out by the profile: $order"
+[ "$("$UWUCC" "$DIR/hot.uwu" -O2 --profile-use="$OUT.uwuprof" --run 2>&1)" = "$expected" ] ||
+    fail "--run output changed with the profile"
+
+build "$DIR/changed.uwu" --profile-use="$OUT.uwuprof"
+[ "$(cat "$OUT.warn")" = "warning: profile for 'classify' does not match the program; ignored" ] ||
+    fail "no mismatch warning for changed.uwu"
+"$OUT" > /dev/null || fail "changed.uwu fails with a stale profile"
+
+echo "profile: generate, use and mismatch warning all check out"
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Builds each program in test/programs at -O0, -O1 and -O2 and through the
+# flat AST, and runs it in memory (--run), comparing its output with
+# NAME.expected. A NAME.modes file replaces those modes with its own, one
+# set of flags per line; a line with --run runs the program in memory.
+#
+#   test/run_programs.sh [uwucc] [uwu_stdlib.o]
+
+UWUCC=${1:-build/uwucc}
+STDLIB=${2:-build/uwu_stdlib.o}
+DIR=$(dirname "$0")/programs
+BIN=${TMPDIR:-/tmp}/uwu_test_$$
+
+DEFAULT_MODES="-O0
+-O1
+-O2
+--flat-ast
+--run"
+
+failed=0
+for src in "$DIR"/*.uwu; do
+    name=$(basename "$src" .uwu)
+    expected="$DIR/$name.expected"
+    if [ -f "$DIR/$name.modes" ]; then
+        modes=$(cat "$DIR/$name.modes")
+    else
+        modes=$DEFAULT_MODES
+    fi
+    while IFS= read -r mode; do
+        [ -z "$mode" ] && continue
+        case " $mode " in
+            *" --run "*)
+                actual=$("$UWUCC" "$src" $mode 2>&1 < /dev/null) ;;
+            *)
+                if "$UWUCC" "$src" $mode -o "$BIN" --stdlib "$STDLIB" > /dev/null 2>&1; then
+                    actual=$("$BIN" 2>&1 < /dev/null)
+                else
+                    actual="compile error"
+                fi ;;
+        esac
+        if [ "$actual" != "$(cat "$expected")" ]; then
+            echo "FAIL $name $mode"
+            echo "$actual" | diff "$expected" - | sed 's/^/    /'
+            failed=1
+        fi
+    done <<EOF
+$modes
+EOF
+done
+rm -f "$BIN"
+
+[ $failed = 0 ] && echo "all programs passed"
+exit $failed